@@ -0,0 +1,137 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+/**
+ * @file
+ * @brief   Scanners which skip runs of uninteresting bytes a word at a time.
+ */
+#ifndef BYTESCAN_H
+#define BYTESCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util.h"
+
+typedef uint64_t scan_word_t;
+
+#define SCAN_ONES  ((scan_word_t)0x0101010101010101ULL)
+#define SCAN_HIGHS ((scan_word_t)0x8080808080808080ULL)
+
+/** Returns a word with the high bit set in exactly the bytes of @p w which are 0. */
+static inline scan_word_t scan_zero_bytes(scan_word_t const w)
+{
+	scan_word_t const lows = ~SCAN_HIGHS;
+	return ~(((w & lows) + lows) | w) & SCAN_HIGHS;
+}
+
+static inline scan_word_t scan_bytes_equal(scan_word_t const w,
+                                           unsigned char const b)
+{
+	return scan_zero_bytes(w ^ (SCAN_ONES * b));
+}
+
+static inline bool is_comment_stop_byte(unsigned char const b)
+{
+	return b == '*' || b == '/' || b == '\\' || b == '?' || b == '\n'
+	    || b == '\r' || b >= 0x80;
+}
+
+/**
+ * Skips the bytes at @p p which need no attention inside a comment.  The
+ * scan stops at the comment delimiters '*' and '/', at backslashes and
+ * question marks which could start a line splice or trigraph, at line
+ * breaks and at the first byte of a multibyte character.
+ *
+ * @return the first byte which is not skipped or @p end
+ */
+static inline const unsigned char *scan_comment(const unsigned char *p,
+                                                const unsigned char *end)
+{
+	while (end - p >= (ptrdiff_t)sizeof(scan_word_t)) {
+		scan_word_t w;
+		memcpy(&w, p, sizeof(w));
+		scan_word_t const stop
+			= (w & SCAN_HIGHS)
+			| scan_bytes_equal(w, '*')
+			| scan_bytes_equal(w, '/')
+			| scan_bytes_equal(w, '\\')
+			| scan_bytes_equal(w, '?')
+			| scan_bytes_equal(w, '\n')
+			| scan_bytes_equal(w, '\r');
+		if (stop != 0)
+			break;
+		p += sizeof(w);
+	}
+	while (p < end && !is_comment_stop_byte(*p))
+		++p;
+	return p;
+}
+
+/**
+ * Skips blanks (spaces and tabs) at @p p.
+ *
+ * @return the first byte which is not a blank or @p end
+ */
+static inline const unsigned char *scan_blanks(const unsigned char *p,
+                                               const unsigned char *end)
+{
+	while (end - p >= (ptrdiff_t)sizeof(scan_word_t)) {
+		scan_word_t w;
+		memcpy(&w, p, sizeof(w));
+		/* every byte has to be a space or a tab */
+		scan_word_t const blank
+			= scan_bytes_equal(w, ' ') | scan_bytes_equal(w, '\t');
+		if (blank != SCAN_HIGHS)
+			break;
+		p += sizeof(w);
+	}
+	while (p < end && (*p == ' ' || *p == '\t'))
+		++p;
+	return p;
+}
+
+/** Bytes which may continue an identifier: [A-Za-z0-9_] */
+extern const bool scan_identifier_bytes[256];
+
+/**
+ * Skips the bytes at @p p which continue an identifier.  '$' and
+ * universal character names are left to the caller.
+ *
+ * @return the first byte which is not skipped or @p end
+ */
+static inline const unsigned char *scan_identifier(const unsigned char *p,
+                                                   const unsigned char *end)
+{
+	while (end - p >= 4) {
+		if (!scan_identifier_bytes[p[0]]) return p;
+		if (!scan_identifier_bytes[p[1]]) return p + 1;
+		if (!scan_identifier_bytes[p[2]]) return p + 2;
+		if (!scan_identifier_bytes[p[3]]) return p + 3;
+		p += 4;
+	}
+	while (p < end && scan_identifier_bytes[*p])
+		++p;
+	return p;
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include "sha1.h"
+
+#include <string.h>
+
+static inline uint32_t rotl(uint32_t value, unsigned shift)
+{
+	return (value << shift) | (value >> (32 - shift));
+}
+
+static void sha1_block(sha1_t *sha1, const unsigned char *block)
+{
+	uint32_t w[80];
+	for (unsigned i = 0; i < 16; ++i) {
+		w[i] = (uint32_t) block[4*i] << 24 | (uint32_t) block[4*i+1] << 16
+		     | (uint32_t) block[4*i+2] << 8 | (uint32_t) block[4*i+3];
+	}
+	for (unsigned i = 16; i < 80; ++i) {
+		w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+	}
+
+	uint32_t a = sha1->state[0];
+	uint32_t b = sha1->state[1];
+	uint32_t c = sha1->state[2];
+	uint32_t d = sha1->state[3];
+	uint32_t e = sha1->state[4];
+	for (unsigned i = 0; i < 80; ++i) {
+		uint32_t f;
+		uint32_t k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rotl(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	sha1->state[0] += a;
+	sha1->state[1] += b;
+	sha1->state[2] += c;
+	sha1->state[3] += d;
+	sha1->state[4] += e;
+}
+
+void sha1_init(sha1_t *sha1)
+{
+	sha1->state[0] = 0x67452301;
+	sha1->state[1] = 0xEFCDAB89;
+	sha1->state[2] = 0x98BADCFE;
+	sha1->state[3] = 0x10325476;
+	sha1->state[4] = 0xC3D2E1F0;
+	sha1->length   = 0;
+}
+
+void sha1_update(sha1_t *sha1, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+	size_t               used  = (size_t) (sha1->length % 64);
+	sha1->length += size;
+
+	if (used > 0) {
+		size_t n = 64 - used < size ? 64 - used : size;
+		memcpy(sha1->block + used, bytes, n);
+		bytes += n;
+		size  -= n;
+		if (used + n < 64)
+			return;
+		sha1_block(sha1, sha1->block);
+	}
+	for (; size >= 64; bytes += 64, size -= 64) {
+		sha1_block(sha1, bytes);
+	}
+	memcpy(sha1->block, bytes, size);
+}
+
+void sha1_final(sha1_t *sha1, unsigned char digest[SHA1_DIGEST_SIZE])
+{
+	uint64_t bits = sha1->length * 8;
+
+	static const unsigned char padding[64] = { 0x80 };
+	size_t used = (size_t) (sha1->length % 64);
+	sha1_update(sha1, padding, used < 56 ? 56 - used : 120 - used);
+
+	unsigned char length[8];
+	for (unsigned i = 0; i < 8; ++i) {
+		length[i] = (unsigned char) (bits >> (56 - 8*i));
+	}
+	sha1_update(sha1, length, sizeof(length));
+
+	for (unsigned i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+		digest[i] = (unsigned char) (sha1->state[i/4] >> (24 - 8*(i%4)));
+	}
+}
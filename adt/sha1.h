@@ -0,0 +1,19 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA1_DIGEST_SIZE 20
+
+typedef struct sha1_t {
+	uint32_t      state[5];
+	uint64_t      length;    /**< bytes hashed so far */
+	unsigned char block[64];
+} sha1_t;
+
+void sha1_init(sha1_t *sha1);
+void sha1_update(sha1_t *sha1, const void *data, size_t size);
+void sha1_final(sha1_t *sha1, unsigned char digest[SHA1_DIGEST_SIZE]);
+
+#endif
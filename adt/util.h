@@ -49,6 +49,15 @@
  */
 #define UNLIKELY(x) __builtin_expect((x), 0)
 
+/**
+ * Storage class of a variable which exists once per thread.
+ */
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 #define lengthof(x) (sizeof(x) / sizeof(*(x)))
 
 #define endof(x) ((x) + lengthof(x))
@@ -26,12 +26,14 @@
 
 #include <libfirm/firm.h>
 #include <libfirm/adt/obst.h>
+#include <libfirm/adt/pset.h>
 #include <libfirm/be.h>
 
 #include "ast2firm.h"
 
 #include "adt/error.h"
 #include "adt/array.h"
+#include "adt/hash_string.h"
 #include "adt/strutil.h"
 #include "adt/util.h"
 #include "symbol_t.h"
@@ -49,7 +51,9 @@
 #include "warning.h"
 #include "printer.h"
 #include "entitymap_t.h"
+#include "plinc_profile.h"
 #include "driver/firm_opt.h"
+#include "driver/firm_timing.h"
 
 typedef struct trampoline_region trampoline_region;
 struct trampoline_region {
@@ -58,6 +62,7 @@ struct trampoline_region {
 };
 
 fp_model_t firm_fp_model = fp_model_precise;
+bool       plinc_double_buffering = false;
 
 static const backend_params *be_params;
 
@@ -95,24 +100,46 @@ static ir_entity          *current_vararg_entity;
 
 static ir_node            *current_pipeline;
 static bool                current_in_stage;
-static long                current_stage_index;
+static long                current_core;
+static unsigned           *current_stage_core;
+static stage_statement_t  *current_stages; /**< stages of the pipeline, last first */
 
 static entitymap_t  entitymap;
 
 static struct obstack asm_obst;
 
+/** the read-only entity created for a string literal */
+typedef struct string_entity_t {
+	string_t   value;
+	ir_entity *entity;
+} string_entity_t;
+
+/** one entity per distinct string literal */
+static pset          *string_entities;
+static struct obstack string_entities_obst;
+
 static symconst_symbol rcce_recv;
 static symconst_symbol rcce_send;
 static symconst_symbol plinc_malloc;
 static symconst_symbol plinc_free;
 static symconst_symbol plinc_data;
 static symconst_symbol plinc_size;
+static symconst_symbol plinc_compress;
+static symconst_symbol plinc_decompress;
+static symconst_symbol plinc_isend;
+static symconst_symbol plinc_irecv_wait;
+static symconst_symbol plinc_irecv_post;
+static symconst_symbol plinc_flush;
 static unsigned sizeof_plinc_size;
 static ir_type *rcce_recv_send_type;
 static ir_type *plinc_serializer_type;
 static ir_type *plinc_deserializer_type;
 static ir_type *plinc_malloc_type;
 static ir_type *plinc_free_type;
+static ir_type *plinc_compress_type;
+static ir_type *plinc_decompress_type;
+static ir_type *plinc_irecv_post_type;
+static ir_type *plinc_flush_type;
 static struct obstack plinc_obst;
 
 typedef enum declaration_kind_t {
@@ -153,9 +180,10 @@ static const char *dbg_retrieve(const dbg_info *dbg, unsigned *line)
 	const source_position_t *pos = (const source_position_t*) dbg;
 	if (pos == NULL)
 		return NULL;
+	decoded_position_t const p = decode_position(*pos);
 	if (line != NULL)
-		*line = pos->lineno;
-	return pos->input_name;
+		*line = p.lineno;
+	return p.input_name;
 }
 
 static dbg_info *get_dbg_info(const source_position_t *pos)
@@ -1192,13 +1220,12 @@ static ir_node *wide_string_literal_to_firm(
  * @param id_prefix  a prefix for the name of the generated string constant
  * @param value      the value of the string constant
  */
-static ir_node *string_to_firm(const source_position_t *const src_pos,
-                               const char *const id_prefix,
-                               const string_t *const value)
+static ir_entity *create_string_entity(dbg_info *const dbgi,
+                                       const char *const id_prefix,
+                                       const string_t *const value)
 {
-	ir_type  *const global_type = get_glob_type();
-	dbg_info *const dbgi        = get_dbg_info(src_pos);
-	ir_type  *const type        = new_type_array(1, ir_type_const_char);
+	ir_type *const global_type = get_glob_type();
+	ir_type *const type        = new_type_array(1, ir_type_const_char);
 
 	ident     *const id     = id_unique(id_prefix);
 	ir_entity *const entity = new_d_entity(global_type, id, type, dbgi);
@@ -1225,9 +1252,47 @@ static ir_node *string_to_firm(const source_position_t *const src_pos,
 	}
 	set_entity_initializer(entity, initializer);
 
+	return entity;
+}
+
+static ir_node *string_to_firm(const source_position_t *const src_pos,
+                               const char *const id_prefix,
+                               const string_t *const value)
+{
+	dbg_info  *const dbgi   = get_dbg_info(src_pos);
+	ir_entity *const entity = create_string_entity(dbgi, id_prefix, value);
 	return create_symconst(dbgi, entity);
 }
 
+static int cmp_string_entity(const void *elt, const void *key)
+{
+	const string_entity_t *const e1 = (const string_entity_t*)elt;
+	const string_entity_t *const e2 = (const string_entity_t*)key;
+	return e1->value.size != e2->value.size
+	    || memcmp(e1->value.begin, e2->value.begin, e1->value.size) != 0;
+}
+
+/**
+ * Creates the address of a string literal.  Equal literals share one
+ * read-only entity.
+ */
+static ir_node *string_literal_to_firm(const source_position_t *const src_pos,
+                                       const string_t *const value)
+{
+	dbg_info       *const dbgi = get_dbg_info(src_pos);
+	unsigned        const hash = hash_string_size(value->begin, value->size);
+	string_entity_t       key  = { *value, NULL };
+
+	string_entity_t *entry = pset_find(string_entities, &key, hash);
+	if (entry == NULL) {
+		entry         = OALLOC(&string_entities_obst, string_entity_t);
+		entry->value  = *value;
+		entry->entity = create_string_entity(dbgi, "str.%u", value);
+		pset_insert(string_entities, entry, hash);
+	}
+	return create_symconst(dbgi, entry->entity);
+}
+
 static bool try_create_integer(literal_expression_t *literal,
                                type_t *type, unsigned char base)
 {
@@ -3475,7 +3540,7 @@ static ir_node *_expression_to_firm(const expression_t *expression)
 {
 #ifndef NDEBUG
 	if (!constant_folding) {
-		if (current_in_stage || current_pipeline == NULL || current_stage_index == 0) {
+		if (current_in_stage || current_pipeline == NULL || current_core == 0) {
 			assert(!expression->base.transformed);
 			((expression_t*) expression)->base.transformed = true;
 		}
@@ -3486,8 +3551,8 @@ static ir_node *_expression_to_firm(const expression_t *expression)
 	EXPR_LITERAL_CASES
 		return literal_to_firm(&expression->literal);
 	case EXPR_STRING_LITERAL:
-		return string_to_firm(&expression->base.source_position, "str.%u",
-		                      &expression->literal.value);
+		return string_literal_to_firm(&expression->base.source_position,
+		                              &expression->literal.value);
 	case EXPR_WIDE_STRING_LITERAL:
 		return wide_string_literal_to_firm(&expression->string_literal);
 	case EXPR_REFERENCE:
@@ -4584,7 +4649,7 @@ static ir_node *expression_statement_to_firm(expression_statement_t *statement)
 
 static ir_node *compound_statement_to_firm(compound_statement_t *compound)
 {
-	if (current_in_stage || current_pipeline == NULL || current_stage_index == 0) {
+	if (current_in_stage || current_pipeline == NULL || current_core == 0) {
 		entity_t *entity = compound->scope.entities;
 		for ( ; entity != NULL; entity = entity->base.next) {
 			if (!is_declaration(entity))
@@ -4903,7 +4968,7 @@ static void for_statement_to_firm(for_statement_t *statement)
 {
 	entity_t *entity;
 
-	if (current_in_stage || current_pipeline == NULL || current_stage_index == 0) {
+	if (current_in_stage || current_pipeline == NULL || current_core == 0) {
 		/* create declarations */
 		entity = statement->scope.entities;
 		for ( ; entity != NULL; entity = entity->base.next) {
@@ -5390,12 +5455,62 @@ static void leave_statement_to_firm(leave_statement_t *statement)
 	errorf(&statement->base.source_position, "__leave not supported yet");
 }
 
+/**
+ * Load the value of a PLINC runtime variable.
+ */
+static ir_node *plinc_load(ir_node **store, symconst_symbol symbol,
+                           ir_mode *mode)
+{
+	ir_node *const addr = new_SymConst(get_modeP(), symbol, symconst_addr_ent);
+	ir_node *const node = new_Load(*store, addr, mode, cons_none);
+	*store = new_Proj(node, get_modeM(), pn_Load_M);
+	return new_Proj(node, mode, pn_Load_res);
+}
+
+/**
+ * Call a PLINC runtime function and return the call node.
+ */
+static ir_node *plinc_call(ir_node **store, ir_node *callee, ir_type *type,
+                           int n_in, ir_node **in)
+{
+	ir_node *const node = new_Call(*store, callee, n_in, in, type);
+	*store = new_Proj(node, get_modeM(), pn_Call_M);
+	return node;
+}
+
+static ir_node *plinc_call_symbol(ir_node **store, symconst_symbol symbol,
+                                  ir_type *type, int n_in, ir_node **in)
+{
+	ir_node *const callee = new_SymConst(get_modeP(), symbol, symconst_addr_ent);
+	return plinc_call(store, callee, type, n_in, in);
+}
+
+static ir_node *plinc_target(long target)
+{
+	return new_Const(new_tarval_from_long(target, atomic_modes[ATOMIC_TYPE_INT]));
+}
+
 static void pipeline_statement_to_firm(pipeline_statement_t *statement)
 {
 	ir_node  *first_block = NULL;
 	dbg_info *dbgi        = get_dbg_info(&statement->base.source_position);
 	ir_node  *pipeline_node = NULL;
-	int i;
+	unsigned  i;
+
+	/* decide which core runs which stages, a profile of previous runs may
+	 * let us fuse consecutive stages */
+	const plinc_pipeline_profile_t *profile
+		= plinc_profile_get(&statement->base.source_position);
+	if (profile != NULL
+			&& plinc_profile_n_stages(profile) != (unsigned)statement->stages) {
+		warningf(WARN_OTHER, &statement->base.source_position,
+		         "pipeline profile describes %u stages but pipeline has %d, ignoring it",
+		         plinc_profile_n_stages(profile), statement->stages);
+		profile = NULL;
+	}
+	unsigned *const stage_core = XMALLOCN(unsigned, statement->stages);
+	unsigned  const n_cores
+		= plinc_profile_map_stages(profile, statement->stages, stage_core);
 
 	if (currently_reachable()) {
 		/* Call procId as switch expression
@@ -5418,10 +5533,9 @@ static void pipeline_statement_to_firm(pipeline_statement_t *statement)
 		ir_node *tuple = new_Proj(call_node, get_modeT(), pn_Call_T_result);
 		ir_node *expression = new_Proj(tuple, get_modeIs(), 0);
 
-		ir_switch_table *table = ir_new_switch_table(current_ir_graph, statement->stages);
+		ir_switch_table *table = ir_new_switch_table(current_ir_graph, n_cores);
 
-		/* TODO Map cores */
-		for (i = 0; i < statement->stages; ++i) {
+		for (i = 0; i < n_cores; ++i) {
 			ir_tarval *index = new_tarval_from_long(i, atomic_modes[ATOMIC_TYPE_INT]);
 			ir_switch_table_set(table, i, index, index, i+1);
 		}
@@ -5436,14 +5550,18 @@ static void pipeline_statement_to_firm(pipeline_statement_t *statement)
 
 	ir_node *const old_pipeline     = current_pipeline;
 	const bool old_in_stage         = current_in_stage;
-	const long old_stage_index      = current_stage_index;
+	const long old_core             = current_core;
+	unsigned *const old_stage_core  = current_stage_core;
+	stage_statement_t *const old_stages = current_stages;
 	ir_node *const old_break_label  = break_label;
 
 	current_pipeline                = pipeline_node;
 	current_in_stage                = false;
+	current_stage_core              = stage_core;
+	current_stages                  = statement->first_stage;
 	break_label                     = NULL;
 
-	for(i = 0; i < statement->stages; ++i) {
+	for(i = 0; i < n_cores; ++i) {
 		ir_node *block = new_immBlock();
 
 		ir_node  *const proj = new_Proj(current_pipeline, mode_X, i+1);
@@ -5451,9 +5569,17 @@ static void pipeline_statement_to_firm(pipeline_statement_t *statement)
 		mature_immBlock(block);
 		set_cur_block(block);
 
-		current_stage_index = i;
+		current_core = i;
 		statement_to_firm(statement->body);
 
+		if (plinc_double_buffering && currently_reachable()) {
+			/* wait for outstanding sends, drop receives posted for an
+			 * iteration that will not happen anymore */
+			ir_node *store = get_store();
+			plinc_call_symbol(&store, plinc_flush, plinc_flush_type, 0, NULL);
+			set_store(store);
+		}
+
 		create_jump_statement(statement->body, get_break_label());
 	}
 
@@ -5469,117 +5595,346 @@ static void pipeline_statement_to_firm(pipeline_statement_t *statement)
 	assert(current_pipeline == pipeline_node);
 	current_pipeline    = old_pipeline;
 	current_in_stage    = old_in_stage;
-	current_stage_index = old_stage_index;
+	current_core        = old_core;
+	current_stage_core  = old_stage_core;
+	current_stages      = old_stages;
 	break_label         = old_break_label;
+
+	xfree(stage_core);
 }
 
-static void stage_statement_to_firm(stage_statement_t *statement)
+/**
+ * Returns the entity of the (de)serializer of a compound type, i.e.
+ * prefix followed by the name of the compound.
+ */
+static ir_entity *get_plinc_serializer(const char *prefix, type_t *type,
+                                       ir_type *irtype)
 {
-	if (statement->index == current_stage_index) {
-		ir_node *store, *node, *load_data_proj, *load_size_proj, *load_malloc_proj, *load_free_proj;
-		ir_node *in[3];
+	obstack_init(&plinc_obst);
 
-		store = get_store();
-		for (stage_entity_t *it = statement->first_entity; it != NULL; it = it->next) {
-			if (it->direction == STAGE_IN && it->target >= 0) {
-				ir_node *variable = reference_addr(it->expression);
-				type_t *type = skip_typeref(it->expression->base.type);
+	obstack_grow(&plinc_obst, prefix, strlen(prefix));
+	const char *type_name = type->compound.compound->base.symbol->string;
+	obstack_grow0(&plinc_obst, type_name, strlen(type_name));
+	const char *name = obstack_finish(&plinc_obst);
 
-				if (is_type_compound(type)) {
-					/* RCCE_recv(&plinc_size, sizeof(plinc_size), target) */
-					in[0] = new_SymConst(get_modeP(), plinc_size, symconst_addr_ent);
-					in[1] = new_Const(new_tarval_from_long(sizeof_plinc_size, atomic_modes[ATOMIC_TYPE_ULONG]));
-					in[2] = new_Const(new_tarval_from_long(it->target, atomic_modes[ATOMIC_TYPE_INT]));
+	ir_entity *entity = new_entity(get_glob_type(), new_id_from_str(name), irtype);
 
-					node = new_Call(store, new_SymConst(get_modeP(), rcce_recv, symconst_addr_ent), 3, in, rcce_recv_send_type);
-					store = new_Proj(node, get_modeM(), pn_Call_M);
+	obstack_free(&plinc_obst, NULL);
+	return entity;
+}
 
-					/* plinc_data = plinc_malloc(plinc_size) */
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_malloc, symconst_addr_ent), get_modeP(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_malloc_proj = new_Proj(node, get_modeP(), pn_Load_res);
+/**
+ * Returns the function used to send data: with double buffering all sends
+ * must go through plinc_isend, as a synchronous send could overtake queued
+ * ones to the same core.
+ */
+static symconst_symbol plinc_send_function(void)
+{
+	return plinc_double_buffering ? plinc_isend : rcce_send;
+}
 
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_size, symconst_addr_ent), get_modeIu(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_size_proj = new_Proj(node, get_modeIu(), pn_Load_res);
+/**
+ * Receive a message from @p target: the size first, then the data, which is
+ * stored in a buffer allocated with plinc_malloc.
+ */
+static void plinc_recv_message(ir_node **store, long target)
+{
+	ir_node *in[3];
 
-					in[0] = load_size_proj;
+	/* RCCE_recv(&plinc_size, sizeof(plinc_size), target) */
+	in[0] = new_SymConst(get_modeP(), plinc_size, symconst_addr_ent);
+	in[1] = new_Const(new_tarval_from_long(sizeof_plinc_size, atomic_modes[ATOMIC_TYPE_ULONG]));
+	in[2] = plinc_target(target);
+	plinc_call_symbol(store, rcce_recv, rcce_recv_send_type, 3, in);
 
-					node = new_Call(store, load_malloc_proj, 1, in, plinc_malloc_type);
-					store = new_Proj(node, get_modeM(), pn_Call_M);
+	/* plinc_data = plinc_malloc(plinc_size) */
+	ir_node *const malloc_ptr = plinc_load(store, plinc_malloc, get_modeP());
+	in[0] = plinc_load(store, plinc_size, get_modeIu());
+	ir_node *const call  = plinc_call(store, malloc_ptr, plinc_malloc_type, 1, in);
+	ir_node *const tuple = new_Proj(call, get_modeT(), pn_Call_T_result);
+	ir_node *const data  = new_Proj(tuple, get_modeP(), 0);
 
-					ir_node *tuple = new_Proj(node, get_modeT(), pn_Call_T_result);
-					ir_node *result = new_Proj(tuple, get_modeP(), 0);
+	ir_node *const data_addr = new_SymConst(get_modeP(), plinc_data, symconst_addr_ent);
+	ir_node *const node      = new_Store(*store, data_addr, data, cons_none);
+	*store = new_Proj(node, get_modeM(), pn_Store_M);
 
-					node = new_Store(store, new_SymConst(get_modeP(), plinc_data, symconst_addr_ent), result, cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
+	/* RCCE_recv(plinc_data, plinc_size, target) */
+	in[0] = data;
+	in[1] = plinc_load(store, plinc_size, get_modeIu());
+	in[2] = plinc_target(target);
+	plinc_call_symbol(store, rcce_recv, rcce_recv_send_type, 3, in);
+}
 
-					/* RCCE_recv(plinc_data, plinc_size, 2) */
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_size, symconst_addr_ent), get_modeIu(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_size_proj = new_Proj(node, get_modeIu(), pn_Load_res);
+/**
+ * Send the message in plinc_data to @p target: the size first, then the data.
+ */
+static void plinc_send_message(ir_node **store, long target)
+{
+	ir_node *in[3];
+
+	/* RCCE_send(&plinc_size, sizeof(plinc_size), target) */
+	in[0] = new_SymConst(get_modeP(), plinc_size, symconst_addr_ent);
+	in[1] = new_Const(new_tarval_from_long(sizeof_plinc_size, atomic_modes[ATOMIC_TYPE_ULONG]));
+	in[2] = plinc_target(target);
+	plinc_call_symbol(store, plinc_send_function(), rcce_recv_send_type, 3, in);
+
+	/* RCCE_send(plinc_data, plinc_size, target) */
+	in[0] = plinc_load(store, plinc_data, get_modeP());
+	in[1] = plinc_load(store, plinc_size, get_modeIu());
+	in[2] = plinc_target(target);
+	plinc_call_symbol(store, plinc_send_function(), rcce_recv_send_type, 3, in);
+}
 
-					in[0] = result;
-					in[1] = load_size_proj;
-					in[2] = new_Const(new_tarval_from_long(it->target, atomic_modes[ATOMIC_TYPE_INT]));
+/**
+ * plinc_free(plinc_data)
+ */
+static void plinc_free_message(ir_node **store)
+{
+	ir_node *in[1];
 
-					node = new_Call(store, new_SymConst(get_modeP(), rcce_recv, symconst_addr_ent), 3, in, rcce_recv_send_type);
-					store = new_Proj(node, get_modeM(), pn_Call_M);
+	ir_node *const free_ptr = plinc_load(store, plinc_free, get_modeP());
+	in[0] = plinc_load(store, plinc_data, get_modeP());
+	plinc_call(store, free_ptr, plinc_free_type, 1, in);
+}
 
-					/* plinc_deserialize_type(&var, plinc_data, &plinc_size) */
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_data, symconst_addr_ent), get_modeP(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_data_proj = new_Proj(node, get_modeP(), pn_Load_res);
+/**
+ * plinc_compress(threshold): encodes the message in plinc_data in place if it
+ * is at least threshold bytes large.
+ */
+static void plinc_compress_message(ir_node **store, il_size_t threshold)
+{
+	ir_node *in[1];
 
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_size, symconst_addr_ent), get_modeIu(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_size_proj = new_Proj(node, get_modeIu(), pn_Load_res);
+	in[0] = new_Const(new_tarval_from_long(threshold, get_modeIu()));
+	plinc_call_symbol(store, plinc_compress, plinc_compress_type, 1, in);
+}
 
-					obstack_init(&plinc_obst);
+/**
+ * plinc_decompress(): decodes the message in plinc_data in place.
+ */
+static void plinc_decompress_message(ir_node **store)
+{
+	plinc_call_symbol(store, plinc_decompress, plinc_decompress_type, 0, NULL);
+}
 
-					const char *base = "_plinc_deserialize_";
-					obstack_grow(&plinc_obst, base, strlen(base));
-					const char *type_name = type->compound.compound->base.symbol->string;
-					obstack_grow(&plinc_obst, type_name, strlen(type_name));
-					const char* deserializer_name = obstack_finish(&plinc_obst);
+/**
+ * Copy a non-compound value of type @p type from @p src to @p dst. CopyB only
+ * takes compound and array types, scalars are loaded and stored.
+ */
+static void plinc_copy(ir_node **store, ir_node *dst, ir_node *src,
+                       type_t *type)
+{
+	if (is_type_array(type)) {
+		ir_node *const node = new_CopyB(*store, dst, src, get_ir_type(type));
+		*store = new_Proj(node, get_modeM(), pn_CopyB_M);
+		return;
+	}
 
-					symconst_symbol deserializer_symbol;
-					deserializer_symbol.entity_p = new_entity(get_glob_type(), new_id_from_str(deserializer_name), plinc_deserializer_type);
-					ir_node *serializer_callee = new_SymConst(get_modeP(), deserializer_symbol, symconst_addr_ent);
+	ir_mode *const mode  = get_ir_mode_storage(type);
+	ir_node *const load  = new_Load(*store, src, mode, cons_none);
+	ir_node *const value = new_Proj(load, mode, pn_Load_res);
+	*store = new_Proj(load, get_modeM(), pn_Load_M);
+	ir_node *const node  = new_Store(*store, dst, value, cons_none);
+	*store = new_Proj(node, get_modeM(), pn_Store_M);
+}
 
-					in[0] = variable;
-					in[1] = load_data_proj;
-					in[2] = load_size_proj;
+/**
+ * Copy a non-compound variable into a freshly allocated message.
+ */
+static void plinc_copy_to_message(ir_node **store, ir_node *variable,
+                                  type_t *type)
+{
+	ir_node *in[1];
+
+	/* plinc_size = sizeof(var) */
+	ir_node *const size      = new_Const_long(get_modeIu(), get_type_size(type));
+	ir_node *const size_addr = new_SymConst(get_modeP(), plinc_size, symconst_addr_ent);
+	ir_node *      node      = new_Store(*store, size_addr, size, cons_none);
+	*store = new_Proj(node, get_modeM(), pn_Store_M);
+
+	/* plinc_data = plinc_malloc(plinc_size) */
+	ir_node *const malloc_ptr = plinc_load(store, plinc_malloc, get_modeP());
+	in[0] = size;
+	ir_node *const call  = plinc_call(store, malloc_ptr, plinc_malloc_type, 1, in);
+	ir_node *const tuple = new_Proj(call, get_modeT(), pn_Call_T_result);
+	ir_node *const data  = new_Proj(tuple, get_modeP(), 0);
+
+	ir_node *const data_addr = new_SymConst(get_modeP(), plinc_data, symconst_addr_ent);
+	node   = new_Store(*store, data_addr, data, cons_none);
+	*store = new_Proj(node, get_modeM(), pn_Store_M);
+
+	/* memcpy(plinc_data, &var, sizeof(var)) */
+	plinc_copy(store, data, variable, type);
+}
 
-					node = new_Call(store, serializer_callee, 3, in, get_entity_type(deserializer_symbol.entity_p));
-					store = new_Proj(node, get_modeM(), pn_Call_M);
+/**
+ * Copy the content of a received message back into a non-compound variable.
+ */
+static void plinc_copy_from_message(ir_node **store, ir_node *variable,
+                                    type_t *type)
+{
+	ir_node *const data = plinc_load(store, plinc_data, get_modeP());
+	plinc_copy(store, variable, data, type);
+}
 
-					obstack_free(&plinc_obst, NULL);
+/**
+ * Returns true if transfers of the variable referenced by a stage entity
+ * should be compressed.
+ */
+static bool is_plinc_compressed(const stage_entity_t *stage_entity,
+                                type_t *type)
+{
+	const entity_t *entity = stage_entity->expression->entity;
+	if (entity->kind != ENTITY_VARIABLE || !entity->variable.plinc_compress)
+		return false;
+	if (is_type_compound(type))
+		return true;
 
-					/* plinc_free(plinc_data) */
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_free, symconst_addr_ent), get_modeP(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_free_proj = new_Proj(node, get_modeP(), pn_Load_res);
+	/* the size of other variables is known, so we can decide right now */
+	if (is_type_array(type) && type->array.is_vla)
+		return false;
+	return get_type_size(type) >= entity->variable.plinc_compress_threshold;
+}
 
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_data, symconst_addr_ent), get_modeP(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_data_proj = new_Proj(node, get_modeP(), pn_Load_res);
+static bool is_stage_on_current_core(const stage_statement_t *statement)
+{
+	return statement->index >= 0
+		&& current_stage_core[statement->index] == current_core;
+}
 
-					in[0] = load_data_proj;
+/**
+ * Returns true if the receives of the current core from core @p source can
+ * be prefetched. Prefetching posts the receives of the next iteration as
+ * soon as the current ones completed, which needs their sizes in advance.
+ * As messages between two cores are matched in order, this is only possible
+ * if every message from @p source to any stage on the core has a fixed size.
+ */
+static bool is_plinc_prefetchable(long source)
+{
+	if (!plinc_double_buffering)
+		return false;
 
-					node = new_Call(store, load_free_proj, 1, in, plinc_free_type);
-					store = new_Proj(node, get_modeM(), pn_Call_M);
+	for (const stage_statement_t *stage = current_stages; stage != NULL;
+	     stage = stage->next) {
+		if (!is_stage_on_current_core(stage))
+			continue;
+
+		for (stage_entity_t *it = stage->first_entity; it != NULL; it = it->next) {
+			if (it->direction != STAGE_IN || it->target < 0
+					|| current_stage_core[it->target] != source)
+				continue;
+
+			type_t *type = skip_typeref(it->expression->base.type);
+			if (is_type_compound(type) || is_plinc_compressed(it, type))
+				return false;
+			if (is_type_array(type) && type->array.is_vla)
+				return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Returns true if @p statement is the last stage run by the current core.
+ */
+static bool is_last_stage_on_current_core(const stage_statement_t *statement)
+{
+	/* stages are listed last first */
+	for (const stage_statement_t *stage = current_stages; stage != NULL;
+	     stage = stage->next) {
+		if (is_stage_on_current_core(stage))
+			return stage == statement;
+	}
+	return false;
+}
+
+/**
+ * Post the prefetched receives of the next iteration for the stages of the
+ * current core in the list starting at @p stage, in the order they are
+ * received.
+ */
+static void plinc_post_receives(ir_node **store, const stage_statement_t *stage)
+{
+	if (stage == NULL)
+		return;
+	/* stages are listed last first */
+	plinc_post_receives(store, stage->next);
+	if (!is_stage_on_current_core(stage))
+		return;
+
+	for (stage_entity_t *it = stage->first_entity; it != NULL; it = it->next) {
+		if (it->direction == STAGE_IN && it->target >= 0
+				&& current_stage_core[it->target] != current_core) {
+			long const target = current_stage_core[it->target];
+			if (!is_plinc_prefetchable(target))
+				continue;
+
+			/* plinc_irecv_post(sizeof(var), target) */
+			ir_node *in[2];
+			type_t  *type = skip_typeref(it->expression->base.type);
+			in[0] = get_type_size_node(type);
+			in[1] = plinc_target(target);
+			plinc_call_symbol(store, plinc_irecv_post, plinc_irecv_post_type, 2, in);
+		}
+	}
+}
+
+static void stage_statement_to_firm(stage_statement_t *statement)
+{
+	if (current_stage_core != NULL && is_stage_on_current_core(statement)) {
+		ir_node *store;
+		ir_node *in[3];
+
+		store = get_store();
+		for (stage_entity_t *it = statement->first_entity; it != NULL; it = it->next) {
+			if (it->direction == STAGE_IN && it->target >= 0
+					&& current_stage_core[it->target] != current_core) {
+				long const target = current_stage_core[it->target];
+				ir_node *variable = reference_addr(it->expression);
+				type_t *type = skip_typeref(it->expression->base.type);
+				bool const compressed = is_plinc_compressed(it, type);
+
+				if (is_type_compound(type)) {
+					plinc_recv_message(&store, target);
+					if (compressed)
+						plinc_decompress_message(&store);
+
+					/* plinc_deserialize_type(&var, plinc_data, plinc_size) */
+					symconst_symbol deserializer;
+					deserializer.entity_p = get_plinc_serializer("_plinc_deserialize_", type, plinc_deserializer_type);
+
+					in[0] = variable;
+					in[1] = plinc_load(&store, plinc_data, get_modeP());
+					in[2] = plinc_load(&store, plinc_size, get_modeIu());
+					plinc_call_symbol(&store, deserializer, plinc_deserializer_type, 3, in);
+
+					plinc_free_message(&store);
+				} else if (compressed) {
+					plinc_recv_message(&store, target);
+					plinc_decompress_message(&store);
+					plinc_copy_from_message(&store, variable, type);
+					plinc_free_message(&store);
+				} else if (is_plinc_prefetchable(target)) {
+					/* plinc_irecv_wait(&var, sizeof(var), target) */
+					in[0] = variable;
+					in[1] = get_type_size_node(type);
+					in[2] = plinc_target(target);
+					plinc_call_symbol(&store, plinc_irecv_wait, rcce_recv_send_type, 3, in);
 				} else {
 					/* RCCE_recv(&var, sizeof(var), target) */
 					in[0] = variable;
 					in[1] = get_type_size_node(type);
-					in[2] = new_Const(new_tarval_from_long(it->target, atomic_modes[ATOMIC_TYPE_INT]));
-
-					ir_node *call_node = new_Call(store, new_SymConst(get_modeP(), rcce_recv, symconst_addr_ent), 3, in, rcce_recv_send_type);
-					store = new_Proj(call_node, get_modeM(), pn_Call_M);
+					in[2] = plinc_target(target);
+					plinc_call_symbol(&store, rcce_recv, rcce_recv_send_type, 3, in);
 				}
 			}
 		}
+
+		/* prefetch the next iteration once the core received everything of
+		 * this one: fused stages may receive from the same source, and an
+		 * earlier post would take the message of a later stage */
+		if (is_last_stage_on_current_core(statement))
+			plinc_post_receives(&store, current_stages);
 		set_store(store);
 
 		current_in_stage = true;
@@ -5588,82 +5943,41 @@ static void stage_statement_to_firm(stage_statement_t *statement)
 
 		store = get_store();
 		for (stage_entity_t *it = statement->first_entity; it != NULL; it = it->next) {
-			if (it->direction == STAGE_OUT && it->target >= 0) {
+			if (it->direction == STAGE_OUT && it->target >= 0
+					&& current_stage_core[it->target] != current_core) {
+				long const target = current_stage_core[it->target];
 				ir_node *variable = reference_addr(it->expression);
 				type_t *type = skip_typeref(it->expression->base.type);
+				bool const compressed = is_plinc_compressed(it, type);
 
 				if (is_type_compound(type)) {
 					/* plinc_serialize_type(&var, plinc_data, &plinc_size) */
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_data, symconst_addr_ent), get_modeP(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_data_proj = new_Proj(node, get_modeP(), pn_Load_res);
-
-					obstack_init(&plinc_obst);
-
-					const char *base = "_plinc_serialize_";
-					obstack_grow(&plinc_obst, base, strlen(base));
-					const char *type_name = type->compound.compound->base.symbol->string;
-					obstack_grow(&plinc_obst, type_name, strlen(type_name));
-					const char* serializer_name = obstack_finish(&plinc_obst);
-
-					symconst_symbol serializer_symbol;
-					serializer_symbol.entity_p = new_entity(get_glob_type(), new_id_from_str(serializer_name), plinc_serializer_type);
-					ir_node *serializer_callee = new_SymConst(get_modeP(), serializer_symbol, symconst_addr_ent);
+					symconst_symbol serializer;
+					serializer.entity_p = get_plinc_serializer("_plinc_serialize_", type, plinc_serializer_type);
 
 					in[0] = variable;
-					in[1] = load_data_proj;
+					in[1] = plinc_load(&store, plinc_data, get_modeP());
 					in[2] = new_SymConst(get_modeP(), plinc_size, symconst_addr_ent);
+					plinc_call_symbol(&store, serializer, plinc_serializer_type, 3, in);
 
-					node = new_Call(store, serializer_callee, 3, in, get_entity_type(serializer_symbol.entity_p));
-					store = new_Proj(node, get_modeM(), pn_Call_M);
-
-					obstack_free(&plinc_obst, NULL);
-
-					/* RCCE_send(&plinc_size, sizeof(plinc_size), target) */
-					in[0] = new_SymConst(get_modeP(), plinc_size, symconst_addr_ent);
-					in[1] = new_Const(new_tarval_from_long(sizeof_plinc_size, atomic_modes[ATOMIC_TYPE_ULONG]));
-					in[2] = new_Const(new_tarval_from_long(it->target, atomic_modes[ATOMIC_TYPE_INT]));
-
-					node = new_Call(store, new_SymConst(get_modeP(), rcce_send, symconst_addr_ent), 3, in, rcce_recv_send_type);
-					store = new_Proj(node, get_modeM(), pn_Call_M);
-
-					/* RCCE_send(plinc_data, plinc_size, 2) */
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_data, symconst_addr_ent), get_modeP(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_data_proj = new_Proj(node, get_modeP(), pn_Load_res);
-
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_size, symconst_addr_ent), get_modeIu(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_size_proj = new_Proj(node, get_modeIu(), pn_Load_res);
-
-					in[0] = load_data_proj;
-					in[1] = load_size_proj;
-					in[2] = new_Const(new_tarval_from_long(it->target, atomic_modes[ATOMIC_TYPE_INT]));
-
-					node = new_Call(store, new_SymConst(get_modeP(), rcce_send, symconst_addr_ent), 3, in, rcce_recv_send_type);
-					store = new_Proj(node, get_modeM(), pn_Call_M);
-
-					/* plinc_free(plinc_data) */
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_free, symconst_addr_ent), get_modeP(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_free_proj = new_Proj(node, get_modeP(), pn_Load_res);
-
-					node = new_Load(store, new_SymConst(get_modeP(), plinc_data, symconst_addr_ent), get_modeP(), cons_none);
-					store = new_Proj(node, get_modeM(), pn_Load_M);
-					load_data_proj = new_Proj(node, get_modeP(), pn_Load_res);
-
-					in[0] = load_data_proj;
-
-					node = new_Call(store, load_free_proj, 1, in, plinc_free_type);
-					store = new_Proj(node, get_modeM(), pn_Call_M);
+					if (compressed) {
+						entity_t const *const entity = it->expression->entity;
+						plinc_compress_message(&store, entity->variable.plinc_compress_threshold);
+					}
+					plinc_send_message(&store, target);
+					plinc_free_message(&store);
+				} else if (compressed) {
+					entity_t const *const entity = it->expression->entity;
+					plinc_copy_to_message(&store, variable, type);
+					plinc_compress_message(&store, entity->variable.plinc_compress_threshold);
+					plinc_send_message(&store, target);
+					plinc_free_message(&store);
 				} else {
 					/* RCCE_send(&var, sizeof(var), target) */
 					in[0] = variable;
 					in[1] = get_type_size_node(type);
-					in[2] = new_Const(new_tarval_from_long(it->target, atomic_modes[ATOMIC_TYPE_INT]));
-
-					ir_node *call_node = new_Call(store, new_SymConst(get_modeP(), rcce_send, symconst_addr_ent), 3, in, rcce_recv_send_type);
-					store = new_Proj(call_node, get_modeM(), pn_Call_M);
+					in[2] = plinc_target(target);
+					plinc_call_symbol(&store, plinc_send_function(), rcce_recv_send_type, 3, in);
 				}
 			}
 		}
@@ -5712,6 +6026,24 @@ static void plinc_init(void)
 	plinc_data.entity_p = new_entity(get_glob_type(), new_id_from_str("_plinc_data"), type_void_ptr);
 	plinc_size.entity_p = new_entity(get_glob_type(), new_id_from_str("_plinc_size"), type_size_t);
 
+	plinc_compress_type = new_type_method(1, 0);
+	set_method_param_type(plinc_compress_type, 0, type_size_t);
+	plinc_compress.entity_p = new_entity(get_glob_type(), new_id_from_str("_plinc_compress"), plinc_compress_type);
+
+	plinc_decompress_type = new_type_method(0, 0);
+	plinc_decompress.entity_p = new_entity(get_glob_type(), new_id_from_str("_plinc_decompress"), plinc_decompress_type);
+
+	plinc_isend.entity_p      = new_entity(get_glob_type(), new_id_from_str("_plinc_isend"), rcce_recv_send_type);
+	plinc_irecv_wait.entity_p = new_entity(get_glob_type(), new_id_from_str("_plinc_irecv_wait"), rcce_recv_send_type);
+
+	plinc_irecv_post_type = new_type_method(2, 0);
+	set_method_param_type(plinc_irecv_post_type, 0, type_size_t);
+	set_method_param_type(plinc_irecv_post_type, 1, type_int);
+	plinc_irecv_post.entity_p = new_entity(get_glob_type(), new_id_from_str("_plinc_irecv_post"), plinc_irecv_post_type);
+
+	plinc_flush_type = new_type_method(0, 0);
+	plinc_flush.entity_p = new_entity(get_glob_type(), new_id_from_str("_plinc_flush"), plinc_flush_type);
+
 	sizeof_plinc_size = get_atomic_type_size(ATOMIC_TYPE_ULONG);
 }
 
@@ -5721,7 +6053,7 @@ static void plinc_init(void)
 static void statement_to_firm(statement_t *statement)
 {
 #ifndef NDEBUG
-	if (current_in_stage || current_pipeline == NULL || current_stage_index == 0) {
+	if (current_in_stage || current_pipeline == NULL || current_core == 0) {
 		assert(!statement->base.transformed);
 		statement->base.transformed = true;
 	}
@@ -6000,6 +6332,14 @@ static void create_function(entity_t *entity)
 	inner_functions     = NULL;
 	current_trampolines = NULL;
 
+	/* per-function construction times only show up in the JSON report */
+	ir_timer_t *t_function = NULL;
+	if (timers_enabled()) {
+		t_function = ir_timer_new();
+		timer_register_fine(t_function, get_entity_ld_name(function_entity));
+		timer_push(t_function);
+	}
+
 	if (entity->declaration.modifiers & DM_CONSTRUCTOR) {
 		ir_type *segment = get_segment_type(IR_SEGMENT_CONSTRUCTORS);
 		add_function_pointer(segment, function_entity, "constructor_ptr.%u");
@@ -6124,6 +6464,9 @@ static void create_function(entity_t *entity)
 		current_trampolines = NULL;
 	}
 
+	if (t_function != NULL)
+		timer_pop(t_function);
+
 	/* create inner functions if any */
 	entity_t **inner = inner_functions;
 	if (inner != NULL) {
@@ -6183,6 +6526,8 @@ static void scope_to_firm(scope_t *scope)
 void init_ast2firm(void)
 {
 	obstack_init(&asm_obst);
+	obstack_init(&string_entities_obst);
+	string_entities = new_pset(cmp_string_entity, 16);
 	init_atomic_modes();
 
 	ir_set_debug_retrieve(dbg_retrieve);
@@ -6218,6 +6563,8 @@ static void init_ir_types(void)
 void exit_ast2firm(void)
 {
 	entitymap_destroy(&entitymap);
+	del_pset(string_entities);
+	obstack_free(&string_entities_obst, NULL);
 	obstack_free(&asm_obst, NULL);
 }
 
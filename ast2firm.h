@@ -20,6 +20,7 @@
 #ifndef AST2FIRM_H
 #define AST2FIRM_H
 
+#include <stdbool.h>
 #include <libfirm/firm.h>
 #include "ast.h"
 #include "type.h"
@@ -39,4 +40,7 @@ void set_create_ld_ident(create_ld_ident_func func);
 extern fp_model_t firm_fp_model;
 extern ir_mode *atomic_modes[ATOMIC_TYPE_LAST+1];
 
+/** Overlap pipeline stage transfers with computation (double buffering). */
+extern bool plinc_double_buffering;
+
 #endif
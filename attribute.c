@@ -94,6 +94,7 @@ static const char *const attribute_names[ATTRIBUTE_LAST+1] = {
 	[ATTRIBUTE_GNU_TRAP_EXIT]              = "trap_exit",
 	[ATTRIBUTE_GNU_SP_SWITCH]              = "sp_switch",
 	[ATTRIBUTE_GNU_SENTINEL]               = "sentinel",
+	[ATTRIBUTE_PLINC_COMPRESS]             = "plinc_compress",
 
 	[ATTRIBUTE_MS_ALIGN]                   = "align",
 	[ATTRIBUTE_MS_ALLOCATE]                = "allocate",
@@ -327,6 +328,39 @@ static void handle_attribute_asm(const attribute_t *attribute,
 	return;
 }
 
+static void handle_attribute_plinc_compress(const attribute_t *attribute,
+                                            entity_t *entity)
+{
+	/* compressing only pays off once a message spans several cache lines */
+	long threshold = 1024;
+	attribute_argument_t *argument = attribute->a.arguments;
+	if (argument != NULL) {
+		if (argument->kind != ATTRIBUTE_ARGUMENT_EXPRESSION) {
+			errorf(&attribute->source_position,
+			       "__attribute__((plinc_compress(X))) argument is not a size");
+			return;
+		}
+		threshold = fold_constant_to_int(argument->v.expression);
+		if (threshold < 0) {
+			errorf(&attribute->source_position,
+			       "compression threshold must not be negative but is %d",
+			       (int)threshold);
+			return;
+		}
+	}
+
+	if (entity->kind != ENTITY_VARIABLE) {
+		source_position_t const *const pos  = &attribute->source_position;
+		char              const *const what = get_entity_kind_name(entity->kind);
+		symbol_t          const *const sym  = entity->base.symbol;
+		warningf(WARN_OTHER, pos, "plinc_compress attribute on %s '%S' ignored", what, sym);
+		return;
+	}
+
+	entity->variable.plinc_compress           = true;
+	entity->variable.plinc_compress_threshold = (il_size_t)threshold;
+}
+
 void handle_entity_attributes(const attribute_t *attributes, entity_t *entity)
 {
 	if (entity->kind == ENTITY_TYPEDEF) {
@@ -385,6 +419,10 @@ void handle_entity_attributes(const attribute_t *attributes, entity_t *entity)
 		case ATTRIBUTE_GNU_ALIGNED:
 			handle_attribute_aligned(attribute, entity);
 			break;
+
+		case ATTRIBUTE_PLINC_COMPRESS:
+			handle_attribute_plinc_compress(attribute, entity);
+			break;
 		default: break;
 		}
 	}
@@ -79,6 +79,7 @@ typedef enum attribute_kind_t {
 	ATTRIBUTE_GNU_TRAP_EXIT,
 	ATTRIBUTE_GNU_SP_SWITCH,
 	ATTRIBUTE_GNU_SENTINEL,
+	ATTRIBUTE_PLINC_COMPRESS,
 	ATTRIBUTE_GNU_ASM,
 	ATTRIBUTE_GNU_LAST = ATTRIBUTE_GNU_ASM,
 	ATTRIBUTE_MS_FIRST,
@@ -0,0 +1,363 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include <config.h>
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define mkdir(path, mode) _mkdir(path)
+#define getpid()          _getpid()
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/file.h>
+#endif
+
+#include "compile_cache.h"
+#include "adt/array.h"
+#include "adt/obst.h"
+#include "adt/sha1.h"
+#include "adt/xmalloc.h"
+
+typedef struct cache_stats_t {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t size;   /**< bytes stored in the cache */
+} cache_stats_t;
+
+typedef struct cache_file_t {
+	char    *path;
+	uint64_t size;
+	time_t   mtime;
+} cache_file_t;
+
+static const char *cache_dir;
+static uint64_t    cache_max_size;
+
+void compile_cache_init(const char *dir, uint64_t max_size)
+{
+	cache_dir      = dir;
+	cache_max_size = max_size;
+	mkdir(dir, 0777);
+}
+
+void compile_cache_key(char key[COMPILE_CACHE_KEY_SIZE], FILE *input,
+                       const char *options)
+{
+	sha1_t sha1;
+	sha1_init(&sha1);
+	sha1_update(&sha1, options, strlen(options) + 1);
+
+	char   buf[16384];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), input)) > 0) {
+		sha1_update(&sha1, buf, n);
+	}
+	rewind(input);
+
+	unsigned char digest[SHA1_DIGEST_SIZE];
+	sha1_final(&sha1, digest);
+	for (unsigned i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+		snprintf(&key[2*i], 3, "%02x", digest[i]);
+	}
+}
+
+void compile_cache_hash_file(struct obstack *obst, const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		obstack_printf(obst, "%s missing\n", filename);
+		return;
+	}
+
+	sha1_t sha1;
+	sha1_init(&sha1);
+	char   buf[16384];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+		sha1_update(&sha1, buf, n);
+	}
+	fclose(file);
+
+	unsigned char digest[SHA1_DIGEST_SIZE];
+	sha1_final(&sha1, digest);
+	obstack_printf(obst, "%s ", filename);
+	for (unsigned i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+		obstack_printf(obst, "%02x", digest[i]);
+	}
+	obstack_1grow(obst, '\n');
+}
+
+/**
+ * Returns the path of the cache entry for @p key, the first two hex digits
+ * of the key select a subdirectory to keep directories small.
+ */
+static void get_entry_path(char *buf, size_t buflen, const char *key,
+                           const char *suffix)
+{
+	snprintf(buf, buflen, "%s/%.2s/%s%s", cache_dir, key, key + 2, suffix);
+}
+
+/**
+ * Locks the statistics against concurrent compilations updating them, until
+ * unlock_stats() is called with the returned descriptor.
+ */
+static int lock_stats(void)
+{
+#ifndef _WIN32
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/stats.lock", cache_dir);
+	int fd = open(path, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		return -1;
+	while (flock(fd, LOCK_EX) != 0) {
+		if (errno != EINTR) {
+			close(fd);
+			return -1;
+		}
+	}
+	return fd;
+#else
+	return -1;
+#endif
+}
+
+static void unlock_stats(int fd)
+{
+#ifndef _WIN32
+	/* closing the descriptor releases the lock */
+	if (fd >= 0)
+		close(fd);
+#else
+	(void) fd;
+#endif
+}
+
+static void read_stats(const char *path, cache_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return;
+
+	char     name[16];
+	uint64_t value;
+	while (fscanf(file, "%15s %" SCNu64, name, &value) == 2) {
+		if (strcmp(name, "hits") == 0) {
+			stats->hits = value;
+		} else if (strcmp(name, "misses") == 0) {
+			stats->misses = value;
+		} else if (strcmp(name, "size") == 0) {
+			stats->size = value;
+		}
+	}
+	fclose(file);
+}
+
+static void write_stats(const char *path, const cache_stats_t *stats)
+{
+	char temp[4096];
+	snprintf(temp, sizeof(temp), "%s.%d", path, (int) getpid());
+	FILE *file = fopen(temp, "w");
+	if (file == NULL)
+		return;
+	fprintf(file, "hits %" PRIu64 "\nmisses %" PRIu64 "\nsize %" PRIu64 "\n",
+	        stats->hits, stats->misses, stats->size);
+	fclose(file);
+	rename(temp, path);
+}
+
+static int compare_cache_files(const void *p1, const void *p2)
+{
+	const cache_file_t *file1 = p1;
+	const cache_file_t *file2 = p2;
+	return file1->mtime < file2->mtime ? -1 : file1->mtime > file2->mtime;
+}
+
+/**
+ * Removes the least recently used entries until the cache uses at most 80%
+ * of its maximum size and returns the new size.
+ */
+static uint64_t evict(void)
+{
+	struct obstack obst;
+	obstack_init(&obst);
+	cache_file_t *files = NEW_ARR_F(cache_file_t, 0);
+	uint64_t      size  = 0;
+
+	for (unsigned i = 0; i < 256; ++i) {
+		char subdir[4096];
+		snprintf(subdir, sizeof(subdir), "%s/%02x", cache_dir, i);
+		DIR *dir = opendir(subdir);
+		if (dir == NULL)
+			continue;
+
+		struct dirent *entry;
+		while ((entry = readdir(dir)) != NULL) {
+			if (entry->d_name[0] == '.')
+				continue;
+			obstack_printf(&obst, "%s/%s", subdir, entry->d_name);
+			obstack_1grow(&obst, '\0');
+			char        *path = obstack_finish(&obst);
+			struct stat  st;
+			if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+				continue;
+
+			cache_file_t file = { path, (uint64_t) st.st_size, st.st_mtime };
+			ARR_APP1(cache_file_t, files, file);
+			size += file.size;
+		}
+		closedir(dir);
+	}
+
+	size_t n_files = ARR_LEN(files);
+	qsort(files, n_files, sizeof(files[0]), compare_cache_files);
+	uint64_t limit = cache_max_size / 10 * 8;
+	for (size_t i = 0; i < n_files && size > limit; ++i) {
+		if (unlink(files[i].path) == 0)
+			size -= files[i].size;
+	}
+
+	DEL_ARR_F(files);
+	obstack_free(&obst, NULL);
+	return size;
+}
+
+/**
+ * Adds to the statistics of the cache and evicts entries if the cache grew
+ * too large.  Concurrent compilations must not lose each others updates, so
+ * the statistics stay locked from reading them until they are written.
+ */
+static void update_stats(uint64_t hits, uint64_t misses, uint64_t size)
+{
+	char stats_path[4096];
+	snprintf(stats_path, sizeof(stats_path), "%s/stats", cache_dir);
+
+	int           lock = lock_stats();
+	cache_stats_t stats;
+	read_stats(stats_path, &stats);
+	stats.hits   += hits;
+	stats.misses += misses;
+	stats.size   += size;
+	if (stats.size > cache_max_size)
+		stats.size = evict();
+	write_stats(stats_path, &stats);
+	unlock_stats(lock);
+}
+
+bool compile_cache_fetch(const char *key, const char *suffix, FILE *output)
+{
+	char path[4096];
+	get_entry_path(path, sizeof(path), key, suffix);
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		update_stats(0, 1, 0);
+		return false;
+	}
+
+	char   buf[16384];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+		if (fwrite(buf, 1, n, output) != n) {
+			perror("could not write output");
+			break;
+		}
+	}
+	fclose(file);
+
+	/* the modification time orders the entries for eviction */
+#ifndef _WIN32
+	utime(path, NULL);
+#endif
+
+	update_stats(1, 0, 0);
+	return true;
+}
+
+void compile_cache_store(const char *key, const char *suffix,
+                         const char *filename)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%.2s", cache_dir, key);
+	mkdir(path, 0777);
+
+	/* write to a temporary name first, concurrent compilations never see a
+	 * partial entry this way */
+	char temp[4096];
+	get_entry_path(path, sizeof(path), key, suffix);
+	snprintf(temp, sizeof(temp), "%s.%d", path, (int) getpid());
+
+	FILE *input = fopen(filename, "rb");
+	if (input == NULL)
+		return;
+	FILE *output = fopen(temp, "wb");
+	if (output == NULL) {
+		fclose(input);
+		return;
+	}
+
+	uint64_t size = 0;
+	bool     ok   = true;
+	char     buf[16384];
+	size_t   n;
+	while ((n = fread(buf, 1, sizeof(buf), input)) > 0) {
+		if (fwrite(buf, 1, n, output) != n) {
+			ok = false;
+			break;
+		}
+		size += n;
+	}
+	fclose(input);
+	if (fclose(output) != 0 || !ok || rename(temp, path) != 0) {
+		unlink(temp);
+		return;
+	}
+
+	update_stats(0, 0, size);
+}
+
+void compile_cache_print_stats(FILE *output)
+{
+	char stats_path[4096];
+	snprintf(stats_path, sizeof(stats_path), "%s/stats", cache_dir);
+	cache_stats_t stats;
+	read_stats(stats_path, &stats);
+
+	uint64_t lookups = stats.hits + stats.misses;
+	fprintf(output, "cache directory  %s\n", cache_dir);
+	fprintf(output, "cache hits       %" PRIu64 "\n", stats.hits);
+	fprintf(output, "cache misses     %" PRIu64 "\n", stats.misses);
+	fprintf(output, "hit rate         %.1f%%\n",
+	        lookups > 0 ? 100.0 * stats.hits / lookups : 0.0);
+	fprintf(output, "cache size       %" PRIu64 " KiB\n", stats.size / 1024);
+	fprintf(output, "max cache size   %" PRIu64 " KiB\n", cache_max_size / 1024);
+}
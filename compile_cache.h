@@ -0,0 +1,71 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct obstack;
+
+/** size of a key including the terminating 0 */
+#define COMPILE_CACHE_KEY_SIZE 41
+
+/**
+ * Use the directory @p dir as compilation cache. Once the cached files
+ * exceed @p max_size bytes the least recently used ones are removed.
+ */
+void compile_cache_init(const char *dir, uint64_t max_size);
+
+/**
+ * Compute the key of a compilation from the preprocessed input @p input and
+ * a description of all options influencing the result. @p input is rewound
+ * afterwards.
+ */
+void compile_cache_key(char key[COMPILE_CACHE_KEY_SIZE], FILE *input,
+                       const char *options);
+
+/**
+ * Append the SHA-1 of the contents of the file @p filename to the options
+ * in @p obst. An option naming a file only describes a compilation together
+ * with the contents of the file.
+ */
+void compile_cache_hash_file(struct obstack *obst, const char *filename);
+
+/**
+ * Copy the result cached for @p key with file suffix @p suffix to @p output.
+ *
+ * @return true on a cache hit, false if nothing has been written
+ */
+bool compile_cache_fetch(const char *key, const char *suffix, FILE *output);
+
+/**
+ * Put the file @p filename into the cache as result for @p key.
+ */
+void compile_cache_store(const char *key, const char *suffix,
+                         const char *filename);
+
+/**
+ * Print hit/miss statistics and the size of the cache.
+ */
+void compile_cache_print_stats(FILE *output);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include <config.h>
+
+#define _GNU_SOURCE
+
+#include "compile_server.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "adt/array.h"
+#include "adt/obst.h"
+#include "adt/xmalloc.h"
+
+extern char **environ;
+
+/**
+ * Start of a compile request. It is followed by payload_size bytes of
+ * NUL-terminated strings: the working directory, argc arguments and envc
+ * environment entries. The client's stdin, stdout and stderr travel along
+ * with the header as SCM_RIGHTS.
+ */
+typedef struct request_header_t {
+	uint32_t magic;
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t payload_size;
+} request_header_t;
+
+#define REQUEST_MAGIC 0x63707372u /* "cpsr" */
+#define N_PASSED_FDS  3
+
+/* a closed connection is reported as error instead of raising SIGPIPE */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	while (size > 0) {
+		ssize_t written = send(fd, p, size, MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p    += written;
+		size -= (size_t)written;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *data, size_t size)
+{
+	char *p = data;
+	while (size > 0) {
+		ssize_t n = read(fd, p, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (n == 0)
+			return false;
+		p    += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+static bool fill_address(struct sockaddr_un *addr, const char *path)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	size_t len = strlen(path);
+	if (len >= sizeof(addr->sun_path))
+		return false;
+	memcpy(addr->sun_path, path, len + 1);
+	return true;
+}
+
+static bool send_header(int fd, const request_header_t *header)
+{
+	union {
+		struct cmsghdr align;
+		char           buf[CMSG_SPACE(N_PASSED_FDS * sizeof(int))];
+	} control;
+	memset(&control, 0, sizeof(control));
+
+	struct iovec  iov = { (void*)header, sizeof(*header) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(N_PASSED_FDS * sizeof(int));
+	int fds[N_PASSED_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	ssize_t sent;
+	do {
+		sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+	return sent == (ssize_t)sizeof(*header);
+}
+
+static bool receive_header(int fd, request_header_t *header,
+                           int fds[N_PASSED_FDS])
+{
+	union {
+		struct cmsghdr align;
+		char           buf[CMSG_SPACE(N_PASSED_FDS * sizeof(int))];
+	} control;
+
+	struct iovec  iov = { header, sizeof(*header) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t received;
+	do {
+		received = recvmsg(fd, &msg, 0);
+	} while (received < 0 && errno == EINTR);
+	if (received != (ssize_t)sizeof(*header))
+		return false;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+	    || cmsg->cmsg_type != SCM_RIGHTS
+	    || cmsg->cmsg_len != CMSG_LEN(N_PASSED_FDS * sizeof(int)))
+		return false;
+	memcpy(fds, CMSG_DATA(cmsg), N_PASSED_FDS * sizeof(int));
+
+	return header->magic == REQUEST_MAGIC;
+}
+
+bool compile_server_request(const char *path, int argc, char **argv,
+                            int *result)
+{
+	struct sockaddr_un addr;
+	if (!fill_address(&addr, path))
+		return false;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return false;
+	}
+
+	char *cwd = getcwd(NULL, 0);
+	if (cwd == NULL) {
+		close(fd);
+		return false;
+	}
+
+	struct obstack payload;
+	obstack_init(&payload);
+	obstack_grow(&payload, cwd, strlen(cwd) + 1);
+	free(cwd);
+	for (int i = 0; i < argc; ++i) {
+		obstack_grow(&payload, argv[i], strlen(argv[i]) + 1);
+	}
+	uint32_t envc = 0;
+	for (char **env = environ; *env != NULL; ++env, ++envc) {
+		obstack_grow(&payload, *env, strlen(*env) + 1);
+	}
+
+	request_header_t header;
+	header.magic        = REQUEST_MAGIC;
+	header.argc         = (uint32_t)argc;
+	header.envc         = envc;
+	header.payload_size = (uint32_t)obstack_object_size(&payload);
+	const char *data    = obstack_finish(&payload);
+
+	/* once the request is out the server owns the compilation, so failing
+	 * from here on must not make the caller compile a second time */
+	bool handled = false;
+	if (send_header(fd, &header)) {
+		handled = true;
+		int32_t status = EXIT_FAILURE;
+		if (!write_all(fd, data, header.payload_size)
+		    || !read_all(fd, &status, sizeof(status))) {
+			fprintf(stderr, "error: lost connection to compile server '%s'\n",
+			        path);
+			status = EXIT_FAILURE;
+		}
+		*result = status;
+	}
+
+	obstack_free(&payload, NULL);
+	close(fd);
+	return handled;
+}
+
+/**
+ * Split the payload of a request into its strings and install the working
+ * directory and environment of the client.
+ */
+static char **unpack_request(const request_header_t *header, char *data)
+{
+	char    *end     = data + header->payload_size;
+	unsigned n_strs  = 1 + header->argc + header->envc;
+	char   **strs    = XMALLOCN(char*, n_strs);
+	char    *p       = data;
+	for (unsigned i = 0; i < n_strs; ++i) {
+		char *nul = memchr(p, '\0', (size_t)(end - p));
+		if (nul == NULL) {
+			xfree(strs);
+			return NULL;
+		}
+		strs[i] = p;
+		p       = nul + 1;
+	}
+
+	if (chdir(strs[0]) != 0) {
+		fprintf(stderr, "error: could not change to directory '%s': %s\n",
+		        strs[0], strerror(errno));
+		xfree(strs);
+		return NULL;
+	}
+
+	char **argv = XMALLOCN(char*, header->argc + 1);
+	memcpy(argv, strs + 1, header->argc * sizeof(*argv));
+	argv[header->argc] = NULL;
+
+	char **env = XMALLOCN(char*, header->envc + 1);
+	memcpy(env, strs + 1 + header->argc, header->envc * sizeof(*env));
+	env[header->envc] = NULL;
+	environ = env;
+
+	xfree(strs);
+	return argv;
+}
+
+/**
+ * Handle a single connection, this runs in a process of its own. Returns in
+ * a child process performing the compilation, exits otherwise.
+ */
+static void handle_connection(int conn, int *argc, char ***argv)
+{
+	signal(SIGCHLD, SIG_DFL);
+
+	request_header_t header;
+	int              fds[N_PASSED_FDS];
+	if (!receive_header(conn, &header, fds))
+		_exit(EXIT_FAILURE);
+
+	char *data = XMALLOCN(char, header.payload_size);
+	if (!read_all(conn, data, header.payload_size))
+		_exit(EXIT_FAILURE);
+
+	for (int i = 0; i < N_PASSED_FDS; ++i) {
+		dup2(fds[i], i);
+		close(fds[i]);
+	}
+
+	int32_t status = EXIT_FAILURE;
+	char  **new_argv = unpack_request(&header, data);
+	if (new_argv != NULL) {
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(conn);
+			*argc = (int)header.argc;
+			*argv = new_argv;
+			return;
+		}
+
+		int wstatus;
+		if (pid > 0 && waitpid(pid, &wstatus, 0) == pid && WIFEXITED(wstatus))
+			status = WEXITSTATUS(wstatus);
+	}
+
+	write_all(conn, &status, sizeof(status));
+	_exit(status);
+}
+
+/**
+ * Checks that the client of the connection @p conn runs as the same user as
+ * the server, which compiles with its own rights.
+ */
+static bool is_same_user(int conn)
+{
+	uid_t uid;
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t    len = sizeof(cred);
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+		return false;
+	uid = cred.uid;
+#else
+	gid_t gid;
+	if (getpeereid(conn, &uid, &gid) != 0)
+		return false;
+#endif
+	return uid == geteuid();
+}
+
+bool compile_server_run(const char *path, int *argc, char ***argv)
+{
+	struct sockaddr_un addr;
+	if (!fill_address(&addr, path)) {
+		fprintf(stderr, "error: socket path '%s' is too long\n", path);
+		return false;
+	}
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		fprintf(stderr, "error: could not create socket: %s\n",
+		        strerror(errno));
+		return false;
+	}
+	unlink(path);
+	/* only the user of the server may connect */
+	mode_t old_mask = umask(0177);
+	int    res      = bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+	umask(old_mask);
+	if (res != 0 || chmod(path, 0600) != 0 || listen(sock, SOMAXCONN) != 0) {
+		fprintf(stderr, "error: could not listen on '%s': %s\n", path,
+		        strerror(errno));
+		close(sock);
+		return false;
+	}
+
+	/* connection handlers are never waited for */
+	signal(SIGCHLD, SIG_IGN);
+
+	for (;;) {
+		int conn = accept(sock, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "error: accepting connection failed: %s\n",
+			        strerror(errno));
+			close(sock);
+			return false;
+		}
+		if (!is_same_user(conn)) {
+			fprintf(stderr, "warning: rejected connection of another user\n");
+			close(conn);
+			continue;
+		}
+
+		fflush(stdout);
+		fflush(stderr);
+		pid_t pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "error: could not create process: %s\n",
+			        strerror(errno));
+		} else if (pid == 0) {
+			close(sock);
+			handle_connection(conn, argc, argv);
+			return true;
+		}
+		close(conn);
+	}
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef COMPILE_SERVER_H
+#define COMPILE_SERVER_H
+
+#include <stdbool.h>
+
+/**
+ * Run as a compile server listening on the unix socket @p path.
+ *
+ * The server only returns in a process created for a single compile
+ * request: *argc and *argv are replaced by the command line of the request,
+ * the working directory, environment and standard file descriptors are the
+ * ones of the requesting client. The caller continues like a normal
+ * compiler invocation from there, its exit status is reported back to the
+ * client. Everything initialized before calling this is shared by all
+ * requests without being set up again.
+ *
+ * @return false if the server could not be started (an error has been
+ *         printed then)
+ */
+bool compile_server_run(const char *path, int *argc, char ***argv);
+
+/**
+ * Hand the compilation described by @p argc and @p argv to the server
+ * listening on @p path.
+ *
+ * @return true if the server handled the request, *result is the exit
+ *         status of the compilation then. false if no server could be
+ *         reached, the caller should compile on its own.
+ */
+bool compile_server_request(const char *path, int argc, char **argv,
+                            int *result);
+
+#endif
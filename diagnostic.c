@@ -37,6 +37,8 @@ unsigned error_count             = 0;
 unsigned warning_count           = 0;
 bool     show_column             = true;
 bool     diagnostics_show_option = true;
+THREAD_LOCAL bool     mute_diagnostics;
+THREAD_LOCAL unsigned muted_diagnostic_count;
 
 static const source_position_t *curr_pos = NULL;
 
@@ -45,11 +47,13 @@ static const source_position_t *curr_pos = NULL;
  */
 static void print_source_position(FILE *out, const source_position_t *pos)
 {
-	fprintf(out, "at line %u", pos->lineno);
+	decoded_position_t const p = decode_position(*pos);
+	fprintf(out, "at line %u", p.lineno);
 	if (show_column)
-		fprintf(out, ":%u", (unsigned)pos->colno);
-	if (curr_pos == NULL || curr_pos->input_name != pos->input_name)
-		fprintf(out, " of \"%s\"", pos->input_name);
+		fprintf(out, ":%u", (unsigned)p.colno);
+	if (curr_pos == NULL
+	    || decode_position(*curr_pos).input_name != p.input_name)
+		fprintf(out, " of \"%s\"", p.input_name);
 }
 
 /**
@@ -203,6 +207,11 @@ static void diagnosticvf(const char *const fmt, va_list ap)
 
 void diagnosticf(const char *const fmt, ...)
 {
+	if (UNLIKELY(mute_diagnostics)) {
+		++muted_diagnostic_count;
+		return;
+	}
+
 	va_list ap;
 	va_start(ap, fmt);
 	++diagnostic_count;
@@ -214,9 +223,10 @@ void diagnosticf(const char *const fmt, ...)
 static void diagnosticposvf(source_position_t const *const pos, char const *const kind, char const *const fmt, va_list ap)
 {
 	FILE *const out = stderr;
-	fprintf(out, "%s:%u:", pos->input_name, pos->lineno);
+	decoded_position_t const p = decode_position(*pos);
+	fprintf(out, "%s:%u:", p.input_name, p.lineno);
 	if (show_column)
-		fprintf(out, "%u:", (unsigned)pos->colno);
+		fprintf(out, "%u:", (unsigned)p.colno);
 	fprintf(out, " %s: ", kind);
 	curr_pos = pos;
 	diagnosticvf(fmt, ap);
@@ -235,6 +245,11 @@ static void errorvf(const source_position_t *pos,
 
 void errorf(const source_position_t *pos, const char *const fmt, ...)
 {
+	if (UNLIKELY(mute_diagnostics)) {
+		++muted_diagnostic_count;
+		return;
+	}
+
 	va_list ap;
 	va_start(ap, fmt);
 	errorvf(pos, fmt, ap);
@@ -243,9 +258,15 @@ void errorf(const source_position_t *pos, const char *const fmt, ...)
 
 void warningf(warning_t const warn, source_position_t const* pos, char const *const fmt, ...)
 {
+	warning_switch_t const *const s = get_warn_switch(warn);
+	if (UNLIKELY(mute_diagnostics)) {
+		if (s->state & WARN_STATE_ON)
+			++muted_diagnostic_count;
+		return;
+	}
+
 	va_list ap;
 	va_start(ap, fmt);
-	warning_switch_t const *const s = get_warn_switch(warn);
 	switch ((unsigned) s->state) {
 			char const* kind;
 		case WARN_STATE_ON:
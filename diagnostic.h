@@ -23,6 +23,7 @@
 #include <stdbool.h>
 #include "token_t.h"
 #include "warning.h"
+#include "adt/util.h"
 
 /* define a NORETURN attribute */
 #ifndef NORETURN
@@ -69,4 +70,12 @@ extern unsigned warning_count;
 extern bool     show_column;             /**< Show column in diagnostic messages */
 extern bool     diagnostics_show_option; /**< Show the switch, which controls a warning. */
 
+/**
+ * While set, the diagnostics of the calling thread are not printed but only
+ * counted in muted_diagnostic_count.  Helper threads use this for work which
+ * is repeated on the main thread if anything was reported.
+ */
+extern THREAD_LOCAL bool     mute_diagnostics;
+extern THREAD_LOCAL unsigned muted_diagnostic_count;
+
 #endif
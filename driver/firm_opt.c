@@ -16,8 +16,11 @@
 #include "firm_opt.h"
 #include "firm_timing.h"
 #include "ast2firm.h"
+#include "adt/array.h"
+#include "adt/error.h"
 #include "adt/strutil.h"
 #include "adt/util.h"
+#include "adt/xmalloc.h"
 
 /* optimization settings */
 struct a_firm_opt {
@@ -56,6 +59,7 @@ struct a_firm_dump {
 	bool statistic;     /**< Firm statistic setting */
 	bool stat_pattern;  /**< enable Firm statistic pattern */
 	bool stat_dag;      /**< enable Firm DAG statistic */
+	bool pass_stats;    /**< report time and node counts per pass */
 };
 
 struct a_firm_be_opt {
@@ -90,6 +94,7 @@ static struct a_firm_dump firm_dump = {
 	.statistic    = STAT_NONE,
 	.stat_pattern = 0,
 	.stat_dag     = 0,
+	.pass_stats   = false,
 };
 
 #define X(a)  a, sizeof(a)-1
@@ -147,6 +152,7 @@ static const struct params {
   { X("stat-final"),             &firm_dump.statistic,       STAT_FINAL,       "Firm statistic after code generation" },
   { X("stat-pattern"),           &firm_dump.stat_pattern,    1, "Firm statistic calculates most used pattern" },
   { X("stat-dag"),               &firm_dump.stat_dag,        1, "Firm calculates DAG statistics" },
+  { X("pass-stats"),             &firm_dump.pass_stats,      1, "report time and node count changes of the optimization passes" },
 };
 
 #undef X
@@ -346,6 +352,10 @@ typedef struct {
 	const char   *description;
 	opt_flags_t   flags;
 	ir_timer_t   *timer;
+	/* collected with -fpass-stats */
+	unsigned      n_runs;      /**< number of times the pass ran */
+	unsigned long usec;        /**< time spent in the pass */
+	long          node_delta;  /**< change of the node count */
 } opt_config_t;
 
 static opt_config_t opts[] = {
@@ -416,6 +426,144 @@ static bool get_opt_enabled(const char *name)
 	return (config->flags & OPT_FLAG_ENABLED) != 0;
 }
 
+/**
+ * Per graph statistics collected with -fpass-stats.  They are kept by the
+ * linker name of the graph's entity, as passes free graphs and entities,
+ * whose memory may be reused by new ones.
+ */
+typedef struct graph_stats_t {
+	ident          *id;
+	const char     *name;
+	unsigned long   usec;         /**< time spent in optimizations */
+	unsigned        nodes_first;  /**< nodes before the first optimization */
+	unsigned        nodes_last;   /**< nodes after the last optimization */
+} graph_stats_t;
+
+/** Number of passes and graphs shown in the pass statistics. */
+#define PASS_STATS_TOP 10
+
+static graph_stats_t *graph_stats;
+static size_t         last_graph_stats;
+static ir_timer_t    *t_pass;
+
+static void count_node(ir_node *node, void *env)
+{
+	unsigned *n_nodes = (unsigned*)env;
+	(void) node;
+	++*n_nodes;
+}
+
+static unsigned count_graph_nodes(ir_graph *irg)
+{
+	unsigned n_nodes = 0;
+	irg_walk_graph(irg, count_node, NULL, &n_nodes);
+	return n_nodes;
+}
+
+static unsigned count_irp_nodes(void)
+{
+	unsigned n_nodes = 0;
+	for (int i = get_irp_n_irgs() - 1; i >= 0; --i) {
+		n_nodes += count_graph_nodes(get_irp_irg(i));
+	}
+	return n_nodes;
+}
+
+static void start_pass_stats(void)
+{
+	ir_timer_reset(t_pass);
+	ir_timer_start(t_pass);
+}
+
+static unsigned long stop_pass_stats(opt_config_t *config, unsigned nodes_before,
+                                     unsigned nodes_after)
+{
+	ir_timer_stop(t_pass);
+	unsigned long usec = ir_timer_elapsed_usec(t_pass);
+
+	++config->n_runs;
+	config->usec       += usec;
+	config->node_delta += (long)nodes_after - (long)nodes_before;
+	return usec;
+}
+
+static graph_stats_t *get_graph_stats(ir_graph *irg, unsigned n_nodes)
+{
+	if (graph_stats == NULL)
+		graph_stats = NEW_ARR_F(graph_stats_t, 0);
+
+	/* passes run graph by graph, so this is nearly always the last one */
+	ident *const id = get_entity_ld_ident(get_irg_entity(irg));
+	size_t       n  = ARR_LEN(graph_stats);
+	if (last_graph_stats < n && graph_stats[last_graph_stats].id == id)
+		return &graph_stats[last_graph_stats];
+	for (size_t i = 0; i < n; ++i) {
+		if (graph_stats[i].id == id) {
+			last_graph_stats = i;
+			return &graph_stats[i];
+		}
+	}
+
+	graph_stats_t stats;
+	stats.id          = id;
+	stats.name        = get_id_str(id);
+	stats.usec        = 0;
+	stats.nodes_first = n_nodes;
+	stats.nodes_last  = n_nodes;
+	ARR_APP1(graph_stats_t, graph_stats, stats);
+	last_graph_stats = n;
+	return &graph_stats[n];
+}
+
+static int cmp_pass_usec(const void *a, const void *b)
+{
+	const opt_config_t *const config_a = *(const opt_config_t *const*)a;
+	const opt_config_t *const config_b = *(const opt_config_t *const*)b;
+	return (config_a->usec < config_b->usec) - (config_a->usec > config_b->usec);
+}
+
+static int cmp_graph_usec(const void *a, const void *b)
+{
+	const graph_stats_t *const stats_a = (const graph_stats_t*)a;
+	const graph_stats_t *const stats_b = (const graph_stats_t*)b;
+	return (stats_a->usec < stats_b->usec) - (stats_a->usec > stats_b->usec);
+}
+
+static void print_pass_stats(FILE *f)
+{
+	opt_config_t *passes[lengthof(opts)];
+	size_t        n_passes = 0;
+	FOR_EACH_OPT(config) {
+		if (config->n_runs > 0)
+			passes[n_passes++] = config;
+	}
+	qsort(passes, n_passes, sizeof(passes[0]), cmp_pass_usec);
+
+	fprintf(f, "%-20s %8s %12s %10s\n", "pass", "runs", "msec", "nodes");
+	for (size_t i = 0; i < n_passes && i < PASS_STATS_TOP; ++i) {
+		const opt_config_t *config = passes[i];
+		fprintf(f, "%-20s %8u %12.3f %+10ld\n", config->name, config->n_runs,
+		        config->usec / 1000.0, config->node_delta);
+	}
+
+	if (graph_stats == NULL)
+		return;
+
+	size_t n_graphs = ARR_LEN(graph_stats);
+	qsort(graph_stats, n_graphs, sizeof(graph_stats[0]), cmp_graph_usec);
+
+	fprintf(f, "\n%-40s %12s %10s %10s\n", "function", "msec", "nodes",
+	        "after");
+	for (size_t i = 0; i < n_graphs && i < PASS_STATS_TOP; ++i) {
+		const graph_stats_t *stats = &graph_stats[i];
+		fprintf(f, "%-40s %12.3f %10u %10u\n", stats->name,
+		        stats->usec / 1000.0, stats->nodes_first, stats->nodes_last);
+	}
+
+	DEL_ARR_F(graph_stats);
+	graph_stats = NULL;
+}
+
 /**
  * perform an optimization on a single graph
  *
@@ -432,10 +580,22 @@ static bool do_irg_opt(ir_graph *irg, const char *name)
 	ir_graph *const old_irg = current_ir_graph;
 	current_ir_graph = irg;
 
+	unsigned nodes_before = 0;
+	if (firm_dump.pass_stats) {
+		nodes_before = count_graph_nodes(irg);
+		start_pass_stats();
+	}
+
 	timer_push(config->timer);
 	config->u.transform_irg(irg);
 	timer_pop(config->timer);
 
+	if (firm_dump.pass_stats) {
+		graph_stats_t *stats = get_graph_stats(irg, nodes_before);
+		stats->nodes_last    = count_graph_nodes(irg);
+		stats->usec += stop_pass_stats(config, nodes_before, stats->nodes_last);
+	}
+
 	if (firm_dump.all_phases && firm_dump.ir_graph) {
 		dump_ir_graph(irg, name);
 	}
@@ -457,10 +617,21 @@ static void do_irp_opt(const char *name)
 	if (! (config->flags & OPT_FLAG_ENABLED))
 		return;
 
+	unsigned nodes_before = 0;
+	if (firm_dump.pass_stats) {
+		nodes_before = count_irp_nodes();
+		start_pass_stats();
+	}
+
 	timer_push(config->timer);
 	config->u.transform_irp();
 	timer_pop(config->timer);
 
+	if (firm_dump.pass_stats) {
+		/* the time is not attributed to single graphs here */
+		stop_pass_stats(config, nodes_before, count_irp_nodes());
+	}
+
 	if (firm_dump.ir_graph && firm_dump.all_phases) {
 		int i;
 		for (i = get_irp_n_irgs() - 1; i >= 0; --i) {
@@ -708,6 +879,250 @@ static void do_firm_lowering(const char *input_filename)
 	}
 }
 
+static void replace_symconst_entity(ir_node *node, void *env)
+{
+	(void) env;
+	if (!is_SymConst_addr_ent(node))
+		return;
+
+	ir_entity *replacement = (ir_entity*)get_entity_link(get_SymConst_entity(node));
+	if (replacement != NULL)
+		set_SymConst_entity(node, replacement);
+}
+
+static void replace_initializer_entities(ir_initializer_t *initializer)
+{
+	switch (get_initializer_kind(initializer)) {
+	case IR_INITIALIZER_CONST:
+		irg_walk(get_initializer_const_value(initializer),
+		         replace_symconst_entity, NULL, NULL);
+		return;
+	case IR_INITIALIZER_TARVAL:
+	case IR_INITIALIZER_NULL:
+		return;
+	case IR_INITIALIZER_COMPOUND: {
+		size_t n = get_initializer_compound_n_entries(initializer);
+		for (size_t i = 0; i < n; ++i) {
+			replace_initializer_entities(
+				get_initializer_compound_value(initializer, i));
+		}
+		return;
+	}
+	}
+	panic("invalid initializer kind");
+}
+
+/**
+ * An entity of the imported files.  Files are imported one after another and
+ * each appends its entities to the segments, so the position in which the
+ * entities are collected is the order of their files.
+ */
+typedef struct imported_entity_t {
+	ir_entity *entity;
+	size_t     import_order;
+} imported_entity_t;
+
+static void append_imported_entity(imported_entity_t **entities,
+                                   ir_entity *entity)
+{
+	imported_entity_t imported;
+	imported.entity       = entity;
+	imported.import_order = ARR_LEN(*entities);
+	ARR_APP1(imported_entity_t, *entities, imported);
+}
+
+/**
+ * Groups entities by linker name, entities of the same name stay in import
+ * order, so the first file wins as with ld.
+ */
+static int cmp_imported_entity(const void *a, const void *b)
+{
+	const imported_entity_t *const imported_a = (const imported_entity_t*)a;
+	const imported_entity_t *const imported_b = (const imported_entity_t*)b;
+	const ident *const id_a = get_entity_ld_ident(imported_a->entity);
+	const ident *const id_b = get_entity_ld_ident(imported_b->entity);
+	if (id_a != id_b)
+		return (id_a > id_b) - (id_a < id_b);
+	size_t const order_a = imported_a->import_order;
+	size_t const order_b = imported_b->import_order;
+	return (order_a > order_b) - (order_a < order_b);
+}
+
+static bool is_strong_definition(const ir_entity *entity)
+{
+	return get_entity_visibility(entity) != ir_visibility_external
+	    && !(get_entity_linkage(entity) & (IR_LINKAGE_WEAK | IR_LINKAGE_MERGE));
+}
+
+static const ir_segment_t linked_segments[] = {
+	IR_SEGMENT_GLOBAL, IR_SEGMENT_THREAD_LOCAL,
+	IR_SEGMENT_CONSTRUCTORS, IR_SEGMENT_DESTRUCTORS
+};
+
+/** Checks whether @p entity is only visible inside its own file. */
+static bool is_file_local(const ir_entity *entity)
+{
+	ir_visibility const visibility = get_entity_visibility(entity);
+	return visibility == ir_visibility_local
+	    || visibility == ir_visibility_private;
+}
+
+/**
+ * Gives the local entity @p entity a new unique linker name derived from
+ * its current one.
+ */
+static void make_ld_ident_unique(ir_entity *entity)
+{
+	/* the name becomes part of the format of id_unique() */
+	const char *name = get_id_str(get_entity_ld_ident(entity));
+	char       *tag  = XMALLOCN(char, 2 * strlen(name) + sizeof(".%u"));
+	char       *dst  = tag;
+	for (const char *c = name; *c != '\0'; ++c) {
+		if (*c == '%')
+			*dst++ = '%';
+		*dst++ = *c;
+	}
+	memcpy(dst, ".%u", sizeof(".%u"));
+	set_entity_ld_ident(entity, id_unique(tag));
+	xfree(tag);
+}
+
+/**
+ * Renames local and private entities of several files sharing a linker name
+ * with another entity, e.g. static variables of the same name or string
+ * constants.  The code generator needs a distinct name for each of them.
+ */
+static void rename_colliding_local_entities(void)
+{
+	imported_entity_t *entities = NEW_ARR_F(imported_entity_t, 0);
+	for (size_t s = 0; s != lengthof(linked_segments); ++s) {
+		ir_type *segment = get_segment_type(linked_segments[s]);
+		for (size_t i = 0, n = get_compound_n_members(segment); i < n; ++i) {
+			append_imported_entity(&entities, get_compound_member(segment, i));
+		}
+	}
+	size_t n_entities = ARR_LEN(entities);
+	qsort(entities, n_entities, sizeof(entities[0]), cmp_imported_entity);
+
+	for (size_t begin = 0, end; begin < n_entities; begin = end) {
+		ident *id = get_entity_ld_ident(entities[begin].entity);
+		for (end = begin + 1; end < n_entities
+		     && get_entity_ld_ident(entities[end].entity) == id; ++end) {
+		}
+		if (end - begin == 1)
+			continue;
+
+		/* the name stays with a nonlocal entity, else with the one of the
+		 * first file */
+		bool keep_first = true;
+		for (size_t i = begin; i < end; ++i) {
+			if (!is_file_local(entities[i].entity))
+				keep_first = false;
+		}
+		for (size_t i = begin; i < end; ++i) {
+			ir_entity *entity = entities[i].entity;
+			if (!is_file_local(entity))
+				continue;
+			if (keep_first) {
+				keep_first = false;
+				continue;
+			}
+			make_ld_ident_unique(entity);
+		}
+	}
+	DEL_ARR_F(entities);
+}
+
+bool link_imported_entities(void)
+{
+	rename_colliding_local_entities();
+
+	/* every file brings its own entity for a symbol it uses, only the
+	 * nonlocal ones of the same name get merged */
+	imported_entity_t *entities = NEW_ARR_F(imported_entity_t, 0);
+	for (size_t s = 0; s != lengthof(linked_segments); ++s) {
+		ir_type *segment = get_segment_type(linked_segments[s]);
+		for (size_t i = 0, n = get_compound_n_members(segment); i < n; ++i) {
+			ir_entity *member = get_compound_member(segment, i);
+			set_entity_link(member, NULL);
+			if (!is_file_local(member)
+			    && (linked_segments[s] == IR_SEGMENT_GLOBAL
+			        || linked_segments[s] == IR_SEGMENT_THREAD_LOCAL))
+				append_imported_entity(&entities, member);
+		}
+	}
+	size_t n_entities = ARR_LEN(entities);
+	qsort(entities, n_entities, sizeof(entities[0]), cmp_imported_entity);
+
+	bool        ok        = true;
+	ir_entity **discarded = NEW_ARR_F(ir_entity*, 0);
+	for (size_t begin = 0, end; begin < n_entities; begin = end) {
+		ident *id = get_entity_ld_ident(entities[begin].entity);
+		for (end = begin + 1; end < n_entities
+		     && get_entity_ld_ident(entities[end].entity) == id; ++end) {
+		}
+		if (end - begin == 1)
+			continue;
+
+		/* prefer a strong definition, then the definition of the first
+		 * file */
+		ir_entity *chosen = NULL;
+		for (size_t i = begin; i < end; ++i) {
+			ir_entity *entity = entities[i].entity;
+			if (!is_strong_definition(entity))
+				continue;
+			if (chosen != NULL) {
+				fprintf(stderr, "error: multiple definitions of '%s'\n",
+				        get_id_str(id));
+				ok = false;
+			}
+			chosen = entity;
+		}
+		for (size_t i = begin; i < end && chosen == NULL; ++i) {
+			if (get_entity_visibility(entities[i].entity) != ir_visibility_external)
+				chosen = entities[i].entity;
+		}
+		if (chosen == NULL)
+			chosen = entities[begin].entity;
+
+		for (size_t i = begin; i < end; ++i) {
+			ir_entity *entity = entities[i].entity;
+			if (entity == chosen)
+				continue;
+			set_entity_link(entity, chosen);
+			/* a second weak definition must not be emitted */
+			if (get_entity_visibility(entity) != ir_visibility_external)
+				ARR_APP1(ir_entity*, discarded, entity);
+		}
+	}
+	DEL_ARR_F(entities);
+
+	if (ok) {
+		for (size_t i = 0, n = get_irp_n_irgs(); i < n; ++i) {
+			irg_walk_graph(get_irp_irg(i), replace_symconst_entity, NULL, NULL);
+		}
+		for (size_t s = 0; s != lengthof(linked_segments); ++s) {
+			ir_type *segment = get_segment_type(linked_segments[s]);
+			for (size_t i = 0, n = get_compound_n_members(segment); i < n; ++i) {
+				ir_entity *member = get_compound_member(segment, i);
+				if (get_entity_initializer(member) != NULL)
+					replace_initializer_entities(get_entity_initializer(member));
+			}
+		}
+
+		for (size_t i = 0, n = ARR_LEN(discarded); i < n; ++i) {
+			ir_entity *entity = discarded[i];
+			ir_graph  *irg    = get_entity_irg(entity);
+			if (irg != NULL)
+				free_ir_graph(irg);
+			remove_compound_member(get_entity_owner(entity), entity);
+			free_entity(entity);
+		}
+	}
+	DEL_ARR_F(discarded);
+	return ok;
+}
+
 /**
  * Initialize for the Firm-generating back end.
  */
@@ -728,6 +1143,7 @@ void gen_firm_init(void)
 	timer_register(t_all_opt, "Firm: all optimizations");
 	t_backend = ir_timer_new();
 	timer_register(t_backend, "Firm: backend");
+	t_pass = ir_timer_new();
 }
 
 static void init_statistics(void)
@@ -806,6 +1222,9 @@ void generate_code(FILE *out, const char *input_filename)
 	if (firm_dump.statistic & STAT_FINAL_IR)
 		stat_dump_snapshot(input_filename, "final-ir");
 
+	if (firm_dump.pass_stats)
+		print_pass_stats(stderr);
+
 	/* run the code generator */
 	timer_start(t_backend);
 	be_main(out, input_filename);
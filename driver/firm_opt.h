@@ -1,6 +1,7 @@
 #ifndef FIRM_OPT_H
 #define FIRM_OPT_H
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <libfirm/firm_types.h>
 #include <libfirm/dbginfo.h>
@@ -107,6 +108,15 @@ void gen_firm_finish(void);
  */
 void generate_code(FILE *out, const char *input_filename);
 
+/**
+ * Resolve the symbols of several imported IR files against each other:
+ * references to a declaration are redirected to the definition of the same
+ * name, so the whole program can be optimized as one.
+ *
+ * @return false if a symbol has more than one strong definition
+ */
+bool link_imported_entities(void);
+
 /** process optimization commandline option */
 int firm_option(const char *opt);
 
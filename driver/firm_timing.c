@@ -6,31 +6,141 @@
 #include "firm_timing.h"
 
 #include <libfirm/adt/xmalloc.h>
+#include <libfirm/adt/obst.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 static int timers_inited;
 
-typedef struct timer_info_t {
-	struct timer_info_t *next;
-	char                *description;
-	ir_timer_t          *timer;
-} timer_info_t;
+typedef struct timer_info_t timer_info_t;
+struct timer_info_t {
+	timer_info_t *next;
+	char         *description;
+	ir_timer_t   *timer;
+	timer_info_t *parent;         /**< enclosing timer at the first activation */
+	timer_info_t *first_child;
+	timer_info_t *last_child;
+	timer_info_t *next_sibling;
+	unsigned      n_activations;
+	int           fine;           /**< no memory sampling, JSON report only */
+	long          peak_rss;       /**< peak resident set size in KiB */
+	size_t        obstack_bytes;  /**< obstack growth while the timer ran */
+};
+
+/** An active timer together with the memory state when it was entered. */
+typedef struct timer_frame_t {
+	timer_info_t *info;
+	size_t        obstack_bytes;
+} timer_frame_t;
 
-static timer_info_t *infos;
-static timer_info_t *last_info;
+/** Maps a timer to its info, a program may register a timer per function. */
+typedef struct timer_map_entry_t {
+	const ir_timer_t *timer;
+	timer_info_t     *info;
+} timer_map_entry_t;
 
-void timer_register(ir_timer_t *timer, const char *description)
+#define HashSet          timer_map_t
+#define HashSetIterator  timer_map_iterator_t
+#define ValueType        timer_map_entry_t
+#define DO_REHASH
+#include "adt/hashset.h"
+#undef DO_REHASH
+#undef HashSetEntry
+#undef HashSetIterator
+#undef HashSet
+
+typedef struct timer_map_iterator_t  timer_map_iterator_t;
+typedef struct timer_map_t           timer_map_t;
+
+static timer_map_entry_t null_timer_map_entry = { NULL, NULL };
+
+static unsigned hash_ptr(const void *ptr)
+{
+	unsigned ptr_int = ((char*) ptr - (char*) NULL);
+	return ptr_int >> 3;
+}
+
+#define DO_REHASH
+#define HashSet                   timer_map_t
+#define HashSetIterator           timer_map_iterator_t
+#define ValueType                 timer_map_entry_t
+#define NullValue                 null_timer_map_entry
+#define KeyType                   const ir_timer_t*
+#define ConstKeyType              const ir_timer_t*
+#define GetKey(value)             (value).timer
+#define InitData(self,value,key)  (value).timer = (key)
+#define Hash(self,key)            hash_ptr(key)
+#define KeysEqual(self,key1,key2) (key1) == (key2)
+#define SetRangeEmpty(ptr,size)   memset(ptr, 0, (size) * sizeof((ptr)[0]))
+#define EntrySetEmpty(value)      (value).timer = NULL
+#define EntrySetDeleted(value)    (value).timer = (ir_timer_t*) -1
+#define EntryIsEmpty(value)       ((value).timer == NULL)
+#define EntryIsDeleted(value)     ((value).timer == (ir_timer_t*)-1)
+#define Alloc(size)               XMALLOCN(timer_map_entry_t, size)
+#define Free(ptr)                 xfree(ptr)
+
+#define hashset_init            timer_map_init
+#define hashset_init_size       timer_map_init_size
+#define hashset_destroy         timer_map_destroy
+#define hashset_insert          timer_map_insert
+#define hashset_remove          timer_map_remove
+#define hashset_find            timer_map_find
+#define hashset_size            timer_map_size
+#define hashset_iterator_init   timer_map_iterator_init
+#define hashset_iterator_next   timer_map_iterator_next
+#define hashset_remove_iterator timer_map_remove_iterator
+
+#include "adt/hashset.c"
+
+#define MAX_TIMER_DEPTH   64
+#define MAX_OBSTACKS       8
+
+static timer_info_t    *infos;
+static timer_info_t    *last_info;
+static timer_map_t      info_map;
+static timer_frame_t    stack[MAX_TIMER_DEPTH];
+static unsigned         stack_depth;
+static struct obstack  *obstacks[MAX_OBSTACKS];
+static unsigned         n_obstacks;
+
+static void register_info(ir_timer_t *timer, const char *description, int fine)
 {
 	timer_info_t *info = XMALLOCZ(timer_info_t);
 
 	info->description = xstrdup(description);
 	info->timer       = timer;
+	info->fine        = fine;
 
 	if (last_info != NULL) {
 		last_info->next = info;
 	} else {
+		timer_map_init(&info_map);
 		infos = info;
 	}
 	last_info = info;
+
+	/* a timer registered twice keeps its first info */
+	timer_map_entry_t *entry = timer_map_insert(&info_map, timer);
+	if (entry->info == NULL)
+		entry->info = info;
+}
+
+void timer_register(ir_timer_t *timer, const char *description)
+{
+	register_info(timer, description, 0);
+}
+
+void timer_register_fine(ir_timer_t *timer, const char *description)
+{
+	register_info(timer, description, 1);
+}
+
+void timer_watch_obstack(struct obstack *obst)
+{
+	if (n_obstacks < MAX_OBSTACKS)
+		obstacks[n_obstacks++] = obst;
 }
 
 void timer_init(void)
@@ -38,49 +148,230 @@ void timer_init(void)
 	timers_inited = 1;
 }
 
-void timer_term(FILE *f)
+int timers_enabled(void)
+{
+	return timers_inited;
+}
+
+static timer_info_t *find_info(const ir_timer_t *timer)
+{
+	if (infos == NULL)
+		return NULL;
+	return timer_map_find(&info_map, timer)->info;
+}
+
+static long get_peak_rss(void)
+{
+#ifndef _WIN32
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		return usage.ru_maxrss;
+#endif
+	return 0;
+}
+
+static size_t get_obstack_bytes(void)
+{
+	size_t bytes = 0;
+	for (unsigned i = 0; i < n_obstacks; ++i) {
+		bytes += obstack_memory_used(obstacks[i]);
+	}
+	return bytes;
+}
+
+static void enter_timer(ir_timer_t *timer)
+{
+	timer_info_t *info = find_info(timer);
+	if (info == NULL || stack_depth >= MAX_TIMER_DEPTH)
+		return;
+
+	if (info->n_activations++ == 0 && stack_depth > 0) {
+		timer_info_t *parent = stack[stack_depth - 1].info;
+		info->parent = parent;
+		if (parent->last_child != NULL) {
+			parent->last_child->next_sibling = info;
+		} else {
+			parent->first_child = info;
+		}
+		parent->last_child = info;
+	}
+
+	timer_frame_t *frame = &stack[stack_depth++];
+	frame->info          = info;
+	frame->obstack_bytes = info->fine ? 0 : get_obstack_bytes();
+}
+
+static void leave_timer(ir_timer_t *timer)
+{
+	if (stack_depth == 0 || stack[stack_depth - 1].info->timer != timer)
+		return;
+
+	timer_frame_t *frame = &stack[--stack_depth];
+	timer_info_t  *info  = frame->info;
+	if (info->fine)
+		return;
+
+	size_t bytes = get_obstack_bytes();
+	if (bytes > frame->obstack_bytes)
+		info->obstack_bytes += bytes - frame->obstack_bytes;
+
+	long rss = get_peak_rss();
+	if (rss > info->peak_rss)
+		info->peak_rss = rss;
+}
+
+static double get_msec(const timer_info_t *info)
+{
+	return (double)ir_timer_elapsed_usec(info->timer) / 1000.0;
+}
+
+static void print_json_string(FILE *f, const char *string)
+{
+	fputc('"', f);
+	for (const char *c = string; *c != '\0'; ++c) {
+		switch (*c) {
+		case '"':  fputs("\\\"", f); break;
+		case '\\': fputs("\\\\", f); break;
+		default:
+			if ((unsigned char)*c < 0x20) {
+				fprintf(f, "\\u%04x", (unsigned char)*c);
+			} else {
+				fputc(*c, f);
+			}
+			break;
+		}
+	}
+	fputc('"', f);
+}
+
+static void print_json_indent(FILE *f, unsigned depth)
+{
+	for (unsigned i = 0; i < depth; ++i) {
+		fputs("  ", f);
+	}
+}
+
+static void print_json_phases(FILE *f, const timer_info_t *first,
+                              unsigned depth);
+
+static void print_json_phase(FILE *f, const timer_info_t *info, unsigned depth)
+{
+	print_json_indent(f, depth);
+	fputs("{ \"name\": ", f);
+	print_json_string(f, info->description);
+	fprintf(f, ", \"msec\": %.3f, \"count\": %u", get_msec(info),
+	        info->n_activations);
+	if (!info->fine) {
+		fprintf(f, ", \"peak_rss_kib\": %ld, \"obstack_bytes\": %lu",
+		        info->peak_rss, (unsigned long)info->obstack_bytes);
+	}
+	if (info->first_child != NULL) {
+		fputs(",\n", f);
+		print_json_indent(f, depth + 1);
+		fputs("\"phases\": [\n", f);
+		print_json_phases(f, info->first_child, depth + 2);
+		print_json_indent(f, depth + 1);
+		fputs("]\n", f);
+		print_json_indent(f, depth);
+		fputs("}", f);
+	} else {
+		fputs(" }", f);
+	}
+}
+
+static void print_json_phases(FILE *f, const timer_info_t *first,
+                              unsigned depth)
+{
+	for (const timer_info_t *info = first; info != NULL;
+	     info = info->next_sibling) {
+		print_json_phase(f, info, depth);
+		fputs(info->next_sibling != NULL ? ",\n" : "\n", f);
+	}
+}
+
+static void print_json(FILE *f)
+{
+	fprintf(f, "{\n  \"peak_rss_kib\": %ld,\n  \"phases\": [\n",
+	        get_peak_rss());
+
+	/* toplevel timers were never nested in another one; timers which were
+	 * never activated are left out */
+	int first = 1;
+	for (const timer_info_t *info = infos; info != NULL; info = info->next) {
+		if (info->parent != NULL || info->n_activations == 0)
+			continue;
+		if (!first)
+			fputs(",\n", f);
+		first = 0;
+		print_json_phase(f, info, 2);
+	}
+	fputs("\n  ]\n}\n", f);
+}
+
+static void print_text(FILE *f)
+{
+	for (const timer_info_t *info = infos; info != NULL; info = info->next) {
+		if (info->fine)
+			continue;
+		fprintf(f, "%-45s %8.3f msec\n", info->description, get_msec(info));
+	}
+}
+
+void timer_term(FILE *f, timer_format_t format)
 {
 	timer_info_t *info;
 	timer_info_t *next;
 
-	for (info = infos; info != NULL; info = next) {
-		ir_timer_t *timer = info->timer;
-		double      val         = (double)ir_timer_elapsed_usec(timer) / 1000.0;
-		const char *description = info->description;
-		fprintf(f, "%-45s %8.3f msec\n", description, val);
+	if (format == TIMER_FORMAT_JSON) {
+		print_json(f);
+	} else {
+		print_text(f);
+	}
 
-		ir_timer_free(timer);
+	for (info = infos; info != NULL; info = next) {
+		ir_timer_free(info->timer);
 		xfree(info->description);
 		next = info->next;
 		xfree(info);
 	}
-	infos = NULL;
-	last_info = NULL;
+	if (infos != NULL)
+		timer_map_destroy(&info_map);
+	infos       = NULL;
+	last_info   = NULL;
+	stack_depth = 0;
+	n_obstacks  = 0;
 
 	timers_inited = 0;
 }
 
 void timer_push(ir_timer_t *timer)
 {
-	if (timers_inited)
+	if (timers_inited) {
 		ir_timer_push(timer);
+		enter_timer(timer);
+	}
 }
 
 void timer_pop(ir_timer_t *timer)
 {
-	(void) timer;
-	if (timers_inited)
+	if (timers_inited) {
 		ir_timer_pop();
+		leave_timer(timer);
+	}
 }
 
 void timer_start(ir_timer_t *timer)
 {
-	if (timers_inited)
+	if (timers_inited) {
 		ir_timer_start(timer);
+		enter_timer(timer);
+	}
 }
 
 void timer_stop(ir_timer_t *timer)
 {
-	if (timers_inited)
+	if (timers_inited) {
 		ir_timer_stop(timer);
+		leave_timer(timer);
+	}
 }
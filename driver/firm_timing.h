@@ -9,9 +9,25 @@
 #include <stdio.h>
 #include <libfirm/timing.h>
 
+struct obstack;
+
+typedef enum timer_format_t {
+	TIMER_FORMAT_TEXT, /**< flat "description msec" lines */
+	TIMER_FORMAT_JSON, /**< phase tree with memory usage */
+} timer_format_t;
+
 void timer_init(void);
+int  timers_enabled(void);
 void timer_register(ir_timer_t *timer, const char *description);
-void timer_term(FILE *f);
+/**
+ * Register a timer which is activated very often or in great numbers (per
+ * token, per function). It is only shown in the JSON report and does not
+ * sample memory usage.
+ */
+void timer_register_fine(ir_timer_t *timer, const char *description);
+/** Attribute the growth of @p obst to the running timers. */
+void timer_watch_obstack(struct obstack *obst);
+void timer_term(FILE *f, timer_format_t format);
 void timer_push(ir_timer_t *timer);
 void timer_pop(ir_timer_t *timer);
 void timer_start(ir_timer_t *timer);
@@ -228,7 +228,9 @@ struct variable_t {
 	bool              address_taken  : 1;  /**< Set if the address of this declaration was taken. */
 	bool              read           : 1;
 	unsigned          elf_visibility : 2;
+	bool              plinc_compress : 1;  /**< PLINC transfers of this variable are compressed. */
 
+	il_size_t         plinc_compress_threshold; /**< Messages smaller than this are sent uncompressed. */
 	initializer_t    *initializer;
 
 	/* ast2firm info */
@@ -1,30 +1,44 @@
 #include "config.h"
 
+#define _GNU_SOURCE
+
 #include "input.h"
 
 #include <ctype.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "lexer.h"
 #include "diagnostic.h"
+#include "adt/util.h"
 
 typedef size_t (*decode_func)(input_t *input, utf32 *buffer, size_t buffer_size);
 
+#define INPUT_BLOCK_SIZE 4096
+
 typedef enum {
 	INPUT_FILE,
-	INPUT_STRING
+	INPUT_BUFFER,
+	INPUT_MAPPED
 } input_kind_t;
 
 struct input_t {
 	input_kind_t kind;
 	union {
 		FILE *file;
-		const char *string;
+		struct {
+			const unsigned char *pos;
+			const unsigned char *end;
+			const unsigned char *begin; /**< start of the mapping */
+		} buffer;
 	} in;
-	decode_func decode;
+	decode_func decode;  /**< NULL if the input is UTF-8 already */
 
-	/* state for utf-8 decoder */
-	utf32  utf8_part_decoded_min_code;
-	utf32  utf8_part_decoded_char;
-	size_t utf8_part_decoded_rest_len;
+	/* staging area for streams and inputs in other encodings */
+	unsigned char block[INPUT_BLOCK_SIZE];
+	size_t        block_len;
+	size_t        block_rest;  /**< incomplete character at the block end */
 };
 
 static input_error_callback_func input_error;
@@ -34,12 +48,17 @@ void set_input_error_callback(input_error_callback_func new_func)
 	input_error = new_func;
 }
 
+/**
+ * Provides the next block of at most @p n bytes in @p *block.  Streams are
+ * read into @p read_buf, buffers are handed out directly.
+ */
 static size_t read_block(input_t *input, unsigned char *const read_buf,
-                         size_t const n)
+                         size_t const n, unsigned char const **const block)
 {
 	if (input->kind == INPUT_FILE) {
 		FILE *file = input->in.file;
 		size_t const s = fread(read_buf, 1, n, file);
+		*block = read_buf;
 		if (s == 0) {
 			/* on OS/X ferror appears to return true on eof as well when running
 			 * the application in gdb... */
@@ -49,12 +68,12 @@ static size_t read_block(input_t *input, unsigned char *const read_buf,
 		}
 		return s;
 	} else {
-		assert(input->kind == INPUT_STRING);
-		size_t len = strlen(input->in.string);
+		assert(input->kind == INPUT_BUFFER || input->kind == INPUT_MAPPED);
+		size_t len = input->in.buffer.end - input->in.buffer.pos;
 		if (len > n)
 			len = n;
-		memcpy(read_buf, input->in.string, len);
-		input->in.string += len;
+		*block = input->in.buffer.pos;
+		input->in.buffer.pos += len;
 		return len;
 	}
 }
@@ -62,11 +81,10 @@ static size_t read_block(input_t *input, unsigned char *const read_buf,
 static size_t decode_iso_8859_1(input_t *input, utf32 *buffer,
                                 size_t buffer_size)
 {
-	unsigned char read_buf[buffer_size];
-	size_t const s = read_block(input, read_buf, sizeof(read_buf));
-
-	unsigned char const *src = read_buf;
-	unsigned char const *end = read_buf + s;
+	unsigned char        read_buf[buffer_size];
+	unsigned char const *src;
+	size_t const         s   = read_block(input, read_buf, sizeof(read_buf), &src);
+	unsigned char const *end = src + s;
 	utf32               *dst = buffer;
 	while (src != end)
 		*dst++ = *src++;
@@ -77,11 +95,10 @@ static size_t decode_iso_8859_1(input_t *input, utf32 *buffer,
 static size_t decode_iso_8859_15(input_t *input, utf32 *buffer,
                                  size_t buffer_size)
 {
-	unsigned char read_buf[buffer_size];
-	size_t const s = read_block(input, read_buf, sizeof(read_buf));
-
-	unsigned char const *src = read_buf;
-	unsigned char const *end = read_buf + s;
+	unsigned char        read_buf[buffer_size];
+	unsigned char const *src;
+	size_t const         s   = read_block(input, read_buf, sizeof(read_buf), &src);
+	unsigned char const *end = src + s;
 	utf32               *dst = buffer;
 	while (src != end) {
 		utf32 tc = *src++;
@@ -101,124 +118,13 @@ static size_t decode_iso_8859_15(input_t *input, utf32 *buffer,
 	return s;
 }
 
-static size_t decode_utf8(input_t *input, utf32 *buffer, size_t buffer_size)
-{
-	unsigned char read_buf[buffer_size];
-
-	while (true) {
-		size_t const s = read_block(input, read_buf, sizeof(read_buf));
-		if (s == 0) {
-			if (input->utf8_part_decoded_rest_len > 0)
-				input_error(0, 0, "incomplete input char at end of input");
-			return 0;
-		}
-
-		unsigned char const *src = read_buf;
-		unsigned char const *end = read_buf + s;
-		utf32               *dst = buffer;
-		utf32                decoded;
-		utf32                min_code;
-
-		if (input->utf8_part_decoded_rest_len != 0) {
-			min_code              = input->utf8_part_decoded_min_code;
-			decoded               = input->utf8_part_decoded_char;
-			size_t const rest_len = input->utf8_part_decoded_rest_len;
-			input->utf8_part_decoded_rest_len = 0;
-			switch (rest_len) {
-				case 4:  goto realign;
-				case 3:  goto three_more;
-				case 2:  goto two_more;
-				default: goto one_more;
-			}
-		}
-
-		while (src != end) {
-			if ((*src & 0x80) == 0) {
-				decoded = *src++;
-			} else if ((*src & 0xE0) == 0xC0) {
-				min_code = 0x80;
-				decoded  = *src++ & 0x1F;
-one_more:
-				if (src == end) {
-					input->utf8_part_decoded_min_code = min_code;
-					input->utf8_part_decoded_char     = decoded;
-					input->utf8_part_decoded_rest_len = 1;
-					break;
-				}
-				if ((*src & 0xC0) == 0x80) {
-					decoded = (decoded << 6) | (*src++ & 0x3F);
-				} else {
-					goto invalid_char;
-				}
-				if (decoded < min_code                      ||
-						decoded > 0x10FFFF                      ||
-						(0xD800 <= decoded && decoded < 0xE000) || // high/low surrogates
-						(0xFDD0 <= decoded && decoded < 0xFDF0) || // noncharacters
-						(decoded & 0xFFFE) == 0xFFFE) {            // noncharacters
-					input_error(0, 0, "invalid byte sequence in input");
-				}
-			} else if ((*src & 0xF0) == 0xE0) {
-				min_code = 0x800;
-				decoded  = *src++ & 0x0F;
-two_more:
-				if (src == end) {
-					input->utf8_part_decoded_min_code = min_code;
-					input->utf8_part_decoded_char     = decoded;
-					input->utf8_part_decoded_rest_len = 2;
-					break;
-				}
-				if ((*src & 0xC0) == 0x80) {
-					decoded = (decoded << 6) | (*src++ & 0x3F);
-				} else {
-					goto invalid_char;
-				}
-				goto one_more;
-			} else if ((*src & 0xF8) == 0xF0) {
-				min_code = 0x10000;
-				decoded  = *src++ & 0x07;
-three_more:
-				if (src == end) {
-					input->utf8_part_decoded_min_code = min_code;
-					input->utf8_part_decoded_char     = decoded;
-					input->utf8_part_decoded_rest_len = 3;
-					break;
-				}
-				if ((*src & 0xC0) == 0x80) {
-					decoded = (decoded << 6) | (*src++ & 0x3F);
-				} else {
-					goto invalid_char;
-				}
-				goto two_more;
-			} else {
-invalid_char:
-				input_error(0, 0, "invalid byte sequence in input");
-realign:
-				do {
-					++src;
-					if (src == end) {
-						input->utf8_part_decoded_rest_len = 4;
-						break;
-					}
-				} while ((*src & 0xC0) == 0x80 || (*src & 0xF8) == 0xF8);
-				continue;
-			}
-			*dst++ = decoded;
-		}
-
-		/* we're done when we could read more than 1 char */
-		if (buffer != dst)
-			return dst - buffer;
-	}
-}
-
 static size_t decode_windows_1252(input_t *input, utf32 *buffer,
                                   size_t buffer_size)
 {
-	unsigned char read_buf[buffer_size];
-	size_t const s = read_block(input, read_buf, sizeof(read_buf));
-
-	unsigned char const *src = read_buf;
-	unsigned char const *end = read_buf + s;
+	unsigned char        read_buf[buffer_size];
+	unsigned char const *src;
+	size_t const         s   = read_block(input, read_buf, sizeof(read_buf), &src);
+	unsigned char const *end = src + s;
 	utf32               *dst = buffer;
 	while (src != end) {
 		utf32 tc = *src++;
@@ -273,7 +179,7 @@ static named_decoder_t const decoders[] = {
 	{ "ISO_8859-15",     decode_iso_8859_15  }, // official alias
 	{ "ISO_8859-1:1987", decode_iso_8859_1   }, // official name
 	{ "Latin-9",         decode_iso_8859_15  }, // official alias
-	{ "UTF-8",           decode_utf8         }, // official name
+	{ "UTF-8",           NULL                }, // official name
 	{ "csISOLatin1",     decode_iso_8859_1   }, // official alias
 	{ "cp1252",          decode_windows_1252 },
 	{ "iso-ir-100",      decode_iso_8859_1   }, // official alias
@@ -296,21 +202,19 @@ static int my_strcasecmp(const char *s1, const char *s2)
 
 static void choose_decoder(input_t *result, const char *encoding)
 {
-	if (encoding == NULL) {
-		result->decode = decode_utf8;
-	} else {
-		for (named_decoder_t const *i = decoders; i->name != NULL; ++i) {
-			if (my_strcasecmp(encoding, i->name) != 0)
-				continue;
+	/* UTF-8 is passed on as is */
+	result->decode = NULL;
+	if (encoding == NULL)
+		return;
+
+	for (named_decoder_t const *i = decoders; i->name != NULL; ++i) {
+		if (my_strcasecmp(encoding, i->name) == 0) {
 			result->decode = i->decoder;
-			break;
-		}
-		if (result->decode == NULL) {
-			fprintf(stderr, "error: input encoding \"%s\" not supported\n",
-					encoding);
-			result->decode = decode_utf8;
+			return;
 		}
 	}
+	fprintf(stderr, "error: input encoding \"%s\" not supported\n",
+			encoding);
 }
 
 input_t *input_from_stream(FILE *file, const char *encoding)
@@ -324,23 +228,204 @@ input_t *input_from_stream(FILE *file, const char *encoding)
 	return result;
 }
 
-input_t *input_from_string(const char *string, const char *encoding)
+input_t *input_from_buffer(const char *buffer, size_t len,
+                           const char *encoding)
 {
-	input_t *result   = XMALLOCZ(input_t);
-	result->kind      = INPUT_STRING;
-	result->in.string = string;
+	input_t *result         = XMALLOCZ(input_t);
+	result->kind            = INPUT_BUFFER;
+	result->in.buffer.pos   = (const unsigned char*)buffer;
+	result->in.buffer.end   = (const unsigned char*)buffer + len;
+	result->in.buffer.begin = (const unsigned char*)buffer;
 
 	choose_decoder(result, encoding);
 
 	return result;
 }
 
-size_t decode(input_t *input, utf32 *buffer, size_t buffer_size)
+input_t *input_from_string(const char *string, const char *encoding)
+{
+	return input_from_buffer(string, strlen(string), encoding);
+}
+
+input_t *input_from_file(FILE *file, const char *encoding)
 {
-	return input->decode(input, buffer, buffer_size);
+#ifndef _WIN32
+	/* only a regular file which was not read from yet can be mapped */
+	struct stat st;
+	int         fd = fileno(file);
+	if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+	    && st.st_size > 0 && ftell(file) == 0) {
+		size_t const size    = (size_t)st.st_size;
+		void  *const mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+			madvise(mapping, size, MADV_SEQUENTIAL);
+#endif
+			input_t *result = input_from_buffer(mapping, size, encoding);
+			result->kind    = INPUT_MAPPED;
+			return result;
+		}
+	}
+#endif
+	return input_from_stream(file, encoding);
+}
+
+size_t input_get_buffer(const input_t *input, const char **begin)
+{
+	if (input->kind == INPUT_FILE || input->decode != NULL)
+		return 0;
+	*begin = (const char*)input->in.buffer.pos;
+	return input->in.buffer.end - input->in.buffer.pos;
+}
+
+/**
+ * Returns the length of the part of @p block which does not end in the
+ * middle of a character.
+ */
+static size_t get_complete_utf8_len(const unsigned char *block, size_t len)
+{
+	for (size_t i = len; i-- > 0 && len - i <= 4;) {
+		unsigned char const b = block[i];
+		if ((b & 0xC0) == 0x80)
+			continue;
+		size_t const char_len = (b & 0xE0) == 0xC0 ? 2
+		                      : (b & 0xF0) == 0xE0 ? 3
+		                      : (b & 0xF8) == 0xF0 ? 4 : 1;
+		return len - i < char_len ? i : len;
+	}
+	return len;
+}
+
+static size_t read_utf8_stream(input_t *input)
+{
+	FILE *file = input->in.file;
+
+	/* keep an incomplete character for the next block */
+	size_t len = input->block_rest;
+	memmove(input->block, input->block + input->block_len - len, len);
+	while (true) {
+		size_t const s = fread(input->block + len, 1,
+		                       sizeof(input->block) - len, file);
+		if (s == 0) {
+			if (!feof(file) && ferror(file))
+				input_error(0, 0, "read from input failed");
+			/* an incomplete character at the end is reported by the reader */
+			input->block_len  = len;
+			input->block_rest = 0;
+			return len;
+		}
+		len += s;
+
+		size_t const complete = get_complete_utf8_len(input->block, len);
+		if (complete > 0) {
+			input->block_len  = len;
+			input->block_rest = len - complete;
+			return complete;
+		}
+	}
+}
+
+static size_t encode_utf8(input_t *input)
+{
+	utf32        decoded[INPUT_BLOCK_SIZE / 4];
+	size_t const n   = input->decode(input, decoded, lengthof(decoded));
+	char        *dst = (char*)input->block;
+	for (size_t i = 0; i < n; ++i) {
+		utf32 const tc = decoded[i];
+		if (tc < 0x80U) {
+			*dst++ = tc;
+		} else if (tc < 0x800) {
+			*dst++ = 0xC0 | (tc >> 6);
+			*dst++ = 0x80 | (tc & 0x3F);
+		} else {
+			/* the 8 bit encodings only reach into the BMP */
+			*dst++ = 0xE0 | ( tc >> 12);
+			*dst++ = 0x80 | ((tc >>  6) & 0x3F);
+			*dst++ = 0x80 | ( tc        & 0x3F);
+		}
+	}
+	return dst - (char*)input->block;
+}
+
+size_t input_next_block(input_t *input, const unsigned char **block)
+{
+	if (input->decode != NULL) {
+		*block = input->block;
+		return encode_utf8(input);
+	}
+
+	if (input->kind == INPUT_FILE) {
+		*block = input->block;
+		return read_utf8_stream(input);
+	}
+
+	/* the complete rest of a buffer can be lexed in one go */
+	size_t const len = input->in.buffer.end - input->in.buffer.pos;
+	*block = input->in.buffer.pos;
+	input->in.buffer.pos = input->in.buffer.end;
+	return len;
+}
+
+utf32 input_decode_utf8(const unsigned char **pos, const unsigned char *end)
+{
+	const unsigned char *p    = *pos;
+	unsigned char const  lead = *p++;
+	utf32                decoded;
+	utf32                min_code;
+	unsigned             n_more;
+	if ((lead & 0xE0) == 0xC0) {
+		min_code = 0x80;
+		decoded  = lead & 0x1F;
+		n_more   = 1;
+	} else if ((lead & 0xF0) == 0xE0) {
+		min_code = 0x800;
+		decoded  = lead & 0x0F;
+		n_more   = 2;
+	} else if ((lead & 0xF8) == 0xF0) {
+		min_code = 0x10000;
+		decoded  = lead & 0x07;
+		n_more   = 3;
+	} else {
+		goto invalid_char;
+	}
+
+	for (; n_more > 0; --n_more) {
+		if (p == end) {
+			input_error(0, 0, "incomplete input char at end of input");
+			*pos = p;
+			return UTF32_INVALID;
+		}
+		if ((*p & 0xC0) != 0x80)
+			goto invalid_char;
+		decoded = (decoded << 6) | (*p++ & 0x3F);
+	}
+	*pos = p;
+
+	if (decoded < min_code                      ||
+			decoded > 0x10FFFF                      ||
+			(0xD800 <= decoded && decoded < 0xE000) || // high/low surrogates
+			(0xFDD0 <= decoded && decoded < 0xFDF0) || // noncharacters
+			(decoded & 0xFFFE) == 0xFFFE) {            // noncharacters
+		input_error(0, 0, "invalid byte sequence in input");
+	}
+	return decoded;
+
+invalid_char:
+	input_error(0, 0, "invalid byte sequence in input");
+	/* realign to the start of the next character */
+	while (p != end && ((*p & 0xC0) == 0x80 || (*p & 0xF8) == 0xF8))
+		++p;
+	*pos = p;
+	return UTF32_INVALID;
 }
 
 void input_free(input_t *input)
 {
+#ifndef _WIN32
+	if (input->kind == INPUT_MAPPED) {
+		munmap((void*)input->in.buffer.begin,
+		       input->in.buffer.end - input->in.buffer.begin);
+	}
+#endif
 	xfree(input);
 }
@@ -8,6 +8,21 @@ typedef struct input_t input_t;
 
 input_t *input_from_stream(FILE *stream, const char *encoding);
 input_t *input_from_string(const char *string, const char *encoding);
+/** Reads @p len bytes from @p buffer without copying them. */
+input_t *input_from_buffer(const char *buffer, size_t len,
+                           const char *encoding);
+/**
+ * Maps the contents of @p file into memory if it is a regular file, else
+ * reads it as a stream.  The file may be closed before the input is freed.
+ */
+input_t *input_from_file(FILE *file, const char *encoding);
+
+/**
+ * Returns the unread part of a UTF-8 buffer or mapped file in @p *begin.
+ *
+ * @return its length, 0 for streams and inputs in other encodings
+ */
+size_t input_get_buffer(const input_t *input, const char **begin);
 
 /** Type for a function being called on an input (or encoding) errors. */
 typedef void (*input_error_callback_func)(unsigned delta_lines,
@@ -16,7 +31,24 @@ typedef void (*input_error_callback_func)(unsigned delta_lines,
 
 void set_input_error_callback(input_error_callback_func func);
 
-size_t decode(input_t *input, utf32 *buffer, size_t buffer_size);
+/**
+ * Provides the next block of the input in UTF-8 in @p *block.  UTF-8
+ * buffers and mapped files are handed out without copying, the block of a
+ * stream never ends in the middle of a character.  The block stays valid
+ * until the next call.
+ *
+ * @return the length of the block, 0 at the end of the input
+ */
+size_t input_next_block(input_t *input, const unsigned char **block);
+
+/** Result of input_decode_utf8() for a byte sequence which is no character. */
+#define UTF32_INVALID ((utf32)-2)
+
+/**
+ * Decodes the multibyte character at @p *pos and advances @p *pos behind it.
+ * Invalid sequences are reported and skipped.
+ */
+utf32 input_decode_utf8(const unsigned char **pos, const unsigned char *end);
 
 void input_free(input_t *input);
 
@@ -26,8 +26,11 @@
 #include "symbol_t.h"
 #include "token_t.h"
 #include "symbol_table_t.h"
+#include "adt/bytescan.h"
+#include "adt/array.h"
 #include "adt/error.h"
 #include "adt/strset.h"
+#include "adt/xmalloc.h"
 #include "adt/util.h"
 #include "types.h"
 #include "type_t.h"
@@ -35,6 +38,7 @@
 #include "parser.h"
 #include "warning.h"
 #include "lang_features.h"
+#include "preprocessor.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -44,21 +48,37 @@
 
 #ifndef _WIN32
 #include <strings.h>
+#include <pthread.h>
 #endif
 
-#define MAX_PUTBACK 16    // 3 would be enough, but 16 gives a nicer alignment
-#define BUF_SIZE    1024
-
-static input_t           *input;
-static utf32              input_buf[BUF_SIZE + MAX_PUTBACK];
-static const utf32       *bufpos;
-static const utf32       *bufend;
-static utf32              c;
-static source_position_t  lexer_pos;
-token_t                   lexer_token;
+#define MAX_PUTBACK 3
+
+/* the lexer state exists once per thread, see lex_in_parallel() */
+static THREAD_LOCAL input_t             *input;
+static THREAD_LOCAL const unsigned char *bufpos;
+static THREAD_LOCAL const unsigned char *bufend;
+static THREAD_LOCAL utf32                putback_buf[MAX_PUTBACK];
+static THREAD_LOCAL unsigned             n_putback;
+static THREAD_LOCAL utf32                c;
+static THREAD_LOCAL decoded_position_t   lexer_pos;
+THREAD_LOCAL token_t                     lexer_token;
+static THREAD_LOCAL strset_t             stringset;
+/** obstack for the strings of the tokens */
+static THREAD_LOCAL struct obstack      *lexer_obstack = &symbol_obstack;
 static symbol_t          *symbol_L;
-static strset_t           stringset;
 bool                      allow_dollar_in_symbol = true;
+/** tokens come from the integrated preprocessor */
+static bool               use_preprocessor;
+
+/**
+ * Returns the current position of the lexer for a diagnostic.
+ */
+static const source_position_t *current_position(void)
+{
+	static THREAD_LOCAL source_position_t pos;
+	pos = encode_position(&lexer_pos);
+	return &pos;
+}
 
 /**
  * Prints a parse error message at the current token.
@@ -67,7 +87,7 @@ bool                      allow_dollar_in_symbol = true;
  */
 static void parse_error(const char *msg)
 {
-	errorf(&lexer_pos, "%s", msg);
+	errorf(current_position(), "%s", msg);
 }
 
 /**
@@ -77,22 +97,44 @@ static void parse_error(const char *msg)
  */
 static NORETURN internal_error(const char *msg)
 {
-	internal_errorf(&lexer_pos, "%s", msg);
+	internal_errorf(current_position(), "%s", msg);
+}
+
+/**
+ * Reads a character which is not a plain ASCII byte in the current block:
+ * a multibyte character or the start of a new block.
+ */
+static utf32 next_slow_char(void)
+{
+	for (;;) {
+		if (bufpos >= bufend) {
+			size_t const n = input_next_block(input, &bufpos);
+			if (n == 0) {
+				bufpos = bufend = NULL;
+				return EOF;
+			}
+			bufend = bufpos + n;
+		}
+		if (*bufpos < 0x80)
+			return *bufpos++;
+		utf32 const tc = input_decode_utf8(&bufpos, bufend);
+		if (tc != UTF32_INVALID)
+			return tc;
+	}
 }
 
 static inline void next_real_char(void)
 {
 	assert(bufpos <= bufend);
-	if (bufpos >= bufend) {
-		size_t n = decode(input, input_buf+MAX_PUTBACK, BUF_SIZE);
-		if (n == 0) {
-			c = EOF;
+	if (UNLIKELY(n_putback > 0)) {
+		c = putback_buf[--n_putback];
+	} else if (LIKELY(bufpos < bufend && *bufpos < 0x80)) {
+		c = *bufpos++;
+	} else {
+		c = next_slow_char();
+		if (c == (utf32)EOF)
 			return;
-		}
-		bufpos = input_buf + MAX_PUTBACK;
-		bufend = bufpos + n;
 	}
-	c = *bufpos++;
 	++lexer_pos.colno;
 }
 
@@ -103,7 +145,8 @@ static inline void next_real_char(void)
  */
 static inline void put_back(utf32 const pc)
 {
-	*(--bufpos - input_buf + input_buf) = pc;
+	assert(n_putback < MAX_PUTBACK);
+	putback_buf[n_putback++] = pc;
 	--lexer_pos.colno;
 }
 
@@ -124,7 +167,10 @@ static inline void next_char(void);
 
 static void maybe_concat_lines(void)
 {
-	eat('\\');
+	/* not eat(): next_char() would handle a following backslash right away
+	 * and put back one character for every backslash of a run */
+	assert(c == '\\');
+	next_real_char();
 
 	switch (c) {
 	MATCH_NEWLINE(return;)
@@ -180,6 +226,24 @@ static inline void next_char(void)
 	}
 }
 
+/**
+ * Skips the bytes behind c which @p scan accepts, as if next_char() had been
+ * called for each of them.  They are plain ASCII characters which need none
+ * of the checks in next_char().
+ *
+ * @return the first skipped byte
+ */
+static inline const unsigned char *skip_scanned(
+		const unsigned char *(*scan)(const unsigned char*, const unsigned char*))
+{
+	const unsigned char *const begin = bufpos;
+	if (n_putback == 0 && begin != NULL) {
+		bufpos           = scan(begin, bufend);
+		lexer_pos.colno += bufpos - begin;
+	}
+	return begin;
+}
+
 #define SYMBOL_CHARS  \
 	case '$': if (!allow_dollar_in_symbol) goto dollar_sign; \
 	case 'a':         \
@@ -254,16 +318,38 @@ static inline void next_char(void)
  */
 static void parse_symbol(void)
 {
-	obstack_1grow(&symbol_obstack, (char) c);
+	/* usually c is the byte before bufpos and the identifier ends inside
+	 * the buffer, then it is looked up right there without a copy */
+	if (LIKELY(n_putback == 0 && bufpos != NULL && bufpos[-1] == c)) {
+		const unsigned char *const begin = bufpos - 1;
+		skip_scanned(scan_identifier);
+		if (LIKELY(bufpos < bufend && *bufpos != '$' && *bufpos != '\\'
+		           && *bufpos != '?')) {
+			symbol_t *symbol = symbol_table_insert_len((const char*) begin,
+			                                           bufpos - begin);
+			lexer_token.kind              = symbol->ID;
+			lexer_token.identifier.symbol = symbol;
+			next_char();
+			return;
+		}
+		/* the identifier might go on behind the buffer or a continuation */
+		obstack_grow(lexer_obstack, begin, bufpos - begin - 1);
+		c = bufpos[-1];
+	}
+
+	obstack_1grow(lexer_obstack, (char) c);
 	next_char();
 
 	while (true) {
 		switch (c) {
 		DIGITS
-		SYMBOL_CHARS
-			obstack_1grow(&symbol_obstack, (char) c);
+		SYMBOL_CHARS {
+			obstack_1grow(lexer_obstack, (char) c);
+			const unsigned char *const run = skip_scanned(scan_identifier);
+			obstack_grow(lexer_obstack, run, bufpos - run);
 			next_char();
 			break;
+		}
 
 		default:
 dollar_sign:
@@ -272,30 +358,34 @@ dollar_sign:
 	}
 
 end_symbol:
-	obstack_1grow(&symbol_obstack, '\0');
+	obstack_1grow(lexer_obstack, '\0');
 
-	char     *string = obstack_finish(&symbol_obstack);
+	char     *string = obstack_finish(lexer_obstack);
 	symbol_t *symbol = symbol_table_insert(string);
 
 	lexer_token.kind              = symbol->ID;
 	lexer_token.identifier.symbol = symbol;
 
 	if (symbol->string != string) {
-		obstack_free(&symbol_obstack, string);
+		obstack_free(lexer_obstack, string);
 	}
 }
 
+/**
+ * Returns the shared copy of @p string.  @p string has to be the last object
+ * on the symbol obstack, it is freed if an equal string exists already.
+ */
 static string_t identify_string(char *string, size_t len)
 {
-	/* TODO hash */
-#if 0
-	const char *result = strset_insert(&stringset, concat);
-	if (result != concat) {
-		obstack_free(&symbol_obstack, concat);
+	/* the set compares up to the first 0, so strings with an embedded 0 cannot
+	 * be shared */
+	if (len > 0 && memchr(string, '\0', len - 1) != NULL)
+		return (string_t) {string, len};
+
+	const char *result = strset_insert(&stringset, string);
+	if (result != string) {
+		obstack_free(lexer_obstack, string);
 	}
-#else
-	const char *result = string;
-#endif
 	return (string_t) {result, len};
 }
 
@@ -304,11 +394,11 @@ static string_t identify_string(char *string, size_t len)
  */
 static void parse_number_suffix(void)
 {
-	assert(obstack_object_size(&symbol_obstack) == 0);
+	assert(obstack_object_size(lexer_obstack) == 0);
 	while (true) {
 		switch (c) {
 		SYMBOL_CHARS
-			obstack_1grow(&symbol_obstack, (char) c);
+			obstack_1grow(lexer_obstack, (char) c);
 			next_char();
 			break;
 		default:
@@ -317,15 +407,15 @@ static void parse_number_suffix(void)
 		}
 	}
 finish_suffix:
-	if (obstack_object_size(&symbol_obstack) == 0) {
+	if (obstack_object_size(lexer_obstack) == 0) {
 		lexer_token.number.suffix.begin = NULL;
 		lexer_token.number.suffix.size  = 0;
 		return;
 	}
 
-	obstack_1grow(&symbol_obstack, '\0');
-	size_t    size   = obstack_object_size(&symbol_obstack);
-	char     *string = obstack_finish(&symbol_obstack);
+	obstack_1grow(lexer_obstack, '\0');
+	size_t    size   = obstack_object_size(lexer_obstack);
+	char     *string = obstack_finish(lexer_obstack);
 
 	lexer_token.number.suffix = identify_string(string, size);
 }
@@ -339,46 +429,46 @@ static void parse_number_hex(void)
 	bool is_float   = false;
 	bool has_digits = false;
 
-	assert(obstack_object_size(&symbol_obstack) == 0);
+	assert(obstack_object_size(lexer_obstack) == 0);
 	while (isxdigit(c)) {
 		has_digits = true;
-		obstack_1grow(&symbol_obstack, (char) c);
+		obstack_1grow(lexer_obstack, (char) c);
 		next_char();
 	}
 
 	if (c == '.') {
 		is_float = true;
-		obstack_1grow(&symbol_obstack, (char) c);
+		obstack_1grow(lexer_obstack, (char) c);
 		next_char();
 
 		while (isxdigit(c)) {
 			has_digits = true;
-			obstack_1grow(&symbol_obstack, (char) c);
+			obstack_1grow(lexer_obstack, (char) c);
 			next_char();
 		}
 	}
 	if (c == 'p' || c == 'P') {
 		is_float = true;
-		obstack_1grow(&symbol_obstack, (char) c);
+		obstack_1grow(lexer_obstack, (char) c);
 		next_char();
 
 		if (c == '-' || c == '+') {
-			obstack_1grow(&symbol_obstack, (char) c);
+			obstack_1grow(lexer_obstack, (char) c);
 			next_char();
 		}
 
 		while (isxdigit(c)) {
-			obstack_1grow(&symbol_obstack, (char) c);
+			obstack_1grow(lexer_obstack, (char) c);
 			next_char();
 		}
 	} else if (is_float) {
 		errorf(&lexer_token.base.source_position,
 		       "hexadecimal floatingpoint constant requires an exponent");
 	}
-	obstack_1grow(&symbol_obstack, '\0');
+	obstack_1grow(lexer_obstack, '\0');
 
-	size_t  size   = obstack_object_size(&symbol_obstack) - 1;
-	char   *string = obstack_finish(&symbol_obstack);
+	size_t  size   = obstack_object_size(lexer_obstack) - 1;
+	char   *string = obstack_finish(lexer_obstack);
 	lexer_token.number.number = identify_string(string, size);
 
 	lexer_token.kind    =
@@ -412,7 +502,7 @@ static void parse_number(void)
 	bool is_float   = false;
 	bool has_digits = false;
 
-	assert(obstack_object_size(&symbol_obstack) == 0);
+	assert(obstack_object_size(lexer_obstack) == 0);
 	if (c == '0') {
 		next_char();
 		if (c == 'x' || c == 'X') {
@@ -422,46 +512,45 @@ static void parse_number(void)
 		} else {
 			has_digits = true;
 		}
-		obstack_1grow(&symbol_obstack, '0');
+		obstack_1grow(lexer_obstack, '0');
 	}
 
 	while (isdigit(c)) {
 		has_digits = true;
-		obstack_1grow(&symbol_obstack, (char) c);
+		obstack_1grow(lexer_obstack, (char) c);
 		next_char();
 	}
 
 	if (c == '.') {
 		is_float = true;
-		obstack_1grow(&symbol_obstack, '.');
+		obstack_1grow(lexer_obstack, '.');
 		next_char();
 
 		while (isdigit(c)) {
 			has_digits = true;
-			obstack_1grow(&symbol_obstack, (char) c);
+			obstack_1grow(lexer_obstack, (char) c);
 			next_char();
 		}
 	}
 	if (c == 'e' || c == 'E') {
 		is_float = true;
-		obstack_1grow(&symbol_obstack, 'e');
+		obstack_1grow(lexer_obstack, 'e');
 		next_char();
 
 		if (c == '-' || c == '+') {
-			obstack_1grow(&symbol_obstack, (char) c);
+			obstack_1grow(lexer_obstack, (char) c);
 			next_char();
 		}
 
 		while (isdigit(c)) {
-			obstack_1grow(&symbol_obstack, (char) c);
+			obstack_1grow(lexer_obstack, (char) c);
 			next_char();
 		}
 	}
 
-	obstack_1grow(&symbol_obstack, '\0');
-	size_t  size   = obstack_object_size(&symbol_obstack) - 1;
-	char   *string = obstack_finish(&symbol_obstack);
-	lexer_token.number.number = identify_string(string, size);
+	obstack_1grow(lexer_obstack, '\0');
+	size_t  size   = obstack_object_size(lexer_obstack) - 1;
+	char   *string = obstack_finish(lexer_obstack);
 
 	/* is it an octal number? */
 	if (is_float) {
@@ -479,6 +568,7 @@ static void parse_number(void)
 	} else {
 		lexer_token.kind = T_INTEGER;
 	}
+	lexer_token.number.number = identify_string(string, size);
 
 	if (!has_digits) {
 		errorf(&lexer_token.base.source_position, "invalid number literal '%S'",
@@ -644,9 +734,9 @@ static void parse_string_literal(void)
 		case '\\': {
 			utf32 const tc = parse_escape_sequence();
 			if (tc >= 0x100) {
-				warningf(WARN_OTHER, &lexer_pos, "escape sequence out of range");
+				warningf(WARN_OTHER, current_position(), "escape sequence out of range");
 			}
-			obstack_1grow(&symbol_obstack, tc);
+			obstack_1grow(lexer_obstack, tc);
 			break;
 		}
 
@@ -661,7 +751,7 @@ static void parse_string_literal(void)
 			goto end_of_string;
 
 		default:
-			obstack_grow_symbol(&symbol_obstack, c);
+			obstack_grow_symbol(lexer_obstack, c);
 			next_char();
 			break;
 		}
@@ -672,9 +762,9 @@ end_of_string:
 	/* TODO: concatenate multiple strings separated by whitespace... */
 
 	/* add finishing 0 to the string */
-	obstack_1grow(&symbol_obstack, '\0');
-	const size_t  size   = (size_t)obstack_object_size(&symbol_obstack);
-	char         *string = obstack_finish(&symbol_obstack);
+	obstack_1grow(lexer_obstack, '\0');
+	const size_t  size   = (size_t)obstack_object_size(lexer_obstack);
+	char         *string = obstack_finish(lexer_obstack);
 
 	lexer_token.kind          = T_STRING_LITERAL;
 	lexer_token.string.string = identify_string(string, size);
@@ -691,7 +781,7 @@ static void parse_wide_character_constant(void)
 		switch (c) {
 		case '\\': {
 			const utf32 tc = parse_escape_sequence();
-			obstack_grow_symbol(&symbol_obstack, tc);
+			obstack_grow_symbol(lexer_obstack, tc);
 			break;
 		}
 
@@ -712,16 +802,16 @@ static void parse_wide_character_constant(void)
 		}
 
 		default:
-			obstack_grow_symbol(&symbol_obstack, c);
+			obstack_grow_symbol(lexer_obstack, c);
 			next_char();
 			break;
 		}
 	}
 
 end_of_wide_char_constant:;
-	obstack_1grow(&symbol_obstack, '\0');
-	size_t  size   = (size_t) obstack_object_size(&symbol_obstack) - 1;
-	char   *string = obstack_finish(&symbol_obstack);
+	obstack_1grow(lexer_obstack, '\0');
+	size_t  size   = (size_t) obstack_object_size(lexer_obstack) - 1;
+	char   *string = obstack_finish(lexer_obstack);
 
 	lexer_token.kind          = T_WIDE_CHARACTER_CONSTANT;
 	lexer_token.string.string = identify_string(string, size);
@@ -753,9 +843,9 @@ static void parse_character_constant(void)
 		case '\\': {
 			utf32 const tc = parse_escape_sequence();
 			if (tc >= 0x100) {
-				warningf(WARN_OTHER, &lexer_pos, "escape sequence out of range");
+				warningf(WARN_OTHER, current_position(), "escape sequence out of range");
 			}
-			obstack_1grow(&symbol_obstack, tc);
+			obstack_1grow(lexer_obstack, tc);
 			break;
 		}
 
@@ -776,7 +866,7 @@ static void parse_character_constant(void)
 		}
 
 		default:
-			obstack_grow_symbol(&symbol_obstack, c);
+			obstack_grow_symbol(lexer_obstack, c);
 			next_char();
 			break;
 
@@ -784,9 +874,9 @@ static void parse_character_constant(void)
 	}
 
 end_of_char_constant:;
-	obstack_1grow(&symbol_obstack, '\0');
-	const size_t        size   = (size_t)obstack_object_size(&symbol_obstack)-1;
-	char         *const string = obstack_finish(&symbol_obstack);
+	obstack_1grow(lexer_obstack, '\0');
+	const size_t        size   = (size_t)obstack_object_size(lexer_obstack)-1;
+	char         *const string = obstack_finish(lexer_obstack);
 
 	lexer_token.kind          = T_CHARACTER_CONSTANT;
 	lexer_token.string.string = identify_string(string, size);
@@ -807,7 +897,7 @@ static void skip_multiline_comment(void)
 			next_char();
 			if (c == '*') {
 				/* nested comment, warn here */
-				warningf(WARN_COMMENT, &lexer_pos, "'/*' within comment");
+				warningf(WARN_COMMENT, current_position(), "'/*' within comment");
 			}
 			break;
 		case '*':
@@ -827,6 +917,7 @@ static void skip_multiline_comment(void)
 		}
 
 		default:
+			skip_scanned(scan_comment);
 			next_char();
 			break;
 		}
@@ -850,12 +941,13 @@ static void skip_line_comment(void)
 		case '\\':
 			next_char();
 			if (c == '\n' || c == '\r') {
-				warningf(WARN_COMMENT, &lexer_pos, "multi-line comment");
+				warningf(WARN_COMMENT, current_position(), "multi-line comment");
 				return;
 			}
 			break;
 
 		default:
+			skip_scanned(scan_comment);
 			next_char();
 			break;
 		}
@@ -863,7 +955,7 @@ static void skip_line_comment(void)
 }
 
 /** The current preprocessor token. */
-static token_t pp_token;
+static THREAD_LOCAL token_t pp_token;
 
 /**
  * Read the next preprocessor token.
@@ -1093,11 +1185,14 @@ static void parse_preprocessor_directive(void)
 void lexer_next_preprocessing_token(void)
 {
 	while (true) {
-		lexer_token.base.source_position = lexer_pos;
+		lexer_token.base.source_position = encode_position(&lexer_pos);
 
 		switch (c) {
 		case ' ':
 		case '\t':
+		case '\f':
+		case '\v':
+			skip_scanned(scan_blanks);
 			next_char();
 			break;
 
@@ -1262,7 +1357,7 @@ void lexer_next_preprocessing_token(void)
 
 		default:
 dollar_sign:
-			errorf(&lexer_pos, "unknown character '%c' found", c);
+			errorf(current_position(), "unknown character '%c' found", c);
 			next_char();
 			lexer_token.kind = T_ERROR;
 			return;
@@ -1270,7 +1365,11 @@ dollar_sign:
 	}
 }
 
-void lexer_next_token(void)
+/**
+ * Reads the next token of the current input, handling line markers and
+ * pragmas on the way.
+ */
+static void lex_token(void)
 {
 	lexer_next_preprocessing_token();
 
@@ -1285,6 +1384,353 @@ newline_found:
 	}
 }
 
+static void reset_input(input_t *new_input, const char *input_name)
+{
+	lexer_pos.lineno     = 0;
+	lexer_pos.colno      = 0;
+	lexer_pos.input_name = input_name;
+
+	input     = new_input;
+	bufpos    = NULL;
+	bufend    = NULL;
+	n_putback = 0;
+
+	/* place a virtual \n at the beginning so the lexer knows that we're
+	 * at the beginning of a line */
+	c = '\n';
+}
+
+#ifndef _WIN32
+/** Inputs smaller than this are not worth splitting. */
+#define PARALLEL_LEX_MIN_SIZE   (1024 * 1024)
+/** The smallest part of the input lexed in one go. */
+#define PARALLEL_LEX_CHUNK_SIZE (256 * 1024)
+
+/** A part of the input lexed independently of the others. */
+typedef struct lexer_chunk_t {
+	const char       *begin;
+	size_t            len;
+	token_t          *tokens;    /**< the tokens up to T_EOF (ARR_F) */
+	uint32_t          first_pos; /**< the offsets reserved for positions */
+	position_range_t *positions; /**< the positions of the tokens */
+	bool              reported;  /**< lexing the chunk reported diagnostics */
+} lexer_chunk_t;
+
+static unsigned         lexer_threads = 1;
+static const char      *chunk_input_name;
+static lexer_chunk_t   *chunks;          /**< the chunks of the input (ARR_F) */
+static size_t           next_chunk;      /**< the next chunk to be lexed */
+static pthread_mutex_t  next_chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t           cur_chunk;       /**< the chunk handed out now */
+static size_t           cur_token;
+static input_t         *relex_input;     /**< input of a chunk lexed again */
+static struct obstack **thread_obstacks; /**< strings of helper threads (ARR_F) */
+
+void lexer_set_threads(unsigned n_threads)
+{
+	lexer_threads = n_threads;
+}
+
+/**
+ * Checks whether a line marker '# N "file"' starts at @p pos.  Nothing
+ * lexed after it depends on the text before, so the input is split there.
+ */
+static bool is_line_marker(const char *pos, const char *end)
+{
+	if (pos == end || *pos++ != '#')
+		return false;
+	while (pos != end && (*pos == ' ' || *pos == '\t'))
+		++pos;
+	if (pos == end || *pos < '1' || *pos > '9')
+		return false;
+	while (pos != end && *pos >= '0' && *pos <= '9')
+		++pos;
+	while (pos != end && (*pos == ' ' || *pos == '\t'))
+		++pos;
+	return pos != end && *pos == '"';
+}
+
+static void add_chunk(const char *begin, const char *end)
+{
+	lexer_chunk_t chunk;
+	chunk.begin     = begin;
+	chunk.len       = end - begin;
+	chunk.tokens    = NULL;
+	chunk.first_pos = 0;
+	chunk.positions = NULL;
+	chunk.reported  = false;
+	ARR_APP1(lexer_chunk_t, chunks, chunk);
+}
+
+/**
+ * Splits @p len bytes at @p begin into chunks of at least @p chunk_size
+ * bytes, each but the first one starting with a line marker.
+ */
+static void split_into_chunks(const char *begin, size_t len, size_t chunk_size)
+{
+	const char *const end         = begin + len;
+	const char       *chunk_begin = begin;
+	const char       *pos         = begin + chunk_size;
+
+	chunks = NEW_ARR_F(lexer_chunk_t, 0);
+	while (pos < end) {
+		const char *const newline = memchr(pos, '\n', end - pos);
+		if (newline == NULL)
+			break;
+		pos = newline + 1;
+
+		/* a backslash joins the marker to the previous line */
+		bool const continued = newline[-1] == '\\'
+			|| (newline[-1] == '\r' && newline[-2] == '\\');
+		if (continued || !is_line_marker(pos, end))
+			continue;
+
+		add_chunk(chunk_begin, pos);
+		chunk_begin = pos;
+		pos        += chunk_size;
+	}
+	add_chunk(chunk_begin, end);
+}
+
+/**
+ * The number of position offsets reserved for a chunk of @p len bytes.
+ * A line takes at most its length plus the offsets of its start and of the
+ * position after its last character.
+ */
+static uint32_t chunk_positions(size_t len)
+{
+	return len < (UINT32_MAX - 16) / 3 ? (uint32_t)(3 * len + 16) : UINT32_MAX;
+}
+
+/** The input state of a thread, which lexing a chunk replaces. */
+typedef struct lexer_input_state_t {
+	input_t             *input;
+	const unsigned char *bufpos;
+	const unsigned char *bufend;
+	utf32                putback_buf[MAX_PUTBACK];
+	unsigned             n_putback;
+	utf32                c;
+	decoded_position_t   pos;
+} lexer_input_state_t;
+
+static void save_input_state(lexer_input_state_t *state)
+{
+	state->input     = input;
+	state->bufpos    = bufpos;
+	state->bufend    = bufend;
+	memcpy(state->putback_buf, putback_buf, sizeof(putback_buf));
+	state->n_putback = n_putback;
+	state->c         = c;
+	state->pos       = lexer_pos;
+}
+
+static void restore_input_state(const lexer_input_state_t *state)
+{
+	input     = state->input;
+	bufpos    = state->bufpos;
+	bufend    = state->bufend;
+	memcpy(putback_buf, state->putback_buf, sizeof(putback_buf));
+	n_putback = state->n_putback;
+	c         = state->c;
+	lexer_pos = state->pos;
+}
+
+static void lex_chunk(lexer_chunk_t *chunk)
+{
+	input_t *chunk_input = input_from_buffer(chunk->begin, chunk->len, NULL);
+	reset_input(chunk_input, chunk_input_name);
+	begin_position_range(chunk->first_pos, chunk_positions(chunk->len));
+
+	unsigned const n_reported = muted_diagnostic_count;
+	token_t       *tokens     = NEW_ARR_F(token_t, 0);
+	do {
+		lex_token();
+		ARR_APP1(token_t, tokens, lexer_token);
+	} while (lexer_token.kind != T_EOF);
+	input_free(chunk_input);
+
+	chunk->tokens    = tokens;
+	chunk->positions = end_position_range();
+	/* without its positions the chunk is lexed again as well */
+	chunk->reported  = muted_diagnostic_count != n_reported
+	                   || chunk->positions == NULL;
+}
+
+/** Lexes chunks until none are left. */
+static void lex_pending_chunks(void)
+{
+	bool const was_muted = mute_diagnostics;
+	mute_diagnostics = true;
+	while (true) {
+		pthread_mutex_lock(&next_chunk_lock);
+		size_t const nr = next_chunk++;
+		pthread_mutex_unlock(&next_chunk_lock);
+		if (nr >= ARR_LEN(chunks))
+			break;
+		lex_chunk(&chunks[nr]);
+	}
+	mute_diagnostics = was_muted;
+}
+
+static void *lex_chunks_thread(void *data)
+{
+	lexer_obstack = data;
+	strset_init(&stringset);
+	lex_pending_chunks();
+	strset_destroy(&stringset);
+	return NULL;
+}
+
+static void free_chunks(void)
+{
+	if (chunks == NULL)
+		return;
+	for (size_t i = 0; i < ARR_LEN(chunks); ++i) {
+		if (chunks[i].tokens != NULL)
+			DEL_ARR_F(chunks[i].tokens);
+		if (chunks[i].positions != NULL)
+			free_position_range(chunks[i].positions);
+	}
+	DEL_ARR_F(chunks);
+	chunks = NULL;
+	if (relex_input != NULL) {
+		input_free(relex_input);
+		relex_input = NULL;
+	}
+}
+
+/**
+ * Lexes the @p len bytes of preprocessed input at @p begin on several
+ * threads.  The tokens are handed out by lexer_next_token() afterwards.
+ */
+static void lex_in_parallel(const char *begin, size_t len,
+                            const char *input_name)
+{
+	size_t chunk_size = len / (lexer_threads * 4);
+	if (chunk_size < PARALLEL_LEX_CHUNK_SIZE)
+		chunk_size = PARALLEL_LEX_CHUNK_SIZE;
+	split_into_chunks(begin, len, chunk_size);
+	size_t const n_chunks = ARR_LEN(chunks);
+	if (n_chunks < 2) {
+		free_chunks();
+		return;
+	}
+
+	chunk_input_name = input_name;
+	next_chunk       = 0;
+	cur_chunk        = 0;
+	cur_token        = 0;
+	for (size_t i = 0; i < n_chunks; ++i) {
+		lexer_chunk_t *const chunk = &chunks[i];
+		chunk->first_pos = reserve_positions(chunk_positions(chunk->len));
+	}
+	symbol_table_set_concurrent(true);
+
+	unsigned const n_helpers = lexer_threads - 1 < n_chunks - 1
+	                           ? lexer_threads - 1 : (unsigned)n_chunks - 1;
+	pthread_t     *threads   = XMALLOCN(pthread_t, n_helpers);
+	unsigned       n_started = 0;
+	if (thread_obstacks == NULL)
+		thread_obstacks = NEW_ARR_F(struct obstack*, 0);
+	for (; n_started < n_helpers; ++n_started) {
+		/* the strings are part of the tokens, they live as long as the
+		 * lexer */
+		struct obstack *obst = XMALLOC(struct obstack);
+		obstack_init(obst);
+		if (pthread_create(&threads[n_started], NULL, lex_chunks_thread,
+		                   obst) != 0) {
+			/* the others take over its share */
+			obstack_free(obst, NULL);
+			xfree(obst);
+			break;
+		}
+		ARR_APP1(struct obstack*, thread_obstacks, obst);
+	}
+
+	/* the chunk inputs are freed when done, the input of this thread has to
+	 * stay valid */
+	lexer_input_state_t state;
+	save_input_state(&state);
+	lex_pending_chunks();
+	restore_input_state(&state);
+	for (unsigned i = 0; i < n_started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	xfree(threads);
+	symbol_table_set_concurrent(false);
+
+	/* the positions of a chunk lexed again are encoded once more */
+	for (size_t i = 0; i < n_chunks; ++i) {
+		lexer_chunk_t *const chunk = &chunks[i];
+		if (chunk->positions == NULL)
+			continue;
+		if (chunk->reported) {
+			free_position_range(chunk->positions);
+		} else {
+			add_position_range(chunk->positions);
+		}
+		chunk->positions = NULL;
+	}
+}
+
+/** Hands out the next token of the chunks lexed in parallel. */
+static void next_chunk_token(void)
+{
+	size_t const n_chunks = ARR_LEN(chunks);
+	while (true) {
+		lexer_chunk_t *chunk = &chunks[cur_chunk];
+		bool const     last  = cur_chunk + 1 == n_chunks;
+		if (chunk->reported) {
+			/* lex it again to report its problems in order */
+			if (relex_input == NULL) {
+				relex_input = input_from_buffer(chunk->begin, chunk->len, NULL);
+				reset_input(relex_input, chunk_input_name);
+			}
+			lex_token();
+			if (lexer_token.kind != T_EOF || last)
+				return;
+			input_free(relex_input);
+			relex_input = NULL;
+		} else {
+			const token_t *token = &chunk->tokens[cur_token];
+			if (token->kind != T_EOF || last) {
+				lexer_token = *token;
+				if (token->kind != T_EOF)
+					++cur_token;
+				return;
+			}
+		}
+
+		DEL_ARR_F(chunk->tokens);
+		chunk->tokens = NULL;
+		++cur_chunk;
+		cur_token = 0;
+	}
+}
+#else
+void lexer_set_threads(unsigned n_threads)
+{
+	/* without threads the input is always lexed in one go */
+	(void) n_threads;
+}
+#endif
+
+void lexer_next_token(void)
+{
+	if (use_preprocessor) {
+		preprocessor_next_token(&lexer_token);
+		return;
+	}
+
+#ifndef _WIN32
+	if (UNLIKELY(chunks != NULL)) {
+		next_chunk_token();
+		return;
+	}
+#endif
+	lex_token();
+}
+
 void init_lexer(void)
 {
 	strset_init(&stringset);
@@ -1296,34 +1742,52 @@ static void input_error(unsigned delta_lines, unsigned delta_cols,
 {
 	lexer_pos.lineno += delta_lines;
 	lexer_pos.colno  += delta_cols;
-	errorf(&lexer_pos, "%s", message);
+	errorf(current_position(), "%s", message);
 }
 
 void lexer_switch_input(input_t *new_input, const char *input_name)
 {
-	lexer_pos.lineno     = 0;
-	lexer_pos.colno      = 0;
-	lexer_pos.input_name = input_name;
-
 	set_input_error_callback(input_error);
-	input  = new_input;
-	bufpos = NULL;
-	bufend = NULL;
+	reset_input(new_input, input_name);
+	use_preprocessor = false;
 
-	/* place a virtual \n at the beginning so the lexer knows that we're
-	 * at the beginning of a line */
-	c = '\n';
+#ifndef _WIN32
+	free_chunks();
+	if (lexer_threads > 1) {
+		const char  *begin;
+		size_t const len = input_get_buffer(new_input, &begin);
+		if (len >= PARALLEL_LEX_MIN_SIZE)
+			lex_in_parallel(begin, len, input_name);
+	}
+#endif
+}
+
+void lexer_switch_preprocessor(void)
+{
+	use_preprocessor = true;
 }
 
 void exit_lexer(void)
 {
+#ifndef _WIN32
+	free_chunks();
+	if (thread_obstacks != NULL) {
+		for (size_t i = 0; i < ARR_LEN(thread_obstacks); ++i) {
+			obstack_free(thread_obstacks[i], NULL);
+			xfree(thread_obstacks[i]);
+		}
+		DEL_ARR_F(thread_obstacks);
+		thread_obstacks = NULL;
+	}
+#endif
 	strset_destroy(&stringset);
 }
 
 static __attribute__((unused))
 void dbg_pos(const source_position_t source_position)
 {
-	fprintf(stdout, "%s:%u:%u\n", source_position.input_name,
-	        source_position.lineno, (unsigned)source_position.colno);
+	decoded_position_t const pos = decode_position(source_position);
+	fprintf(stdout, "%s:%u:%u\n", pos.input_name, pos.lineno,
+	        (unsigned)pos.colno);
 	fflush(stdout);
 }
@@ -23,8 +23,9 @@
 #include "symbol_table_t.h"
 #include "token_t.h"
 #include "input.h"
+#include "adt/util.h"
 
-extern token_t lexer_token;
+extern THREAD_LOCAL token_t lexer_token;
 extern bool    allow_dollar_in_symbol;
 
 void lexer_next_token(void);
@@ -37,6 +38,17 @@ void exit_lexer(void);
 
 void lexer_switch_input(input_t *input, const char *input_name);
 
+/**
+ * Lexes large inputs given to lexer_switch_input() on @p n_threads threads.
+ * The input is split in front of line markers of preprocessed C.
+ */
+void lexer_set_threads(unsigned n_threads);
+
+/**
+ * Take the tokens from the preprocessor input set with switch_pp_input().
+ */
+void lexer_switch_preprocessor(void);
+
 string_t concat_strings(const string_t *s1, const string_t *s2);
 string_t make_string(const char *str);
 
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Measures the throughput of the lexer on generated and real sources.
+#
+# usage: bench.sh CPARSER DIR [RUNS]
+#
+# The generated files are kept in DIR.  The first run stores its results in
+# DIR/baseline, later runs fail if the lexer got slower than that.  Remove
+# the file to take a new baseline.
+set -e
+cparser=$1
+dir=$2
+runs=${3:-5}
+src=`cd \`dirname $0\`/.. && pwd`
+mkdir -p "$dir"
+
+# lots of declarations, identifiers and numbers
+if [ ! -f "$dir/decls.c" ]; then
+	awk 'BEGIN {
+		for (i = 0; i < 40000; ++i) {
+			printf "static unsigned long var_%d = %dUL + 0x%x * %d.%de3;\n", i, i, i * 7, i % 97, i % 10
+			printf "int function_%d(int a, char const *b) { return a <= %d ? b[a] : (int)var_%d; }\n", i, i, i
+		}
+	}' > "$dir/decls.c"
+fi
+
+# a long table of string literals with escape sequences
+if [ ! -f "$dir/strings.c" ]; then
+	awk 'BEGIN {
+		print "const char *const table[] = {"
+		for (i = 0; i < 100000; ++i)
+			printf "\t\"entry %d of the \\\"table\\\"\\n\\t\\%o\" L\"wide %d\",\n", i, i % 256, i
+		print "};"
+	}' > "$dir/strings.c"
+fi
+
+# deeply nested macros, expanded by the preprocessor
+if [ ! -f "$dir/macros.i" ]; then
+	awk 'BEGIN {
+		print "#define M0(x) ((x) + 1)"
+		for (i = 1; i <= 8; ++i)
+			printf "#define M%d(x) M%d(M%d(x))\n", i, i - 1, i - 1
+		for (i = 0; i < 2000; ++i)
+			printf "int value_%d = M8(%d);\n", i, i
+	}' > "$dir/macros.c"
+	"$cparser" -E "$dir/macros.c" -o "$dir/macros.i"
+fi
+
+files="$dir/decls.c $dir/strings.c $dir/macros.i"
+files="$files $src/parser.c $src/preprocessor.c $src/ast2firm.c"
+if [ -f "$dir/baseline" ]; then
+	"$cparser" --benchmark-lexer --benchmark-runs=$runs \
+		--benchmark-baseline="$dir/baseline" $files
+else
+	"$cparser" --benchmark-lexer --benchmark-runs=$runs \
+		--benchmark-save="$dir/baseline" $files
+fi
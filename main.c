@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <assert.h>
 
@@ -54,6 +55,7 @@
 
 #else
 #include <unistd.h>
+#include <sys/wait.h>
 #define HAVE_MKSTEMP
 #endif
 
@@ -61,11 +63,14 @@
 #include <libfirm/be.h>
 
 #include "lexer.h"
+#include "preprocessor.h"
 #include "token_t.h"
 #include "types.h"
 #include "type_hash.h"
 #include "parser.h"
 #include "type_t.h"
+#include "ast_t.h"
+#include "symbol_table.h"
 #include "ast2firm.h"
 #include "diagnostic.h"
 #include "lang_features.h"
@@ -74,6 +79,7 @@
 #include "driver/firm_machine.h"
 #include "adt/error.h"
 #include "adt/strutil.h"
+#include "adt/xmalloc.h"
 #include "wrappergen/write_fluffy.h"
 #include "wrappergen/write_jna.h"
 #include "revision.h"
@@ -81,6 +87,9 @@
 #include "help.h"
 #include "mangle.h"
 #include "printer.h"
+#include "plinc_profile.h"
+#include "compile_server.h"
+#include "compile_cache.h"
 
 #ifndef PREPROCESSOR
 #ifndef __WIN32__
@@ -115,9 +124,27 @@ static struct obstack    cppflags_obst;
 static struct obstack    ldflags_obst;
 static struct obstack    asflags_obst;
 static char              dep_target[1024];
+/* dependency generation with the integrated preprocessor */
+static bool              dep_only;              /**< -M, -MM */
+static bool              dep_system_headers = true;
+static bool              dep_phony_targets;     /**< -MP */
+static const char       *dep_file;              /**< -MF */
+static char              dep_targets[1024];     /**< -MT, -MQ */
+static bool              dep_recording;
 static const char       *outname;
 static bool              define_intmax_types;
 static const char       *input_encoding;
+/** preprocess with the integrated preprocessor instead of an external cpp */
+static bool              integrated_cpp = true;
+static bool              no_std_include;
+static bool              pipe_to_assembler;
+static const char       *cache_dir;
+static uint64_t          cache_max_size = UINT64_C(1) << 30;
+/* settings of --benchmark-lexer */
+static unsigned          benchmark_runs      = 5;
+static unsigned          benchmark_tolerance = 5; /**< percent */
+static const char       *benchmark_baseline;
+static const char       *benchmark_save;
 
 typedef enum lang_standard_t {
 	STANDARD_DEFAULT, /* gnu99 (for C, GCC does gnu89) or gnu++98 (for C++) */
@@ -138,6 +165,7 @@ typedef struct file_list_entry_t file_list_entry_t;
 typedef enum filetype_t {
 	FILETYPE_AUTODETECT,
 	FILETYPE_C,
+	FILETYPE_C_HEADER,
 	FILETYPE_PREPROCESSED_C,
 	FILETYPE_CXX,
 	FILETYPE_PREPROCESSED_CXX,
@@ -179,11 +207,21 @@ static void get_output_name(char *buf, size_t buflen, const char *inputname,
 		panic("filename too long");
 }
 
-static translation_unit_t *do_parsing(FILE *const in, const char *const input_name)
+static translation_unit_t *do_parsing(FILE *const in, const char *const input_name,
+                                      bool const preprocess)
 {
 	start_parsing();
 
-	input_t *input = input_from_stream(in, input_encoding);
+	if (preprocess) {
+		switch_pp_input(in, input_name, input_encoding);
+		lexer_switch_preprocessor();
+		parse();
+		translation_unit_t *unit = finish_parsing();
+		close_pp_input();
+		return unit;
+	}
+
+	input_t *input = input_from_file(in, input_encoding);
 	lexer_switch_input(input, input_name);
 	parse();
 	translation_unit_t *unit = finish_parsing();
@@ -194,7 +232,7 @@ static translation_unit_t *do_parsing(FILE *const in, const char *const input_na
 
 static void lextest(FILE *in, const char *fname)
 {
-	input_t *input = input_from_stream(in, input_encoding);
+	input_t *input = input_from_file(in, input_encoding);
 	lexer_switch_input(input, fname);
 
 	do {
@@ -258,6 +296,19 @@ static const char *type_to_string(type_t *type)
 	return get_atomic_kind_name(type->atomic.akind);
 }
 
+/**
+ * Returns true if @p filetype is preprocessed by the integrated
+ * preprocessor.  Cross compilation, C++ and assembler still need the
+ * external one, as do options it does not know.
+ */
+static bool use_integrated_cpp(filetype_t filetype)
+{
+	return integrated_cpp
+	    && (filetype == FILETYPE_C || filetype == FILETYPE_C_HEADER)
+	    && target_triple == NULL
+	    && getenv("CPARSER_PP") == NULL;
+}
+
 static FILE *preprocess(const char *fname, filetype_t filetype)
 {
 	static const char *common_flags = NULL;
@@ -304,6 +355,7 @@ static FILE *preprocess(const char *fname, filetype_t filetype)
 
 	switch (filetype) {
 	case FILETYPE_C:
+	case FILETYPE_C_HEADER:
 		add_flag(&cppflags_obst, "-std=c99");
 		break;
 	case FILETYPE_CXX:
@@ -345,7 +397,7 @@ static FILE *preprocess(const char *fname, filetype_t filetype)
 	return f;
 }
 
-static void assemble(const char *out, const char *in)
+static char *get_assembler_commandline(const char *out, const char *in)
 {
 	obstack_1grow(&asflags_obst, '\0');
 	const char *flags = obstack_finish(&asflags_obst);
@@ -368,7 +420,13 @@ static void assemble(const char *out, const char *in)
 	if (verbose) {
 		puts(commandline);
 	}
-	int err = system(commandline);
+	return commandline;
+}
+
+static void assemble(const char *out, const char *in)
+{
+	char *commandline = get_assembler_commandline(out, in);
+	int   err         = system(commandline);
 	if (err != EXIT_SUCCESS) {
 		fprintf(stderr, "assembler reported an error\n");
 		exit(EXIT_FAILURE);
@@ -376,6 +434,43 @@ static void assemble(const char *out, const char *in)
 	obstack_free(&asflags_obst, commandline);
 }
 
+/**
+ * Starts the assembler reading the assembly from a pipe (-pipe), so code
+ * generation and assembling overlap and no assembly file is written.  It is
+ * started right before the assembly is written, so no error in between can
+ * leave it behind.
+ */
+static FILE *open_assembler_pipe(const char *out)
+{
+	char *commandline = get_assembler_commandline(out, "-");
+	FILE *pipe        = popen(commandline, "w");
+	if (pipe == NULL) {
+		fprintf(stderr, "could not start assembler: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	obstack_free(&asflags_obst, commandline);
+	return pipe;
+}
+
+static void close_assembler_pipe(FILE *pipe, const char *out)
+{
+	if (pclose(pipe) != EXIT_SUCCESS) {
+		fprintf(stderr, "assembler reported an error\n");
+		unlink(out);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Stops the assembler after an error in its input and removes the object
+ * file it wrote.
+ */
+static void abort_assembler_pipe(FILE *pipe, const char *out)
+{
+	pclose(pipe);
+	unlink(out);
+}
+
 static void print_file_name(const char *file)
 {
 	add_flag(&ldflags_obst, "-print-file-name=%s", file);
@@ -509,6 +604,7 @@ static void free_temp_files(void)
 }
 
 typedef enum compile_mode_t {
+	BenchmarkLexer,
 	BenchmarkParser,
 	PreprocessOnly,
 	ParseOnly,
@@ -523,6 +619,218 @@ typedef enum compile_mode_t {
 	PrintJna
 } compile_mode_t;
 
+/**
+ * Returns true if the translation units of an invocation in @p mode can be
+ * compiled independently of each other.
+ */
+static bool is_separately_compilable(compile_mode_t mode)
+{
+	return mode == ParseOnly || mode == Compile || mode == CompileAssemble
+	    || mode == CompileAssembleLink;
+}
+
+/**
+ * Returns the object file the current unit is assembled to: the output file
+ * with -c, a temporary file otherwise.
+ */
+static const char *get_object_name(compile_mode_t mode, FILE *out,
+                                   char *buf, size_t buflen)
+{
+	if (mode == CompileAssemble) {
+		fclose(out);
+		return outname;
+	}
+	FILE *tempf = make_temp_file(buf, buflen, "cco");
+	fclose(tempf);
+	return buf;
+}
+
+static void add_dep_target(const char *target, bool quote)
+{
+	size_t len = strlen(dep_targets);
+	char  *dst = dep_targets + len;
+	char  *end = dep_targets + sizeof(dep_targets) - 2;
+	if (len > 0)
+		*dst++ = ' ';
+	for (const char *c = target; *c != '\0' && dst < end; ++c) {
+		if (quote) {
+			if (*c == '$') {
+				*dst++ = '$';
+			} else if (*c == ' ' || *c == '\t' || *c == '#') {
+				*dst++ = '\\';
+			}
+		}
+		*dst++ = *c;
+	}
+	*dst = '\0';
+	if (dst >= end)
+		panic("dependency target too long");
+}
+
+/**
+ * Starts recording the files read by the integrated preprocessor if
+ * dependencies were requested.
+ */
+static void begin_dependencies(bool construct_dep_target)
+{
+	if (!dep_only && !construct_dep_target)
+		return;
+	record_pp_dependencies(dep_system_headers);
+	dep_recording = true;
+}
+
+/**
+ * Writes the dependencies recorded while preprocessing @p filename, to
+ * @p out for -M, else to the -MF or .d file.
+ */
+static bool finish_dependencies(const char *filename, compile_mode_t mode,
+                                FILE *out)
+{
+	if (!dep_recording)
+		return true;
+	dep_recording = false;
+
+	char target[1024];
+	if (dep_targets[0] != '\0') {
+		snprintf(target, sizeof(target), "%s", dep_targets);
+	} else if (!dep_only && (mode == Compile || mode == CompileAssemble)) {
+		snprintf(target, sizeof(target), "%s", outname);
+	} else {
+		get_output_name(target, sizeof(target), filename, ".o");
+	}
+
+	const char *name   = dep_file != NULL ? dep_file : dep_target;
+	FILE       *output = out;
+	if (dep_file != NULL || !dep_only) {
+		output = fopen(name, "w");
+		if (output == NULL) {
+			fprintf(stderr, "Could not open '%s' for writing: %s\n", name,
+			        strerror(errno));
+			return false;
+		}
+	}
+	write_pp_dependencies(output, target, dep_phony_targets);
+	if (output != out)
+		fclose(output);
+	return true;
+}
+
+#ifndef _WIN32
+/**
+ * Compile every translation unit in @p files in a worker process of its own,
+ * with at most @p n_jobs workers running at once. Firm keeps one program per
+ * process, so this is the only way to handle several units in one
+ * invocation.
+ *
+ * In the parent process this returns NULL once all workers finished. The
+ * compiled units have been replaced by their object files then, *result is
+ * EXIT_FAILURE if any of them failed. In a worker process the unit to
+ * compile is returned and *worker_outname is set to its output file.
+ */
+static file_list_entry_t *compile_in_workers(file_list_entry_t *files,
+		unsigned n_jobs, compile_mode_t mode, struct obstack *obst,
+		const char **worker_outname, int *result)
+{
+	typedef struct worker_t {
+		pid_t              pid;
+		file_list_entry_t *unit;
+		const char        *outname;
+	} worker_t;
+
+	worker_t *workers   = XMALLOCNZ(worker_t, n_jobs);
+	unsigned  n_running = 0;
+
+	for (file_list_entry_t *unit = files; unit != NULL || n_running > 0; ) {
+		if (unit != NULL && unit->type == FILETYPE_OBJECT) {
+			unit = unit->next;
+			continue;
+		}
+
+		if (unit != NULL && n_running < n_jobs) {
+			char        buf[4096];
+			const char *outname = NULL;
+			switch (mode) {
+			case Compile:
+				get_output_name(buf, sizeof(buf), unit->name, ".s");
+				outname = obstack_copy(obst, buf, strlen(buf) + 1);
+				break;
+			case CompileAssemble:
+				get_output_name(buf, sizeof(buf), unit->name, ".o");
+				outname = obstack_copy(obst, buf, strlen(buf) + 1);
+				break;
+			case CompileAssembleLink: {
+				FILE *tempf = make_temp_file(buf, sizeof(buf), "cco");
+				fclose(tempf);
+				outname = obstack_copy(obst, buf, strlen(buf) + 1);
+				break;
+			}
+			default:
+				break;
+			}
+
+			fflush(stdout);
+			fflush(stderr);
+			pid_t pid = fork();
+			if (pid < 0) {
+				fprintf(stderr, "error: could not create worker process: %s\n",
+				        strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			if (pid == 0) {
+				/* the temporary files belong to the parent, only remove our
+				 * own ones when exiting */
+				temp_files      = NULL;
+				unit->next      = NULL;
+				*worker_outname = outname;
+				xfree(workers);
+				return unit;
+			}
+
+			worker_t *worker = &workers[0];
+			while (worker->pid != 0)
+				++worker;
+			worker->pid     = pid;
+			worker->unit    = unit;
+			worker->outname = outname;
+			++n_running;
+			unit = unit->next;
+			continue;
+		}
+
+		/* wait for a worker to finish */
+		int   status;
+		pid_t pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			panic("lost track of worker processes");
+		}
+
+		worker_t *worker = NULL;
+		for (unsigned i = 0; i < n_jobs; ++i) {
+			if (workers[i].pid == pid) {
+				worker = &workers[i];
+				break;
+			}
+		}
+		if (worker == NULL)
+			continue;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+			*result = EXIT_FAILURE;
+		} else if (mode == CompileAssembleLink) {
+			worker->unit->name = worker->outname;
+			worker->unit->type = FILETYPE_OBJECT;
+		}
+		worker->pid = 0;
+		--n_running;
+	}
+
+	xfree(workers);
+	return NULL;
+}
+#endif
+
 static void usage(const char *argv0)
 {
 	fprintf(stderr, "Usage %s [options] input [-o output]\n", argv0);
@@ -574,14 +882,17 @@ static void print_help_basic(const char *argv0)
 	put_help("-E",                       "Preprocess only");
 	put_help("-S",                       "Compile but do not assembler or link");
 	put_help("-o",                       "Specify output file");
+	put_help("-j N",                     "Compile up to N translation units in parallel");
+	put_help("--server SOCKET",          "Serve compile requests on unix socket SOCKET (clients find it via CPARSER_SERVER)");
 	put_help("-v",                       "Verbose output (show invocation of sub-processes)");
 	put_help("-x",                       "Force input language:");
 	put_choice("c",                      "C");
+	put_choice("c-header",               "C header, precompiled to FILE.gch");
 	put_choice("c++",                    "C++");
 	put_choice("assembler",              "Assembler (no preprocessing)");
 	put_choice("assembler-with-cpp",     "Assembler with preprocessing");
 	put_choice("none",                   "Autodetection");
-	put_help("-pipe",                    "Ignored (gcc compatibility)");
+	put_help("-pipe",                    "Pipe the generated assembly to the assembler instead of using temporary files");
 }
 
 static void print_help_preprocessor(void)
@@ -593,15 +904,17 @@ static void print_help_preprocessor(void)
 	put_help("-I PATH",                  "");
 	put_help("-D SYMBOL[=value]",        "");
 	put_help("-U SYMBOL",                "");
-	put_help("-Wp,OPTION",               "Pass option directly to preprocessor");
-	put_help("-M",                       "");
-	put_help("-MD",                      "");
-	put_help("-MMD",                     "");
-	put_help("-MM",                      "");
-	put_help("-MP",                      "");
-	put_help("-MT",                      "");
-	put_help("-MQ",                      "");
-	put_help("-MF",                      "");
+	put_help("-Wp,OPTION",               "Pass option directly to preprocessor (uses the external preprocessor)");
+	put_help("-fno-integrated-cpp",      "Preprocess with an external preprocessor");
+	put_help("-no-integrated-cpp",       "Same as -fno-integrated-cpp");
+	put_help("-M",                       "Print a make rule for the dependencies instead of preprocessing");
+	put_help("-MD",                      "Write the dependencies to a .d file while compiling");
+	put_help("-MMD",                     "Like -MD, but leave out system headers");
+	put_help("-MM",                      "Like -M, but leave out system headers");
+	put_help("-MP",                      "Add a phony target for each header");
+	put_help("-MT TARGET",               "Set the target of the dependency rule");
+	put_help("-MQ TARGET",               "Like -MT, but quote characters special to make");
+	put_help("-MF FILE",                 "Write the dependencies to FILE");
 }
 
 static void print_help_parser(void)
@@ -666,6 +979,14 @@ static void print_help_codegeneration(void)
 	put_help("-fhosted",                 "Compile in hosted (not freestanding) mode");
 	put_help("-fprofile-generate",       "Generate instrumented code to collect profile information");
 	put_help("-fprofile-use",            "Use profile information generated by instrumented binaries");
+	put_help("-fcache-dir=DIR",          "Reuse results of identical compilations stored in DIR");
+	put_help("-fcache-size=SIZE",        "Limit the cache to SIZE bytes (suffix K, M or G), default 1G");
+	put_help("--cache-stats",            "Print statistics of the cache given with -fcache-dir");
+	put_help("-ftoken-cache=DIR",        "Keep the tokens of headers in DIR and reuse them while unchanged");
+	put_help("-finclude-dir-listing",    "Only open headers found in a listing of each include directory");
+	put_help("-flexer-threads=N",        "Lex large preprocessed inputs on N threads");
+	put_help("-fpipeline-profile=FILE",  "Use measured stage times to map pipeline stages to cores");
+	put_help("-fpipeline-double-buffer", "Overlap pipeline stage transfers with computation");
 	put_help("-ffp-precise",             "Precise floating point model");
 	put_help("-ffp-fast",                "Imprecise floating point model");
 	put_help("-ffp-strict",              "Strict floating point model");
@@ -713,7 +1034,13 @@ static void print_help_debug(void)
 	put_help("--print-implicit-cast",    "");
 	put_help("--print-parenthesis",      "");
 	put_help("--benchmark",              "Preprocess and parse, produces no output");
+	put_help("--benchmark-lexer",        "Measure the throughput of the lexer on the inputs");
+	put_help("--benchmark-runs=N",       "Lex each input N times, the fastest run counts");
+	put_help("--benchmark-baseline=FILE","Fail if the lexer is slower than the results in FILE");
+	put_help("--benchmark-tolerance=PCT","Accept results up to PCT percent below the baseline");
+	put_help("--benchmark-save=FILE",    "Write the lexer results to FILE for later comparison");
 	put_help("--time",                   "Measure time of compiler passes");
+	put_help("--time-report=FORMAT",     "Like --time, FORMAT is text or json (phase tree with memory usage)");
 	put_help("--dump-function func",     "Preprocess, parse and output vcg graph of func");
 	put_help("--export-ir",              "Preprocess, parse and output compiler intermediate representation");
 }
@@ -799,10 +1126,292 @@ static FILE *open_file(const char *filename)
 	return in;
 }
 
+/**
+ * Reads all of @p in into a new buffer.
+ */
+static char *read_whole_file(FILE *in, size_t *len)
+{
+	size_t size   = 65536;
+	size_t filled = 0;
+	char  *buffer = XMALLOCN(char, size);
+	size_t read;
+	while ((read = fread(buffer + filled, 1, size - filled, in)) > 0) {
+		filled += read;
+		if (filled == size) {
+			size  *= 2;
+			buffer = XREALLOC(buffer, char, size);
+		}
+	}
+	*len = filled;
+	return buffer;
+}
+
+/**
+ * Returns the tokens per second @p filename reached in the baseline file,
+ * 0 if it has none.
+ */
+static double get_baseline_throughput(FILE *baseline, const char *filename)
+{
+	char   name[4096];
+	double mbytes_per_sec;
+	double tokens_per_sec;
+	rewind(baseline);
+	while (fscanf(baseline, "%4095s %lf %lf", name, &mbytes_per_sec,
+	              &tokens_per_sec) == 3) {
+		if (streq(name, filename))
+			return tokens_per_sec;
+	}
+	return 0;
+}
+
+/**
+ * Lexes each input benchmark_runs times and reports the throughput of the
+ * fastest run.  With a baseline a throughput more than benchmark_tolerance
+ * percent below the stored one fails.
+ */
+static int benchmark_lexer(file_list_entry_t *files)
+{
+	FILE *baseline = NULL;
+	if (benchmark_baseline != NULL) {
+		baseline = fopen(benchmark_baseline, "r");
+		if (baseline == NULL) {
+			fprintf(stderr, "Could not open '%s': %s\n", benchmark_baseline,
+			        strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+	FILE *save = NULL;
+	if (benchmark_save != NULL) {
+		save = fopen(benchmark_save, "w");
+		if (save == NULL) {
+			fprintf(stderr, "Could not open '%s' for writing: %s\n",
+			        benchmark_save, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	int         result = EXIT_SUCCESS;
+	ir_timer_t *timer  = ir_timer_new();
+	for (file_list_entry_t *file = files; file != NULL; file = file->next) {
+		if (file->type == FILETYPE_OBJECT || file->type == FILETYPE_IR)
+			continue;
+
+		const char *filename = file->name;
+		FILE       *in       = open_file(filename);
+		size_t      len;
+		char       *buffer   = read_whole_file(in, &len);
+		if (in != stdin)
+			fclose(in);
+
+		unsigned long best_usec = 0;
+		size_t        n_tokens  = 0;
+		for (unsigned run = 0; run < benchmark_runs; ++run) {
+			/* the diagnostics of the first run suffice */
+			mute_diagnostics = run > 0;
+			n_tokens         = 0;
+
+			input_t *input = input_from_buffer(buffer, len, input_encoding);
+			ir_timer_reset(timer);
+			ir_timer_start(timer);
+			lexer_switch_input(input, filename);
+			do {
+				lexer_next_token();
+				++n_tokens;
+			} while (lexer_token.kind != T_EOF);
+			ir_timer_stop(timer);
+			input_free(input);
+
+			unsigned long const usec = ir_timer_elapsed_usec(timer);
+			if (run == 0 || usec < best_usec)
+				best_usec = usec;
+		}
+		mute_diagnostics = false;
+		xfree(buffer);
+
+		double const seconds        = (best_usec > 0 ? best_usec : 1) / 1e6;
+		double const mbytes_per_sec = len / (1024.0 * 1024.0) / seconds;
+		double const tokens_per_sec = n_tokens / seconds;
+		printf("%-40s %9.2f MB/s %12.0f tokens/s", filename, mbytes_per_sec,
+		       tokens_per_sec);
+		if (baseline != NULL) {
+			double const base = get_baseline_throughput(baseline, filename);
+			if (base > 0) {
+				double const change = (tokens_per_sec / base - 1) * 100;
+				printf("  %+6.1f%%", change);
+				if (change < -(double)benchmark_tolerance) {
+					printf(" slower than baseline");
+					result = EXIT_FAILURE;
+				}
+			}
+		}
+		putchar('\n');
+		if (save != NULL)
+			fprintf(save, "%s %.2f %.0f\n", filename, mbytes_per_sec,
+			        tokens_per_sec);
+	}
+	ir_timer_free(timer);
+
+	if (baseline != NULL)
+		fclose(baseline);
+	if (save != NULL && fclose(save) != 0) {
+		fprintf(stderr, "Could not write '%s': %s\n", benchmark_save,
+		        strerror(errno));
+		result = EXIT_FAILURE;
+	}
+	return result;
+}
+
+/**
+ * Writes the precompiled version of the header @p filename to @p outname,
+ * or to FILENAME.gch if it is NULL.
+ */
+static int precompile_header(const char *filename, const char *outname)
+{
+	char outnamebuf[4096];
+	if (outname == NULL) {
+		snprintf(outnamebuf, sizeof(outnamebuf), "%s.gch", filename);
+		outname = outnamebuf;
+	}
+
+	FILE *in  = open_file(filename);
+	FILE *out = fopen(outname, "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Could not open '%s' for writing: %s\n", outname,
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	init_tokens();
+	switch_pp_input(in, filename, input_encoding);
+	bool written = write_precompiled_header(out);
+	close_pp_input();
+	if (in != stdin)
+		fclose(in);
+	if (fclose(out) != 0)
+		written = false;
+
+	if (!written)
+		fprintf(stderr, "error: could not write '%s'\n", outname);
+	if (!written || error_count > 0) {
+		unlink(outname);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Writes the preprocessed input to a temporary file and returns it opened
+ * for reading. The compilation cache has to hash the whole input before
+ * compiling it. Returns NULL if preprocessing failed.
+ */
+static FILE *spool_preprocessed_input(FILE *in, const char *filename,
+                                      bool integrated_pp, bool is_pipe)
+{
+	char  tempname[1024];
+	FILE *spool = make_temp_file(tempname, sizeof(tempname), "cci");
+	bool  ok    = true;
+	if (integrated_pp) {
+		init_tokens();
+		switch_pp_input(in, filename, input_encoding);
+		print_preprocessed_input(spool);
+		close_pp_input();
+		fclose(in);
+		ok = error_count == 0;
+	} else {
+		copy_file(spool, in);
+		if (is_pipe) {
+			ok = pclose(in) == EXIT_SUCCESS;
+		} else {
+			fclose(in);
+		}
+	}
+	fclose(spool);
+	if (!ok)
+		return NULL;
+	return open_file(tempname);
+}
+
+/**
+ * Describes everything besides the preprocessed input which influences the
+ * result of a compilation: the compiler, the target, all options except
+ * the names of the input and output files, and the contents of the stage
+ * profile @p pipeline_profile.
+ */
+static const char *get_cache_options(struct obstack *obst, int argc,
+                                     char **argv, compile_mode_t mode,
+                                     const char *pipeline_profile)
+{
+	assert(obstack_object_size(obst) == 0);
+	obstack_printf(obst, "%s %d %s\n", cparser_REVISION, (int) mode,
+	               target_triple != NULL ? target_triple : "host");
+	const char *assembler = getenv("CPARSER_AS");
+	if (assembler != NULL)
+		obstack_printf(obst, "CPARSER_AS=%s\n", assembler);
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (arg[0] != '-' || streq(arg, "-"))
+			continue;
+		if (streq(arg, "-o") || streq(arg, "-MF") || streq(arg, "-MT")
+		    || streq(arg, "-MQ")) {
+			++i;
+			continue;
+		}
+		if (strstart(arg, "-o") || strstart(arg, "-MF")
+		    || strstart(arg, "-MT") || strstart(arg, "-MQ")
+		    || strstart(arg, "-fcache-"))
+			continue;
+		obstack_printf(obst, "%s\n", arg);
+	}
+	if (pipeline_profile != NULL)
+		compile_cache_hash_file(obst, pipeline_profile);
+	obstack_1grow(obst, '\0');
+	return obstack_finish(obst);
+}
+
+/**
+ * Adds the contents of the profile read by the backend for -fprofile-use,
+ * FILENAME.prof, to the options of a compilation of @p filename.
+ */
+static const char *get_profile_cache_options(struct obstack *obst,
+                                             const char *options,
+                                             const char *filename)
+{
+	char profile_name[4096];
+	snprintf(profile_name, sizeof(profile_name), "%s.prof", filename);
+
+	assert(obstack_object_size(obst) == 0);
+	obstack_printf(obst, "%s", options);
+	compile_cache_hash_file(obst, profile_name);
+	obstack_1grow(obst, '\0');
+	return obstack_finish(obst);
+}
+
+/**
+ * Parses the decimal number @p string into @p value.
+ *
+ * @return false if @p string is no number or it does not fit into an
+ *         unsigned int
+ */
+static bool parse_unsigned(const char *string, unsigned *value)
+{
+	if (*string < '0' || *string > '9')
+		return false;
+	errno = 0;
+	char          *end;
+	unsigned long  result = strtoul(string, &end, 10);
+	if (*end != '\0' || errno != 0 || result > UINT_MAX)
+		return false;
+	*value = (unsigned) result;
+	return true;
+}
+
 static filetype_t get_filetype_from_string(const char *string)
 {
-	if (streq(string, "c") || streq(string, "c-header"))
+	if (streq(string, "c"))
 		return FILETYPE_C;
+	if (streq(string, "c-header"))
+		return FILETYPE_C_HEADER;
 	if (streq(string, "c++") || streq(string, "c++-header"))
 		return FILETYPE_CXX;
 	if (streq(string, "assembler"))
@@ -1030,6 +1639,134 @@ static void init_types_and_adjust(void)
 	}
 }
 
+static void add_predefined_number(const char *name, unsigned long long value,
+                                  const char *suffix)
+{
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%llu%s", value, suffix);
+	add_predefined_macro(name, buf);
+}
+
+static void add_predefined_max(const char *name, atomic_type_kind_t kind,
+                               const char *suffix)
+{
+	unsigned           bits  = get_atomic_type_size(kind) * 8;
+	unsigned long long value = ~0ULL >> (sizeof(value) * 8 - bits);
+	if (get_atomic_type_flags(kind) & ATOMIC_TYPE_FLAG_SIGNED)
+		value >>= 1;
+	add_predefined_number(name, value, suffix);
+}
+
+static void add_predefined_size(const char *name, atomic_type_kind_t kind)
+{
+	add_predefined_number(name, get_atomic_type_size(kind), "");
+}
+
+/**
+ * Defines the macros an external gcc would predefine for the target.
+ */
+static void add_predefined_macros(void)
+{
+	add_predefined_macro("__STDC__", "1");
+	add_predefined_macro("__STDC_HOSTED__", freestanding ? "0" : "1");
+	switch (standard) {
+	case STANDARD_C90:
+		add_predefined_macro("__STDC_VERSION__", "199409L");
+		break;
+	case STANDARD_DEFAULT:
+	case STANDARD_C99:
+	case STANDARD_GNU99:
+		add_predefined_macro("__STDC_VERSION__", "199901L");
+		break;
+	default:
+		break;
+	}
+	if (c_mode & _GNUC) {
+		add_predefined_macro("__GNUC__",            "4");
+		add_predefined_macro("__GNUC_MINOR__",      "2");
+		add_predefined_macro("__GNUC_PATCHLEVEL__", "0");
+	}
+	add_predefined_macro("__VERSION__", "\"" cparser_REVISION "\"");
+	add_predefined_macro("__NO_INLINE__", "1");
+
+	/* target architecture */
+	const char *cpu = target_machine->cpu_type;
+	if (is_ia32_cpu(cpu)) {
+		add_predefined_macro("__i386__", "1");
+		add_predefined_macro("__i386",   "1");
+	} else if (streq(cpu, "x86_64")) {
+		add_predefined_macro("__x86_64__", "1");
+		add_predefined_macro("__x86_64",   "1");
+		add_predefined_macro("__amd64__",  "1");
+		add_predefined_macro("__amd64",    "1");
+	} else if (streq(cpu, "sparc")) {
+		add_predefined_macro("__sparc__", "1");
+		add_predefined_macro("__sparc",   "1");
+	} else if (streq(cpu, "arm")) {
+		add_predefined_macro("__arm__", "1");
+	}
+
+	/* operating system */
+	if (firm_is_darwin_os(target_machine)) {
+		add_predefined_macro("__APPLE__", "1");
+		add_predefined_macro("__MACH__",  "1");
+	} else if (firm_is_windows_os(target_machine)) {
+		add_predefined_macro("_WIN32",   "1");
+		add_predefined_macro("__WIN32",  "1");
+		add_predefined_macro("__WIN32__", "1");
+	} else if (firm_is_unixish_os(target_machine)) {
+		add_predefined_macro("__unix__", "1");
+		add_predefined_macro("__unix",   "1");
+		add_predefined_macro("__ELF__",  "1");
+		if (strstr(target_machine->operating_system, "linux") != NULL) {
+			add_predefined_macro("__linux__",     "1");
+			add_predefined_macro("__linux",       "1");
+			add_predefined_macro("__gnu_linux__", "1");
+		}
+	}
+	add_predefined_macro("__USER_LABEL_PREFIX__",
+	                     firm_is_darwin_os(target_machine) ? "_" : "");
+	add_predefined_macro("__REGISTER_PREFIX__", "");
+
+	/* types */
+	add_predefined_macro("__CHAR_BIT__", "8");
+	if (!char_is_signed)
+		add_predefined_macro("__CHAR_UNSIGNED__", "1");
+	add_predefined_macro("__SIZE_TYPE__",    type_to_string(type_size_t));
+	add_predefined_macro("__PTRDIFF_TYPE__", type_to_string(type_ptrdiff_t));
+	add_predefined_macro("__WCHAR_TYPE__",   type_to_string(type_wchar_t));
+	add_predefined_macro("__WINT_TYPE__",    type_to_string(type_wint_t));
+	if (define_intmax_types) {
+		add_predefined_macro("__INTMAX_TYPE__",  type_to_string(type_intmax_t));
+		add_predefined_macro("__UINTMAX_TYPE__", type_to_string(type_uintmax_t));
+	}
+	add_predefined_max("__SCHAR_MAX__",     ATOMIC_TYPE_SCHAR,    "");
+	add_predefined_max("__SHRT_MAX__",      ATOMIC_TYPE_SHORT,    "");
+	add_predefined_max("__INT_MAX__",       ATOMIC_TYPE_INT,      "");
+	add_predefined_max("__LONG_MAX__",      ATOMIC_TYPE_LONG,     "L");
+	add_predefined_max("__LONG_LONG_MAX__", ATOMIC_TYPE_LONGLONG, "LL");
+	add_predefined_max("__WCHAR_MAX__",     wchar_atomic_kind,    "");
+	add_predefined_size("__SIZEOF_SHORT__",       ATOMIC_TYPE_SHORT);
+	add_predefined_size("__SIZEOF_INT__",         ATOMIC_TYPE_INT);
+	add_predefined_size("__SIZEOF_LONG__",        ATOMIC_TYPE_LONG);
+	add_predefined_size("__SIZEOF_LONG_LONG__",   ATOMIC_TYPE_LONGLONG);
+	add_predefined_size("__SIZEOF_FLOAT__",       ATOMIC_TYPE_FLOAT);
+	add_predefined_size("__SIZEOF_DOUBLE__",      ATOMIC_TYPE_DOUBLE);
+	add_predefined_size("__SIZEOF_LONG_DOUBLE__", ATOMIC_TYPE_LONG_DOUBLE);
+	add_predefined_size("__SIZEOF_WCHAR_T__",     wchar_atomic_kind);
+	add_predefined_number("__SIZEOF_SIZE_T__",  get_type_size(type_size_t), "");
+	add_predefined_number("__SIZEOF_POINTER__", get_type_size(type_void_ptr), "");
+	if (get_atomic_type_size(ATOMIC_TYPE_LONG) == 8
+			&& get_type_size(type_void_ptr) == 8) {
+		add_predefined_macro("__LP64__", "1");
+		add_predefined_macro("_LP64",    "1");
+	}
+	add_predefined_macro("__ORDER_LITTLE_ENDIAN__", "1234");
+	add_predefined_macro("__ORDER_BIG_ENDIAN__",    "4321");
+	add_predefined_macro("__BYTE_ORDER__", byte_order_big_endian
+	                     ? "__ORDER_BIG_ENDIAN__" : "__ORDER_LITTLE_ENDIAN__");
+}
+
 int main(int argc, char **argv)
 {
 	const char        *dumpfunction         = NULL;
@@ -1042,8 +1779,12 @@ int main(int argc, char **argv)
 	file_list_entry_t *last_file            = NULL;
 	bool               construct_dep_target = false;
 	bool               do_timing            = false;
+	timer_format_t     timing_format        = TIMER_FORMAT_TEXT;
+	bool               print_cache_stats    = false;
 	bool               profile_generate     = false;
 	bool               profile_use          = false;
+	const char        *pipeline_profile     = NULL;
+	unsigned           n_jobs               = 1;
 	struct obstack     file_obst;
 
 	atexit(free_temp_files);
@@ -1054,10 +1795,21 @@ int main(int argc, char **argv)
 		return pptest_main(argc, argv);
 	}
 
+#ifndef _WIN32
+	/* let a running compile server do the work if there is one */
+	const char *server = getenv("CPARSER_SERVER");
+	if (server != NULL && (argc < 2 || !streq(argv[1], "--server"))) {
+		int server_result;
+		if (compile_server_request(server, argc, argv, &server_result))
+			return server_result;
+	}
+#endif
+
 	obstack_init(&cppflags_obst);
 	obstack_init(&ldflags_obst);
 	obstack_init(&asflags_obst);
 	obstack_init(&file_obst);
+	init_preprocessor();
 
 #define GET_ARG_AFTER(def, args)                                             \
 	do {                                                                     \
@@ -1083,6 +1835,24 @@ int main(int argc, char **argv)
 	/* initialize this early because it has to parse options */
 	gen_firm_init();
 
+	/* the keywords are registered again once the language mode is known */
+	init_symbol_table();
+	init_tokens();
+
+#ifndef _WIN32
+	/* the server only returns in the process handling a request, everything
+	 * initialized up to here is shared by all requests. Setup depending on
+	 * the command line (target, types, builtins) is done per request. */
+	if (argc >= 2 && streq(argv[1], "--server")) {
+		if (argc != 3) {
+			fprintf(stderr, "error: expected socket path after '--server'\n");
+			return EXIT_FAILURE;
+		}
+		if (!compile_server_run(argv[2], &argc, &argv))
+			return EXIT_FAILURE;
+	}
+#endif
+
 	/* early options parsing (find out optimization level and OS) */
 	for (int i = 1; i < argc; ++i) {
 		const char *arg = argv[i];
@@ -1133,14 +1903,17 @@ int main(int argc, char **argv)
 				const char *opt;
 				GET_ARG_AFTER(opt, "-I");
 				add_flag(&cppflags_obst, "-I%s", opt);
+				add_include_path(opt);
 			} else if (option[0] == 'D') {
 				const char *opt;
 				GET_ARG_AFTER(opt, "-D");
 				add_flag(&cppflags_obst, "-D%s", opt);
+				add_define_string(opt);
 			} else if (option[0] == 'U') {
 				const char *opt;
 				GET_ARG_AFTER(opt, "-U");
 				add_flag(&cppflags_obst, "-U%s", opt);
+				add_undefine(opt);
 			} else if (option[0] == 'l') {
 				const char *opt;
 				GET_ARG_AFTER(opt, "-l");
@@ -1154,6 +1927,16 @@ int main(int argc, char **argv)
 			} else if (SINGLE_OPTION('w')) {
 				add_flag(&cppflags_obst, "-w");
 				disable_all_warnings();
+			} else if (option[0] == 'j') {
+				const char *opt;
+				GET_ARG_AFTER(opt, "-j");
+				unsigned jobs;
+				if (!parse_unsigned(opt, &jobs) || jobs == 0) {
+					fprintf(stderr, "error: invalid number of jobs '%s'\n", opt);
+					argument_errors = true;
+				} else {
+					n_jobs = jobs;
+				}
 			} else if (option[0] == 'x') {
 				const char *opt;
 				GET_ARG_AFTER(opt, "-x");
@@ -1162,16 +1945,20 @@ int main(int argc, char **argv)
 					fprintf(stderr, "Unknown language '%s'\n", opt);
 					argument_errors = true;
 				}
-			} else if (streq(option, "M")) {
+			} else if (streq(option, "M") ||
+			           streq(option, "MM")) {
 				mode = PreprocessOnly;
-				add_flag(&cppflags_obst, "-M");
+				add_flag(&cppflags_obst, "-%s", option);
+				dep_only           = true;
+				dep_system_headers = streq(option, "M");
 			} else if (streq(option, "MMD") ||
 			           streq(option, "MD")) {
 			    construct_dep_target = true;
 				add_flag(&cppflags_obst, "-%s", option);
-			} else if (streq(option, "MM")  ||
-			           streq(option, "MP")) {
+				dep_system_headers = streq(option, "MD");
+			} else if (streq(option, "MP")) {
 				add_flag(&cppflags_obst, "-%s", option);
+				dep_phony_targets = true;
 			} else if (streq(option, "MT") ||
 			           streq(option, "MQ") ||
 			           streq(option, "MF")) {
@@ -1179,20 +1966,28 @@ int main(int argc, char **argv)
 				GET_ARG_AFTER(opt, "-MT");
 				add_flag(&cppflags_obst, "-%s", option);
 				add_flag(&cppflags_obst, "%s", opt);
+				if (option[1] == 'F') {
+					dep_file = opt;
+				} else {
+					add_dep_target(opt, option[1] == 'Q');
+				}
 			} else if (streq(option, "include")) {
 				const char *opt;
 				GET_ARG_AFTER(opt, "-include");
 				add_flag(&cppflags_obst, "-include");
 				add_flag(&cppflags_obst, "%s", opt);
+				integrated_cpp = false;
 			} else if (streq(option, "isystem")) {
 				const char *opt;
 				GET_ARG_AFTER(opt, "-isystem");
 				add_flag(&cppflags_obst, "-isystem");
 				add_flag(&cppflags_obst, "%s", opt);
+				add_system_include_path(opt);
 #if defined(linux) || defined(__linux) || defined(__linux__) || defined(__CYGWIN__)
 			} else if (streq(option, "pthread")) {
 				/* set flags for the preprocessor */
 				add_flag(&cppflags_obst, "-D_REENTRANT");
+				add_define_string("_REENTRANT");
 				/* set flags for the linker */
 				add_flag(&ldflags_obst, "-lpthread");
 #endif
@@ -1200,8 +1995,12 @@ int main(int argc, char **argv)
 					|| streq(option, "trigraphs")) {
 				/* pass these through to the preprocessor */
 				add_flag(&cppflags_obst, "%s", arg);
+				if (streq(option, "nostdinc"))
+					no_std_include = true;
+			} else if (streq(option, "no-integrated-cpp")) {
+				integrated_cpp = false;
 			} else if (streq(option, "pipe")) {
-				/* here for gcc compatibility */
+				pipe_to_assembler = true;
 			} else if (streq(option, "static")) {
 				add_flag(&ldflags_obst, "-static");
 			} else if (streq(option, "shared")) {
@@ -1213,6 +2012,37 @@ int main(int argc, char **argv)
 				if (strstart(orig_opt, "input-charset=")) {
 					char const* const encoding = strchr(orig_opt, '=') + 1;
 					input_encoding = encoding;
+				} else if (strstart(orig_opt, "pipeline-profile=")) {
+					pipeline_profile = strchr(orig_opt, '=') + 1;
+				} else if (strstart(orig_opt, "cache-dir=")) {
+					cache_dir = strchr(orig_opt, '=') + 1;
+				} else if (strstart(orig_opt, "token-cache=")) {
+					set_token_cache_dir(strchr(orig_opt, '=') + 1);
+				} else if (strstart(orig_opt, "lexer-threads=")) {
+					const char *val = strchr(orig_opt, '=') + 1;
+					unsigned    threads;
+					if (!parse_unsigned(val, &threads) || threads == 0) {
+						fprintf(stderr, "error: invalid number of lexer threads '%s'\n", val);
+						argument_errors = true;
+					} else {
+						lexer_set_threads(threads);
+					}
+				} else if (strstart(orig_opt, "cache-size=")) {
+					const char *val  = strchr(orig_opt, '=') + 1;
+					char       *end;
+					uint64_t    size = strtoull(val, &end, 10);
+					switch (*end) {
+					case 'G': size <<= 10; /* FALLTHROUGH */
+					case 'M': size <<= 10; /* FALLTHROUGH */
+					case 'K': size <<= 10; ++end; break;
+					default: break;
+					}
+					if (end == val || *end != '\0' || size == 0) {
+						fprintf(stderr, "error: invalid cache size '%s'\n", val);
+						argument_errors = true;
+					} else {
+						cache_max_size = size;
+					}
 				} else if (strstart(orig_opt, "align-loops=") ||
 				           strstart(orig_opt, "align-jumps=") ||
 				           strstart(orig_opt, "align-functions=")) {
@@ -1251,6 +2081,10 @@ int main(int argc, char **argv)
 
 					if (streq(opt, "diagnostics-show-option")) {
 						diagnostics_show_option = truth_value;
+					} else if (streq(opt, "integrated-cpp")) {
+						integrated_cpp = truth_value;
+					} else if (streq(opt, "include-dir-listing")) {
+						set_include_dir_listing(truth_value);
 					} else if (streq(opt, "dollars-in-identifiers")) {
 						allow_dollar_in_symbol = truth_value;
 					} else if (streq(opt, "omit-frame-pointer")) {
@@ -1277,6 +2111,8 @@ int main(int argc, char **argv)
 						profile_generate = truth_value;
 					} else if (streq(opt, "profile-use")) {
 						profile_use = truth_value;
+					} else if (streq(opt, "pipeline-double-buffer")) {
+						plinc_double_buffering = truth_value;
 					} else if (!truth_value &&
 					           streq(opt, "asynchronous-unwind-tables")) {
 					    /* nothing todo, a gcc feature which we do not support
@@ -1328,6 +2164,7 @@ int main(int argc, char **argv)
 					const char *opt;
 					GET_ARG_AFTER(opt, "-Wp,");
 					add_flag(&cppflags_obst, "-Wp,%s", opt);
+					integrated_cpp = false;
 				} else if (strstart(option + 1, "l,")) {
 					// pass options directly to the linker
 					const char *opt;
@@ -1499,8 +2336,34 @@ int main(int argc, char **argv)
 					strict_mode = true;
 				} else if (streq(option, "lextest")) {
 					mode = LexTest;
+				} else if (streq(option, "cache-stats")) {
+					print_cache_stats = true;
 				} else if (streq(option, "benchmark")) {
 					mode = BenchmarkParser;
+				} else if (streq(option, "benchmark-lexer")) {
+					mode = BenchmarkLexer;
+				} else if (strstart(option, "benchmark-runs=")) {
+					const char *val = strchr(option, '=') + 1;
+					unsigned    runs;
+					if (!parse_unsigned(val, &runs) || runs == 0) {
+						fprintf(stderr, "error: invalid number of benchmark runs '%s'\n", val);
+						argument_errors = true;
+					} else {
+						benchmark_runs = runs;
+					}
+				} else if (strstart(option, "benchmark-tolerance=")) {
+					const char *val = strchr(option, '=') + 1;
+					unsigned    tolerance;
+					if (!parse_unsigned(val, &tolerance)) {
+						fprintf(stderr, "error: invalid benchmark tolerance '%s'\n", val);
+						argument_errors = true;
+					} else {
+						benchmark_tolerance = tolerance;
+					}
+				} else if (strstart(option, "benchmark-baseline=")) {
+					benchmark_baseline = strchr(option, '=') + 1;
+				} else if (strstart(option, "benchmark-save=")) {
+					benchmark_save = strchr(option, '=') + 1;
 				} else if (streq(option, "print-ast")) {
 					mode = PrintAst;
 				} else if (streq(option, "print-implicit-cast")) {
@@ -1531,6 +2394,19 @@ int main(int argc, char **argv)
 					jna_set_libname(argv[i]);
 				} else if (streq(option, "time")) {
 					do_timing = true;
+				} else if (strstart(option, "time-report=")) {
+					const char *const format = &option[12];
+					if (streq(format, "text")) {
+						timing_format = TIMER_FORMAT_TEXT;
+					} else if (streq(format, "json")) {
+						timing_format = TIMER_FORMAT_JSON;
+					} else {
+						fprintf(stderr, "error: unknown time report format '%s'\n",
+						        format);
+						argument_errors = true;
+						break;
+					}
+					do_timing = true;
 				} else if (streq(option, "version")) {
 					print_cparser_version();
 					return EXIT_SUCCESS;
@@ -1600,7 +2476,7 @@ int main(int argc, char **argv)
 							streq(suffix, "cxx") ? FILETYPE_CXX                    :
 							streq(suffix, "c++") ? FILETYPE_CXX                    :
 							streq(suffix, "ii")  ? FILETYPE_PREPROCESSED_CXX       :
-							streq(suffix, "h")   ? FILETYPE_C                      :
+							streq(suffix, "h")   ? FILETYPE_C_HEADER               :
 							streq(suffix, "ir")  ? FILETYPE_IR                     :
 							streq(suffix, "o")   ? FILETYPE_OBJECT                 :
 							streq(suffix, "s")   ? FILETYPE_PREPROCESSED_ASSEMBLER :
@@ -1634,6 +2510,16 @@ int main(int argc, char **argv)
 		print_file_name(print_file_name_file);
 		return EXIT_SUCCESS;
 	}
+	if (cache_dir != NULL)
+		compile_cache_init(cache_dir, cache_max_size);
+	if (print_cache_stats) {
+		if (cache_dir == NULL) {
+			fprintf(stderr, "error: --cache-stats needs -fcache-dir\n");
+			return EXIT_FAILURE;
+		}
+		compile_cache_print_stats(stdout);
+		return EXIT_SUCCESS;
+	}
 	if (files == NULL) {
 		fprintf(stderr, "error: no input files specified\n");
 		argument_errors = true;
@@ -1655,7 +2541,6 @@ int main(int argc, char **argv)
 		set_be_option("profileuse");
 	}
 
-	init_symbol_table();
 	init_types_and_adjust();
 	init_typehash();
 	init_basic_types();
@@ -1666,16 +2551,67 @@ int main(int argc, char **argv)
 	else
 		panic("unexpected wchar type");
 	init_lexer();
+	add_predefined_macros();
+	if (!no_std_include)
+		setup_include_path();
 	init_ast();
 	init_parser();
 	init_ast2firm();
 	init_mangle();
+	init_plinc_profile();
 
-	if (do_timing)
+	if (pipeline_profile != NULL && !plinc_profile_load(pipeline_profile))
+		return EXIT_FAILURE;
+
+	if (do_timing) {
 		timer_init();
+		timer_watch_obstack(&ast_obstack);
+		timer_watch_obstack(&symbol_obstack);
+	}
+
+	bool     temp_outname = false;
+	unsigned n_units      = 0;
+	unsigned n_ir_files   = 0;
+	for (file_list_entry_t *file = files; file != NULL; file = file->next) {
+		if (file->type == FILETYPE_IR)
+			++n_ir_files;
+		else if (file->type != FILETYPE_OBJECT)
+			++n_units;
+	}
+	/* several IR files are merged into one program */
+	if (n_ir_files > 1 && n_units > 0) {
+		fprintf(stderr, "error: several IR files cannot be compiled together with other sources\n");
+		return EXIT_FAILURE;
+	}
+	bool link_ir_files = n_ir_files > 1;
+	if (n_ir_files > 0)
+		++n_units;
+	if (n_units > 1 && is_separately_compilable(mode)) {
+#ifndef _WIN32
+		if (outname != NULL && mode != CompileAssembleLink) {
+			fprintf(stderr, "error: cannot specify -o with -c or -S with multiple files\n");
+			return EXIT_FAILURE;
+		}
+
+		const char        *worker_outname;
+		file_list_entry_t *unit = compile_in_workers(files, n_jobs, mode,
+				&file_obst, &worker_outname, &result);
+		if (unit != NULL) {
+			/* we are a worker: compile the unit as if it was the only one */
+			files   = unit;
+			outname = worker_outname;
+			if (mode == CompileAssembleLink) {
+				mode         = CompileAssemble;
+				temp_outname = true;
+			}
+		} else if (result != EXIT_SUCCESS || mode != CompileAssembleLink) {
+			return result;
+		}
+#endif
+	}
 
 	if (construct_dep_target) {
-		if (outname != 0 && strlen(outname) >= 2) {
+		if (outname != 0 && strlen(outname) >= 2 && !temp_outname) {
 			get_output_name(dep_target, sizeof(dep_target), outname, ".d");
 		} else {
 			get_output_name(dep_target, sizeof(dep_target), files->name, ".d");
@@ -1684,11 +2620,23 @@ int main(int argc, char **argv)
 		dep_target[0] = '\0';
 	}
 
+	/* a header on its own is precompiled instead of compiled */
+	if (files->type == FILETYPE_C_HEADER && files->next == NULL
+	    && use_integrated_cpp(FILETYPE_C_HEADER)
+	    && (mode == Compile || mode == CompileAssemble
+	        || mode == CompileAssembleLink)) {
+		return precompile_header(files->name, outname);
+	}
+
+	if (mode == BenchmarkLexer)
+		return benchmark_lexer(files);
+
 	char outnamebuf[4096];
 	if (outname == NULL) {
 		const char *filename = files->name;
 
 		switch(mode) {
+		case BenchmarkLexer:
 		case BenchmarkParser:
 		case PrintAst:
 		case PrintFluffy:
@@ -1741,6 +2689,7 @@ int main(int argc, char **argv)
 
 	file_list_entry_t *file;
 	bool               already_constructed_firm = false;
+	const char        *cache_options            = NULL;
 	for (file = files; file != NULL; file = file->next) {
 		char        asm_tempfile[1024];
 		const char *filename = file->name;
@@ -1749,6 +2698,17 @@ int main(int argc, char **argv)
 		if (filetype == FILETYPE_OBJECT)
 			continue;
 
+		/* all but the last IR file are only imported, the last one
+		 * completes the program */
+		if (filetype == FILETYPE_IR && n_ir_files > 1) {
+			if (ir_import(filename) != 0) {
+				fprintf(stderr, "Firm-Program import failed\n");
+				return EXIT_FAILURE;
+			}
+			--n_ir_files;
+			continue;
+		}
+
 		FILE *in = NULL;
 		if (mode == LexTest) {
 			if (in == NULL)
@@ -1759,11 +2719,43 @@ int main(int argc, char **argv)
 		}
 
 		FILE *preprocessed_in = NULL;
+		bool       integrated_pp = false;
 		filetype_t next_filetype = filetype;
 		switch (filetype) {
+			case FILETYPE_C_HEADER:
 			case FILETYPE_C:
 				next_filetype = FILETYPE_PREPROCESSED_C;
-				goto preprocess;
+				if (!use_integrated_cpp(filetype))
+					goto preprocess;
+
+				in = open_file(filename);
+				begin_dependencies(construct_dep_target);
+				if (mode == PreprocessOnly) {
+					init_tokens();
+					switch_pp_input(in, filename, input_encoding);
+					if (dep_only) {
+						skip_preprocessed_input();
+					} else {
+						print_preprocessed_input(out);
+					}
+					close_pp_input();
+					fclose(in);
+					if (error_count == 0
+					    && !finish_dependencies(filename, mode, out))
+						++error_count;
+					fclose(out);
+					if (error_count > 0) {
+						/* remove output file in case of error */
+						if (out != stdout)
+							unlink(outname);
+						return EXIT_FAILURE;
+					}
+					return EXIT_SUCCESS;
+				}
+
+				integrated_pp = true;
+				filetype      = next_filetype;
+				break;
 			case FILETYPE_CXX:
 				next_filetype = FILETYPE_PREPROCESSED_CXX;
 				goto preprocess;
@@ -1795,10 +2787,75 @@ preprocess:
 				break;
 		}
 
-		FILE *asm_out;
-		if (mode == Compile) {
+		/* a cached result replaces parsing and code generation */
+		char     cache_key[COMPILE_CACHE_KEY_SIZE];
+		unsigned cache_warnings = 0;
+		bool     use_cache = cache_dir != NULL
+		                  && filetype == FILETYPE_PREPROCESSED_C
+		                  && (mode == Compile || mode == CompileAssemble
+		                      || mode == CompileAssembleLink);
+		if (use_cache) {
+			if (in == NULL) {
+				in = open_file(filename);
+			} else {
+				in = spool_preprocessed_input(in, filename, integrated_pp,
+				                              in == preprocessed_in);
+				preprocessed_in = NULL;
+				integrated_pp   = false;
+				if (in == NULL || !finish_dependencies(filename, mode, out)) {
+					result = EXIT_FAILURE;
+					continue;
+				}
+			}
+			if (cache_options == NULL) {
+				cache_options = get_cache_options(&file_obst, argc, argv, mode,
+				                                  pipeline_profile);
+			}
+			const char *options = cache_options;
+			if (profile_use) {
+				options = get_profile_cache_options(&file_obst, cache_options,
+				                                    filename);
+			}
+			compile_cache_key(cache_key, in, options);
+			/* a hit cannot repeat the warnings of the compilation, so only
+			 * compilations without warnings are stored */
+			cache_warnings = warning_count;
+
+			if (mode == Compile) {
+				if (compile_cache_fetch(cache_key, ".s", out)) {
+					fclose(in);
+					continue;
+				}
+			} else {
+				char        temp[1024];
+				const char *filename_o = outname;
+				FILE       *obj        = out;
+				if (mode == CompileAssembleLink) {
+					obj        = make_temp_file(temp, sizeof(temp), "cco");
+					filename_o = temp;
+				}
+				bool hit = compile_cache_fetch(cache_key, ".o", obj);
+				if (obj != out || hit)
+					fclose(obj);
+				if (hit) {
+					fclose(in);
+					size_t len = strlen(filename_o) + 1;
+					file->name = obstack_copy(&file_obst, filename_o, len);
+					file->type = FILETYPE_OBJECT;
+					continue;
+				}
+			}
+		}
+
+		bool        pipe_asm   = pipe_to_assembler
+		                      && (mode == CompileAssemble
+		                          || mode == CompileAssembleLink);
+		const char *filename_o = NULL;
+		char        obj_tempfile[1024];
+		FILE       *asm_out    = NULL;
+		if (mode == Compile && !use_cache) {
 			asm_out = out;
-		} else {
+		} else if (!pipe_asm) {
 			asm_out = make_temp_file(asm_tempfile, sizeof(asm_tempfile), "ccs");
 		}
 
@@ -1857,7 +2914,7 @@ do_parsing:
 			timer_register(t_parsing, "Frontend: Parsing");
 			timer_push(t_parsing);
 			init_tokens();
-			translation_unit_t *const unit = do_parsing(in, filename);
+			translation_unit_t *const unit = do_parsing(in, filename, integrated_pp);
 			timer_pop(t_parsing);
 
 			/* prints the AST even if errors occurred */
@@ -1876,6 +2933,11 @@ do_parsing:
 				fprintf(stderr, "%u warning(s)\n", warning_count);
 			}
 
+			if (!finish_dependencies(filename, mode, out)) {
+				result = EXIT_FAILURE;
+				continue;
+			}
+
 			if (in == preprocessed_in) {
 				int pp_result = pclose(preprocessed_in);
 				if (pp_result != EXIT_SUCCESS) {
@@ -1947,8 +3009,15 @@ graph_built:
 				return EXIT_SUCCESS;
 			}
 
+			if (pipe_asm) {
+				filename_o = get_object_name(mode, out, obj_tempfile,
+				                             sizeof(obj_tempfile));
+				asm_out    = open_assembler_pipe(filename_o);
+			}
 			generate_code(asm_out, filename);
-			if (asm_out != out) {
+			if (pipe_asm) {
+				close_assembler_pipe(asm_out, filename_o);
+			} else if (asm_out != out) {
 				fclose(asm_out);
 			}
 		} else if (filetype == FILETYPE_IR) {
@@ -1958,25 +3027,44 @@ graph_built:
 				fprintf(stderr, "Firm-Program import failed\n");
 				return EXIT_FAILURE;
 			}
+			if (link_ir_files && !link_imported_entities())
+				return EXIT_FAILURE;
 			goto graph_built;
 		} else if (filetype == FILETYPE_PREPROCESSED_ASSEMBLER) {
+			if (pipe_asm) {
+				filename_o = get_object_name(mode, out, obj_tempfile,
+				                             sizeof(obj_tempfile));
+				asm_out    = open_assembler_pipe(filename_o);
+			}
 			copy_file(asm_out, in);
 			if (in == preprocessed_in) {
 				int pp_result = pclose(preprocessed_in);
 				if (pp_result != EXIT_SUCCESS) {
 					/* remove output in error case */
+					if (pipe_asm)
+						abort_assembler_pipe(asm_out, filename_o);
 					if (out != stdout)
 						unlink(outname);
 					return pp_result;
 				}
 			}
-			if (asm_out != out) {
+			if (pipe_asm) {
+				close_assembler_pipe(asm_out, filename_o);
+			} else if (asm_out != out) {
 				fclose(asm_out);
 			}
 		}
 
-		if (mode == Compile)
+		if (mode == Compile) {
+			if (use_cache) {
+				if (warning_count == cache_warnings)
+					compile_cache_store(cache_key, ".s", asm_tempfile);
+				FILE *asm_in = open_file(asm_tempfile);
+				copy_file(out, asm_in);
+				fclose(asm_in);
+			}
 			continue;
+		}
 
 		/* if we're here then we have preprocessed assembly */
 		filename = asm_tempfile;
@@ -1984,18 +3072,14 @@ graph_built:
 
 		/* assemble */
 		if (filetype == FILETYPE_PREPROCESSED_ASSEMBLER) {
-			char        temp[1024];
-			const char *filename_o;
-			if (mode == CompileAssemble) {
-				fclose(out);
-				filename_o = outname;
-			} else {
-				FILE *tempf = make_temp_file(temp, sizeof(temp), "cco");
-				fclose(tempf);
-				filename_o = temp;
+			/* with -pipe the assembler already ran during code generation */
+			if (!pipe_asm) {
+				filename_o = get_object_name(mode, out, obj_tempfile,
+				                             sizeof(obj_tempfile));
+				assemble(filename_o, filename);
 			}
-
-			assemble(filename_o, filename);
+			if (use_cache && warning_count == cache_warnings)
+				compile_cache_store(cache_key, ".o", filename_o);
 
 			size_t len = strlen(filename_o) + 1;
 			filename = obstack_copy(&file_obst, filename_o, len);
@@ -2054,7 +3138,7 @@ graph_built:
 	}
 
 	if (do_timing)
-		timer_term(stderr);
+		timer_term(stderr, timing_format);
 
 	obstack_free(&cppflags_obst, NULL);
 	obstack_free(&ldflags_obst, NULL);
@@ -2062,14 +3146,17 @@ graph_built:
 	obstack_free(&file_obst, NULL);
 
 	gen_firm_finish();
+	exit_plinc_profile();
 	exit_mangle();
 	exit_ast2firm();
 	exit_parser();
 	exit_ast();
 	exit_lexer();
+	exit_preprocessor();
 	exit_typehash();
 	exit_types();
 	exit_tokens();
+	exit_source_positions();
 	exit_symbol_table();
 	return EXIT_SUCCESS;
 }
@@ -43,9 +43,13 @@
 #include "adt/bitfiddle.h"
 #include "adt/error.h"
 #include "adt/array.h"
+#include "driver/firm_timing.h"
 
 //#define PRINT_TOKENS
-#define MAX_LOOKAHEAD 1
+/** Number of tokens in the token window, a power of two. */
+#define TOKEN_WINDOW_SIZE 8
+/** How far look_ahead() can see beyond the current token. */
+#define MAX_LOOKAHEAD     (TOKEN_WINDOW_SIZE - 1)
 
 typedef struct {
 	entity_t           *old_entity;
@@ -77,12 +81,16 @@ typedef struct parse_initializer_env_t {
 
 typedef entity_t* (*parsed_declaration_func) (entity_t *declaration, bool is_definition);
 
-/** The current token. */
-static token_t              token;
-/** The lookahead ring-buffer. */
-static token_t              lookahead_buffer[MAX_LOOKAHEAD];
-/** Position of the next token in the lookahead buffer. */
-static size_t               lookahead_bufpos;
+/** The current token, it lives in the token window. */
+static const token_t       *token;
+/** Ring of the current token and the tokens looked ahead at. */
+static token_t              token_window[TOKEN_WINDOW_SIZE];
+/** Position of the current token in the token window. */
+static size_t               token_window_pos;
+/** Number of tokens lexed beyond the current token. */
+static size_t               token_window_ahead;
+/** Timer for fetching tokens, only set if timing is enabled. */
+static ir_timer_t          *t_lexing          = NULL;
 static stack_entry_t       *environment_stack = NULL;
 static stack_entry_t       *label_stack       = NULL;
 static scope_t             *file_scope        = NULL;
@@ -139,7 +147,7 @@ static symbol_t *sym_anonymous = NULL;
 static unsigned short token_anchor_set[T_LAST_TOKEN];
 
 /** The current source position. */
-#define HERE (&token.base.source_position)
+#define HERE (&token->base.source_position)
 
 /** true if we are in GCC mode. */
 #define GNU_MODE ((c_mode & _GNUC) || in_gcc_extension)
@@ -376,7 +384,7 @@ static statement_t *allocate_statement_zero(statement_kind_t kind)
 
 	res->base.kind            = kind;
 	res->base.parent          = current_parent;
-	res->base.source_position = token.base.source_position;
+	res->base.source_position = token->base.source_position;
 	return res;
 }
 
@@ -393,7 +401,7 @@ static expression_t *allocate_expression_zero(expression_kind_t kind)
 
 	res->base.kind            = kind;
 	res->base.type            = type_error_type;
-	res->base.source_position = token.base.source_position;
+	res->base.source_position = token->base.source_position;
 	return res;
 }
 
@@ -471,26 +479,46 @@ static size_t label_top(void)
 	return ARR_LEN(label_stack);
 }
 
+/**
+ * Lexes the token @p offset tokens behind the current one into the token
+ * window.
+ */
+static void lex_into_window(size_t offset)
+{
+	if (UNLIKELY(t_lexing != NULL)) {
+		timer_push(t_lexing);
+		lexer_next_token();
+		timer_pop(t_lexing);
+	} else {
+		lexer_next_token();
+	}
+	size_t const pos = (token_window_pos + offset) & (TOKEN_WINDOW_SIZE - 1);
+	token_window[pos] = lexer_token;
+}
+
 /**
  * Return the next token.
  */
 static inline void next_token(void)
 {
-	token                              = lookahead_buffer[lookahead_bufpos];
-	lookahead_buffer[lookahead_bufpos] = lexer_token;
-	lexer_next_token();
-
-	lookahead_bufpos = (lookahead_bufpos + 1) % MAX_LOOKAHEAD;
+	token_window_pos = (token_window_pos + 1) & (TOKEN_WINDOW_SIZE - 1);
+	token            = &token_window[token_window_pos];
+	/* tokens already looked at are not lexed again */
+	if (token_window_ahead > 0) {
+		--token_window_ahead;
+	} else {
+		lex_into_window(0);
+	}
 
 #ifdef PRINT_TOKENS
-	print_token(stderr, &token);
+	print_token(stderr, token);
 	fprintf(stderr, "\n");
 #endif
 }
 
 static inline bool next_if(int const type)
 {
-	if (token.kind == type) {
+	if (token->kind == type) {
 		next_token();
 		return true;
 	} else {
@@ -504,8 +532,12 @@ static inline bool next_if(int const type)
 static inline const token_t *look_ahead(size_t num)
 {
 	assert(0 < num && num <= MAX_LOOKAHEAD);
-	size_t pos = (lookahead_bufpos + num - 1) % MAX_LOOKAHEAD;
-	return &lookahead_buffer[pos];
+	while (token_window_ahead < num) {
+		++token_window_ahead;
+		lex_into_window(token_window_ahead);
+	}
+	size_t pos = (token_window_pos + num) & (TOKEN_WINDOW_SIZE - 1);
+	return &token_window[pos];
 }
 
 /**
@@ -554,9 +586,9 @@ static void rem_anchor_token(int token_kind)
  */
 static bool at_anchor(void)
 {
-	if (token.kind < 0)
+	if (token->kind < 0)
 		return false;
-	return token_anchor_set[token.kind];
+	return token_anchor_set[token->kind];
 }
 
 /**
@@ -575,11 +607,11 @@ static void eat_until_matching_token(int type)
 	unsigned parenthesis_count = 0;
 	unsigned brace_count       = 0;
 	unsigned bracket_count     = 0;
-	while (token.kind        != end_token ||
+	while (token->kind       != end_token ||
 	       parenthesis_count != 0         ||
 	       brace_count       != 0         ||
 	       bracket_count     != 0) {
-		switch (token.kind) {
+		switch (token->kind) {
 		case T_EOF: return;
 		case '(': ++parenthesis_count; break;
 		case '{': ++brace_count;       break;
@@ -599,7 +631,7 @@ static void eat_until_matching_token(int type)
 			if (bracket_count > 0)
 				--bracket_count;
 check_stop:
-			if (token.kind        == end_token &&
+			if (token->kind       == end_token &&
 			    parenthesis_count == 0         &&
 			    brace_count       == 0         &&
 			    bracket_count     == 0)
@@ -618,9 +650,9 @@ check_stop:
  */
 static void eat_until_anchor(void)
 {
-	while (token_anchor_set[token.kind] == 0) {
-		if (token.kind == '(' || token.kind == '{' || token.kind == '[')
-			eat_until_matching_token(token.kind);
+	while (token_anchor_set[token->kind] == 0) {
+		if (token->kind == '(' || token->kind == '{' || token->kind == '[')
+			eat_until_matching_token(token->kind);
 		next_token();
 	}
 }
@@ -634,7 +666,7 @@ static void eat_block(void)
 	next_if('}');
 }
 
-#define eat(token_kind) (assert(token.kind == (token_kind)), next_token())
+#define eat(token_kind) (assert(token->kind == (token_kind)), next_token())
 
 /**
  * Report a parse error because an expected token was not found.
@@ -650,7 +682,7 @@ void parse_error_expected(const char *message, ...)
 	}
 	va_list ap;
 	va_start(ap, message);
-	errorf(HERE, "got %K, expected %#k", &token, &ap, ", ");
+	errorf(HERE, "got %K, expected %#k", token, &ap, ", ");
 	va_end(ap);
 }
 
@@ -671,12 +703,12 @@ static void type_error_incompatible(const char *msg,
  */
 #define expect(expected, error_label)                     \
 	do {                                                  \
-		if (UNLIKELY(token.kind != (expected))) {         \
+		if (UNLIKELY(token->kind != (expected))) {         \
 			parse_error_expected(NULL, (expected), NULL); \
 			add_anchor_token(expected);                   \
 			eat_until_anchor();                           \
 			rem_anchor_token(expected);                   \
-			if (token.kind != (expected))                 \
+			if (token->kind != (expected))                 \
 			  goto error_label;                           \
 		}                                                 \
 		next_token();                                     \
@@ -774,7 +806,7 @@ static void stack_push(stack_entry_t **stack_ptr, entity_t *entity)
  */
 static void environment_push(entity_t *entity)
 {
-	assert(entity->base.source_position.input_name != NULL);
+	assert(has_source_position(entity->base.source_position));
 	assert(entity->base.parent_scope != NULL);
 	stack_push(&environment_stack, entity);
 }
@@ -1061,14 +1093,14 @@ static void warn_string_concat(const source_position_t *pos)
 
 static string_t parse_string_literals(void)
 {
-	assert(token.kind == T_STRING_LITERAL);
-	string_t result = token.string.string;
+	assert(token->kind == T_STRING_LITERAL);
+	string_t result = token->string.string;
 
 	next_token();
 
-	while (token.kind == T_STRING_LITERAL) {
-		warn_string_concat(&token.base.source_position);
-		result = concat_strings(&result, &token.string.string);
+	while (token->kind == T_STRING_LITERAL) {
+		warn_string_concat(&token->base.source_position);
+		result = concat_strings(&result, &token->string.string);
 		next_token();
 	}
 
@@ -1115,13 +1147,13 @@ static attribute_argument_t *parse_attribute_arguments(void)
 {
 	attribute_argument_t  *first  = NULL;
 	attribute_argument_t **anchor = &first;
-	if (token.kind != ')') do {
+	if (token->kind != ')') do {
 		attribute_argument_t *argument = allocate_ast_zero(sizeof(*argument));
 
 		/* is it an identifier */
-		if (token.kind == T_IDENTIFIER
+		if (token->kind == T_IDENTIFIER
 				&& (look_ahead(1)->kind == ',' || look_ahead(1)->kind == ')')) {
-			symbol_t *symbol   = token.identifier.symbol;
+			symbol_t *symbol   = token->identifier.symbol;
 			argument->kind     = ATTRIBUTE_ARGUMENT_SYMBOL;
 			argument->v.symbol = symbol;
 			next_token();
@@ -1161,9 +1193,9 @@ end_error:
 
 static symbol_t *get_symbol_from_token(void)
 {
-	switch(token.kind) {
+	switch(token->kind) {
 	case T_IDENTIFIER:
-		return token.identifier.symbol;
+		return token->identifier.symbol;
 	case T_auto:
 	case T_char:
 	case T_double:
@@ -1193,7 +1225,7 @@ static symbol_t *get_symbol_from_token(void)
 	case T_volatile:
 	case T_inline:
 		/* maybe we need more tokens ... add them on demand */
-		return get_token_kind_symbol(token.kind);
+		return get_token_kind_symbol(token->kind);
 	default:
 		return NULL;
 	}
@@ -1242,7 +1274,7 @@ static attribute_t *parse_attribute_gnu(void)
 	expect('(', end_error);
 	expect('(', end_error);
 
-	if (token.kind != ')') do {
+	if (token->kind != ')') do {
 		attribute_t *attribute = parse_attribute_gnu_single();
 		if (attribute == NULL)
 			goto end_error;
@@ -1266,7 +1298,7 @@ static attribute_t *parse_attributes(attribute_t *first)
 			anchor = &(*anchor)->next;
 
 		attribute_t *attribute;
-		switch (token.kind) {
+		switch (token->kind) {
 		case T___attribute__:
 			attribute = parse_attribute_gnu();
 			if (attribute == NULL)
@@ -1299,7 +1331,7 @@ static attribute_t *parse_attributes(attribute_t *first)
 
 		case T___thiscall:
 			/* TODO record modifier */
-			warningf(WARN_OTHER, HERE, "Ignoring declaration modifier %K", &token);
+			warningf(WARN_OTHER, HERE, "Ignoring declaration modifier %K", token);
 			attribute = allocate_attribute_zero(ATTRIBUTE_MS_THISCALL);
 			eat(T___thiscall);
 			break;
@@ -1552,10 +1584,10 @@ static designator_t *parse_designation(void)
 
 	for (;;) {
 		designator_t *designator;
-		switch (token.kind) {
+		switch (token->kind) {
 		case '[':
 			designator = allocate_ast_zero(sizeof(designator[0]));
-			designator->source_position = token.base.source_position;
+			designator->source_position = token->base.source_position;
 			next_token();
 			add_anchor_token(']');
 			designator->array_index = parse_constant_expression();
@@ -1564,14 +1596,14 @@ static designator_t *parse_designation(void)
 			break;
 		case '.':
 			designator = allocate_ast_zero(sizeof(designator[0]));
-			designator->source_position = token.base.source_position;
+			designator->source_position = token->base.source_position;
 			next_token();
-			if (token.kind != T_IDENTIFIER) {
+			if (token->kind != T_IDENTIFIER) {
 				parse_error_expected("while parsing designator",
 				                     T_IDENTIFIER, NULL);
 				return NULL;
 			}
-			designator->symbol = token.identifier.symbol;
+			designator->symbol = token->identifier.symbol;
 			next_token();
 			break;
 		default:
@@ -1678,12 +1710,12 @@ static initializer_t *parse_scalar_initializer(type_t *type,
 {
 	/* there might be extra {} hierarchies */
 	int braces = 0;
-	if (token.kind == '{') {
+	if (token->kind == '{') {
 		warningf(WARN_OTHER, HERE, "extra curly braces around scalar initializer");
 		do {
 			eat('{');
 			++braces;
-		} while (token.kind == '{');
+		} while (token->kind == '{');
 	}
 
 	expression_t *expression = parse_assignment_expression();
@@ -1707,7 +1739,7 @@ static initializer_t *parse_scalar_initializer(type_t *type,
 	bool additional_warning_displayed = false;
 	while (braces > 0) {
 		next_if(',');
-		if (token.kind != '}') {
+		if (token->kind != '}') {
 			if (!additional_warning_displayed) {
 				warningf(WARN_OTHER, HERE, "additional elements in scalar initializer");
 				additional_warning_displayed = true;
@@ -1999,10 +2031,10 @@ static void skip_initializers(void)
 {
 	next_if('{');
 
-	while (token.kind != '}') {
-		if (token.kind == T_EOF)
+	while (token->kind != '}') {
+		if (token->kind == T_EOF)
 			return;
-		if (token.kind == '{') {
+		if (token->kind == '{') {
 			eat_block();
 			continue;
 		}
@@ -2024,7 +2056,7 @@ static initializer_t *parse_sub_initializer(type_path_t *path,
 		type_t *outer_type, size_t top_path_level,
 		parse_initializer_env_t *env)
 {
-	if (token.kind == '}') {
+	if (token->kind == '}') {
 		/* empty initializer */
 		return create_empty_initializer();
 	}
@@ -2042,14 +2074,14 @@ static initializer_t *parse_sub_initializer(type_path_t *path,
 
 	while (true) {
 		designator_t *designator = NULL;
-		if (token.kind == '.' || token.kind == '[') {
+		if (token->kind == '.' || token->kind == '[') {
 			designator = parse_designation();
 			goto finish_designator;
-		} else if (token.kind == T_IDENTIFIER && look_ahead(1)->kind == ':') {
+		} else if (token->kind == T_IDENTIFIER && look_ahead(1)->kind == ':') {
 			/* GNU-style designator ("identifier: value") */
 			designator = allocate_ast_zero(sizeof(designator[0]));
-			designator->source_position = token.base.source_position;
-			designator->symbol          = token.identifier.symbol;
+			designator->source_position = token->base.source_position;
+			designator->symbol          = token->identifier.symbol;
 			eat(T_IDENTIFIER);
 			eat(':');
 
@@ -2072,7 +2104,7 @@ finish_designator:
 
 		initializer_t *sub;
 
-		if (token.kind == '{') {
+		if (token->kind == '{') {
 			if (type != NULL && is_type_scalar(type)) {
 				sub = parse_scalar_initializer(type, env->must_be_constant);
 			} else {
@@ -2140,7 +2172,7 @@ finish_designator:
 				sub = initializer_from_expression(outer_type, expression);
 				if (sub != NULL) {
 					next_if(',');
-					if (token.kind != '}') {
+					if (token->kind != '}') {
 						warningf(WARN_OTHER, HERE, "excessive elements in initializer for type '%T'", orig_type);
 					}
 					/* TODO: eat , ... */
@@ -2185,11 +2217,11 @@ finish_designator:
 		ARR_APP1(initializer_t*, initializers, sub);
 
 error_parse_next:
-		if (token.kind == '}') {
+		if (token->kind == '}') {
 			break;
 		}
 		expect(',', end_error);
-		if (token.kind == '}') {
+		if (token->kind == '}') {
 			break;
 		}
 
@@ -2248,7 +2280,7 @@ static initializer_t *parse_initializer(parse_initializer_env_t *env)
 
 	if (is_type_scalar(type)) {
 		result = parse_scalar_initializer(type, env->must_be_constant);
-	} else if (token.kind == '{') {
+	} else if (token->kind == '{') {
 		eat('{');
 
 		type_path_t path;
@@ -2335,31 +2367,31 @@ static compound_t *parse_compound_type_specifier(bool is_struct)
 	entity_t    *entity     = NULL;
 	attribute_t *attributes = NULL;
 
-	if (token.kind == T___attribute__) {
+	if (token->kind == T___attribute__) {
 		attributes = parse_attributes(NULL);
 	}
 
 	entity_kind_tag_t const kind = is_struct ? ENTITY_STRUCT : ENTITY_UNION;
-	if (token.kind == T_IDENTIFIER) {
+	if (token->kind == T_IDENTIFIER) {
 		/* the compound has a name, check if we have seen it already */
-		symbol = token.identifier.symbol;
+		symbol = token->identifier.symbol;
 		entity = get_tag(symbol, kind);
 		next_token();
 
 		if (entity != NULL) {
 			if (entity->base.parent_scope != current_scope &&
-			    (token.kind == '{' || token.kind == ';')) {
+			    (token->kind == '{' || token->kind == ';')) {
 				/* we're in an inner scope and have a definition. Shadow
 				 * existing definition in outer scope */
 				entity = NULL;
-			} else if (entity->compound.complete && token.kind == '{') {
+			} else if (entity->compound.complete && token->kind == '{') {
 				source_position_t const *const ppos = &entity->base.source_position;
 				errorf(&pos, "multiple definitions of '%N' (previous definition %P)", entity, ppos);
 				/* clear members in the hope to avoid further errors */
 				entity->compound.members.entities = NULL;
 			}
 		}
-	} else if (token.kind != '{') {
+	} else if (token->kind != '{') {
 		char const *const msg =
 			is_struct ? "while parsing struct type specifier" :
 			            "while parsing union type specifier";
@@ -2379,7 +2411,7 @@ static compound_t *parse_compound_type_specifier(bool is_struct)
 		append_entity(current_scope, entity);
 	}
 
-	if (token.kind == '{') {
+	if (token->kind == '{') {
 		parse_compound_type_entries(&entity->compound);
 
 		/* ISO/IEC 14882:1998(E) §7.1.3:5 */
@@ -2400,7 +2432,7 @@ static void parse_enum_entries(type_t *const enum_type)
 {
 	eat('{');
 
-	if (token.kind == '}') {
+	if (token->kind == '}') {
 		errorf(HERE, "empty enum not allowed");
 		next_token();
 		return;
@@ -2408,18 +2440,18 @@ static void parse_enum_entries(type_t *const enum_type)
 
 	add_anchor_token('}');
 	do {
-		if (token.kind != T_IDENTIFIER) {
+		if (token->kind != T_IDENTIFIER) {
 			parse_error_expected("while parsing enum entry", T_IDENTIFIER, NULL);
 			eat_block();
 			rem_anchor_token('}');
 			return;
 		}
 
-		symbol_t *symbol       = token.identifier.symbol;
+		symbol_t *symbol       = token->identifier.symbol;
 		entity_t *const entity
 			= allocate_entity_zero(ENTITY_ENUM_VALUE, NAMESPACE_NORMAL, symbol);
 		entity->enum_value.enum_type = enum_type;
-		entity->base.source_position = token.base.source_position;
+		entity->base.source_position = token->base.source_position;
 		next_token();
 
 		if (next_if('=')) {
@@ -2432,7 +2464,7 @@ static void parse_enum_entries(type_t *const enum_type)
 		}
 
 		record_entity(entity, false);
-	} while (next_if(',') && token.kind != '}');
+	} while (next_if(',') && token->kind != '}');
 	rem_anchor_token('}');
 
 	expect('}', end_error);
@@ -2448,19 +2480,19 @@ static type_t *parse_enum_specifier(void)
 	symbol_t               *symbol;
 
 	eat(T_enum);
-	switch (token.kind) {
+	switch (token->kind) {
 		case T_IDENTIFIER:
-			symbol = token.identifier.symbol;
+			symbol = token->identifier.symbol;
 			entity = get_tag(symbol, ENTITY_ENUM);
 			next_token();
 
 			if (entity != NULL) {
 				if (entity->base.parent_scope != current_scope &&
-						(token.kind == '{' || token.kind == ';')) {
+						(token->kind == '{' || token->kind == ';')) {
 					/* we're in an inner scope and have a definition. Shadow
 					 * existing definition in outer scope */
 					entity = NULL;
-				} else if (entity->enume.complete && token.kind == '{') {
+				} else if (entity->enume.complete && token->kind == '{') {
 					source_position_t const *const ppos = &entity->base.source_position;
 					errorf(&pos, "multiple definitions of '%N' (previous definition %P)", entity, ppos);
 				}
@@ -2488,7 +2520,7 @@ static type_t *parse_enum_specifier(void)
 	type->enumt.enume      = &entity->enume;
 	type->enumt.base.akind = ATOMIC_TYPE_INT;
 
-	if (token.kind == '{') {
+	if (token->kind == '{') {
 		if (symbol != NULL) {
 			environment_push(entity);
 		}
@@ -2530,9 +2562,9 @@ static type_t *parse_typeof(void)
 
 	expression_t *expression  = NULL;
 
-	switch (token.kind) {
+	switch (token->kind) {
 	case T_IDENTIFIER:
-		if (is_typedef_symbol(token.identifier.symbol)) {
+		if (is_typedef_symbol(token->identifier.symbol)) {
 	DECLARATION_START
 			type = parse_typename();
 		} else {
@@ -2597,14 +2629,14 @@ static attribute_t *parse_attribute_ms_property(attribute_t *attribute)
 		= allocate_ast_zero(sizeof(*property));
 
 	do {
-		if (token.kind != T_IDENTIFIER) {
+		if (token->kind != T_IDENTIFIER) {
 			parse_error_expected("while parsing property declspec",
 			                     T_IDENTIFIER, NULL);
 			goto end_error;
 		}
 
 		symbol_t **prop;
-		symbol_t  *symbol = token.identifier.symbol;
+		symbol_t  *symbol = token->identifier.symbol;
 		if (streq(symbol->string, "put")) {
 			prop = &property->put_symbol;
 		} else if (streq(symbol->string, "get")) {
@@ -2615,13 +2647,13 @@ static attribute_t *parse_attribute_ms_property(attribute_t *attribute)
 		}
 		eat(T_IDENTIFIER);
 		expect('=', end_error);
-		if (token.kind != T_IDENTIFIER) {
+		if (token->kind != T_IDENTIFIER) {
 			parse_error_expected("while parsing property declspec",
 			                     T_IDENTIFIER, NULL);
 			goto end_error;
 		}
 		if (prop != NULL)
-			*prop = token.identifier.symbol;
+			*prop = token->identifier.symbol;
 		next_token();
 	} while (next_if(','));
 
@@ -2638,8 +2670,8 @@ static attribute_t *parse_microsoft_extended_decl_modifier_single(void)
 	attribute_kind_t kind = ATTRIBUTE_UNKNOWN;
 	if (next_if(T_restrict)) {
 		kind = ATTRIBUTE_MS_RESTRICT;
-	} else if (token.kind == T_IDENTIFIER) {
-		const char *name = token.identifier.symbol->string;
+	} else if (token->kind == T_IDENTIFIER) {
+		const char *name = token->identifier.symbol->string;
 		for (attribute_kind_t k = ATTRIBUTE_MS_FIRST; k <= ATTRIBUTE_MS_LAST;
 		     ++k) {
 			const char *attribute_name = get_attribute_name(k);
@@ -2730,12 +2762,12 @@ static void parse_declaration_specifiers(declaration_specifiers_t *specifiers)
 	bool               saw_error       = false;
 
 	memset(specifiers, 0, sizeof(*specifiers));
-	specifiers->source_position = token.base.source_position;
+	specifiers->source_position = token->base.source_position;
 
 	while (true) {
 		specifiers->attributes = parse_attributes(specifiers->attributes);
 
-		switch (token.kind) {
+		switch (token->kind) {
 		/* storage class */
 #define MATCH_STORAGE_CLASS(token, class)                                  \
 		case token:                                                        \
@@ -2897,7 +2929,7 @@ wrong_thread_storage_class:
 					case T_IDENTIFIER:
 					case '&':
 					case '*':
-						errorf(HERE, "discarding stray %K in declaration specifier", &token);
+						errorf(HERE, "discarding stray %K in declaration specifier", token);
 						next_token();
 						continue;
 
@@ -2906,7 +2938,7 @@ wrong_thread_storage_class:
 				}
 			}
 
-			type_t *const typedef_type = get_typedef_type(token.identifier.symbol);
+			type_t *const typedef_type = get_typedef_type(token->identifier.symbol);
 			if (typedef_type == NULL) {
 				/* Be somewhat resilient to typos like 'vodi f()' at the beginning of a
 				 * declaration, so it doesn't generate 'implicit int' followed by more
@@ -2917,9 +2949,9 @@ wrong_thread_storage_class:
 					case T_IDENTIFIER:
 					case '&':
 					case '*': {
-						errorf(HERE, "%K does not name a type", &token);
+						errorf(HERE, "%K does not name a type", token);
 
-						symbol_t *symbol = token.identifier.symbol;
+						symbol_t *symbol = token->identifier.symbol;
 						entity_t *entity
 							= create_error_entity(symbol, ENTITY_TYPEDEF);
 
@@ -3147,7 +3179,7 @@ static type_qualifiers_t parse_type_qualifiers(void)
 	type_qualifiers_t qualifiers = TYPE_QUALIFIER_NONE;
 
 	while (true) {
-		switch (token.kind) {
+		switch (token->kind) {
 		/* type qualifiers */
 		MATCH_TYPE_QUALIFIER(T_const,    TYPE_QUALIFIER_CONST);
 		MATCH_TYPE_QUALIFIER(T_restrict, TYPE_QUALIFIER_RESTRICT);
@@ -3170,16 +3202,16 @@ static type_qualifiers_t parse_type_qualifiers(void)
  */
 static void parse_identifier_list(scope_t *scope)
 {
-	assert(token.kind == T_IDENTIFIER);
+	assert(token->kind == T_IDENTIFIER);
 	do {
-		entity_t *const entity = allocate_entity_zero(ENTITY_PARAMETER, NAMESPACE_NORMAL, token.identifier.symbol);
-		entity->base.source_position = token.base.source_position;
+		entity_t *const entity = allocate_entity_zero(ENTITY_PARAMETER, NAMESPACE_NORMAL, token->identifier.symbol);
+		entity->base.source_position = token->base.source_position;
 		/* a K&R parameter has no type, yet */
 		next_token();
 
 		if (scope != NULL)
 			append_entity(scope, entity);
-	} while (next_if(',') && token.kind == T_IDENTIFIER);
+	} while (next_if(',') && token->kind == T_IDENTIFIER);
 }
 
 static entity_t *parse_parameter(void)
@@ -3210,16 +3242,16 @@ static void semantic_parameter_incomplete(const entity_t *entity)
 static bool has_parameters(void)
 {
 	/* func(void) is not a parameter */
-	if (token.kind == T_IDENTIFIER) {
+	if (token->kind == T_IDENTIFIER) {
 		entity_t const *const entity
-			= get_entity(token.identifier.symbol, NAMESPACE_NORMAL);
+			= get_entity(token->identifier.symbol, NAMESPACE_NORMAL);
 		if (entity == NULL)
 			return true;
 		if (entity->kind != ENTITY_TYPEDEF)
 			return true;
 		if (skip_typeref(entity->typedefe.type) != type_void)
 			return true;
-	} else if (token.kind != T_void) {
+	} else if (token->kind != T_void) {
 		return true;
 	}
 	if (look_ahead(1)->kind != ')')
@@ -3238,8 +3270,8 @@ static void parse_parameters(function_type_t *type, scope_t *scope)
 	add_anchor_token(')');
 	int saved_comma_state = save_and_reset_anchor_state(',');
 
-	if (token.kind == T_IDENTIFIER
-	    && !is_typedef_symbol(token.identifier.symbol)) {
+	if (token->kind == T_IDENTIFIER
+	    && !is_typedef_symbol(token->identifier.symbol)) {
 		token_kind_t la1_type = (token_kind_t)look_ahead(1)->kind;
 		if (la1_type == ',' || la1_type == ')') {
 			type->kr_style_parameters = true;
@@ -3248,14 +3280,14 @@ static void parse_parameters(function_type_t *type, scope_t *scope)
 		}
 	}
 
-	if (token.kind == ')') {
+	if (token->kind == ')') {
 		/* ISO/IEC 14882:1998(E) §C.1.6:1 */
 		if (!(c_mode & _CXX))
 			type->unspecified_parameters = true;
 	} else if (has_parameters()) {
 		function_parameter_t **anchor = &type->parameters;
 		do {
-			switch (token.kind) {
+			switch (token->kind) {
 			case T_DOTDOTDOT:
 				next_token();
 				type->variadic = true;
@@ -3399,10 +3431,10 @@ static construct_type_t *parse_array_declarator(void)
 	array->is_static       = is_static;
 
 	expression_t *size = NULL;
-	if (token.kind == '*' && look_ahead(1)->kind == ']') {
+	if (token->kind == '*' && look_ahead(1)->kind == ']') {
 		array->is_variable = true;
 		next_token();
-	} else if (token.kind != ']') {
+	} else if (token->kind != ']') {
 		size = parse_assignment_expression();
 
 		/* §6.7.5.2:1  Array size must have integer type */
@@ -3469,7 +3501,7 @@ static construct_type_t *parse_inner_declarator(parse_declarator_env_t *env)
 	for (;;) {
 		construct_type_t *type;
 		//variable_t       *based = NULL; /* MS __based extension */
-		switch (token.kind) {
+		switch (token->kind) {
 			case '&':
 				type = parse_reference_declarator();
 				break;
@@ -3497,13 +3529,13 @@ static construct_type_t *parse_inner_declarator(parse_declarator_env_t *env)
 ptr_operator_end: ;
 	construct_type_t *inner_types = NULL;
 
-	switch (token.kind) {
+	switch (token->kind) {
 	case T_IDENTIFIER:
 		if (env->must_be_abstract) {
 			errorf(HERE, "no identifier expected in typename");
 		} else {
-			env->symbol          = token.identifier.symbol;
-			env->source_position = token.base.source_position;
+			env->symbol          = token->identifier.symbol;
+			env->source_position = token->base.source_position;
 		}
 		next_token();
 		break;
@@ -3557,7 +3589,7 @@ ptr_operator_end: ;
 
 	for (;;) {
 		construct_type_t *type;
-		switch (token.kind) {
+		switch (token->kind) {
 		case '(': {
 			scope_t *scope = NULL;
 			if (!env->must_be_abstract) {
@@ -4096,7 +4128,8 @@ entity_t *record_entity(entity_t *entity, const bool is_definition)
 						goto finish;
 				} else {
 					/* GCC extension: redef in system headers is allowed */
-					if ((pos->is_system_header || ppos->is_system_header) &&
+					if ((decode_position(*pos).is_system_header ||
+					     decode_position(*ppos).is_system_header) &&
 					    types_compatible(type, prev_type))
 						goto finish;
 				}
@@ -4181,7 +4214,7 @@ warn_redundant_declaration: ;
 						merge_in_attributes(decl, prev_decl->attributes);
 					} else if (!is_definition        &&
 							is_type_valid(prev_type) &&
-							!pos->is_system_header) {
+							!decode_position(*pos).is_system_header) {
 						warningf(WARN_REDUNDANT_DECLS, pos, "redundant declaration for '%Y' (declared %P)", symbol, ppos);
 					}
 				} else if (current_function == NULL) {
@@ -4387,9 +4420,9 @@ static void parse_declaration_rest(entity_t *ndeclaration,
 	add_anchor_token(';');
 	add_anchor_token(',');
 	while (true) {
-		entity_t *entity = finished_declaration(ndeclaration, token.kind == '=');
+		entity_t *entity = finished_declaration(ndeclaration, token->kind == '=');
 
-		if (token.kind == '=') {
+		if (token->kind == '=') {
 			parse_init_declarator_rest(entity);
 		} else if (entity->kind == ENTITY_VARIABLE) {
 			/* ISO/IEC 14882:1998(E) §8.5.3:3  The initializer can be omitted
@@ -4451,7 +4484,7 @@ static void parse_declaration(parsed_declaration_func finished_declaration,
 	parse_declaration_specifiers(&specifiers);
 	rem_anchor_token(';');
 
-	if (token.kind == ';') {
+	if (token->kind == ';') {
 		parse_anonymous_declaration_rest(&specifiers);
 	} else {
 		entity_t *entity = parse_declarator(&specifiers, flags);
@@ -4497,7 +4530,7 @@ static void parse_kr_declaration_list(entity_t *entity)
 
 	/* parse declaration list */
 	for (;;) {
-		switch (token.kind) {
+		switch (token->kind) {
 			DECLARATION_START
 			/* This covers symbols, which are no type, too, and results in
 			 * better error messages.  The typical cases are misspelled type
@@ -4609,7 +4642,7 @@ static void print_in_function(void)
 {
 	if (first_err) {
 		first_err = false;
-		char const *const file = current_function->base.base.source_position.input_name;
+		char const *const file = decode_position(current_function->base.base.source_position).input_name;
 		diagnosticf("%s: In '%N':\n", file, (entity_t const*)current_function);
 	}
 }
@@ -4628,7 +4661,7 @@ static void check_labels(void)
 			continue;
 
 		label_t *label = goto_statement->label;
-		if (label->base.source_position.input_name == NULL) {
+		if (!has_source_position(label->base.source_position)) {
 			print_in_function();
 			source_position_t const *const pos = &goto_statement->base.source_position;
 			errorf(pos, "'%N' used but not defined", (entity_t const*)label);
@@ -5355,7 +5388,7 @@ static void parse_external_declaration(void)
 	rem_anchor_token(';');
 
 	/* must be a declaration */
-	if (token.kind == ';') {
+	if (token->kind == ';') {
 		parse_anonymous_declaration_rest(&specifiers);
 		return;
 	}
@@ -5374,7 +5407,7 @@ static void parse_external_declaration(void)
 	rem_anchor_token(',');
 
 	/* must be a declaration */
-	switch (token.kind) {
+	switch (token->kind) {
 		case ',':
 		case ';':
 		case '=':
@@ -5386,7 +5419,7 @@ static void parse_external_declaration(void)
 	/* must be a function definition */
 	parse_kr_declaration_list(ndeclaration);
 
-	if (token.kind != '{') {
+	if (token->kind != '{') {
 		parse_error_expected("while parsing function definition", '{', NULL);
 		eat_until_matching_token(';');
 		return;
@@ -5674,7 +5707,7 @@ static void parse_compound_declarators(compound_t *compound,
 	do {
 		entity_t *entity;
 
-		if (token.kind == ':') {
+		if (token->kind == ':') {
 			/* anonymous bitfield */
 			type_t *type = specifiers->type;
 			entity_t *entity = allocate_entity_zero(ENTITY_COMPOUND_MEMBER,
@@ -5716,7 +5749,7 @@ static void parse_compound_declarators(compound_t *compound,
 					}
 				}
 
-				if (token.kind == ':') {
+				if (token->kind == ':') {
 					parse_bitfield_member(entity);
 
 					attribute_t *attributes = parse_attributes(NULL);
@@ -5729,7 +5762,7 @@ static void parse_compound_declarators(compound_t *compound,
 					} else if (is_type_incomplete(type)) {
 						/* §6.7.2.1:16 flexible array member */
 						if (!is_type_array(type)       ||
-								token.kind          != ';' ||
+								token->kind         != ';' ||
 								look_ahead(1)->kind != '}') {
 							errorf(pos, "'%N' has incomplete type '%T'", entity, orig_type);
 						} else if (compound->members.entities == NULL) {
@@ -5754,7 +5787,7 @@ static void parse_compound_type_entries(compound_t *compound)
 	add_anchor_token('}');
 
 	for (;;) {
-		switch (token.kind) {
+		switch (token->kind) {
 			DECLARATION_START
 			case T___extension__:
 			case T_IDENTIFIER: {
@@ -5815,8 +5848,8 @@ static expression_parser_function_t expression_parsers[T_LAST_TOKEN];
 static expression_t *expected_expression_error(void)
 {
 	/* skip the error message if the error token was read */
-	if (token.kind != T_ERROR) {
-		errorf(HERE, "expected expression, got token %K", &token);
+	if (token->kind != T_ERROR) {
+		errorf(HERE, "expected expression, got token %K", token);
 	}
 	next_token();
 
@@ -5838,17 +5871,17 @@ static type_t *get_wide_string_type(void)
  */
 static expression_t *parse_string_literal(void)
 {
-	source_position_t begin   = token.base.source_position;
-	string_t          res     = token.string.string;
-	bool              is_wide = (token.kind == T_WIDE_STRING_LITERAL);
+	source_position_t begin   = token->base.source_position;
+	string_t          res     = token->string.string;
+	bool              is_wide = (token->kind == T_WIDE_STRING_LITERAL);
 
 	next_token();
-	while (token.kind == T_STRING_LITERAL
-			|| token.kind == T_WIDE_STRING_LITERAL) {
-		warn_string_concat(&token.base.source_position);
-		res = concat_strings(&res, &token.string.string);
+	while (token->kind == T_STRING_LITERAL
+			|| token->kind == T_WIDE_STRING_LITERAL) {
+		warn_string_concat(&token->base.source_position);
+		res = concat_strings(&res, &token->string.string);
 		next_token();
-		is_wide |= token.kind == T_WIDE_STRING_LITERAL;
+		is_wide |= token->kind == T_WIDE_STRING_LITERAL;
 	}
 
 	expression_t *literal;
@@ -5882,12 +5915,12 @@ static expression_t *parse_boolean_literal(bool value)
 static void warn_traditional_suffix(void)
 {
 	warningf(WARN_TRADITIONAL, HERE, "traditional C rejects the '%S' suffix",
-	         &token.number.suffix);
+	         &token->number.suffix);
 }
 
 static void check_integer_suffix(void)
 {
-	const string_t *suffix = &token.number.suffix;
+	const string_t *suffix = &token->number.suffix;
 	if (suffix->size == 0)
 		return;
 
@@ -5916,7 +5949,7 @@ static void check_integer_suffix(void)
 		}
 	}
 	if (*c != '\0') {
-		errorf(&token.base.source_position,
+		errorf(&token->base.source_position,
 		       "invalid suffix '%S' on integer constant", suffix);
 	} else if (not_traditional) {
 		warn_traditional_suffix();
@@ -5925,7 +5958,7 @@ static void check_integer_suffix(void)
 
 static type_t *check_floatingpoint_suffix(void)
 {
-	const string_t *suffix = &token.number.suffix;
+	const string_t *suffix = &token->number.suffix;
 	type_t         *type   = type_double;
 	if (suffix->size == 0)
 		return type;
@@ -5940,7 +5973,7 @@ static type_t *check_floatingpoint_suffix(void)
 		type = type_long_double;
 	}
 	if (*c != '\0') {
-		errorf(&token.base.source_position,
+		errorf(&token->base.source_position,
 		       "invalid suffix '%S' on floatingpoint constant", suffix);
 	} else if (not_traditional) {
 		warn_traditional_suffix();
@@ -5957,7 +5990,7 @@ static expression_t *parse_number_literal(void)
 	expression_kind_t  kind;
 	type_t            *type;
 
-	switch (token.kind) {
+	switch (token->kind) {
 	case T_INTEGER:
 		kind = EXPR_LITERAL_INTEGER;
 		check_integer_suffix();
@@ -5987,8 +6020,8 @@ static expression_t *parse_number_literal(void)
 
 	expression_t *literal = allocate_expression_zero(kind);
 	literal->base.type      = type;
-	literal->literal.value  = token.number.number;
-	literal->literal.suffix = token.number.suffix;
+	literal->literal.value  = token->number.number;
+	literal->literal.suffix = token->number.suffix;
 	next_token();
 
 	/* integer type depends on the size of the number and the size
@@ -6006,7 +6039,7 @@ static expression_t *parse_character_constant(void)
 {
 	expression_t *literal = allocate_expression_zero(EXPR_LITERAL_CHARACTER);
 	literal->base.type     = c_mode & _CXX ? type_char : type_int;
-	literal->literal.value = token.string.string;
+	literal->literal.value = token->string.string;
 
 	size_t len = literal->literal.value.size;
 	if (len > 1) {
@@ -6029,7 +6062,7 @@ static expression_t *parse_wide_character_constant(void)
 {
 	expression_t *literal = allocate_expression_zero(EXPR_LITERAL_WIDE_CHARACTER);
 	literal->base.type     = type_int;
-	literal->literal.value = token.string.string;
+	literal->literal.value = token->string.string;
 
 	size_t len = wstrlen(&literal->literal.value);
 	if (len > 1) {
@@ -6180,11 +6213,11 @@ static entity_t *parse_qualified_identifier(void)
 
 	entity_t *entity;
 	while (true) {
-		if (token.kind != T_IDENTIFIER) {
+		if (token->kind != T_IDENTIFIER) {
 			parse_error_expected("while parsing identifier", T_IDENTIFIER, NULL);
 			return create_error_entity(sym_anonymous, ENTITY_VARIABLE);
 		}
-		symbol = token.identifier.symbol;
+		symbol = token->identifier.symbol;
 		pos    = *HERE;
 		next_token();
 
@@ -6215,7 +6248,7 @@ static entity_t *parse_qualified_identifier(void)
 	}
 
 	if (entity == NULL) {
-		if (!strict_mode && token.kind == '(') {
+		if (!strict_mode && token->kind == '(') {
 			/* an implicitly declared function */
 			warningf(WARN_IMPLICIT_FUNCTION_DECLARATION, &pos,
 			         "implicit declaration of function '%Y'", symbol);
@@ -6231,7 +6264,7 @@ static entity_t *parse_qualified_identifier(void)
 
 static expression_t *parse_reference(void)
 {
-	source_position_t const pos    = token.base.source_position;
+	source_position_t const pos    = token->base.source_position;
 	entity_t         *const entity = parse_qualified_identifier();
 
 	type_t *orig_type;
@@ -6357,7 +6390,7 @@ static expression_t *parse_cast(void)
 	rem_anchor_token(')');
 	expect(')', end_error);
 
-	if (token.kind == '{') {
+	if (token->kind == '{') {
 		return parse_compound_literal(&pos, type);
 	}
 
@@ -6510,25 +6543,25 @@ static designator_t *parse_designator(void)
 	designator_t *result    = allocate_ast_zero(sizeof(result[0]));
 	result->source_position = *HERE;
 
-	if (token.kind != T_IDENTIFIER) {
+	if (token->kind != T_IDENTIFIER) {
 		parse_error_expected("while parsing member designator",
 		                     T_IDENTIFIER, NULL);
 		return NULL;
 	}
-	result->symbol = token.identifier.symbol;
+	result->symbol = token->identifier.symbol;
 	next_token();
 
 	designator_t *last_designator = result;
 	while (true) {
 		if (next_if('.')) {
-			if (token.kind != T_IDENTIFIER) {
+			if (token->kind != T_IDENTIFIER) {
 				parse_error_expected("while parsing member designator",
 				                     T_IDENTIFIER, NULL);
 				return NULL;
 			}
 			designator_t *designator    = allocate_ast_zero(sizeof(result[0]));
 			designator->source_position = *HERE;
-			designator->symbol          = token.identifier.symbol;
+			designator->symbol          = token->identifier.symbol;
 			next_token();
 
 			last_designator->next = designator;
@@ -6741,7 +6774,7 @@ static expression_t *parse_compare_builtin(void)
 {
 	expression_t *expression;
 
-	switch (token.kind) {
+	switch (token->kind) {
 	case T___builtin_isgreater:
 		expression = allocate_expression_zero(EXPR_BINARY_ISGREATER);
 		break;
@@ -6817,10 +6850,10 @@ end_error:
  */
 static label_t *get_label(void)
 {
-	assert(token.kind == T_IDENTIFIER);
+	assert(token->kind == T_IDENTIFIER);
 	assert(current_function != NULL);
 
-	entity_t *label = get_entity(token.identifier.symbol, NAMESPACE_LABEL);
+	entity_t *label = get_entity(token->identifier.symbol, NAMESPACE_LABEL);
 	/* If we find a local label, we already created the declaration. */
 	if (label != NULL && label->kind == ENTITY_LOCAL_LABEL) {
 		if (label->base.parent_scope != current_scope) {
@@ -6829,7 +6862,7 @@ static label_t *get_label(void)
 		}
 	} else if (label == NULL || label->base.parent_scope != &current_function->parameters) {
 		/* There is no matching label in the same function, so create a new one. */
-		label = allocate_entity_zero(ENTITY_LABEL, NAMESPACE_LABEL, token.identifier.symbol);
+		label = allocate_entity_zero(ENTITY_LABEL, NAMESPACE_LABEL, token->identifier.symbol);
 		label_push(label);
 	}
 
@@ -6842,9 +6875,9 @@ static label_t *get_label(void)
  */
 static expression_t *parse_label_address(void)
 {
-	source_position_t source_position = token.base.source_position;
+	source_position_t source_position = token->base.source_position;
 	eat(T_ANDAND);
-	if (token.kind != T_IDENTIFIER) {
+	if (token->kind != T_IDENTIFIER) {
 		parse_error_expected("while parsing label address", T_IDENTIFIER, NULL);
 		return create_error_expression();
 	}
@@ -6875,13 +6908,13 @@ static expression_t *parse_noop_expression(void)
 
 	eat(T___noop);
 
-	if (token.kind == '(') {
+	if (token->kind == '(') {
 		/* parse arguments */
 		eat('(');
 		add_anchor_token(')');
 		add_anchor_token(',');
 
-		if (token.kind != ')') do {
+		if (token->kind != ')') do {
 			(void)parse_assignment_expression();
 		} while (next_if(','));
 	}
@@ -6898,7 +6931,7 @@ end_error:
  */
 static expression_t *parse_primary_expression(void)
 {
-	switch (token.kind) {
+	switch (token->kind) {
 	case T_false:                        return parse_boolean_literal(false);
 	case T_true:                         return parse_boolean_literal(true);
 	case T_INTEGER:
@@ -6940,7 +6973,7 @@ static expression_t *parse_primary_expression(void)
 	case T_COLONCOLON:
 		return parse_reference();
 	case T_IDENTIFIER:
-		if (!is_typedef_symbol(token.identifier.symbol)) {
+		if (!is_typedef_symbol(token->identifier.symbol)) {
 			return parse_reference();
 		}
 		/* FALLTHROUGH */
@@ -6954,7 +6987,7 @@ static expression_t *parse_primary_expression(void)
 	}
 	}
 
-	errorf(HERE, "unexpected token %K, expected an expression", &token);
+	errorf(HERE, "unexpected token %K, expected an expression", token);
 	eat_until_anchor();
 	return create_error_expression();
 }
@@ -7033,7 +7066,7 @@ static expression_t *parse_typeprop(expression_kind_t const kind)
 
 	type_t       *orig_type;
 	expression_t *expression;
-	if (token.kind == '(' && is_declaration_specifier(look_ahead(1))) {
+	if (token->kind == '(' && is_declaration_specifier(look_ahead(1))) {
 		source_position_t const pos = *HERE;
 		next_token();
 		add_anchor_token(')');
@@ -7041,7 +7074,7 @@ static expression_t *parse_typeprop(expression_kind_t const kind)
 		rem_anchor_token(')');
 		expect(')', end_error);
 
-		if (token.kind == '{') {
+		if (token->kind == '{') {
 			/* It was not sizeof(type) after all.  It is sizeof of an expression
 			 * starting with a compound literal */
 			expression = parse_compound_literal(&pos, orig_type);
@@ -7103,16 +7136,16 @@ static expression_t *parse_alignof(void)
 
 static expression_t *parse_select_expression(expression_t *addr)
 {
-	assert(token.kind == '.' || token.kind == T_MINUSGREATER);
-	bool select_left_arrow = (token.kind == T_MINUSGREATER);
+	assert(token->kind == '.' || token->kind == T_MINUSGREATER);
+	bool select_left_arrow = (token->kind == T_MINUSGREATER);
 	source_position_t const pos = *HERE;
 	next_token();
 
-	if (token.kind != T_IDENTIFIER) {
+	if (token->kind != T_IDENTIFIER) {
 		parse_error_expected("while parsing select", T_IDENTIFIER, NULL);
 		return create_error_expression();
 	}
-	symbol_t *symbol = token.identifier.symbol;
+	symbol_t *symbol = token->identifier.symbol;
 	next_token();
 
 	type_t *const orig_type = addr->base.type;
@@ -7321,7 +7354,7 @@ static expression_t *parse_call_expression(expression_t *expression)
 	add_anchor_token(')');
 	add_anchor_token(',');
 
-	if (token.kind != ')') {
+	if (token->kind != ')') {
 		call_argument_t **anchor = &call->arguments;
 		do {
 			call_argument_t *argument = allocate_ast_zero(sizeof(*argument));
@@ -7478,7 +7511,7 @@ static expression_t *parse_conditional_expression(expression_t *expression)
 
 	expression_t *true_expression = expression;
 	bool          gnu_cond = false;
-	if (GNU_MODE && token.kind == ':') {
+	if (GNU_MODE && token->kind == ':') {
 		gnu_cond = true;
 	} else {
 		true_expression = parse_expression();
@@ -7654,7 +7687,7 @@ static expression_t *parse_throw(void)
 	eat(T_throw);
 
 	expression_t *value = NULL;
-	switch (token.kind) {
+	switch (token->kind) {
 		EXPRESSION_START {
 			value = parse_assignment_expression();
 			/* ISO/IEC 14882:1998(E) §15.1:3 */
@@ -8745,12 +8778,12 @@ CREATE_BINEXPR_PARSER(',',                    EXPR_BINARY_COMMA,              PR
 
 static expression_t *parse_subexpression(precedence_t precedence)
 {
-	if (token.kind < 0) {
+	if (token->kind < 0) {
 		return expected_expression_error();
 	}
 
 	expression_parser_function_t *parser
-		= &expression_parsers[token.kind];
+		= &expression_parsers[token->kind];
 	expression_t                 *left;
 
 	if (parser->parser != NULL) {
@@ -8761,11 +8794,11 @@ static expression_t *parse_subexpression(precedence_t precedence)
 	assert(left != NULL);
 
 	while (true) {
-		if (token.kind < 0) {
+		if (token->kind < 0) {
 			return expected_expression_error();
 		}
 
-		parser = &expression_parsers[token.kind];
+		parser = &expression_parsers[token->kind];
 		if (parser->infix_parser == NULL)
 			break;
 		if (parser->infix_precedence < precedence)
@@ -8895,17 +8928,17 @@ static asm_argument_t *parse_asm_arguments(bool is_out)
 	asm_argument_t  *result = NULL;
 	asm_argument_t **anchor = &result;
 
-	while (token.kind == T_STRING_LITERAL || token.kind == '[') {
+	while (token->kind == T_STRING_LITERAL || token->kind == '[') {
 		asm_argument_t *argument = allocate_ast_zero(sizeof(argument[0]));
 		memset(argument, 0, sizeof(argument[0]));
 
 		if (next_if('[')) {
-			if (token.kind != T_IDENTIFIER) {
+			if (token->kind != T_IDENTIFIER) {
 				parse_error_expected("while parsing asm argument",
 				                     T_IDENTIFIER, NULL);
 				return NULL;
 			}
-			argument->symbol = token.identifier.symbol;
+			argument->symbol = token->identifier.symbol;
 
 			expect(']', end_error);
 		}
@@ -8997,7 +9030,7 @@ static asm_clobber_t *parse_asm_clobbers(void)
 	asm_clobber_t *result  = NULL;
 	asm_clobber_t **anchor = &result;
 
-	while (token.kind == T_STRING_LITERAL) {
+	while (token->kind == T_STRING_LITERAL) {
 		asm_clobber_t *clobber = allocate_ast_zero(sizeof(clobber[0]));
 		clobber->clobber       = parse_string_literals();
 
@@ -9026,7 +9059,7 @@ static statement_t *parse_asm_statement(void)
 
 	expect('(', end_error);
 	add_anchor_token(')');
-	if (token.kind != T_STRING_LITERAL) {
+	if (token->kind != T_STRING_LITERAL) {
 		parse_error_expected("after asm(", T_STRING_LITERAL, NULL);
 		goto end_of_asm;
 	}
@@ -9072,7 +9105,7 @@ end_error:
 static statement_t *parse_label_inner_statement(statement_t const *const label, char const *const label_kind)
 {
 	statement_t *inner_stmt;
-	switch (token.kind) {
+	switch (token->kind) {
 		case '}':
 			errorf(&label->base.source_position, "%s at end of compound statement", label_kind);
 			inner_stmt = create_error_statement();
@@ -9272,7 +9305,7 @@ static statement_t *parse_label_statement(void)
 
 	eat(':');
 
-	if (token.kind == T___attribute__ && !(c_mode & _CXX)) {
+	if (token->kind == T___attribute__ && !(c_mode & _CXX)) {
 		parse_attributes(NULL); // TODO process attributes
 	}
 
@@ -9536,7 +9569,7 @@ static statement_t *parse_for(void)
 	PUSH_EXTENSION();
 
 	if (next_if(';')) {
-	} else if (is_declaration_specifier(&token)) {
+	} else if (is_declaration_specifier(token)) {
 		parse_declaration(record_entity, DECL_FLAGS_NONE);
 	} else {
 		add_anchor_token(';');
@@ -9552,7 +9585,7 @@ static statement_t *parse_for(void)
 
 	POP_EXTENSION();
 
-	if (token.kind != ';') {
+	if (token->kind != ';') {
 		add_anchor_token(';');
 		expression_t *const cond = parse_expression();
 		statement->fors.condition = cond;
@@ -9563,7 +9596,7 @@ static statement_t *parse_for(void)
 		rem_anchor_token(';');
 	}
 	expect(';', end_error2);
-	if (token.kind != ')') {
+	if (token->kind != ')') {
 		expression_t *const step = parse_expression();
 		statement->fors.step = step;
 		mark_vars_read(step, ENT_ANY);
@@ -9616,7 +9649,7 @@ static statement_t *parse_goto(void)
 		}
 
 		statement->gotos.expression = expression;
-	} else if (token.kind == T_IDENTIFIER) {
+	} else if (token->kind == T_IDENTIFIER) {
 		label_t *const label = get_label();
 		label->used            = true;
 		statement->gotos.label = label;
@@ -9753,7 +9786,7 @@ static statement_t *parse_return(void)
 	eat(T_return);
 
 	expression_t *return_value = NULL;
-	if (token.kind != ';') {
+	if (token->kind != ';') {
 		return_value = parse_expression();
 		mark_vars_read(return_value, NULL);
 	}
@@ -9919,12 +9952,12 @@ static statement_t *parse_local_label_declaration(void)
 	entity_t *end     = NULL;
 	entity_t **anchor = &begin;
 	do {
-		if (token.kind != T_IDENTIFIER) {
+		if (token->kind != T_IDENTIFIER) {
 			parse_error_expected("while parsing local label declaration",
 				T_IDENTIFIER, NULL);
 			goto end_error;
 		}
-		symbol_t *symbol = token.identifier.symbol;
+		symbol_t *symbol = token->identifier.symbol;
 		entity_t *entity = get_entity(symbol, NAMESPACE_LABEL);
 		if (entity != NULL && entity->base.parent_scope == current_scope) {
 			source_position_t const *const ppos = &entity->base.source_position;
@@ -9932,7 +9965,7 @@ static statement_t *parse_local_label_declaration(void)
 		} else {
 			entity = allocate_entity_zero(ENTITY_LOCAL_LABEL, NAMESPACE_LABEL, symbol);
 			entity->base.parent_scope    = current_scope;
-			entity->base.source_position = token.base.source_position;
+			entity->base.source_position = token->base.source_position;
 
 			*anchor = entity;
 			anchor  = &entity->base.next;
@@ -9956,8 +9989,8 @@ static void parse_namespace_definition(void)
 	entity_t *entity = NULL;
 	symbol_t *symbol = NULL;
 
-	if (token.kind == T_IDENTIFIER) {
-		symbol = token.identifier.symbol;
+	if (token->kind == T_IDENTIFIER) {
+		symbol = token->identifier.symbol;
 		next_token();
 
 		entity = get_entity(symbol, NAMESPACE_NORMAL);
@@ -9965,7 +9998,7 @@ static void parse_namespace_definition(void)
 				&& entity->kind != ENTITY_NAMESPACE
 				&& entity->base.parent_scope == current_scope) {
 			if (is_entity_valid(entity)) {
-				error_redefined_as_different_kind(&token.base.source_position,
+				error_redefined_as_different_kind(&token->base.source_position,
 						entity, ENTITY_NAMESPACE);
 			}
 			entity = NULL;
@@ -9974,11 +10007,11 @@ static void parse_namespace_definition(void)
 
 	if (entity == NULL) {
 		entity = allocate_entity_zero(ENTITY_NAMESPACE, NAMESPACE_NORMAL, symbol);
-		entity->base.source_position = token.base.source_position;
+		entity->base.source_position = token->base.source_position;
 		entity->base.parent_scope    = current_scope;
 	}
 
-	if (token.kind == '=') {
+	if (token->kind == '=') {
 		/* TODO: parse namespace alias */
 		panic("namespace alias definition not supported yet");
 	}
@@ -10063,7 +10096,7 @@ static statement_t *parse_stage(void)
 
 		stage_direction_t direction;
 
-		if (token.kind != ')') {
+		if (token->kind != ')') {
 			do {
 				if (next_if(T_in)) {
 					direction = STAGE_IN;
@@ -10144,12 +10177,12 @@ static statement_t *intern_parse_statement(void)
 
 	/* declaration or statement */
 	add_anchor_token(';');
-	switch (token.kind) {
+	switch (token->kind) {
 	case T_IDENTIFIER: {
 		token_kind_t la1_type = (token_kind_t)look_ahead(1)->kind;
 		if (la1_type == ':') {
 			statement = parse_label_statement();
-		} else if (is_typedef_symbol(token.identifier.symbol)) {
+		} else if (is_typedef_symbol(token->identifier.symbol)) {
 			statement = parse_declaration_statement();
 		} else {
 			/* it's an identifier, the grammar says this must be an
@@ -10159,7 +10192,7 @@ static statement_t *intern_parse_statement(void)
 			switch (la1_type) {
 			case '&':
 			case '*':
-				if (get_entity(token.identifier.symbol, NAMESPACE_NORMAL) != NULL) {
+				if (get_entity(token->identifier.symbol, NAMESPACE_NORMAL) != NULL) {
 			default:
 					statement = parse_expression_statement();
 				} else {
@@ -10214,7 +10247,7 @@ static statement_t *intern_parse_statement(void)
 		break;
 
 	default:
-		errorf(HERE, "unexpected token %K while parsing statement", &token);
+		errorf(HERE, "unexpected token %K while parsing statement", token);
 		statement = create_error_statement();
 		if (!at_anchor())
 			next_token();
@@ -10223,7 +10256,7 @@ static statement_t *intern_parse_statement(void)
 	rem_anchor_token(';');
 
 	assert(statement != NULL
-			&& statement->base.source_position.input_name != NULL);
+			&& has_source_position(statement->base.source_position));
 
 	return statement;
 }
@@ -10353,8 +10386,8 @@ static statement_t *parse_compound_statement(bool inside_expression_statement)
 
 	statement_t **anchor            = &statement->compound.statements;
 	bool          only_decls_so_far = true;
-	while (token.kind != '}') {
-		if (token.kind == T_EOF) {
+	while (token->kind != '}') {
+		if (token->kind == T_EOF) {
 			errorf(&statement->base.source_position,
 			       "EOF while parsing compound statement");
 			break;
@@ -10585,7 +10618,7 @@ end_error:
 
 static void parse_external(void)
 {
-	switch (token.kind) {
+	switch (token->kind) {
 		case T_extern:
 			if (look_ahead(1)->kind == T_STRING_LITERAL) {
 				parse_linkage_specification();
@@ -10621,9 +10654,9 @@ static void parse_external(void)
 			/* FALLTHROUGH */
 
 		default:
-			errorf(HERE, "stray %K outside of function", &token);
-			if (token.kind == '(' || token.kind == '{' || token.kind == '[')
-				eat_until_matching_token(token.kind);
+			errorf(HERE, "stray %K outside of function", token);
+			if (token->kind == '(' || token->kind == '{' || token->kind == '[')
+				eat_until_matching_token(token->kind);
 			next_token();
 			return;
 	}
@@ -10640,7 +10673,7 @@ static void parse_externals(void)
 	memcpy(token_anchor_copy, token_anchor_set, sizeof(token_anchor_copy));
 #endif
 
-	while (token.kind != T_EOF && token.kind != '}') {
+	while (token->kind != T_EOF && token->kind != '}') {
 #ifndef NDEBUG
 		for (int i = 0; i < T_LAST_TOKEN; ++i) {
 			unsigned short count = token_anchor_set[i] - token_anchor_copy[i];
@@ -10672,12 +10705,12 @@ static void parse_translation_unit(void)
 	while (true) {
 		parse_externals();
 
-		if (token.kind == T_EOF)
+		if (token->kind == T_EOF)
 			break;
 
-		errorf(HERE, "stray %K outside of function", &token);
-		if (token.kind == '(' || token.kind == '{' || token.kind == '[')
-			eat_until_matching_token(token.kind);
+		errorf(HERE, "stray %K outside of function", token);
+		if (token->kind == '(' || token->kind == '{' || token->kind == '[')
+			eat_until_matching_token(token->kind);
 		next_token();
 	}
 }
@@ -10702,6 +10735,11 @@ void start_parsing(void)
 
 	print_to_file(stderr);
 
+	if (timers_enabled()) {
+		t_lexing = ir_timer_new();
+		timer_register_fine(t_lexing, "Frontend: Lexing");
+	}
+
 	assert(unit == NULL);
 	unit = allocate_ast_zero(sizeof(unit[0]));
 
@@ -10725,6 +10763,8 @@ translation_unit_t *finish_parsing(void)
 	check_unused_globals();
 	file_scope = NULL;
 
+	t_lexing = NULL;
+
 	DEL_ARR_F(environment_stack);
 	DEL_ARR_F(label_stack);
 
@@ -10795,10 +10835,9 @@ void prepare_main_collect2(entity_t *entity)
 
 void parse(void)
 {
-	lookahead_bufpos = 0;
-	for (int i = 0; i < MAX_LOOKAHEAD + 2; ++i) {
-		next_token();
-	}
+	token_window_pos   = 0;
+	token_window_ahead = 0;
+	next_token();
 	current_linkage   = c_mode & _CXX ? LINKAGE_CXX : LINKAGE_C;
 	incomplete_arrays = NEW_ARR_F(declaration_t*, 0);
 	parse_translation_unit();
@@ -0,0 +1,251 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plinc_profile.h"
+#include "adt/array.h"
+#include "adt/obst.h"
+#include "adt/strutil.h"
+
+typedef struct stage_profile_t {
+	double compute; /**< time spent in the stage body per iteration */
+	double wait;    /**< time spent blocked in send/receive per iteration */
+	bool   valid;   /**< the profile contained a line for this stage */
+} stage_profile_t;
+
+struct plinc_pipeline_profile_t {
+	plinc_pipeline_profile_t *next;
+	const char               *input_name;
+	unsigned                  lineno;
+	stage_profile_t          *stages;     /**< flexible array of stages */
+};
+
+/** more stages than any pipeline has cores, guards against bogus indices */
+#define MAX_PROFILE_STAGES 1024
+
+static struct obstack            profile_obst;
+static plinc_pipeline_profile_t *first_profile;
+
+static plinc_pipeline_profile_t *find_profile(const char *input_name,
+                                              unsigned lineno)
+{
+	for (plinc_pipeline_profile_t *profile = first_profile; profile != NULL;
+	     profile = profile->next) {
+		if (profile->lineno == lineno && streq(profile->input_name, input_name))
+			return profile;
+	}
+	return NULL;
+}
+
+static plinc_pipeline_profile_t *get_profile(const char *input_name,
+                                             unsigned lineno)
+{
+	plinc_pipeline_profile_t *profile = find_profile(input_name, lineno);
+	if (profile != NULL)
+		return profile;
+
+	size_t const len  = strlen(input_name);
+	char  *const name = obstack_copy0(&profile_obst, input_name, len);
+
+	profile             = OALLOCZ(&profile_obst, plinc_pipeline_profile_t);
+	profile->next       = first_profile;
+	profile->input_name = name;
+	profile->lineno     = lineno;
+	profile->stages     = NEW_ARR_F(stage_profile_t, 0);
+	first_profile       = profile;
+	return profile;
+}
+
+/**
+ * Parse one "FILE:LINE STAGE COMPUTE WAIT" line, found at line
+ * @p profile_line of the profile @p profile_name.
+ */
+static bool parse_profile_line(const char *profile_name, unsigned profile_line,
+                               char *line)
+{
+	/* the position is everything up to the first whitespace, the file name
+	 * ends at the last colon of it (file names may contain colons) */
+	char *pos_end = line;
+	while (*pos_end != '\0' && *pos_end != ' ' && *pos_end != '\t')
+		++pos_end;
+	if (*pos_end == '\0')
+		goto malformed;
+	*pos_end = '\0';
+
+	char *colon = strrchr(line, ':');
+	if (colon == NULL || colon == line)
+		goto malformed;
+	*colon = '\0';
+
+	char          *end;
+	unsigned long  lineno  = strtoul(colon + 1, &end, 10);
+	if (end == colon + 1 || *end != '\0')
+		goto malformed;
+
+	char          *p       = pos_end + 1;
+	while (*p == ' ' || *p == '\t')
+		++p;
+	/* strtoul() would wrap a negative stage around */
+	if (*p == '-')
+		goto malformed;
+	unsigned long  stage   = strtoul(p, &end, 10);
+	if (end == p)
+		goto malformed;
+	p = end;
+	double const   compute = strtod(p, &end);
+	if (end == p)
+		goto malformed;
+	p = end;
+	double const   wait    = strtod(p, &end);
+	if (end == p)
+		goto malformed;
+	while (*end == ' ' || *end == '\t')
+		++end;
+	if (*end != '\0' || compute < 0 || wait < 0)
+		goto malformed;
+	if (stage >= MAX_PROFILE_STAGES) {
+		fprintf(stderr, "%s:%u: error: pipeline profile stage %lu exceeds the limit of %u stages\n",
+		        profile_name, profile_line, stage, MAX_PROFILE_STAGES);
+		return false;
+	}
+
+	plinc_pipeline_profile_t *profile = get_profile(line, lineno);
+	size_t                    n       = ARR_LEN(profile->stages);
+	if (stage >= n) {
+		ARR_RESIZE(stage_profile_t, profile->stages, stage + 1);
+		memset(&profile->stages[n], 0, (stage + 1 - n) * sizeof(profile->stages[0]));
+	}
+	stage_profile_t *const stage_profile = &profile->stages[stage];
+	stage_profile->compute = compute;
+	stage_profile->wait    = wait;
+	stage_profile->valid   = true;
+	return true;
+
+malformed:
+	fprintf(stderr, "%s:%u: error: malformed pipeline profile entry\n",
+	        profile_name, profile_line);
+	return false;
+}
+
+bool plinc_profile_load(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		fprintf(stderr, "error: could not open pipeline profile '%s': %s\n",
+		        filename, strerror(errno));
+		return false;
+	}
+
+	bool     res    = true;
+	unsigned lineno = 0;
+	char     buf[4096];
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		++lineno;
+
+		size_t len = strlen(buf);
+		while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r'))
+			buf[--len] = '\0';
+
+		char *line = buf;
+		while (*line == ' ' || *line == '\t')
+			++line;
+		if (*line == '\0' || *line == '#')
+			continue;
+
+		if (!parse_profile_line(filename, lineno, line))
+			res = false;
+	}
+	fclose(f);
+	return res;
+}
+
+const plinc_pipeline_profile_t *plinc_profile_get(const source_position_t *pos)
+{
+	decoded_position_t const p = decode_position(*pos);
+	if (p.input_name == NULL)
+		return NULL;
+	return find_profile(p.input_name, p.lineno);
+}
+
+unsigned plinc_profile_n_stages(const plinc_pipeline_profile_t *profile)
+{
+	return (unsigned)ARR_LEN(profile->stages);
+}
+
+unsigned plinc_profile_map_stages(const plinc_pipeline_profile_t *profile,
+                                  unsigned n_stages, unsigned *stage_core)
+{
+	bool usable = profile != NULL && ARR_LEN(profile->stages) == n_stages;
+	for (unsigned i = 0; usable && i < n_stages; ++i) {
+		usable = profile->stages[i].valid;
+	}
+	if (!usable) {
+		for (unsigned i = 0; i < n_stages; ++i) {
+			stage_core[i] = i;
+		}
+		return n_stages;
+	}
+
+	/* in a balanced pipeline every stage computes or waits for the whole
+	 * iteration period, so the largest compute + wait sum is the period
+	 * the pipeline achieved. Stages whose combined compute time fits into
+	 * this period can share a core without slowing the pipeline down. */
+	const stage_profile_t *stages = profile->stages;
+	double                 period = 0;
+	for (unsigned i = 0; i < n_stages; ++i) {
+		double const total = stages[i].compute + stages[i].wait;
+		if (total > period)
+			period = total;
+	}
+
+	unsigned core = 0;
+	double   load = 0;
+	for (unsigned i = 0; i < n_stages; ++i) {
+		double const compute = stages[i].compute;
+		if (i > 0 && load + compute > period) {
+			++core;
+			load = 0;
+		}
+		stage_core[i]  = core;
+		load          += compute;
+	}
+	return core + 1;
+}
+
+void init_plinc_profile(void)
+{
+	obstack_init(&profile_obst);
+	first_profile = NULL;
+}
+
+void exit_plinc_profile(void)
+{
+	for (plinc_pipeline_profile_t *profile = first_profile; profile != NULL;
+	     profile = profile->next) {
+		DEL_ARR_F(profile->stages);
+	}
+	obstack_free(&profile_obst, NULL);
+	first_profile = NULL;
+}
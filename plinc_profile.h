@@ -0,0 +1,73 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLINC_PROFILE_H
+#define PLINC_PROFILE_H
+
+#include <stdbool.h>
+#include "token_t.h"
+
+typedef struct plinc_pipeline_profile_t plinc_pipeline_profile_t;
+
+/**
+ * Read a pipeline profile file.
+ *
+ * Every non-empty line not starting with '#' describes one stage:
+ *
+ *     FILE:LINE STAGE COMPUTE WAIT
+ *
+ * FILE:LINE is the position of the pipeline keyword, STAGE the index of the
+ * stage in source order (below 1024), COMPUTE the time spent inside the stage
+ * body and WAIT the time spent blocked in send/receive per iteration. Both
+ * times may use any unit as long as it is the same for the whole file.
+ *
+ * @return true on success, false if the file could not be read (an error
+ *         has been printed then)
+ */
+bool plinc_profile_load(const char *filename);
+
+/**
+ * Return the profile recorded for the pipeline at position @p pos or NULL if
+ * there is none.
+ */
+const plinc_pipeline_profile_t *plinc_profile_get(const source_position_t *pos);
+
+/**
+ * Return the number of stages described by a pipeline profile.
+ */
+unsigned plinc_profile_n_stages(const plinc_pipeline_profile_t *profile);
+
+/**
+ * Decide which core runs which stage of a pipeline with @p n_stages stages.
+ * Consecutive stages are fused onto one core as long as their combined
+ * compute time does not exceed the measured iteration period of the
+ * pipeline. Fused groups are placed on consecutive cores.
+ *
+ * @param profile     the profile of the pipeline or NULL for one core per stage
+ * @param n_stages    the number of stages
+ * @param stage_core  receives the core of every stage
+ * @return the number of cores used
+ */
+unsigned plinc_profile_map_stages(const plinc_pipeline_profile_t *profile,
+                                  unsigned n_stages, unsigned *stage_core);
+
+void init_plinc_profile(void);
+void exit_plinc_profile(void);
+
+#endif
@@ -0,0 +1,9 @@
+#!/bin/sh
+cd `dirname $0`
+for i in *.c; do
+	name=`basename $i .c`
+	echo "==> Checking $i"
+	../cparser -fpipeline-double-buffer -fpipeline-profile=$name.prof -S $i -o /tmp/plinctest.s
+	grep -o '_plinc_irecv_[a-z]*' /tmp/plinctest.s > /tmp/plinctest
+	diff -u refresults/$name /tmp/plinctest
+done
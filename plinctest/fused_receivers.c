@@ -0,0 +1,22 @@
+/* stages 1 and 2 run on the same core and both receive from stage 0, the
+ * receives of the next iteration may only be posted after both waited */
+void consume(int x);
+
+void fused_receivers(void)
+{
+	int a;
+	int b;
+
+	pipeline {
+		stage (out a, out b) {
+			a = 1;
+			b = 2;
+		}
+		stage (in a) {
+			consume(a);
+		}
+		stage (in b) {
+			consume(b);
+		}
+	}
+}
@@ -1,17 +1,40 @@
 #include <config.h>
 
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define mkdir(path, mode) _mkdir(path)
+#define getpid()          _getpid()
+#else
+#include <unistd.h>
+#include <dirent.h>
+#endif
 
+#include "preprocessor.h"
 #include "token_t.h"
 #include "symbol_t.h"
+#include "type.h"
+#include "lexer.h"
 #include "adt/util.h"
 #include "adt/error.h"
+#include "adt/array.h"
 #include "adt/strutil.h"
 #include "adt/strset.h"
+#include "adt/bytescan.h"
+#include "adt/sha1.h"
 #include "lang_features.h"
 #include "diagnostic.h"
 #include "string_rep.h"
@@ -20,26 +43,47 @@
 #define MAX_PUTBACK 3
 #define INCLUDE_LIMIT 199  /* 199 is for gcc "compatibility" */
 
-struct pp_argument_t {
-	size_t   list_len;
-	token_t *token_list;
-};
+#ifndef SYSTEM_INCLUDE_DIR
+#define SYSTEM_INCLUDE_DIR "/usr/include"
+#endif
+
+#ifndef LOCAL_INCLUDE_DIR
+#define LOCAL_INCLUDE_DIR "/usr/local/include"
+#endif
 
 struct pp_definition_t {
 	symbol_t          *symbol;
 	source_position_t  source_position;
-	pp_definition_t   *parent_expansion;
-	size_t             expand_pos;
+	pp_definition_t   *next;           /**< next definition of this unit */
 	bool               is_variadic    : 1;
 	bool               is_expanding   : 1;
 	bool               has_parameters : 1;
-	size_t             n_parameters;
-	symbol_t          *parameters;
+	bool               has_paste      : 1; /**< replacement contains ## */
+	size_t             n_parameters;   /**< including __VA_ARGS__ */
+	symbol_t         **parameters;
 
 	/* replacement */
 	size_t             list_len;
 	token_t           *token_list;
+};
 
+/** an argument of a function-like macro invocation */
+typedef struct pp_argument_t {
+	token_t *tokens;     /**< the tokens as written (ARR_F) */
+	token_t *expanded;   /**< the fully macro-expanded tokens (ARR_F) */
+} pp_argument_t;
+
+/** a replacement list currently being read */
+typedef struct pp_expansion_state_t pp_expansion_state_t;
+struct pp_expansion_state_t {
+	/** the macro being expanded, NULL for a barrier which returns end of
+	 * file instead of continuing with the enclosing tokens */
+	pp_definition_t      *definition;
+	const token_t        *token_list;
+	size_t                list_len;
+	size_t                pos;
+	bool                  had_whitespace; /**< whitespace before the macro name */
+	pp_expansion_state_t *parent;
 };
 
 typedef struct pp_conditional_t pp_conditional_t;
@@ -51,19 +95,6 @@ struct pp_conditional_t {
 	pp_conditional_t  *parent;
 };
 
-typedef struct pp_input_t pp_input_t;
-struct pp_input_t {
-	FILE              *file;
-	input_t           *input;
-	utf32              c;
-	utf32              buf[1024+MAX_PUTBACK];
-	const utf32       *bufend;
-	const utf32       *bufpos;
-	source_position_t  position;
-	pp_input_t        *parent;
-	unsigned           output_line;
-};
-
 /** additional info about the current token */
 typedef struct add_token_info_t {
 	/** whitespace from beginning of line to the token */
@@ -77,20 +108,122 @@ typedef struct add_token_info_t {
 typedef struct searchpath_entry_t searchpath_entry_t;
 struct searchpath_entry_t {
 	const char         *path;
+	bool                is_system_path;
+	bool                names_read; /**< tried to list the directory */
+	bool                has_names;  /**< names is valid */
+	/** the names in the directory with include_dir_listing */
+	strset_t            names;
 	searchpath_entry_t *next;
 };
 
+/** what is known about a path an #include tried before */
+typedef struct include_file_t {
+	const char *filename;  /**< the path it was opened with */
+	bool        missing;   /**< there is no file at the path */
+	/** the macro of an include guard around the whole file, or NULL */
+	symbol_t   *guard;
+	/** the translation unit of its #pragma once, 0 if it has none */
+	unsigned    once_unit;
+	/** device and inode of a file with a #pragma once, which recognize it
+	 * under another path */
+	dev_t       dev;
+	ino_t       ino;
+} include_file_t;
+
+/** state of the include guard detection of an input */
+typedef enum include_guard_state_t {
+	GUARD_NONE,   /**< the file is not guarded */
+	GUARD_START,  /**< nothing but whitespace and comments so far */
+	GUARD_INSIDE, /**< inside the #ifndef of the guard */
+	GUARD_ENDED,  /**< behind the #endif of the guard */
+} include_guard_state_t;
+
+/** flags of a token in the token cache */
+typedef enum cached_token_flags_t {
+	CACHED_NEWLINE         = 1u << 0, /**< a line ended before the token */
+	CACHED_COMMENT_NEWLINE = 1u << 1, /**< a comment before it spans lines */
+	CACHED_WHITESPACE      = 1u << 2, /**< whitespace before the token */
+	CACHED_HEADERNAME      = 1u << 3, /**< header name of an #include */
+	CACHED_SYSTEM_HEADER   = 1u << 4, /**< the header name was a <...> one */
+} cached_token_flags_t;
+
+/**
+ * A token of the token cache.  The positions are physical ones, the offset
+ * of #line directives is added when the token is replayed.
+ */
+typedef struct cached_token_t {
+	token_t  token;
+	unsigned flags;
+	/** whitespace before the token, added to the count of the line unless
+	 * the token starts a new line */
+	unsigned whitespace;
+	/** the position of the token in the file, without #line offsets */
+	unsigned lineno;
+	unsigned colno;
+	/** the input position behind the token */
+	unsigned end_lineno;
+	unsigned end_colno;
+} cached_token_t;
+
+typedef struct pp_input_t pp_input_t;
+struct pp_input_t {
+	FILE                     *file;
+	input_t                  *input;
+	utf32                     c;
+	const unsigned char      *bufend;
+	const unsigned char      *bufpos;
+	utf32                     putback_buf[MAX_PUTBACK];
+	unsigned                  n_putback;
+	decoded_position_t        position;
+	pp_input_t               *parent;
+	unsigned                  output_line;
+	/** the search path entry the file was found in */
+	const searchpath_entry_t *path;
+	/** conditionals open when an #include switched away from this input */
+	pp_conditional_t         *conditional_base;
+	/** first token after an #include, read before switching away */
+	token_t                   pending_token;
+	add_token_info_t          pending_info;
+	/** the line behind the #include for the line directive on return */
+	decoded_position_t        return_position;
+	/** line offset introduced by #line directives */
+	unsigned                  line_delta;
+	/** tokens lexed for the token cache so far (ARR_F) */
+	cached_token_t           *record;
+	/** tokens replayed from the token cache instead of the file (ARR_F) */
+	cached_token_t           *replay;
+	size_t                    replay_pos;
+	/** the record of an included file, NULL for the main file */
+	include_file_t           *file_info;
+	include_guard_state_t     guard_state;
+	/** macro and conditional of the include guard candidate */
+	symbol_t                 *guard;
+	pp_conditional_t         *guard_conditional;
+};
+
+/** the value of an #if expression */
+typedef struct pp_value_t {
+	uintmax_t value;
+	bool      is_unsigned;
+} pp_value_t;
+
+/** a -D or -U option */
+typedef struct command_line_macro_t command_line_macro_t;
+struct command_line_macro_t {
+	const char           *directive;
+	command_line_macro_t *next;
+};
+
 static pp_input_t      input;
 
 static pp_input_t     *input_stack;
 static unsigned        n_inputs;
 static struct obstack  input_obstack;
+static const char     *input_encoding;
 
 static pp_conditional_t *conditional_stack;
 
 static token_t           pp_token;
-static bool              resolve_escape_sequences = false;
-static bool              ignore_unknown_chars     = true;
 static bool              in_pp_directive;
 static bool              skip_mode;
 static FILE             *out;
@@ -98,48 +231,176 @@ static struct obstack    pp_obstack;
 static struct obstack    config_obstack;
 static const char       *printed_input_name = NULL;
 static source_position_t expansion_pos;
-static pp_definition_t  *current_expansion  = NULL;
 static strset_t          stringset;
 static preprocessor_token_kind_t last_token = TP_ERROR;
 
-static searchpath_entry_t *searchpath;
+static pp_expansion_state_t *expansion_stack;
+static struct obstack        expansion_obstack;
+static pp_definition_t      *definitions;
+
+/* the token behind a function-like macro name which turned out not to be
+ * an invocation */
+static token_t           lookahead_token;
+static add_token_info_t  lookahead_info;
+static bool              has_lookahead;
+
+static searchpath_entry_t  *searchpath;
+static searchpath_entry_t  *searchpath_last;
+static searchpath_entry_t  *system_searchpath;
+static searchpath_entry_t **system_searchpath_anchor = &system_searchpath;
+
+static command_line_macro_t  *predefined_macros;
+static command_line_macro_t **predefined_macros_anchor = &predefined_macros;
+static command_line_macro_t  *command_line_macros;
+static command_line_macro_t **command_line_macros_anchor = &command_line_macros;
+
+static symbol_t *symbol_va_args;
+static symbol_t *symbol__Pragma;
+static symbol_t *symbol___FILE__;
+static symbol_t *symbol___LINE__;
+static symbol_t *symbol___DATE__;
+static symbol_t *symbol___TIME__;
+static symbol_t *symbol___COUNTER__;
+static symbol_t *symbol___INCLUDE_LEVEL__;
+static symbol_t *symbol___BASE_FILE__;
+static symbol_t *symbol_GCC;
+static symbol_t *symbol_system_header;
+static symbol_t *symbol_once;
+
+static const char *base_file_name;
+static unsigned    counter;
+static char        date_string[sizeof("\"Mmm dd yyyy\"")];
+static char        time_string[sizeof("\"hh:mm:ss\"")];
+
+static const string_t zero_string = { "0", 2 };
+static const string_t one_string  = { "1", 2 };
 
 static add_token_info_t  info;
 
+/* precompiled headers */
+static bool              pch_allowed;     /**< the unit is still untouched */
+static const char      **pch_dependencies; /**< files read while precompiling */
+/** the precompiled header expanded __BASE_FILE__ or __INCLUDE_LEVEL__, whose
+ * values differ in the units including it */
+static bool              pch_context_dependent;
+static source_position_t pch_context_position;
+static token_t          *pch_tokens;      /**< tokens being replayed (ARR_F) */
+static size_t            pch_pos;
+/** the token behind the #include of the precompiled header */
+static token_t           pch_pending_token;
+static add_token_info_t  pch_pending_info;
+
+/* dependency generation */
+static const char      **dependencies;    /**< files read so far (ARR_F) */
+static bool              dependencies_system; /**< include system headers */
+
+/* multiple include optimization */
+static include_file_t  **include_files;      /**< open addressing hash */
+static size_t            include_files_size; /**< a power of two */
+static size_t            n_include_files;
+/** only open headers found in a listing of the search path directory */
+static bool              include_dir_listing;
+/** number of the current translation unit for #pragma once */
+static unsigned          translation_unit;
+/** the files with a #pragma once in this translation unit (ARR_F) */
+static include_file_t  **once_files;
+
+/* token cache */
+static const char       *token_cache_dir;
+/** newlines seen while lexing the current token */
+static bool              lexed_newline;
+static bool              lexed_comment_newline;
+
 static inline void next_char(void);
 static void next_preprocessing_token(void);
-static void print_line_directive(const source_position_t *pos, const char *add);
+static void next_expanded_token(void);
+static void parse_preprocessing_directive(void);
+static void skip_conditional_block(void);
+static void print_line_directive(const decoded_position_t *pos,
+                                 const char *add);
+static bool load_precompiled_header(const char *filename);
+static void start_token_cache(const char *filename);
+static void finish_token_cache(void);
+static void lex_recorded_token(void);
+static void replay_token(void);
+static void record_headername(const char *headername, bool system_include);
+static bool replay_headername(const char **headername, bool *system_include);
+static bool replay_function_like(void);
+
+static void pp_input_error(unsigned delta_lines, unsigned delta_cols,
+                           const char *message)
+{
+	decoded_position_t position = input.position;
+	position.lineno += delta_lines;
+	position.colno  += delta_cols;
+	source_position_t const pos = encode_position(&position);
+	errorf(&pos, "%s", message);
+}
+
+static void add_dependency(const char *filename, bool is_system_header)
+{
+	if (dependencies == NULL || (is_system_header && !dependencies_system))
+		return;
+
+	for (size_t i = 0, n = ARR_LEN(dependencies); i < n; ++i) {
+		if (streq(dependencies[i], filename))
+			return;
+	}
+	ARR_APP1(const char*, dependencies, filename);
+}
 
-static void switch_input(FILE *file, const char *filename)
+/** Notes that the translation unit depends on the input @p filename. */
+static void add_input_dependency(const char *filename, bool is_system_header)
 {
-	input.file                = file;
-	input.input               = input_from_stream(file, NULL);
-	input.bufend              = NULL;
-	input.bufpos              = NULL;
-	input.output_line         = 0;
-	input.position.input_name = filename;
-	input.position.lineno     = 1;
+	if (pch_dependencies != NULL)
+		ARR_APP1(const char*, pch_dependencies, filename);
+	add_dependency(filename, is_system_header);
+}
+
+static void switch_input(FILE *file, const char *filename,
+                         const searchpath_entry_t *path, bool is_system_header)
+{
+	input.file                      = file;
+	input.input                     = input_from_file(file, input_encoding);
+	input.bufend                    = NULL;
+	input.bufpos                    = NULL;
+	input.n_putback                 = 0;
+	input.line_delta                = 0;
+	input.record                    = NULL;
+	input.replay                    = NULL;
+	input.output_line               = 0;
+	input.path                      = path;
+	input.position.input_name       = filename;
+	input.position.lineno           = 1;
+	input.position.is_system_header = is_system_header;
+	input.file_info                 = NULL;
+	input.guard_state               = GUARD_NONE;
+
+	add_input_dependency(filename, is_system_header);
 
 	/* indicate that we're at a new input */
-	print_line_directive(&input.position, input_stack != NULL ? "1" : NULL);
+	if (out != NULL)
+		print_line_directive(&input.position, input_stack != NULL ? "1" : NULL);
 
 	/* place a virtual '\n' so we realize we're at line begin */
 	input.position.lineno = 0;
 	input.c               = '\n';
-	next_preprocessing_token();
 }
 
 static void close_input(void)
 {
-	input_free(input.input);
+	finish_token_cache();
+	if (input.input != NULL)
+		input_free(input.input);
 	assert(input.file != NULL);
 
 	fclose(input.file);
 	input.input  = NULL;
 	input.file   = NULL;
-	input.bufend = NULL;
-	input.bufpos = NULL;
-	input.c      = EOF;
+	input.bufend    = NULL;
+	input.bufpos    = NULL;
+	input.n_putback = 0;
+	input.c         = EOF;
 }
 
 static void push_input(void)
@@ -149,12 +410,6 @@ static void push_input(void)
 
 	memcpy(saved_input, &input, sizeof(*saved_input));
 
-	/* adjust buffer positions */
-	if (input.bufpos != NULL)
-		saved_input->bufpos = saved_input->buf + (input.bufpos - input.buf);
-	if (input.bufend != NULL)
-		saved_input->bufend = saved_input->buf + (input.bufend - input.buf);
-
 	saved_input->parent = input_stack;
 	input_stack         = saved_input;
 	++n_inputs;
@@ -170,12 +425,6 @@ static void pop_restore_input(void)
 	memcpy(&input, saved_input, sizeof(input));
 	input.parent = NULL;
 
-	/* adjust buffer positions */
-	if (saved_input->bufpos != NULL)
-		input.bufpos = input.buf + (saved_input->bufpos - saved_input->buf);
-	if (saved_input->bufend != NULL)
-		input.bufend = input.buf + (saved_input->bufend - saved_input->buf);
-
 	input_stack = saved_input->parent;
 	obstack_free(&input_obstack, saved_input);
 	--n_inputs;
@@ -191,19 +440,41 @@ static void parse_error(const char *msg)
 	errorf(&pp_token.base.source_position,  "%s", msg);
 }
 
+/**
+ * Reads a character which is not a plain ASCII byte in the current block:
+ * a multibyte character or the start of a new block.
+ */
+static utf32 next_slow_char(void)
+{
+	for (;;) {
+		if (input.bufpos >= input.bufend) {
+			size_t const n = input_next_block(input.input, &input.bufpos);
+			if (n == 0) {
+				input.bufpos = input.bufend = NULL;
+				return EOF;
+			}
+			input.bufend = input.bufpos + n;
+		}
+		if (*input.bufpos < 0x80)
+			return *input.bufpos++;
+		utf32 const tc = input_decode_utf8(&input.bufpos, input.bufend);
+		if (tc != UTF32_INVALID)
+			return tc;
+	}
+}
+
 static inline void next_real_char(void)
 {
 	assert(input.bufpos <= input.bufend);
-	if (input.bufpos >= input.bufend) {
-		size_t const n = decode(input.input, input.buf + MAX_PUTBACK, lengthof(input.buf) - MAX_PUTBACK);
-		if (n == 0) {
-			input.c = EOF;
+	if (UNLIKELY(input.n_putback > 0)) {
+		input.c = input.putback_buf[--input.n_putback];
+	} else if (LIKELY(input.bufpos < input.bufend && *input.bufpos < 0x80)) {
+		input.c = *input.bufpos++;
+	} else {
+		input.c = next_slow_char();
+		if (input.c == (utf32)EOF)
 			return;
-		}
-		input.bufpos = input.buf + MAX_PUTBACK;
-		input.bufend = input.bufpos + n;
 	}
-	input.c = *input.bufpos++;
 	++input.position.colno;
 }
 
@@ -214,11 +485,29 @@ static inline void next_real_char(void)
  */
 static inline void put_back(utf32 const pc)
 {
-	assert(input.bufpos > input.buf);
-	*(--input.bufpos - input.buf + input.buf) = (char) pc;
+	assert(input.n_putback < MAX_PUTBACK);
+	input.putback_buf[input.n_putback++] = pc;
 	--input.position.colno;
 }
 
+/**
+ * Skips the bytes behind input.c which @p scan accepts, as if next_char() had
+ * been called for each of them.  They are plain ASCII characters which need
+ * none of the checks in next_char().
+ *
+ * @return the first skipped byte
+ */
+static inline const unsigned char *skip_scanned(
+		const unsigned char *(*scan)(const unsigned char*, const unsigned char*))
+{
+	const unsigned char *const begin = input.bufpos;
+	if (input.n_putback == 0 && begin != NULL) {
+		input.bufpos          = scan(begin, input.bufend);
+		input.position.colno += input.bufpos - begin;
+	}
+	return begin;
+}
+
 #define MATCH_NEWLINE(code)                   \
 	case '\r':                                \
 		next_char();                          \
@@ -235,7 +524,10 @@ static inline void put_back(utf32 const pc)
 
 static void maybe_concat_lines(void)
 {
-	eat('\\');
+	/* not eat(): next_char() would handle a following backslash right away
+	 * and put back one character for every backslash of a run */
+	assert(input.c == '\\');
+	next_real_char();
 
 	switch (input.c) {
 	MATCH_NEWLINE(
@@ -361,42 +653,50 @@ static int digit_value(int digit)
  *
  * @param first_digit  the already read first digit
  */
-static utf32 parse_octal_sequence(const utf32 first_digit)
+static utf32 parse_octal_sequence(const char **pos, const utf32 first_digit)
 {
 	assert(is_octal_digit(first_digit));
-	utf32 value = digit_value(first_digit);
-	if (!is_octal_digit(input.c)) return value;
-	value = 8 * value + digit_value(input.c);
-	next_char();
-	if (!is_octal_digit(input.c)) return value;
-	value = 8 * value + digit_value(input.c);
-	next_char();
+	const char *c     = *pos;
+	utf32       value = digit_value(first_digit);
+	for (int i = 0; i < 2 && is_octal_digit(*c); ++i, ++c) {
+		value = 8 * value + digit_value(*c);
+	}
+	*pos = c;
 	return value;
-
 }
 
 /**
  * Parses a hex character sequence.
  */
-static utf32 parse_hex_sequence(void)
+static utf32 parse_hex_sequence(const char **pos)
 {
-	utf32 value = 0;
-	while (isxdigit(input.c)) {
-		value = 16 * value + digit_value(input.c);
-		next_char();
+	const char *c     = *pos;
+	utf32       value = 0;
+	while (isxdigit((unsigned char) *c)) {
+		value = 16 * value + digit_value(*c);
+		++c;
 	}
+	*pos = c;
 	return value;
 }
 
 /**
- * Parse an escape sequence.
+ * Parse an escape sequence of a string or character constant.  Escape
+ * sequences are kept as written in preprocessing tokens and only resolved
+ * when the tokens are handed to the parser.
+ *
+ * @param pos       points behind the backslash, is moved behind the sequence
+ * @param position  the position of the token for diagnostics
  */
-static utf32 parse_escape_sequence(void)
+static utf32 parse_escape_sequence(const char **pos,
+                                   const source_position_t *position)
 {
-	eat('\\');
-
-	utf32 const ec = input.c;
-	next_char();
+	utf32 const ec = (unsigned char) **pos;
+	if (ec == '\0') {
+		errorf(position, "reached end of file while parsing escape sequence");
+		return EOF;
+	}
+	++*pos;
 
 	switch (ec) {
 	case '"':  return '"';
@@ -411,7 +711,7 @@ static utf32 parse_escape_sequence(void)
 	case 't': return '\t';
 	case 'v': return '\v';
 	case 'x':
-		return parse_hex_sequence();
+		return parse_hex_sequence(pos);
 	case '0':
 	case '1':
 	case '2':
@@ -420,10 +720,7 @@ static utf32 parse_escape_sequence(void)
 	case '5':
 	case '6':
 	case '7':
-		return parse_octal_sequence(ec);
-	case EOF:
-		parse_error("reached end of file while parsing escape sequence");
-		return EOF;
+		return parse_octal_sequence(pos, ec);
 	/* \E is not documented, but handled, by GCC.  It is acceptable according
 	 * to §6.11.4, whereas \e is not. */
 	case 'E':
@@ -433,13 +730,13 @@ static utf32 parse_escape_sequence(void)
 		break;
 	case 'u':
 	case 'U':
-		parse_error("universal character parsing not implemented yet");
+		errorf(position, "universal character parsing not implemented yet");
 		return EOF;
 	default:
 		break;
 	}
 	/* §6.4.4.4:8 footnote 64 */
-	parse_error("unknown escape sequence");
+	errorf(position, "unknown escape sequence");
 	return EOF;
 }
 
@@ -452,62 +749,77 @@ static const char *identify_string(char *string)
 	return result;
 }
 
-static string_t make_string(char *string, size_t len)
+static string_t make_pp_string(char *string, size_t len)
 {
+	/* the set compares up to the first 0, so strings with an embedded 0 cannot
+	 * be shared */
+	if (len > 0 && memchr(string, '\0', len - 1) != NULL)
+		return (string_t) {string, len};
+
 	const char *result = identify_string(string);
 	return (string_t) {result, len};
 }
 
-static void parse_string_literal(void)
+/**
+ * Reads the contents of a string literal or character constant up to the
+ * closing @p quote.  Escape sequences are kept as written.
+ */
+static bool parse_quoted(utf32 const quote, const char *what)
 {
-	const unsigned start_linenr = input.position.lineno;
+	const source_position_t start = pp_token.base.source_position;
 
-	eat('"');
+	eat(quote);
 
 	while (true) {
 		switch (input.c) {
-		case '\\': {
-			utf32 tc;
-			if (resolve_escape_sequences) {
-				tc = parse_escape_sequence();
-				obstack_1grow(&symbol_obstack, (char) tc);
-			} else {
-				obstack_1grow(&symbol_obstack, (char) input.c);
-				next_char();
-				obstack_1grow(&symbol_obstack, (char) input.c);
-				next_char();
-			}
+		case '\\':
+			obstack_1grow(&symbol_obstack, '\\');
+			next_char();
+			if (input.c == (utf32) EOF || input.c == '\n' || input.c == '\r')
+				break;
+			obstack_grow_symbol(&symbol_obstack, input.c);
+			next_char();
 			break;
-		}
 
-		case EOF: {
-			source_position_t source_position;
-			source_position.input_name = pp_token.base.source_position.input_name;
-			source_position.lineno     = start_linenr;
-			errorf(&source_position, "string has no end");
-			pp_token.kind = TP_ERROR;
-			return;
-		}
+		case '\r':
+		case '\n':
+			if (!skip_mode)
+				errorf(&start, "newline while parsing %s", what);
+			goto error;
 
-		case '"':
-			next_char();
-			goto end_of_string;
+		case EOF:
+			if (!skip_mode)
+				errorf(&start, "EOF while parsing %s", what);
+			goto error;
 
 		default:
+			if (input.c == quote) {
+				next_char();
+				obstack_1grow(&symbol_obstack, '\0');
+				return true;
+			}
 			obstack_grow_symbol(&symbol_obstack, input.c);
 			next_char();
 			break;
 		}
 	}
 
-end_of_string:
-	/* add finishing 0 to the string */
-	obstack_1grow(&symbol_obstack, '\0');
+error:
+	obstack_free(&symbol_obstack, obstack_finish(&symbol_obstack));
+	pp_token.kind = TP_ERROR;
+	return false;
+}
+
+static void parse_string_literal(void)
+{
+	if (!parse_quoted('"', "string literal"))
+		return;
+
 	const size_t size   = (size_t)obstack_object_size(&symbol_obstack);
 	char *const  string = obstack_finish(&symbol_obstack);
 
 	pp_token.kind          = TP_STRING_LITERAL;
-	pp_token.string.string = make_string(string, size);
+	pp_token.string.string = make_pp_string(string, size);
 }
 
 /**
@@ -520,104 +832,29 @@ static void parse_wide_string_literal(void)
 		pp_token.kind = TP_WIDE_STRING_LITERAL;
 }
 
-static void parse_wide_character_constant(void)
-{
-	eat('\'');
-
-	while (true) {
-		switch (input.c) {
-		case '\\': {
-			const utf32 tc = parse_escape_sequence();
-			obstack_grow_symbol(&symbol_obstack, tc);
-			break;
-		}
-
-		MATCH_NEWLINE(
-			parse_error("newline while parsing character constant");
-			break;
-		)
-
-		case '\'':
-			next_char();
-			goto end_of_wide_char_constant;
-
-		case EOF:
-			parse_error("EOF while parsing character constant");
-			pp_token.kind = TP_ERROR;
-			return;
-
-		default:
-			obstack_grow_symbol(&symbol_obstack, input.c);
-			next_char();
-			break;
-		}
-	}
-
-end_of_wide_char_constant:
-	obstack_1grow(&symbol_obstack, '\0');
-	size_t  size = (size_t) obstack_object_size(&symbol_obstack)-1;
-	char   *string = obstack_finish(&symbol_obstack);
-	pp_token.kind          = TP_WIDE_CHARACTER_CONSTANT;
-	pp_token.string.string = make_string(string, size);
-
-	if (size == 0) {
-		parse_error("empty character constant");
-	}
-}
-
 static void parse_character_constant(void)
 {
-	const unsigned start_linenr = input.position.lineno;
-
-	eat('\'');
-
-	int tc;
-	while (true) {
-		switch (input.c) {
-		case '\\':
-			tc = parse_escape_sequence();
-			obstack_1grow(&symbol_obstack, (char) tc);
-			break;
-
-		MATCH_NEWLINE(
-			parse_error("newline while parsing character constant");
-			break;
-		)
-
-		case EOF: {
-			source_position_t source_position;
-			source_position.input_name = pp_token.base.source_position.input_name;
-			source_position.lineno     = start_linenr;
-			errorf(&source_position, "EOF while parsing character constant");
-			pp_token.kind = TP_ERROR;
-			return;
-		}
-
-		case '\'':
-			next_char();
-			goto end_of_char_constant;
-
-		default:
-			obstack_1grow(&symbol_obstack, (char) input.c);
-			next_char();
-			break;
-
-		}
-	}
+	if (!parse_quoted('\'', "character constant"))
+		return;
 
-end_of_char_constant:;
-	obstack_1grow(&symbol_obstack, '\0');
 	const size_t size   = (size_t)obstack_object_size(&symbol_obstack);
 	char *const  string = obstack_finish(&symbol_obstack);
 
 	pp_token.kind          = TP_CHARACTER_CONSTANT;
-	pp_token.string.string = make_string(string, size);
+	pp_token.string.string = make_pp_string(string, size);
 
-	if (size == 0) {
+	if (size == 1 && !skip_mode) {
 		parse_error("empty character constant");
 	}
 }
 
+static void parse_wide_character_constant(void)
+{
+	parse_character_constant();
+	if (pp_token.kind == TP_CHARACTER_CONSTANT)
+		pp_token.kind = TP_WIDE_CHARACTER_CONSTANT;
+}
+
 #define SYMBOL_CHARS_WITHOUT_E_P \
 	case 'a': \
 	case 'b': \
@@ -688,53 +925,6 @@ end_of_char_constant:;
 	case '8':  \
 	case '9':
 
-/**
- * returns next final token from a preprocessor macro expansion
- */
-static void expand_next(void)
-{
-	assert(current_expansion != NULL);
-
-	pp_definition_t *definition = current_expansion;
-
-restart:
-	if (definition->list_len == 0
-			|| definition->expand_pos >= definition->list_len) {
-		/* we're finished with the current macro, move up 1 level in the
-		 * expansion stack */
-		pp_definition_t *parent = definition->parent_expansion;
-		definition->parent_expansion = NULL;
-		definition->is_expanding     = false;
-
-		/* it was the outermost expansion, parse normal pptoken */
-		if (parent == NULL) {
-			current_expansion = NULL;
-			next_preprocessing_token();
-			return;
-		}
-		definition        = parent;
-		current_expansion = definition;
-		goto restart;
-	}
-	pp_token = definition->token_list[definition->expand_pos];
-	pp_token.base.source_position = expansion_pos;
-	++definition->expand_pos;
-
-	if (pp_token.kind != TP_IDENTIFIER)
-		return;
-
-	/* if it was an identifier then we might need to expand again */
-	pp_definition_t *symbol_definition = pp_token.identifier.symbol->pp_definition;
-	if (symbol_definition != NULL && !symbol_definition->is_expanding) {
-		symbol_definition->parent_expansion = definition;
-		symbol_definition->expand_pos       = 0;
-		symbol_definition->is_expanding     = true;
-		definition                          = symbol_definition;
-		current_expansion                   = definition;
-		goto restart;
-	}
-}
-
 static void skip_line_comment(void)
 {
 	while (true) {
@@ -747,6 +937,7 @@ static void skip_line_comment(void)
 			return;
 
 		default:
+			skip_scanned(scan_comment);
 			next_char();
 			break;
 		}
@@ -774,39 +965,44 @@ static void skip_multiline_comment(void)
 			break;
 
 		MATCH_NEWLINE(
-			info.at_line_begin |= !in_pp_directive;
+			info.at_line_begin   |= !in_pp_directive;
+			lexed_comment_newline = true;
 			break;
 		)
 
 		case EOF: {
-			source_position_t source_position;
-			source_position.input_name = pp_token.base.source_position.input_name;
-			source_position.lineno     = start_linenr;
+			decoded_position_t position
+				= decode_position(pp_token.base.source_position);
+			position.lineno = start_linenr;
+			source_position_t const source_position = encode_position(&position);
 			errorf(&source_position, "at end of file while looking for comment end");
 			return;
 		}
 
 		default:
+			skip_scanned(scan_comment);
 			next_char();
 			break;
 		}
 	}
 }
 
+/**
+ * Skips whitespace and comments up to, but not including, the end of the
+ * line.
+ */
 static void skip_whitespace(void)
 {
 	while (true) {
 		switch (input.c) {
 		case ' ':
 		case '\t':
+		case '\f':
+		case '\v':
+			skip_scanned(scan_blanks);
 			next_char();
 			continue;
 
-		MATCH_NEWLINE(
-			info.at_line_begin = true;
-			return;
-		)
-
 		case '/':
 			next_char();
 			if (input.c == '/') {
@@ -828,6 +1024,55 @@ static void skip_whitespace(void)
 	}
 }
 
+/**
+ * Skips the rest of the current line of a conditional block which is not
+ * compiled.  Only comments and quotes need to be recognized.
+ */
+static void skip_line(void)
+{
+	while (true) {
+		switch (input.c) {
+		case '\r':
+		case '\n':
+		case EOF:
+			return;
+
+		case '/':
+			next_char();
+			if (input.c == '/') {
+				next_char();
+				skip_line_comment();
+			} else if (input.c == '*') {
+				next_char();
+				skip_multiline_comment();
+			}
+			continue;
+
+		case '"':
+		case '\'': {
+			utf32 const quote = input.c;
+			next_char();
+			while (input.c != quote) {
+				if (input.c == '\r' || input.c == '\n' || input.c == (utf32) EOF)
+					return;
+				if (input.c == '\\') {
+					next_char();
+					if (input.c == '\r' || input.c == '\n' || input.c == (utf32) EOF)
+						return;
+				}
+				next_char();
+			}
+			next_char();
+			continue;
+		}
+
+		default:
+			next_char();
+			continue;
+		}
+	}
+}
+
 static void eat_pp(int type)
 {
 	(void) type;
@@ -837,16 +1082,45 @@ static void eat_pp(int type)
 
 static void parse_symbol(void)
 {
+	/* usually input.c is the byte before bufpos and the identifier ends
+	 * inside the buffer, then it is looked up right there without a copy */
+	if (LIKELY(input.n_putback == 0 && input.bufpos != NULL
+	           && input.bufpos[-1] == input.c)) {
+		const unsigned char *const begin = input.bufpos - 1;
+		skip_scanned(scan_identifier);
+		const unsigned char *const end   = input.bufpos;
+		/* a lone L might start a wide string or character constant */
+		if (LIKELY(end < input.bufend && *end != '$' && *end != '\\'
+		           && *end != '?' && (end - begin != 1 || *begin != 'L'))) {
+			symbol_t *symbol = symbol_table_insert_len((const char*) begin,
+			                                           end - begin);
+			pp_token.kind              = TP_IDENTIFIER;
+			pp_token.identifier.symbol = symbol;
+			next_char();
+			return;
+		}
+		/* the identifier might go on behind the buffer or a continuation */
+		obstack_grow(&symbol_obstack, begin, end - begin - 1);
+		input.c = end[-1];
+	}
+
 	obstack_1grow(&symbol_obstack, (char) input.c);
 	next_char();
 
 	while (true) {
 		switch (input.c) {
+		case '$':
+			if (!allow_dollar_in_symbol)
+				goto end_symbol;
+			/* fallthrough */
 		DIGITS
-		SYMBOL_CHARS
+		SYMBOL_CHARS {
 			obstack_1grow(&symbol_obstack, (char) input.c);
+			const unsigned char *const run = skip_scanned(scan_identifier);
+			obstack_grow(&symbol_obstack, run, input.bufpos - run);
 			next_char();
 			break;
+		}
 
 		default:
 			goto end_symbol;
@@ -870,7 +1144,9 @@ end_symbol:
 
 	symbol_t *symbol = symbol_table_insert(string);
 
-	pp_token.kind              = symbol->pp_ID;
+	/* keywords and directive names are identifiers for the preprocessor,
+	 * the parser gets symbol->ID and directives look at symbol->pp_ID */
+	pp_token.kind              = TP_IDENTIFIER;
 	pp_token.identifier.symbol = symbol;
 
 	/* we can free the memory from symbol obstack if we already had an entry in
@@ -917,7 +1193,7 @@ end_number:
 	char   *string = obstack_finish(&symbol_obstack);
 
 	pp_token.kind          = TP_NUMBER;
-	pp_token.number.number = make_string(string, size);
+	pp_token.number.number = make_pp_string(string, size);
 }
 
 
@@ -944,31 +1220,38 @@ end_number:
 			pp_token.kind = set_type;                      \
 		)
 
-static void next_preprocessing_token(void)
+/**
+ * Reads the next preprocessing token from the input.
+ */
+static void lex_preprocessing_token(void)
 {
-	if (current_expansion != NULL) {
-		expand_next();
-		return;
-	}
-
 	info.at_line_begin  = false;
 	info.had_whitespace = false;
 restart:
-	pp_token.base.source_position = input.position;
+	pp_token.base.source_position = encode_position(&input.position);
 	switch (input.c) {
 	case ' ':
 	case '\t':
-		++info.whitespace;
+	case '\f':
+	case '\v': {
+		const unsigned char *const run = skip_scanned(scan_blanks);
+		info.whitespace    += 1 + (input.bufpos - run);
 		info.had_whitespace = true;
 		next_char();
 		goto restart;
+	}
 
 	MATCH_NEWLINE(
-		info.at_line_begin = true;
+		info.at_line_begin  = true;
 		info.had_whitespace = true;
+		lexed_newline       = true;
 		goto restart;
 	)
 
+	case '$':
+		if (!allow_dollar_in_symbol)
+			goto unknown_char;
+		/* fallthrough */
 	SYMBOL_CHARS
 		parse_symbol();
 		return;
@@ -1122,41 +1405,134 @@ restart:
 		next_char();
 		return;
 
-	case EOF:
-		if (input_stack != NULL) {
-			close_input();
-			pop_restore_input();
-			fputc('\n', out);
-			print_line_directive(&input.position, "2");
-			goto restart;
-		} else {
-			pp_token.base.source_position.lineno++;
-			info.at_line_begin = true;
-			pp_token.kind = TP_EOF;
-		}
+	case EOF: {
+		/* the end of an #include is handled by next_expanded_token, so
+		 * directives at the end of a header don't leave it too early */
+		decoded_position_t position = input.position;
+		++position.lineno;
+		pp_token.base.source_position = encode_position(&position);
+		info.at_line_begin = true;
+		lexed_newline      = true;
+		pp_token.kind      = TP_EOF;
 		return;
+	}
 
 	default:
+unknown_char:
+		/* unknown characters are passed on, the parser complains about
+		 * them if they survive preprocessing */
+		pp_token.kind = input.c;
 		next_char();
-		if (!ignore_unknown_chars) {
-			errorf(&pp_token.base.source_position,
-			       "unknown character '%c' found\n", input.c);
-			pp_token.kind = TP_ERROR;
-		} else {
-			pp_token.kind = input.c;
-		}
 		return;
 	}
 }
 
-static void print_quoted_string(const char *const string)
+static void pop_expansion(void)
 {
-	fputc('"', out);
-	for (const char *c = string; *c != 0; ++c) {
-		switch (*c) {
-		case '"': fputs("\\\"", out); break;
-		case '\\':  fputs("\\\\", out); break;
-		case '\a':  fputs("\\a", out); break;
+	pp_expansion_state_t *expansion = expansion_stack;
+	if (expansion->definition != NULL)
+		expansion->definition->is_expanding = false;
+	expansion_stack = expansion->parent;
+
+	/* the outermost expansion owns all memory on the obstack */
+	if (expansion_stack == NULL)
+		obstack_free(&expansion_obstack, expansion);
+}
+
+/**
+ * Pushes a replacement list to read tokens from.  A NULL definition pushes
+ * a barrier, which reports end of file when it is exhausted.
+ */
+static pp_expansion_state_t *push_expansion(pp_definition_t *definition,
+                                            const token_t *token_list,
+                                            size_t list_len)
+{
+	pp_expansion_state_t *expansion
+		= OALLOCZ(&expansion_obstack, pp_expansion_state_t);
+	expansion->definition     = definition;
+	expansion->token_list     = token_list;
+	expansion->list_len       = list_len;
+	expansion->had_whitespace = info.had_whitespace;
+	expansion->parent         = expansion_stack;
+	expansion_stack           = expansion;
+
+	if (definition != NULL)
+		definition->is_expanding = true;
+	return expansion;
+}
+
+/**
+ * Sets pp_token to the next preprocessing token, taking it from the
+ * macro expansions in progress before reading the input.
+ */
+static void next_preprocessing_token(void)
+{
+	if (UNLIKELY(has_lookahead)) {
+		has_lookahead = false;
+		pp_token      = lookahead_token;
+		info          = lookahead_info;
+		return;
+	}
+
+	if (UNLIKELY(pch_tokens != NULL)) {
+		if (pch_pos < ARR_LEN(pch_tokens)) {
+			/* the first token ends the #include directive */
+			info.at_line_begin  = pch_pos == 0;
+			pp_token            = pch_tokens[pch_pos++];
+			info.had_whitespace = pp_token.base.had_whitespace;
+			return;
+		}
+		/* continue behind the #include */
+		DEL_ARR_F(pch_tokens);
+		pch_tokens = NULL;
+		pp_token   = pch_pending_token;
+		info       = pch_pending_info;
+		return;
+	}
+
+	while (expansion_stack != NULL) {
+		pp_expansion_state_t *expansion = expansion_stack;
+		if (expansion->pos < expansion->list_len) {
+			pp_token = expansion->token_list[expansion->pos];
+			info.at_line_begin = false;
+			if (expansion->definition != NULL) {
+				/* the first token takes over the spacing of the macro name */
+				if (expansion->pos == 0)
+					pp_token.base.had_whitespace = expansion->had_whitespace;
+				pp_token.base.source_position = expansion_pos;
+			}
+			info.had_whitespace = pp_token.base.had_whitespace;
+			++expansion->pos;
+			return;
+		}
+
+		if (expansion->definition == NULL) {
+			pp_token.kind       = TP_EOF;
+			info.at_line_begin  = true;
+			info.had_whitespace = false;
+			return;
+		}
+		pop_expansion();
+	}
+
+	pp_token.base.no_expand = false;
+	if (UNLIKELY(input.replay != NULL)) {
+		replay_token();
+	} else if (UNLIKELY(input.record != NULL)) {
+		lex_recorded_token();
+	} else {
+		lex_preprocessing_token();
+	}
+}
+
+static void print_quoted_string(const char *const string)
+{
+	fputc('"', out);
+	for (const char *c = string; *c != 0; ++c) {
+		switch (*c) {
+		case '"': fputs("\\\"", out); break;
+		case '\\':  fputs("\\\\", out); break;
+		case '\a':  fputs("\\a", out); break;
 		case '\b':  fputs("\\b", out); break;
 		case '\f':  fputs("\\f", out); break;
 		case '\n':  fputs("\\n", out); break;
@@ -1176,7 +1552,8 @@ static void print_quoted_string(const char *const string)
 	fputc('"', out);
 }
 
-static void print_line_directive(const source_position_t *pos, const char *add)
+static void print_line_directive(const decoded_position_t *pos,
+                                 const char *add)
 {
 	fprintf(out, "# %u ", pos->lineno);
 	print_quoted_string(pos->input_name);
@@ -1184,6 +1561,9 @@ static void print_line_directive(const source_position_t *pos, const char *add)
 		fputc(' ', out);
 		fputs(add, out);
 	}
+	if (pos->is_system_header) {
+		fputs(" 3", out);
+	}
 
 	printed_input_name = pos->input_name;
 	input.output_line  = pos->lineno-1;
@@ -1191,18 +1571,75 @@ static void print_line_directive(const source_position_t *pos, const char *add)
 
 static void emit_newlines(void)
 {
-	unsigned delta = pp_token.base.source_position.lineno - input.output_line;
+	decoded_position_t const pos
+		= decode_position(pp_token.base.source_position);
+	unsigned delta = pos.lineno - input.output_line;
 
 	if (delta >= 9) {
 		fputc('\n', out);
-		print_line_directive(&pp_token.base.source_position, NULL);
+		print_line_directive(&pos, NULL);
 		fputc('\n', out);
 	} else {
 		for (unsigned i = 0; i < delta; ++i) {
 			fputc('\n', out);
 		}
 	}
-	input.output_line = pp_token.base.source_position.lineno;
+	input.output_line = pos.lineno;
+}
+
+/**
+ * Appends the spelling of a token to @p obst.
+ *
+ * @param escape  escape '"' and '\' in string literals and character
+ *                constants (for the # operator)
+ */
+static void grow_token_spelling(struct obstack *obst, const token_t *token,
+                                bool escape)
+{
+	char quote;
+	switch (token->kind) {
+	case TP_IDENTIFIER: {
+		const char *string = token->identifier.symbol->string;
+		obstack_grow(obst, string, strlen(string));
+		return;
+	}
+	case TP_NUMBER:
+		obstack_grow(obst, token->number.number.begin,
+		             strlen(token->number.number.begin));
+		return;
+	case TP_WIDE_STRING_LITERAL:
+	case TP_WIDE_CHARACTER_CONSTANT:
+		obstack_1grow(obst, 'L');
+		/* fallthrough */
+	case TP_STRING_LITERAL:
+	case TP_CHARACTER_CONSTANT:
+		quote = token->kind == TP_STRING_LITERAL
+		     || token->kind == TP_WIDE_STRING_LITERAL ? '"' : '\'';
+		if (escape && quote == '"')
+			obstack_1grow(obst, '\\');
+		obstack_1grow(obst, quote);
+		for (const char *c = token->string.string.begin; *c != '\0'; ++c) {
+			if (escape && (*c == '"' || *c == '\\'))
+				obstack_1grow(obst, '\\');
+			obstack_1grow(obst, *c);
+		}
+		if (escape && quote == '"')
+			obstack_1grow(obst, '\\');
+		obstack_1grow(obst, quote);
+		return;
+	case TP_EOF:
+	case TP_ERROR:
+		return;
+	default: {
+		const symbol_t *symbol = get_pp_token_kind_symbol(token->kind);
+		if (symbol != NULL) {
+			obstack_grow(obst, symbol->string, strlen(symbol->string));
+		} else {
+			obstack_grow_symbol(obst, token->kind);
+		}
+		return;
+	}
+	}
 }
 
 static void emit_pp_token(void)
@@ -1216,6 +1653,10 @@ static void emit_pp_token(void)
 		for (unsigned i = 0; i < info.whitespace; ++i)
 			fputc(' ', out);
 
+	} else if (decode_position(pp_token.base.source_position).lineno
+	           > input.output_line) {
+		/* first token of a macro expansion at the beginning of a line */
+		emit_newlines();
 	} else if (info.had_whitespace ||
 			   tokens_would_paste(last_token, pp_token.kind)) {
 		fputc(' ', out);
@@ -1242,6 +1683,8 @@ static void emit_pp_token(void)
 		fputs(pp_token.string.string.begin, out);
 		fputc('\'', out);
 		break;
+	case TP_ERROR:
+		break;
 	default:
 		print_pp_token_kind(out, pp_token.kind);
 		break;
@@ -1281,7 +1724,9 @@ static bool pp_tokens_equal(const token_t *token1, const token_t *token2)
 		return token1->identifier.symbol == token2->identifier.symbol;
 	case TP_NUMBER:
 	case TP_CHARACTER_CONSTANT:
+	case TP_WIDE_CHARACTER_CONSTANT:
 	case TP_STRING_LITERAL:
+	case TP_WIDE_STRING_LITERAL:
 		return strings_equal(&token1->string.string, &token2->string.string);
 
 	default:
@@ -1294,6 +1739,15 @@ static bool pp_definitions_equal(const pp_definition_t *definition1,
 {
 	if (definition1->list_len != definition2->list_len)
 		return false;
+	if (definition1->has_parameters != definition2->has_parameters
+			|| definition1->is_variadic != definition2->is_variadic
+			|| definition1->n_parameters != definition2->n_parameters)
+		return false;
+
+	for (size_t i = 0; i < definition1->n_parameters; ++i) {
+		if (definition1->parameters[i] != definition2->parameters[i])
+			return false;
+	}
 
 	size_t         len = definition1->list_len;
 	const token_t *t1  = definition1->token_list;
@@ -1305,47 +1759,110 @@ static bool pp_definitions_equal(const pp_definition_t *definition1,
 	return true;
 }
 
+/**
+ * Returns the index of the parameter named by @p token or -1.
+ */
+static int get_parameter_index(const pp_definition_t *definition,
+                               const token_t *token)
+{
+	if (token->kind != TP_IDENTIFIER)
+		return -1;
+
+	symbol_t *symbol = token->identifier.symbol;
+	for (size_t i = 0; i < definition->n_parameters; ++i) {
+		if (definition->parameters[i] == symbol)
+			return (int) i;
+	}
+	return -1;
+}
+
+static bool is_builtin_macro(const symbol_t *symbol)
+{
+	return symbol == symbol___FILE__ || symbol == symbol___LINE__
+	    || symbol == symbol___DATE__ || symbol == symbol___TIME__
+	    || symbol == symbol___COUNTER__ || symbol == symbol___INCLUDE_LEVEL__
+	    || symbol == symbol___BASE_FILE__;
+}
+
 static void parse_define_directive(void)
 {
-	eat_pp(TP_define);
+	next_preprocessing_token();
 	assert(obstack_object_size(&pp_obstack) == 0);
 
 	if (pp_token.kind != TP_IDENTIFIER || info.at_line_begin) {
 		errorf(&pp_token.base.source_position,
 		       "expected identifier after #define, got '%t'", &pp_token);
-		goto error_out;
+		eat_pp_directive();
+		return;
 	}
 	symbol_t *symbol = pp_token.identifier.symbol;
+	if (symbol->pp_ID == TP_defined) {
+		errorf(&pp_token.base.source_position,
+		       "\"defined\" cannot be used as a macro name");
+		eat_pp_directive();
+		return;
+	}
 
-	pp_definition_t *new_definition
-		= obstack_alloc(&pp_obstack, sizeof(new_definition[0]));
-	memset(new_definition, 0, sizeof(new_definition[0]));
-	new_definition->source_position = input.position;
+	pp_definition_t *new_definition = OALLOCZ(&pp_obstack, pp_definition_t);
+	new_definition->symbol          = symbol;
+	new_definition->source_position = pp_token.base.source_position;
 
 	/* this is probably the only place where spaces are significant in the
 	 * lexer (except for the fact that they separate tokens). #define b(x)
 	 * is something else than #define b (x) */
-	if (input.c == '(') {
+	bool const is_function_like = UNLIKELY(input.replay != NULL)
+	                              ? replay_function_like() : input.c == '(';
+	if (is_function_like) {
 		/* eat the '(' */
 		next_preprocessing_token();
 		/* get next token after '(' */
 		next_preprocessing_token();
 
 		while (true) {
+			if (info.at_line_begin) {
+				errorf(&pp_token.base.source_position,
+				       "missing ')' in macro parameter list");
+				goto error_out;
+			}
+
 			switch (pp_token.kind) {
 			case TP_DOTDOTDOT:
 				new_definition->is_variadic = true;
+				obstack_ptr_grow(&pp_obstack, symbol_va_args);
 				next_preprocessing_token();
 				if (pp_token.kind != ')') {
-					errorf(&input.position,
+					errorf(&pp_token.base.source_position,
 							"'...' not at end of macro argument list");
 					goto error_out;
 				}
 				break;
-			case TP_IDENTIFIER:
-				obstack_ptr_grow(&pp_obstack, pp_token.identifier.symbol);
+			case TP_IDENTIFIER: {
+				symbol_t  *parameter = pp_token.identifier.symbol;
+				symbol_t **params    = obstack_base(&pp_obstack);
+				size_t     n_params  = obstack_object_size(&pp_obstack)
+				                     / sizeof(params[0]);
+				for (size_t i = 0; i < n_params; ++i) {
+					if (params[i] == parameter) {
+						errorf(&pp_token.base.source_position,
+						       "duplicate macro parameter '%Y'", parameter);
+						goto error_out;
+					}
+				}
+				obstack_ptr_grow(&pp_obstack, parameter);
 				next_preprocessing_token();
 
+				/* GNU named variadic parameter "args..." */
+				if (pp_token.kind == TP_DOTDOTDOT) {
+					new_definition->is_variadic = true;
+					next_preprocessing_token();
+					if (pp_token.kind != ')') {
+						errorf(&pp_token.base.source_position,
+						       "'...' not at end of macro argument list");
+						goto error_out;
+					}
+					break;
+				}
+
 				if (pp_token.kind == ',') {
 					next_preprocessing_token();
 					break;
@@ -1358,6 +1875,7 @@ static void parse_define_directive(void)
 					goto error_out;
 				}
 				break;
+			}
 			case ')':
 				next_preprocessing_token();
 				goto finish_argument_list;
@@ -1382,6 +1900,7 @@ static void parse_define_directive(void)
 	assert(obstack_object_size(&pp_obstack) == 0);
 	size_t list_len = 0;
 	while (!info.at_line_begin) {
+		pp_token.base.had_whitespace = info.had_whitespace;
 		obstack_grow(&pp_obstack, &pp_token, sizeof(pp_token));
 		++list_len;
 		next_preprocessing_token();
@@ -1390,10 +1909,29 @@ static void parse_define_directive(void)
 	new_definition->list_len   = list_len;
 	new_definition->token_list = obstack_finish(&pp_obstack);
 
+	const token_t *tokens = new_definition->token_list;
+	if (list_len > 0 && (tokens[0].kind == TP_HASHHASH
+			|| tokens[list_len-1].kind == TP_HASHHASH)) {
+		errorf(&new_definition->source_position,
+		       "'##' cannot appear at either end of a macro expansion");
+		goto error_free;
+	}
+	for (size_t i = 0; i < list_len; ++i) {
+		if (tokens[i].kind == TP_HASHHASH) {
+			new_definition->has_paste = true;
+		} else if (tokens[i].kind == '#' && new_definition->has_parameters
+				&& (i+1 >= list_len
+				    || get_parameter_index(new_definition, &tokens[i+1]) < 0)) {
+			errorf(&tokens[i].base.source_position,
+			       "'#' is not followed by a macro parameter");
+			goto error_free;
+		}
+	}
+
 	pp_definition_t *old_definition = symbol->pp_definition;
 	if (old_definition != NULL) {
 		if (!pp_definitions_equal(old_definition, new_definition)) {
-			warningf(WARN_OTHER, &input.position, "multiple definition of macro '%Y' (first defined %P)", symbol, &old_definition->source_position);
+			warningf(WARN_OTHER, &new_definition->source_position, "multiple definition of macro '%Y' (first defined %P)", symbol, &old_definition->source_position);
 		} else {
 			/* reuse the old definition */
 			obstack_free(&pp_obstack, new_definition);
@@ -1401,6 +1939,10 @@ static void parse_define_directive(void)
 		}
 	}
 
+	if (new_definition != old_definition) {
+		new_definition->next = definitions;
+		definitions          = new_definition;
+	}
 	symbol->pp_definition = new_definition;
 	return;
 
@@ -1410,14 +1952,17 @@ error_out:
 		obstack_free(&pp_obstack, ptr);
 	}
 	eat_pp_directive();
+error_free:
+	obstack_free(&pp_obstack, new_definition);
 }
 
 static void parse_undef_directive(void)
 {
-	eat_pp(TP_undef);
+	next_preprocessing_token();
 
-	if (pp_token.kind != TP_IDENTIFIER) {
-		errorf(&input.position,
+	if (pp_token.kind != TP_IDENTIFIER || info.at_line_begin) {
+		source_position_t const position = encode_position(&input.position);
+		errorf(&position,
 		       "expected identifier after #undef, got '%t'", &pp_token);
 		eat_pp_directive();
 		return;
@@ -1428,419 +1973,3740 @@ static void parse_undef_directive(void)
 	next_preprocessing_token();
 
 	if (!info.at_line_begin) {
-		warningf(WARN_OTHER, &input.position, "extra tokens at end of #undef directive");
+		source_position_t const position = encode_position(&input.position);
+		warningf(WARN_OTHER, &position, "extra tokens at end of #undef directive");
 	}
 	eat_pp_directive();
 }
 
-static const char *parse_headername(void)
+/**
+ * Stringifies a macro argument for the # operator.
+ */
+static token_t stringify_argument(const token_t *tokens, const token_t *hash)
 {
-	/* behind an #include we can have the special headername lexems.
-	 * They're only allowed behind an #include so they're not recognized
-	 * by the normal next_preprocessing_token. We handle them as a special
-	 * exception here */
-	if (info.at_line_begin) {
-		parse_error("expected headername after #include");
-		return NULL;
-	}
-
 	assert(obstack_object_size(&symbol_obstack) == 0);
+	size_t n_tokens = ARR_LEN(tokens);
+	for (size_t i = 0; i < n_tokens; ++i) {
+		if (i > 0 && tokens[i].base.had_whitespace)
+			obstack_1grow(&symbol_obstack, ' ');
+		grow_token_spelling(&symbol_obstack, &tokens[i], true);
+	}
+	obstack_1grow(&symbol_obstack, '\0');
+	size_t  size   = obstack_object_size(&symbol_obstack);
+	char   *string = obstack_finish(&symbol_obstack);
 
-	/* check wether we have a "... or <... headername */
-	switch (input.c) {
-	case '<':
-		next_char();
-		while (true) {
-			switch (input.c) {
-			case EOF:
-				/* fallthrough */
-			MATCH_NEWLINE(
-				parse_error("header name without closing '>'");
-				return NULL;
-			)
-			case '>':
-				next_char();
-				goto finished_headername;
-			}
-			obstack_1grow(&symbol_obstack, (char) input.c);
-			next_char();
-		}
-		/* we should never be here */
-
-	case '"':
-		next_char();
-		while (true) {
-			switch (input.c) {
-			case EOF:
-				/* fallthrough */
-			MATCH_NEWLINE(
-				parse_error("header name without closing '>'");
-				return NULL;
-			)
-			case '"':
-				next_char();
-				goto finished_headername;
-			}
-			obstack_1grow(&symbol_obstack, (char) input.c);
-			next_char();
-		}
-		/* we should never be here */
+	token_t result;
+	memset(&result, 0, sizeof(result));
+	result.kind                = TP_STRING_LITERAL;
+	result.base.source_position = hash->base.source_position;
+	result.base.had_whitespace  = hash->base.had_whitespace;
+	result.string.string        = make_pp_string(string, size);
+	return result;
+}
 
-	default:
-		/* TODO: do normal pp_token parsing and concatenate results */
-		panic("pp_token concat include not implemented yet");
-	}
+static bool is_identifier_char(char c)
+{
+	return isalnum((unsigned char) c) || c == '_'
+	    || (c == '$' && allow_dollar_in_symbol);
+}
 
-finished_headername:
+/**
+ * Concatenates two tokens for the ## operator and stores the result in
+ * @p left.
+ *
+ * @return false if the result is no valid preprocessing token
+ */
+static bool paste_tokens(token_t *left, const token_t *right)
+{
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	grow_token_spelling(&symbol_obstack, left, false);
+	grow_token_spelling(&symbol_obstack, right, false);
 	obstack_1grow(&symbol_obstack, '\0');
-	char *headername = obstack_finish(&symbol_obstack);
+	size_t  size   = obstack_object_size(&symbol_obstack);
+	char   *string = obstack_finish(&symbol_obstack);
 
-	/* TODO: iterate search-path to find the file */
+	if (string[0] == 'L' && (string[1] == '"' || string[1] == '\'')
+			&& size > 4 && string[size-2] == string[1]) {
+		/* L pasted to a string literal or character constant */
+		bool is_string = string[1] == '"';
+		string[size-2] = '\0';
+		char *contents = obstack_copy(&symbol_obstack, string+2, size-3);
+		obstack_free(&symbol_obstack, string);
 
-	skip_whitespace();
+		left->kind          = is_string ? TP_WIDE_STRING_LITERAL
+		                                : TP_WIDE_CHARACTER_CONSTANT;
+		left->string.string = make_pp_string(contents, size-3);
+		return true;
+	}
 
-	return identify_string(headername);
-}
+	if (isalpha((unsigned char) string[0]) || string[0] == '_'
+			|| (string[0] == '$' && allow_dollar_in_symbol)) {
+		for (const char *c = string; *c != '\0'; ++c) {
+			if (!is_identifier_char(*c))
+				goto invalid;
+		}
+		symbol_t *symbol = symbol_table_insert(string);
+		if (symbol->string != string)
+			obstack_free(&symbol_obstack, string);
+		left->kind              = TP_IDENTIFIER;
+		left->identifier.symbol = symbol;
+		left->base.no_expand    = false;
+		return true;
+	}
 
-static bool do_include(bool system_include, const char *headername)
-{
-	if (!system_include) {
-		/* for "bla" includes first try current dir
-		 * TODO: this isn't correct, should be the directory of the source file
-		 */
-		FILE *file = fopen(headername, "r");
-		if (file != NULL) {
-			switch_input(file, headername);
-			return true;
+	if (isdigit((unsigned char) string[0])
+			|| (string[0] == '.' && isdigit((unsigned char) string[1]))) {
+		for (const char *c = string; *c != '\0'; ++c) {
+			if (is_identifier_char(*c) || *c == '.')
+				continue;
+			if ((*c == '+' || *c == '-')
+					&& (c[-1] == 'e' || c[-1] == 'E'
+					    || c[-1] == 'p' || c[-1] == 'P'))
+				continue;
+			goto invalid;
 		}
+		left->kind          = TP_NUMBER;
+		left->number.number = make_pp_string(string, size);
+		return true;
 	}
 
-	size_t headername_len = strlen(headername);
-	assert(obstack_object_size(&pp_obstack) == 0);
-	/* check searchpath */
-	for (searchpath_entry_t *entry = searchpath; entry != NULL;
-	     entry = entry->next) {
-	    const char *path = entry->path;
-	    size_t      len  = strlen(path);
-		obstack_grow(&pp_obstack, path, len);
-		if (path[len-1] != '/')
-			obstack_1grow(&pp_obstack, '/');
-		obstack_grow(&pp_obstack, headername, headername_len+1);
-
-		char *complete_path = obstack_finish(&pp_obstack);
-		FILE *file          = fopen(complete_path, "r");
-		if (file != NULL) {
-			const char *filename = identify_string(complete_path);
-			switch_input(file, filename);
+	if (string[0] != '\0') {
+		symbol_t *symbol = symbol_table_insert(string);
+		int       kind   = symbol->pp_ID;
+		if (symbol->string != string)
+			obstack_free(&symbol_obstack, string);
+		if (kind != TP_IDENTIFIER && kind < TP_IDENTIFIER) {
+			left->kind = kind;
 			return true;
 		}
-		obstack_free(&pp_obstack, complete_path);
+		return false;
 	}
 
+invalid:
+	obstack_free(&symbol_obstack, string);
 	return false;
 }
 
-static bool parse_include_directive(void)
+/**
+ * Appends the tokens of an argument.  The first token takes over the
+ * spacing of the parameter in the replacement list.
+ */
+static void append_argument(token_t **result, const token_t *tokens,
+                            const token_t *parameter)
 {
-	/* don't eat the TP_include here!
-	 * we need an alternative parsing for the next token */
-	skip_whitespace();
-	bool system_include = input.c == '<';
-	const char *headername = parse_headername();
-	if (headername == NULL) {
-		eat_pp_directive();
-		return false;
-	}
-
-	if (!info.at_line_begin) {
-		warningf(WARN_OTHER, &pp_token.base.source_position,
-		         "extra tokens at end of #include directive");
-		eat_pp_directive();
-	}
-
-	if (n_inputs > INCLUDE_LIMIT) {
-		errorf(&pp_token.base.source_position, "#include nested too deeply");
-		/* eat \n or EOF */
-		next_preprocessing_token();
-		return false;
+	size_t n_tokens = ARR_LEN(tokens);
+	for (size_t i = 0; i < n_tokens; ++i) {
+		token_t token = tokens[i];
+		if (i == 0)
+			token.base.had_whitespace = parameter->base.had_whitespace;
+		ARR_APP1(token_t, *result, token);
 	}
+}
 
-	/* we have to reenable space counting and macro expansion here,
-	 * because it is still disabled in directive parsing,
-	 * but we will trigger a preprocessing token reading of the new file
-	 * now and need expansions/space counting */
-	in_pp_directive = false;
+static void expand_argument(pp_argument_t *argument)
+{
+	token_t *expanded = NEW_ARR_F(token_t, 0);
 
-	/* switch inputs */
-	emit_newlines();
-	push_input();
-	bool res = do_include(system_include, headername);
-	if (!res) {
-		errorf(&pp_token.base.source_position,
-		       "failed including '%s': %s", headername, strerror(errno));
-		pop_restore_input();
-		return false;
+	push_expansion(NULL, argument->tokens, ARR_LEN(argument->tokens));
+	while (true) {
+		next_expanded_token();
+		if (pp_token.kind == TP_EOF)
+			break;
+		pp_token.base.had_whitespace = info.had_whitespace;
+		ARR_APP1(token_t, expanded, pp_token);
 	}
+	pop_expansion();
 
-	return true;
+	argument->expanded = expanded;
 }
 
-static pp_conditional_t *push_conditional(void)
+/**
+ * Replaces the parameters in the replacement list of @p definition and
+ * applies the # and ## operators.
+ *
+ * @return a new ARR_F with the resulting tokens
+ */
+static token_t *substitute_arguments(const pp_definition_t *definition,
+                                     pp_argument_t *arguments)
 {
-	pp_conditional_t *conditional
-		= obstack_alloc(&pp_obstack, sizeof(*conditional));
-	memset(conditional, 0, sizeof(*conditional));
-
-	conditional->parent = conditional_stack;
-	conditional_stack   = conditional;
+	token_t       *result   = NEW_ARR_F(token_t, 0);
+	const token_t *list     = definition->token_list;
+	size_t         list_len = definition->list_len;
+	/* an empty argument left of ## is a placemarker */
+	bool           placemarker = false;
+
+	for (size_t i = 0; i < list_len; ++i) {
+		const token_t *token = &list[i];
+
+		if (token->kind == '#' && definition->has_parameters) {
+			int index = get_parameter_index(definition, &list[i+1]);
+			assert(index >= 0);
+			token_t string = stringify_argument(arguments[index].tokens, token);
+			ARR_APP1(token_t, result, string);
+			placemarker = false;
+			++i;
+			continue;
+		}
 
-	return conditional;
-}
+		if (token->kind == TP_HASHHASH) {
+			const token_t *operand = &list[++i];
+			int            index   = get_parameter_index(definition, operand);
+			const token_t *tokens  = operand;
+			size_t         n_tokens = 1;
+			if (index >= 0) {
+				tokens   = arguments[index].tokens;
+				n_tokens = ARR_LEN(tokens);
+
+				/* GNU extension: , ## __VA_ARGS__ swallows the comma if
+				 * the variable arguments are empty */
+				if (definition->is_variadic
+						&& (size_t) index == definition->n_parameters-1
+						&& !placemarker && ARR_LEN(result) > 0
+						&& result[ARR_LEN(result)-1].kind == ',') {
+					if (n_tokens == 0)
+						ARR_SHRINKLEN(result, ARR_LEN(result)-1);
+					for (size_t t = 0; t < n_tokens; ++t) {
+						ARR_APP1(token_t, result, tokens[t]);
+					}
+					continue;
+				}
+			}
 
-static void pop_conditional(void)
-{
-	assert(conditional_stack != NULL);
-	conditional_stack = conditional_stack->parent;
-}
+			size_t first = 0;
+			if (n_tokens > 0 && !placemarker) {
+				token_t *left = &result[ARR_LEN(result)-1];
+				if (!paste_tokens(left, &tokens[0])) {
+					errorf(&left->base.source_position,
+					       "pasting \"%t\" and \"%t\" does not give a valid preprocessing token",
+					       left, &tokens[0]);
+				} else {
+					first = 1;
+				}
+			}
+			for (size_t t = first; t < n_tokens; ++t) {
+				ARR_APP1(token_t, result, tokens[t]);
+			}
+			placemarker = placemarker && n_tokens == 0;
+			continue;
+		}
 
-static void check_unclosed_conditionals(void)
-{
-	while (conditional_stack != NULL) {
-		pp_conditional_t *conditional = conditional_stack;
+		int index = get_parameter_index(definition, token);
+		if (index < 0 || !definition->has_parameters) {
+			ARR_APP1(token_t, result, *token);
+			placemarker = false;
+			continue;
+		}
 
-		if (conditional->in_else) {
-			errorf(&conditional->source_position, "unterminated #else");
+		pp_argument_t *argument = &arguments[index];
+		bool next_is_paste = i+1 < list_len && list[i+1].kind == TP_HASHHASH;
+		if (next_is_paste) {
+			/* operands of ## are not macro-expanded */
+			append_argument(&result, argument->tokens, token);
+			placemarker = ARR_LEN(argument->tokens) == 0;
 		} else {
-			errorf(&conditional->source_position, "unterminated condition");
+			if (argument->expanded == NULL)
+				expand_argument(argument);
+			append_argument(&result, argument->expanded, token);
+			placemarker = false;
 		}
-		pop_conditional();
 	}
+
+	return result;
 }
 
-static void parse_ifdef_ifndef_directive(void)
+/**
+ * Reads the arguments of a function-like macro invocation, pp_token is the
+ * opening parenthesis.
+ *
+ * @return an ARR_F of the arguments or NULL on error
+ */
+static pp_argument_t *collect_arguments(const pp_definition_t *definition,
+                                        const source_position_t *position)
 {
-	bool is_ifndef = (pp_token.kind == TP_ifndef);
-	bool condition;
-	next_preprocessing_token();
+	size_t         n_parameters = definition->n_parameters;
+	pp_argument_t *arguments    = NEW_ARR_F(pp_argument_t, 0);
+	token_t       *tokens       = NEW_ARR_F(token_t, 0);
+	unsigned       depth        = 0;
 
-	if (skip_mode) {
-		eat_pp_directive();
-		pp_conditional_t *conditional = push_conditional();
-		conditional->source_position  = pp_token.base.source_position;
-		conditional->skip             = true;
-		return;
+	next_preprocessing_token();
+	while (true) {
+		switch (pp_token.kind) {
+		case '#':
+			/* directives inside macro arguments are processed as usual */
+			if (info.at_line_begin) {
+				parse_preprocessing_directive();
+				if (skip_mode)
+					skip_conditional_block();
+				continue;
+			}
+			break;
+
+		case TP_EOF:
+			errorf(position, "unterminated argument list invoking macro '%Y'",
+			       definition->symbol);
+			goto error;
+
+		case '(':
+			++depth;
+			break;
+
+		case ')':
+			if (depth > 0) {
+				--depth;
+				break;
+			}
+			goto end_of_arguments;
+
+		case ',':
+			/* the variable arguments take all remaining commas */
+			if (depth == 0 && !(definition->is_variadic
+					&& ARR_LEN(arguments) + 1 >= n_parameters)) {
+				pp_argument_t argument = { tokens, NULL };
+				ARR_APP1(pp_argument_t, arguments, argument);
+				tokens = NEW_ARR_F(token_t, 0);
+				next_preprocessing_token();
+				continue;
+			}
+			break;
+
+		default:
+			break;
+		}
+
+		pp_token.base.had_whitespace = info.had_whitespace;
+		ARR_APP1(token_t, tokens, pp_token);
+		next_preprocessing_token();
 	}
 
-	if (pp_token.kind != TP_IDENTIFIER || info.at_line_begin) {
-		errorf(&pp_token.base.source_position,
-		       "expected identifier after #%s, got '%t'",
-		       is_ifndef ? "ifndef" : "ifdef", &pp_token);
-		eat_pp_directive();
+end_of_arguments:;
+	/* "f()" is an invocation with one empty argument */
+	pp_argument_t argument = { tokens, NULL };
+	ARR_APP1(pp_argument_t, arguments, argument);
+
+	size_t n_arguments = ARR_LEN(arguments);
+	if (n_arguments == n_parameters - 1 && definition->is_variadic) {
+		/* the variable arguments may be left out completely */
+		pp_argument_t empty = { NEW_ARR_F(token_t, 0), NULL };
+		ARR_APP1(pp_argument_t, arguments, empty);
+	} else if (n_arguments == 1 && n_parameters == 0
+			&& ARR_LEN(arguments[0].tokens) == 0) {
+		DEL_ARR_F(arguments[0].tokens);
+		ARR_SHRINKLEN(arguments, 0);
+	} else if (n_arguments != n_parameters) {
+		errorf(position, "macro '%Y' requires %u arguments, but %u given",
+		       definition->symbol, (unsigned) n_parameters,
+		       (unsigned) n_arguments);
+		tokens = NULL;
+		goto error;
+	}
+	return arguments;
 
-		/* just take the true case in the hope to avoid further errors */
-		condition = true;
+error:
+	for (size_t i = 0; i < ARR_LEN(arguments); ++i) {
+		DEL_ARR_F(arguments[i].tokens);
+	}
+	DEL_ARR_F(arguments);
+	if (tokens != NULL)
+		DEL_ARR_F(tokens);
+	return NULL;
+}
+
+static void free_arguments(pp_argument_t *arguments)
+{
+	for (size_t i = 0; i < ARR_LEN(arguments); ++i) {
+		DEL_ARR_F(arguments[i].tokens);
+		if (arguments[i].expanded != NULL)
+			DEL_ARR_F(arguments[i].expanded);
+	}
+	DEL_ARR_F(arguments);
+}
+
+static string_t make_number_string(unsigned long long value)
+{
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	obstack_printf(&symbol_obstack, "%llu", value);
+	obstack_1grow(&symbol_obstack, '\0');
+	size_t  size   = obstack_object_size(&symbol_obstack);
+	char   *string = obstack_finish(&symbol_obstack);
+	return make_pp_string(string, size);
+}
+
+/**
+ * Replaces pp_token by the value of a builtin macro like __FILE__.
+ */
+/**
+ * Remembers that the header being precompiled expands a builtin macro whose
+ * value depends on the unit including it.
+ */
+static void note_pch_context_use(void)
+{
+	if (pch_dependencies != NULL && !pch_context_dependent) {
+		pch_context_dependent = true;
+		pch_context_position  = pp_token.base.source_position;
+	}
+}
+
+static void expand_builtin_macro(const symbol_t *symbol)
+{
+	const char *string;
+	if (symbol == symbol___LINE__) {
+		pp_token.kind          = TP_NUMBER;
+		pp_token.number.number = make_number_string(
+				decode_position(pp_token.base.source_position).lineno);
+		return;
+	} else if (symbol == symbol___COUNTER__) {
+		pp_token.kind          = TP_NUMBER;
+		pp_token.number.number = make_number_string(counter++);
+		return;
+	} else if (symbol == symbol___INCLUDE_LEVEL__) {
+		note_pch_context_use();
+		pp_token.kind          = TP_NUMBER;
+		pp_token.number.number = make_number_string(n_inputs);
+		return;
+	} else if (symbol == symbol___FILE__) {
+		string = input.position.input_name;
+	} else if (symbol == symbol___BASE_FILE__) {
+		note_pch_context_use();
+		string = base_file_name;
+	} else if (symbol == symbol___DATE__) {
+		string = date_string;
+	} else if (symbol == symbol___TIME__) {
+		string = time_string;
 	} else {
-		symbol_t        *symbol        = pp_token.identifier.symbol;
-		pp_definition_t *pp_definition = symbol->pp_definition;
+		return;
+	}
+
+	/* string literals are kept with their escape sequences */
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	for (const char *c = string; *c != '\0'; ++c) {
+		if (*c == '"' || *c == '\\')
+			obstack_1grow(&symbol_obstack, '\\');
+		obstack_1grow(&symbol_obstack, *c);
+	}
+	obstack_1grow(&symbol_obstack, '\0');
+	size_t  size   = obstack_object_size(&symbol_obstack);
+	char   *result = obstack_finish(&symbol_obstack);
+
+	pp_token.kind          = TP_STRING_LITERAL;
+	pp_token.string.string = make_pp_string(result, size);
+}
+
+/**
+ * Starts the expansion of the identifier in pp_token if it names a macro.
+ *
+ * @return true if the expansion replaces the token, false if the token
+ *         is taken as it is
+ */
+static bool start_expansion(void)
+{
+	symbol_t        *symbol     = pp_token.identifier.symbol;
+	pp_definition_t *definition = symbol->pp_definition;
+	if (definition == NULL) {
+		if (UNLIKELY(is_builtin_macro(symbol)))
+			expand_builtin_macro(symbol);
+		return false;
+	}
+	if (definition->is_expanding || pp_token.base.no_expand) {
+		/* the name stays unexpanded, even when it is rescanned later as part
+		 * of an argument */
+		pp_token.base.no_expand = true;
+		return false;
+	}
+
+	if (expansion_stack == NULL)
+		expansion_pos = pp_token.base.source_position;
+
+	if (!definition->has_parameters) {
+		if (!definition->has_paste) {
+			push_expansion(definition, definition->token_list,
+			               definition->list_len);
+			return true;
+		}
+		token_t *tokens = substitute_arguments(definition, NULL);
+		pp_expansion_state_t *expansion = push_expansion(definition, NULL, 0);
+		expansion->token_list = obstack_copy(&expansion_obstack, tokens,
+		                                     ARR_LEN(tokens) * sizeof(tokens[0]));
+		expansion->list_len   = ARR_LEN(tokens);
+		DEL_ARR_F(tokens);
+		return true;
+	}
+
+	/* a function-like macro is only expanded if a '(' follows */
+	token_t          name_token = pp_token;
+	add_token_info_t name_info  = info;
+	next_preprocessing_token();
+	if (pp_token.kind != '(') {
+		lookahead_token = pp_token;
+		lookahead_info  = info;
+		has_lookahead   = true;
+		pp_token        = name_token;
+		info            = name_info;
+		return false;
+	}
+
+	pp_argument_t *arguments
+		= collect_arguments(definition, &name_token.base.source_position);
+	if (arguments == NULL) {
+		/* continue behind the invocation */
+		lookahead_token = pp_token;
+		lookahead_info  = info;
+		has_lookahead   = true;
+		return true;
+	}
+
+	token_t *tokens = substitute_arguments(definition, arguments);
+	free_arguments(arguments);
+
+	info = name_info;
+	pp_expansion_state_t *expansion = push_expansion(definition, NULL, 0);
+	expansion->token_list = obstack_copy(&expansion_obstack, tokens,
+	                                     ARR_LEN(tokens) * sizeof(tokens[0]));
+	expansion->list_len   = ARR_LEN(tokens);
+	DEL_ARR_F(tokens);
+	return true;
+}
+
+/**
+ * Handles the _Pragma operator, pp_token is the _Pragma identifier.
+ */
+static void parse_pragma_operator(void)
+{
+	source_position_t position = pp_token.base.source_position;
+
+	next_preprocessing_token();
+	if (pp_token.kind != '(') {
+		errorf(&position, "_Pragma takes a parenthesized string literal");
+		return;
+	}
+	next_preprocessing_token();
+	if (pp_token.kind != TP_STRING_LITERAL
+			&& pp_token.kind != TP_WIDE_STRING_LITERAL) {
+		errorf(&position, "_Pragma takes a parenthesized string literal");
+		return;
+	}
+	const char *pragma = pp_token.string.string.begin;
+	next_preprocessing_token();
+	if (pp_token.kind != ')') {
+		errorf(&position, "_Pragma takes a parenthesized string literal");
+		return;
+	}
+	next_preprocessing_token();
+
+	/* only -E has a use for it: the parser ignores unknown pragmas anyway */
+	if (out == NULL)
+		return;
+
+	fputs("\n#pragma ", out);
+	for (const char *c = pragma; *c != '\0'; ++c) {
+		if (*c == '\\' && (c[1] == '"' || c[1] == '\\'))
+			++c;
+		fputc(*c, out);
+	}
+	decoded_position_t const pos = decode_position(position);
+	fputc('\n', out);
+	print_line_directive(&pos, NULL);
+	fputc('\n', out);
+	input.output_line = pos.lineno;
+}
+
+static pp_conditional_t *push_conditional(void)
+{
+	pp_conditional_t *conditional
+		= obstack_alloc(&pp_obstack, sizeof(*conditional));
+	memset(conditional, 0, sizeof(*conditional));
+
+	conditional->parent = conditional_stack;
+	conditional_stack   = conditional;
+
+	return conditional;
+}
+
+static void pop_conditional(void)
+{
+	assert(conditional_stack != NULL);
+	conditional_stack = conditional_stack->parent;
+}
+
+/**
+ * Notes that the current input has an effect, which is only allowed inside
+ * of an include guard.
+ */
+static void mark_unguarded(void)
+{
+	if (input.guard_state != GUARD_INSIDE)
+		input.guard_state = GUARD_NONE;
+}
+
+/**
+ * Returns from an included file to the token behind its #include.
+ */
+static void pop_include(void)
+{
+	const pp_conditional_t *base = input_stack->conditional_base;
+	while (conditional_stack != base) {
+		pp_conditional_t *conditional = conditional_stack;
+		errorf(&conditional->source_position,
+		       conditional->in_else ? "unterminated #else"
+		                            : "unterminated condition");
+		pop_conditional();
+	}
+	skip_mode = false;
+
+	/* the guard is known once the whole file is seen */
+	if (input.file_info != NULL) {
+		input.file_info->guard
+			= input.guard_state == GUARD_ENDED ? input.guard : NULL;
+	}
+
+	close_input();
+	pop_restore_input();
+
+	pp_token = input.pending_token;
+	info     = input.pending_info;
+	if (out != NULL) {
+		fputc('\n', out);
+		print_line_directive(&input.return_position, "2");
+	}
+}
+
+/**
+ * Sets pp_token to the next token after macro expansion and processing of
+ * directives.
+ */
+static void next_expanded_token(void)
+{
+	next_preprocessing_token();
+	while (true) {
+		switch (pp_token.kind) {
+		case '#':
+			if (!info.at_line_begin || pch_tokens != NULL)
+				break;
+			parse_preprocessing_directive();
+			if (skip_mode)
+				skip_conditional_block();
+			continue;
+
+		case TP_EOF:
+			if (expansion_stack == NULL && input_stack != NULL) {
+				pop_include();
+				continue;
+			}
+			return;
+
+		case TP_IDENTIFIER:
+			/* tokens of a precompiled header are expanded already */
+			if (pch_tokens != NULL)
+				break;
+			if (pp_token.identifier.symbol == symbol__Pragma) {
+				mark_unguarded();
+				parse_pragma_operator();
+				continue;
+			}
+			if (!start_expansion())
+				break;
+			next_preprocessing_token();
+			continue;
+
+		default:
+			break;
+		}
+
+		mark_unguarded();
+		return;
+	}
+}
+
+/**
+ * Skips the lines of a conditional block which is not compiled until a
+ * directive ends skip mode.
+ */
+static void skip_conditional_block(void)
+{
+	while (skip_mode) {
+		if (pp_token.kind == TP_EOF)
+			return;
+		if (pp_token.kind == '#' && info.at_line_begin) {
+			parse_preprocessing_directive();
+			continue;
+		}
+		if (UNLIKELY(input.record != NULL || input.replay != NULL)) {
+			/* the token cache contains the skipped lines as well, the next
+			 * translation unit might not skip them */
+			do {
+				next_preprocessing_token();
+			} while (!info.at_line_begin);
+			continue;
+		}
+		skip_line();
 		next_preprocessing_token();
+	}
+}
 
-		if (!info.at_line_begin) {
-			errorf(&pp_token.base.source_position,
-			       "extra tokens at end of #%s",
-			       is_ifndef ? "ifndef" : "ifdef");
-			eat_pp_directive();
+/**
+ * Reads the rest of the directive line and macro-expands it.
+ * pp_token is the first token of the next line afterwards.
+ *
+ * @param is_condition  handle the defined operator of #if
+ * @return an ARR_F of the tokens terminated by TP_EOF
+ */
+static token_t *read_directive_line(bool is_condition)
+{
+	token_t *line = NEW_ARR_F(token_t, 0);
+	while (!info.at_line_begin) {
+		if (is_condition && pp_token.kind == TP_IDENTIFIER
+				&& pp_token.identifier.symbol->pp_ID == TP_defined) {
+			/* defined X or defined(X): the operand must not be expanded */
+			token_t result = pp_token;
+			result.base.had_whitespace = info.had_whitespace;
+			result.kind = TP_NUMBER;
+
+			next_preprocessing_token();
+			bool in_paren = pp_token.kind == '(' && !info.at_line_begin;
+			if (in_paren)
+				next_preprocessing_token();
+
+			bool defined = false;
+			if (pp_token.kind != TP_IDENTIFIER || info.at_line_begin) {
+				errorf(&result.base.source_position,
+				       "operator \"defined\" requires an identifier");
+			} else {
+				const symbol_t *symbol = pp_token.identifier.symbol;
+				defined = symbol->pp_definition != NULL
+				       || is_builtin_macro(symbol);
+				next_preprocessing_token();
+			}
+			if (in_paren) {
+				if (pp_token.kind != ')' || info.at_line_begin) {
+					errorf(&result.base.source_position,
+					       "missing ')' after \"defined\"");
+				} else {
+					next_preprocessing_token();
+				}
+			}
+
+			result.number.number = defined ? one_string : zero_string;
+			ARR_APP1(token_t, line, result);
+			continue;
+		}
+
+		pp_token.base.had_whitespace = info.had_whitespace;
+		ARR_APP1(token_t, line, pp_token);
+		next_preprocessing_token();
+	}
+
+	/* expand the line while keeping the first token of the next line */
+	token_t          next_token = pp_token;
+	add_token_info_t next_info  = info;
+
+	token_t *expanded = NEW_ARR_F(token_t, 0);
+	push_expansion(NULL, line, ARR_LEN(line));
+	while (true) {
+		next_expanded_token();
+		if (pp_token.kind == TP_EOF)
+			break;
+		pp_token.base.had_whitespace = info.had_whitespace;
+		ARR_APP1(token_t, expanded, pp_token);
+	}
+	pop_expansion();
+	DEL_ARR_F(line);
+
+	pp_token.base.source_position = next_token.base.source_position;
+	ARR_APP1(token_t, expanded, pp_token);
+
+	pp_token = next_token;
+	info     = next_info;
+	return expanded;
+}
+
+/**
+ * Returns the file name of a header name, a string literal or a sequence of
+ * tokens in < >.
+ */
+static const char *get_computed_headername(const token_t *tokens,
+                                           bool *system_include)
+{
+	if (tokens[0].kind == TP_STRING_LITERAL && tokens[1].kind == TP_EOF) {
+		*system_include = false;
+		return tokens[0].string.string.begin;
+	}
+	if (tokens[0].kind != '<')
+		return NULL;
+
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	const token_t *token = &tokens[1];
+	for (; token->kind != '>'; ++token) {
+		if (token->kind == TP_EOF) {
+			obstack_free(&symbol_obstack, obstack_finish(&symbol_obstack));
+			return NULL;
 		}
+		if (token != &tokens[1] && token->base.had_whitespace)
+			obstack_1grow(&symbol_obstack, ' ');
+		grow_token_spelling(&symbol_obstack, token, false);
+	}
+	obstack_1grow(&symbol_obstack, '\0');
+	*system_include = true;
+	return identify_string(obstack_finish(&symbol_obstack));
+}
+
+static const char *parse_headername(void)
+{
+	/* behind an #include we can have the special headername lexems.
+	 * They're only allowed behind an #include so they're not recognized
+	 * by the normal next_preprocessing_token. We handle them as a special
+	 * exception here */
+	assert(obstack_object_size(&symbol_obstack) == 0);
+
+	/* check wether we have a "... or <... headername */
+	utf32 const end = input.c == '<' ? '>' : '"';
+	next_char();
+	while (true) {
+		switch (input.c) {
+		case EOF:
+		case '\r':
+		case '\n':
+			errorf(&pp_token.base.source_position,
+			       "header name without closing '%c'", (char) end);
+			obstack_free(&symbol_obstack, obstack_finish(&symbol_obstack));
+			return NULL;
+		default:
+			if (input.c == end) {
+				next_char();
+				goto finished_headername;
+			}
+			break;
+		}
+		obstack_1grow(&symbol_obstack, (char) input.c);
+		next_char();
+	}
+
+finished_headername:
+	obstack_1grow(&symbol_obstack, '\0');
+	char *headername = obstack_finish(&symbol_obstack);
+
+	return identify_string(headername);
+}
+
+static size_t include_file_slot(include_file_t *const *table, size_t size,
+                                const char *filename)
+{
+	size_t const mask = size - 1;
+	size_t       i    = ((size_t) filename >> 3) & mask;
+	while (table[i] != NULL && table[i]->filename != filename) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+/**
+ * Returns the record of the path @p filename, which has to be identified
+ * already, or NULL if no #include tried it yet.
+ */
+static include_file_t *find_include_file(const char *filename)
+{
+	if (include_files == NULL)
+		return NULL;
+	return include_files[include_file_slot(include_files, include_files_size,
+	                                       filename)];
+}
+
+static include_file_t *get_include_file(const char *filename)
+{
+	if (2 * (n_include_files + 1) > include_files_size) {
+		size_t const     new_size  = include_files_size == 0
+		                             ? 64 : 2 * include_files_size;
+		include_file_t **new_files = XMALLOCNZ(include_file_t*, new_size);
+		for (size_t i = 0; i < include_files_size; ++i) {
+			include_file_t *file = include_files[i];
+			if (file != NULL) {
+				new_files[include_file_slot(new_files, new_size,
+				                            file->filename)] = file;
+			}
+		}
+		xfree(include_files);
+		include_files      = new_files;
+		include_files_size = new_size;
+	}
+
+	size_t const i = include_file_slot(include_files, include_files_size,
+	                                   filename);
+	if (include_files[i] == NULL) {
+		include_file_t *file = OALLOCZ(&config_obstack, include_file_t);
+		file->filename   = filename;
+		include_files[i] = file;
+		++n_include_files;
+	}
+	return include_files[i];
+}
+
+/**
+ * Checks whether including a file again has no effect, because its include
+ * guard is defined or it has a #pragma once.
+ */
+static bool is_redundant_include(const include_file_t *file)
+{
+	if (file->once_unit == translation_unit)
+		return true;
+
+	const symbol_t *guard = file->guard;
+	return guard != NULL
+	    && (guard->pp_definition != NULL || is_builtin_macro(guard));
+}
+
+void set_include_dir_listing(bool enable)
+{
+	include_dir_listing = enable;
+}
+
+/**
+ * Reads the names in the directory of the search path entry @p entry.
+ */
+static void read_include_dir(searchpath_entry_t *entry)
+{
+	entry->names_read = true;
+#ifndef _WIN32
+	DIR *dir = opendir(entry->path);
+	if (dir == NULL) {
+		/* a directory which does not exist contains nothing */
+		if (errno != ENOENT && errno != ENOTDIR)
+			return;
+	}
+
+	strset_init(&entry->names);
+	entry->has_names = true;
+	if (dir == NULL)
+		return;
+
+	for (struct dirent *dirent; (dirent = readdir(dir)) != NULL; ) {
+		const char *name = dirent->d_name;
+		strset_insert(&entry->names,
+		              obstack_copy(&config_obstack, name, strlen(name)+1));
+	}
+	closedir(dir);
+#endif
+}
+
+/**
+ * Checks the listing of the search path entry @p entry for the first
+ * component of @p headername.
+ *
+ * @return false if the header cannot be in the directory
+ */
+static bool may_contain_header(searchpath_entry_t *entry,
+                               const char *headername)
+{
+	if (!include_dir_listing || entry == NULL)
+		return true;
+	if (!entry->names_read)
+		read_include_dir(entry);
+	if (!entry->has_names)
+		return true;
+
+	const char *slash = strchr(headername, '/');
+	if (slash == NULL)
+		return strset_find(&entry->names, headername) != NULL;
+
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	obstack_grow0(&symbol_obstack, headername, slash - headername);
+	char *component = obstack_finish(&symbol_obstack);
+	bool  found     = strset_find(&entry->names, component) != NULL;
+	obstack_free(&symbol_obstack, component);
+	return found;
+}
+
+/**
+ * Tries to open @p headername in the directory @p path, which belongs to the
+ * search path entry @p entry if it is not NULL.  A file which was included
+ * before and would have no effect is not opened again, @p file is set to
+ * NULL then.  Paths which did not exist before are not tried again.
+ *
+ * @return true if the file exists
+ */
+static bool open_include(searchpath_entry_t *entry, const char *path,
+                         size_t path_len, const char *headername, FILE **file,
+                         const char **filename)
+{
+	if (!may_contain_header(entry, headername)) {
+		errno = ENOENT;
+		return false;
+	}
+
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	if (path_len > 0) {
+		obstack_grow(&symbol_obstack, path, path_len);
+		if (path[path_len-1] != '/')
+			obstack_1grow(&symbol_obstack, '/');
+	}
+	obstack_grow(&symbol_obstack, headername, strlen(headername)+1);
+
+	char       *complete_path = obstack_finish(&symbol_obstack);
+	const char *known         = strset_find(&stringset, complete_path);
+	if (known != NULL) {
+		const include_file_t *known_file = find_include_file(known);
+		if (known_file != NULL && known_file->missing) {
+			obstack_free(&symbol_obstack, complete_path);
+			errno = ENOENT;
+			return false;
+		}
+		if (known_file != NULL && is_redundant_include(known_file)) {
+			obstack_free(&symbol_obstack, complete_path);
+			*file     = NULL;
+			*filename = known;
+			return true;
+		}
+	}
+
+	*file = fopen(complete_path, "r");
+	if (*file == NULL) {
+		int const error = errno;
+		if (error == ENOENT || error == ENOTDIR) {
+			/* remember the miss, the next lookup needs no system call */
+			get_include_file(identify_string(complete_path))->missing = true;
+		} else {
+			obstack_free(&symbol_obstack, complete_path);
+		}
+		errno = error;
+		return false;
+	}
+	*filename = identify_string(complete_path);
+	return true;
+}
+
+/**
+ * Checks whether @p file is a file with a #pragma once, which was included
+ * through another path.
+ */
+static bool is_once_file(FILE *file)
+{
+	size_t const n_once_files = ARR_LEN(once_files);
+	if (n_once_files == 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fileno(file), &st) != 0)
+		return false;
+	for (size_t i = 0; i < n_once_files; ++i) {
+		const include_file_t *once = once_files[i];
+		if (once->ino == st.st_ino && once->dev == st.st_dev)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Continues with the included file @p file, or with the tokens of its
+ * precompiled version if it is included before anything else happened.
+ *
+ * @return false if the file is skipped, because it would have no effect
+ */
+static bool enter_include(FILE *file, const char *filename,
+                          const searchpath_entry_t *path, bool is_system_header)
+{
+	if (file == NULL) {
+		add_input_dependency(filename, is_system_header);
+		return false;
+	}
+	if (is_once_file(file)) {
+		/* the next #include of the path needs no system call */
+		get_include_file(filename)->once_unit = translation_unit;
+		fclose(file);
+		add_input_dependency(filename, is_system_header);
+		return false;
+	}
+	if (pch_allowed && n_inputs == 1 && out == NULL
+			&& load_precompiled_header(filename)) {
+		fclose(file);
+		return true;
+	}
+	switch_input(file, filename, path, is_system_header);
+	input.file_info   = get_include_file(filename);
+	input.guard_state = GUARD_START;
+	if (token_cache_dir != NULL)
+		start_token_cache(filename);
+	return true;
+}
+
+/**
+ * Enters the file included by an #include of @p headername.
+ *
+ * @param skipped  set to true if the file has no effect and is not entered
+ * @return false if the file was not found
+ */
+static bool do_include(bool system_include, bool include_next,
+                       const char *headername, bool *skipped)
+{
+	const char *filename;
+	FILE       *file;
+
+	/* the error reported if there is no directory to search */
+	errno = ENOENT;
+
+	if (headername[0] == '/') {
+		if (!open_include(NULL, "", 0, headername, &file, &filename))
+			return false;
+		*skipped = !enter_include(file, filename, NULL,
+		                          input.position.is_system_header);
+		return true;
+	}
+
+	searchpath_entry_t *entry = searchpath;
+	if (include_next && input.path != NULL) {
+		entry = input.path->next;
+	} else if (!system_include && !include_next) {
+		/* for "bla" includes first try the directory of the current file */
+		const char *name  = input.position.input_name;
+		const char *slash = strrchr(name, '/');
+		size_t      len   = slash != NULL ? (size_t) (slash - name) + 1 : 0;
+		if (open_include(NULL, name, len, headername, &file, &filename)) {
+			*skipped = !enter_include(file, filename, input.path,
+			                          input.position.is_system_header);
+			return true;
+		}
+	}
+
+	/* check searchpath */
+	for (; entry != NULL; entry = entry->next) {
+		if (open_include(entry, entry->path, strlen(entry->path), headername,
+		                 &file, &filename)) {
+			*skipped = !enter_include(file, filename, entry,
+			                          entry->is_system_path);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void parse_include_directive(bool include_next)
+{
+	source_position_t position = pp_token.base.source_position;
+
+	/* don't eat the TP_include here!
+	 * we need an alternative parsing for the next token */
+	bool        system_include;
+	bool        has_headername;
+	const char *headername = NULL;
+	/* the line the directive ends in */
+	unsigned    end_line   = decode_position(position).lineno;
+	if (UNLIKELY(input.replay != NULL)) {
+		has_headername = replay_headername(&headername, &system_include);
+	} else {
+		skip_whitespace();
+		system_include = input.c == '<';
+		has_headername = input.c == '<' || input.c == '"';
+		if (has_headername) {
+			headername = parse_headername();
+			if (UNLIKELY(input.record != NULL))
+				record_headername(headername, system_include);
+		}
+	}
+	if (has_headername) {
+		end_line   = input.position.lineno;
+		next_preprocessing_token();
+		if (headername != NULL && !info.at_line_begin) {
+			warningf(WARN_OTHER, &pp_token.base.source_position,
+			         "extra tokens at end of #include directive");
+		}
+		eat_pp_directive();
+	} else {
+		next_preprocessing_token();
+		token_t *tokens = read_directive_line(false);
+		headername      = get_computed_headername(tokens, &system_include);
+		if (headername == NULL) {
+			errorf(&position, "#include expects \"FILENAME\" or <FILENAME>");
+		}
+		DEL_ARR_F(tokens);
+	}
+	if (headername == NULL)
+		return;
+
+	if (n_inputs >= INCLUDE_LIMIT) {
+		errorf(&position, "#include nested too deeply");
+		return;
+	}
+
+	/* we have to reenable space counting and macro expansion here,
+	 * because it is still disabled in directive parsing,
+	 * but we will trigger a preprocessing token reading of the new file
+	 * now and need expansions/space counting */
+	in_pp_directive = false;
+
+	/* switch inputs, the token behind the directive is already read */
+	input.pending_token    = pp_token;
+	input.pending_info     = info;
+	input.conditional_base = conditional_stack;
+	input.return_position        = decode_position(position);
+	input.return_position.lineno = end_line + 1;
+	/* like gcc, stay at the directive if it is the last line */
+	if (pp_token.kind == TP_EOF)
+		input.return_position.lineno = end_line;
+	if (out != NULL) {
+		while (input.output_line + 1 < end_line) {
+			fputc('\n', out);
+			++input.output_line;
+		}
+		fputc('\n', out);
+	}
+	push_input();
+	bool skipped = false;
+	bool res     = do_include(system_include, include_next, headername,
+	                          &skipped);
+	if (!res) {
+		errorf(&position, "failed including '%s': %s", headername,
+		       strerror(errno));
+		pop_restore_input();
+		return;
+	}
+	if (skipped) {
+		/* pp_token still is the token behind the directive */
+		pop_restore_input();
+		return;
+	}
+
+	if (pch_tokens != NULL) {
+		/* the precompiled header replaces the file */
+		pop_restore_input();
+		pch_pending_token = pp_token;
+		pch_pending_info  = info;
+		pch_pos           = 0;
+	}
+
+	/* read the first token of the new file */
+	next_preprocessing_token();
+}
+
+static void check_unclosed_conditionals(void)
+{
+	while (conditional_stack != NULL) {
+		pp_conditional_t *conditional = conditional_stack;
+
+		if (conditional->in_else) {
+			errorf(&conditional->source_position, "unterminated #else");
+		} else {
+			errorf(&conditional->source_position, "unterminated condition");
+		}
+		pop_conditional();
+	}
+}
+
+static const token_t *condition_token;
+static bool           condition_error;
+
+static void condition_error_at(const token_t *token, const char *msg)
+{
+	if (!condition_error)
+		errorf(&token->base.source_position, "%s", msg);
+	condition_error = true;
+}
+
+static pp_value_t parse_condition_expression(bool evaluate);
+
+static pp_value_t parse_number_value(const token_t *token)
+{
+	pp_value_t  result = { 0, false };
+	const char *string = token->number.number.begin;
+	char       *end;
+
+	errno        = 0;
+	result.value = strtoumax(string, &end, 0);
+	if (errno == ERANGE) {
+		warningf(WARN_OTHER, &token->base.source_position,
+		         "integer constant is too large for its type");
+	}
+
+	for (const char *c = end; *c != '\0'; ++c) {
+		switch (*c) {
+		case 'u':
+		case 'U':
+			result.is_unsigned = true;
+			break;
+		case 'l':
+		case 'L':
+			break;
+		case '.':
+		case 'e':
+		case 'E':
+		case 'p':
+		case 'P':
+			condition_error_at(token,
+			                   "floating constant in preprocessor expression");
+			return result;
+		default:
+			if (isdigit((unsigned char) *c)) {
+				condition_error_at(token, "invalid digit in octal constant");
+			} else {
+				condition_error_at(token,
+				                   "invalid suffix on integer constant in #if");
+			}
+			return result;
+		}
+	}
+
+	if (!result.is_unsigned && result.value > INTMAX_MAX)
+		result.is_unsigned = true;
+	return result;
+}
+
+static pp_value_t parse_character_value(const token_t *token)
+{
+	pp_value_t  result = { 0, false };
+	const char *c      = token->string.string.begin;
+	if (*c == '\0')
+		return result;
+
+	if (token->kind == TP_WIDE_CHARACTER_CONSTANT) {
+		if (*c == '\\') {
+			++c;
+			result.value = parse_escape_sequence(&c, &token->base.source_position);
+		} else {
+			result.value = read_utf8_char(&c);
+		}
+		return result;
+	}
+
+	/* same value as the parser gives the constant: a single char has the
+	 * signedness of plain char, the chars of a multi-character constant are
+	 * combined */
+	uintmax_t value   = 0;
+	size_t    n_chars = 0;
+	while (*c != '\0') {
+		utf32 ch;
+		if (*c == '\\') {
+			++c;
+			ch = parse_escape_sequence(&c, &token->base.source_position);
+		} else {
+			ch = (unsigned char) *c++;
+		}
+		value = (value << 8) | (unsigned char) ch;
+		++n_chars;
+	}
+
+	if (n_chars == 1
+			&& get_atomic_type_flags(ATOMIC_TYPE_CHAR) & ATOMIC_TYPE_FLAG_SIGNED) {
+		result.value = (intmax_t) (signed char) value;
+	} else {
+		result.value = value;
+	}
+	return result;
+}
+
+static pp_value_t parse_condition_primary(bool evaluate)
+{
+	pp_value_t     result = { 0, false };
+	const token_t *token  = condition_token;
+
+	switch (token->kind) {
+	case TP_NUMBER:
+		++condition_token;
+		return parse_number_value(token);
+
+	case TP_CHARACTER_CONSTANT:
+	case TP_WIDE_CHARACTER_CONSTANT:
+		++condition_token;
+		return parse_character_value(token);
+
+	case TP_IDENTIFIER:
+		++condition_token;
+		if (token->identifier.symbol->pp_ID == TP_defined) {
+			/* defined produced by a macro expansion */
+			bool in_paren = condition_token->kind == '(';
+			if (in_paren)
+				++condition_token;
+			if (condition_token->kind != TP_IDENTIFIER) {
+				condition_error_at(token,
+				                   "operator \"defined\" requires an identifier");
+				return result;
+			}
+			const symbol_t *symbol = condition_token->identifier.symbol;
+			result.value = symbol->pp_definition != NULL
+			            || is_builtin_macro(symbol);
+			++condition_token;
+			if (in_paren) {
+				if (condition_token->kind != ')') {
+					condition_error_at(token, "missing ')' after \"defined\"");
+					return result;
+				}
+				++condition_token;
+			}
+		}
+		/* remaining identifiers are 0 */
+		return result;
+
+	case '(':
+		++condition_token;
+		result = parse_condition_expression(evaluate);
+		if (condition_token->kind != ')') {
+			condition_error_at(condition_token,
+			                   "missing ')' in expression");
+			return result;
+		}
+		++condition_token;
+		return result;
+
+	case '+':
+		++condition_token;
+		return parse_condition_primary(evaluate);
+
+	case '-':
+		++condition_token;
+		result       = parse_condition_primary(evaluate);
+		result.value = -result.value;
+		return result;
+
+	case '~':
+		++condition_token;
+		result       = parse_condition_primary(evaluate);
+		result.value = ~result.value;
+		return result;
+
+	case '!':
+		++condition_token;
+		result             = parse_condition_primary(evaluate);
+		result.value       = result.value == 0;
+		result.is_unsigned = false;
+		return result;
+
+	case TP_EOF:
+		condition_error_at(token, "#if with no expression");
+		return result;
+
+	default:
+		if (!condition_error) {
+			errorf(&token->base.source_position,
+			       "token '%t' is not valid in preprocessor expressions", token);
+		}
+		condition_error = true;
+		return result;
+	}
+}
+
+static unsigned get_binary_precedence(int kind)
+{
+	switch (kind) {
+	case '*':
+	case '/':
+	case '%':                     return 10;
+	case '+':
+	case '-':                     return 9;
+	case TP_LESSLESS:
+	case TP_GREATERGREATER:       return 8;
+	case '<':
+	case '>':
+	case TP_LESSEQUAL:
+	case TP_GREATEREQUAL:         return 7;
+	case TP_EQUALEQUAL:
+	case TP_EXCLAMATIONMARKEQUAL: return 6;
+	case '&':                     return 5;
+	case '^':                     return 4;
+	case '|':                     return 3;
+	case TP_ANDAND:               return 2;
+	case TP_PIPEPIPE:             return 1;
+	default:                      return 0;
+	}
+}
+
+static pp_value_t apply_binary(const token_t *op, pp_value_t left,
+                               pp_value_t right, bool evaluate)
+{
+	bool       is_unsigned = left.is_unsigned || right.is_unsigned;
+	uintmax_t  l           = left.value;
+	uintmax_t  r           = right.value;
+	pp_value_t result      = { 0, is_unsigned };
+
+	switch (op->kind) {
+	case '*': result.value = l * r; break;
+	case '+': result.value = l + r; break;
+	case '-': result.value = l - r; break;
+	case '&': result.value = l & r; break;
+	case '^': result.value = l ^ r; break;
+	case '|': result.value = l | r; break;
+	case '/':
+	case '%':
+		if (r == 0) {
+			if (evaluate)
+				condition_error_at(op, "division by zero in #if");
+			return result;
+		}
+		if (is_unsigned) {
+			result.value = op->kind == '/' ? l / r : l % r;
+		} else if ((intmax_t) r == -1) {
+			/* avoid the overflow of INTMAX_MIN / -1 */
+			result.value = op->kind == '/' ? -l : 0;
+		} else {
+			result.value = op->kind == '/'
+				? (uintmax_t) ((intmax_t) l / (intmax_t) r)
+				: (uintmax_t) ((intmax_t) l % (intmax_t) r);
+		}
+		return result;
+	case TP_LESSLESS:
+	case TP_GREATERGREATER: {
+		bool shift_left = op->kind == TP_LESSLESS;
+		result.is_unsigned = left.is_unsigned;
+		if (!right.is_unsigned && (intmax_t) r < 0) {
+			shift_left = !shift_left;
+			r          = -r;
+		}
+		if (shift_left) {
+			result.value = r >= sizeof(uintmax_t) * 8 ? 0 : l << r;
+		} else if (left.is_unsigned || (intmax_t) l >= 0) {
+			result.value = r >= sizeof(uintmax_t) * 8 ? 0 : l >> r;
+		} else {
+			result.value = r >= sizeof(uintmax_t) * 8
+				? (uintmax_t) -1 : (uintmax_t) ((intmax_t) l >> r);
+		}
+		return result;
+	}
+	case '<':
+	case '>':
+	case TP_LESSEQUAL:
+	case TP_GREATEREQUAL: {
+		int cmp;
+		if (is_unsigned) {
+			cmp = l < r ? -1 : l > r;
+		} else {
+			cmp = (intmax_t) l < (intmax_t) r ? -1 : (intmax_t) l > (intmax_t) r;
+		}
+		result.is_unsigned = false;
+		switch (op->kind) {
+		case '<':             result.value = cmp <  0; break;
+		case '>':             result.value = cmp >  0; break;
+		case TP_LESSEQUAL:    result.value = cmp <= 0; break;
+		case TP_GREATEREQUAL: result.value = cmp >= 0; break;
+		}
+		return result;
+	}
+	case TP_EQUALEQUAL:
+		result.value       = l == r;
+		result.is_unsigned = false;
+		return result;
+	case TP_EXCLAMATIONMARKEQUAL:
+		result.value       = l != r;
+		result.is_unsigned = false;
+		return result;
+	default:
+		panic("invalid binary operator in #if");
+	}
+	return result;
+}
+
+/**
+ * Parses binary operators with at least @p min_precedence by precedence
+ * climbing.
+ */
+static pp_value_t parse_condition_binary(unsigned min_precedence,
+                                         bool evaluate)
+{
+	pp_value_t left = parse_condition_primary(evaluate);
+	while (!condition_error) {
+		const token_t *op         = condition_token;
+		unsigned       precedence = get_binary_precedence(op->kind);
+		if (precedence == 0 || precedence < min_precedence)
+			break;
+		++condition_token;
+
+		if (op->kind == TP_ANDAND || op->kind == TP_PIPEPIPE) {
+			bool is_and = op->kind == TP_ANDAND;
+			bool l      = left.value != 0;
+			/* the right side is not evaluated if the left side decides */
+			pp_value_t right = parse_condition_binary(precedence + 1,
+					evaluate && (is_and ? l : !l));
+			left.value       = is_and ? l && right.value != 0
+			                          : l || right.value != 0;
+			left.is_unsigned = false;
+			continue;
+		}
+
+		pp_value_t right = parse_condition_binary(precedence + 1, evaluate);
+		left = apply_binary(op, left, right, evaluate);
+	}
+	return left;
+}
+
+static pp_value_t parse_condition_conditional(bool evaluate)
+{
+	pp_value_t condition = parse_condition_binary(1, evaluate);
+	if (condition_token->kind != '?' || condition_error)
+		return condition;
+	++condition_token;
+
+	bool       value       = condition.value != 0;
+	pp_value_t true_value  = parse_condition_expression(evaluate && value);
+	if (condition_token->kind != ':') {
+		condition_error_at(condition_token, "expected ':' in expression");
+		return true_value;
+	}
+	++condition_token;
+	pp_value_t false_value = parse_condition_conditional(evaluate && !value);
+
+	pp_value_t result = value ? true_value : false_value;
+	result.is_unsigned = true_value.is_unsigned || false_value.is_unsigned;
+	return result;
+}
+
+static pp_value_t parse_condition_expression(bool evaluate)
+{
+	pp_value_t result = parse_condition_conditional(evaluate);
+	while (condition_token->kind == ',' && !condition_error) {
+		++condition_token;
+		result = parse_condition_conditional(evaluate);
+	}
+	return result;
+}
+
+/**
+ * Evaluates the expression of an #if or #elif directive, pp_token is the
+ * directive name.
+ */
+static bool parse_condition(void)
+{
+	next_preprocessing_token();
+	token_t *tokens = read_directive_line(true);
+
+	condition_token = tokens;
+	condition_error = false;
+	pp_value_t value = parse_condition_expression(true);
+	if (!condition_error && condition_token->kind != TP_EOF) {
+		errorf(&condition_token->base.source_position,
+		       "missing binary operator before token '%t'", condition_token);
+		condition_error = true;
+	}
+	DEL_ARR_F(tokens);
+
+	return !condition_error && value.value != 0;
+}
+
+static void parse_if_directive(void)
+{
+	source_position_t position = pp_token.base.source_position;
+
+	if (skip_mode) {
+		eat_pp_directive();
+		pp_conditional_t *conditional = push_conditional();
+		conditional->source_position  = position;
+		conditional->skip             = true;
+		return;
+	}
+
+	bool condition = parse_condition();
+
+	pp_conditional_t *conditional = push_conditional();
+	conditional->source_position  = position;
+	conditional->condition        = condition;
+
+	if (!condition) {
+		skip_mode = true;
+	}
+}
+
+static void parse_elif_directive(void)
+{
+	source_position_t position    = pp_token.base.source_position;
+	pp_conditional_t *conditional = conditional_stack;
+	if (conditional == NULL) {
+		errorf(&position, "#elif without prior #if");
+		eat_pp_directive();
+		return;
+	}
+
+	if (conditional->in_else) {
+		errorf(&position, "#elif after #else (condition started %P)",
+		       &conditional->source_position);
+		eat_pp_directive();
+		skip_mode = true;
+		return;
+	}
+
+	conditional->source_position = position;
+	if (input.guard_state == GUARD_INSIDE
+			&& conditional == input.guard_conditional)
+		input.guard_state = GUARD_NONE;
+	if (conditional->skip) {
+		eat_pp_directive();
+		return;
+	}
+	if (conditional->condition) {
+		/* an earlier group was taken */
+		eat_pp_directive();
+		skip_mode = true;
+		return;
+	}
+
+	skip_mode = false;
+	bool condition = parse_condition();
+	conditional->condition = condition;
+	skip_mode              = !condition;
+}
+
+static void parse_ifdef_ifndef_directive(bool is_ifndef)
+{
+	bool condition;
+	next_preprocessing_token();
+
+	if (skip_mode) {
+		eat_pp_directive();
+		pp_conditional_t *conditional = push_conditional();
+		conditional->source_position  = pp_token.base.source_position;
+		conditional->skip             = true;
+		return;
+	}
+
+	symbol_t *symbol = NULL;
+	if (pp_token.kind != TP_IDENTIFIER || info.at_line_begin) {
+		errorf(&pp_token.base.source_position,
+		       "expected identifier after #%s, got '%t'",
+		       is_ifndef ? "ifndef" : "ifdef", &pp_token);
+		eat_pp_directive();
+
+		/* just take the true case in the hope to avoid further errors */
+		condition = true;
+	} else {
+		symbol = pp_token.identifier.symbol;
+		bool is_defined = symbol->pp_definition != NULL
+		               || is_builtin_macro(symbol);
+		next_preprocessing_token();
+
+		if (!info.at_line_begin) {
+			errorf(&pp_token.base.source_position,
+			       "extra tokens at end of #%s",
+			       is_ifndef ? "ifndef" : "ifdef");
+			eat_pp_directive();
+		}
+
+		/* evaluate wether we are in true or false case */
+		condition = is_ifndef ? !is_defined : is_defined;
+	}
+
+	pp_conditional_t *conditional = push_conditional();
+	conditional->source_position  = pp_token.base.source_position;
+	conditional->condition        = condition;
+
+	/* an #ifndef before anything else might be an include guard */
+	if (is_ifndef && input.guard_state == GUARD_START) {
+		if (symbol != NULL) {
+			input.guard_state       = GUARD_INSIDE;
+			input.guard             = symbol;
+			input.guard_conditional = conditional;
+		} else {
+			input.guard_state = GUARD_NONE;
+		}
+	}
+
+	if (!condition) {
+		skip_mode = true;
+	}
+}
+
+static void parse_else_directive(void)
+{
+	next_preprocessing_token();
+
+	if (!info.at_line_begin) {
+		if (!skip_mode) {
+			warningf(WARN_OTHER, &pp_token.base.source_position, "extra tokens at end of #else");
+		}
+		eat_pp_directive();
+	}
+
+	pp_conditional_t *conditional = conditional_stack;
+	if (conditional == NULL) {
+		errorf(&pp_token.base.source_position, "#else without prior #if");
+		return;
+	}
+
+	if (conditional->in_else) {
+		errorf(&pp_token.base.source_position,
+		       "#else after #else (condition started %P)",
+		       &conditional->source_position);
+		skip_mode = true;
+		return;
+	}
+
+	if (input.guard_state == GUARD_INSIDE
+			&& conditional == input.guard_conditional)
+		input.guard_state = GUARD_NONE;
+
+	conditional->in_else = true;
+	if (!conditional->skip) {
+		skip_mode = conditional->condition;
+	}
+	conditional->condition       = true;
+	conditional->source_position = pp_token.base.source_position;
+}
+
+static void parse_endif_directive(void)
+{
+	next_preprocessing_token();
+
+	if (!info.at_line_begin) {
+		if (!skip_mode) {
+			warningf(WARN_OTHER, &pp_token.base.source_position, "extra tokens at end of #endif");
+		}
+		eat_pp_directive();
+	}
+
+	pp_conditional_t *conditional = conditional_stack;
+	if (conditional == NULL) {
+		errorf(&pp_token.base.source_position, "#endif without prior #if");
+		return;
+	}
+
+	if (!conditional->skip) {
+		skip_mode = false;
+	}
+	if (input.guard_state == GUARD_INSIDE
+			&& conditional == input.guard_conditional)
+		input.guard_state = GUARD_ENDED;
+	pop_conditional();
+}
+
+/**
+ * Parses #line and the line markers "# 42 "file" flags" of gcc.
+ *
+ * @param position  the position of the directive
+ */
+static void parse_line_directive(const source_position_t *position,
+                                 bool is_line_marker)
+{
+	if (!is_line_marker)
+		next_preprocessing_token();
+	unsigned  old_n_inputs = n_inputs;
+	token_t  *tokens       = read_directive_line(false);
+	if (n_inputs != old_n_inputs) {
+		/* the directive was the last line of a header */
+		DEL_ARR_F(tokens);
+		return;
+	}
+
+	const token_t *token = tokens;
+	const char    *digit = token->kind == TP_NUMBER
+	                       ? token->number.number.begin : "";
+	if (*digit == '\0' || strspn(digit, "0123456789") != strlen(digit)) {
+		errorf(position, "#line directive requires a simple digit sequence");
+		DEL_ARR_F(tokens);
+		return;
+	}
+	unsigned line = (unsigned) strtoul(digit, NULL, 10);
+	++token;
+
+	const char *name      = input.position.input_name;
+	bool        is_system = input.position.is_system_header;
+	if (token->kind == TP_STRING_LITERAL) {
+		assert(obstack_object_size(&symbol_obstack) == 0);
+		for (const char *c = token->string.string.begin; *c != '\0'; ++c) {
+			if (*c == '\\' && (c[1] == '"' || c[1] == '\\'))
+				++c;
+			obstack_1grow(&symbol_obstack, *c);
+		}
+		obstack_1grow(&symbol_obstack, '\0');
+		name = identify_string(obstack_finish(&symbol_obstack));
+		++token;
+
+		/* flags of line markers:
+		 * 1 - indicates start of a new file
+		 * 2 - indicates return from a file
+		 * 3 - indicates system header
+		 * 4 - indicates implicit extern "C" in C++ mode */
+		if (is_line_marker) {
+			is_system = false;
+			for (; token->kind == TP_NUMBER; ++token) {
+				if (streq(token->number.number.begin, "3"))
+					is_system = true;
+			}
+		}
+	}
+	if (token->kind != TP_EOF) {
+		errorf(position, "invalid filename in #line directive");
+	}
+	DEL_ARR_F(tokens);
+
+	/* the line after the directive gets the given number */
+	unsigned delta = line - (decode_position(*position).lineno + 1);
+	input.line_delta                += delta;
+	input.position.lineno           += delta;
+	input.position.input_name        = name;
+	input.position.is_system_header  = is_system;
+
+	decoded_position_t token_position
+		= decode_position(pp_token.base.source_position);
+	token_position.lineno           += delta;
+	token_position.input_name        = name;
+	token_position.is_system_header  = is_system;
+	pp_token.base.source_position = encode_position(&token_position);
+
+	if (out != NULL) {
+		decoded_position_t new_position = input.position;
+		new_position.lineno = line;
+		fputc('\n', out);
+		print_line_directive(&new_position, NULL);
+	}
+}
+
+/**
+ * Parses #error and #warning.
+ */
+static void parse_diagnostic_directive(bool is_error)
+{
+	source_position_t position = pp_token.base.source_position;
+	next_preprocessing_token();
+
+	assert(obstack_object_size(&pp_obstack) == 0);
+	bool first = true;
+	while (!info.at_line_begin) {
+		if (!first && info.had_whitespace)
+			obstack_1grow(&pp_obstack, ' ');
+		grow_token_spelling(&pp_obstack, &pp_token, false);
+		first = false;
+		next_preprocessing_token();
+	}
+	obstack_1grow(&pp_obstack, '\0');
+	char *message = obstack_finish(&pp_obstack);
+
+	if (is_error) {
+		errorf(&position, "#error %s", message);
+	} else {
+		warningf(WARN_OTHER, &position, "#warning %s", message);
+	}
+	obstack_free(&pp_obstack, message);
+}
+
+/**
+ * Handles #pragma once: the current file is not included again in this
+ * translation unit.
+ */
+static void parse_pragma_once(void)
+{
+	if (input.file_info == NULL) {
+		warningf(WARN_OTHER, &pp_token.base.source_position,
+		         "#pragma once in main file");
+	} else if (input.file_info->once_unit != translation_unit) {
+		include_file_t *file = input.file_info;
+		file->once_unit = translation_unit;
+		struct stat st;
+		if (stat(file->filename, &st) == 0 && st.st_ino != 0) {
+			file->dev = st.st_dev;
+			file->ino = st.st_ino;
+			ARR_APP1(include_file_t*, once_files, file);
+		}
+	}
+	eat_pp_directive();
+}
+
+static bool is_pragma_once(void)
+{
+	return pp_token.kind == TP_IDENTIFIER && !info.at_line_begin
+	    && pp_token.identifier.symbol == symbol_once;
+}
+
+static void parse_pragma_directive(void)
+{
+	if (out != NULL) {
+		/* pragmas are passed on to the output */
+		emit_newlines();
+		next_preprocessing_token();
+		if (is_pragma_once()) {
+			parse_pragma_once();
+			return;
+		}
+		fputs("#pragma", out);
+		while (!info.at_line_begin) {
+			fputc(' ', out);
+			assert(obstack_object_size(&pp_obstack) == 0);
+			grow_token_spelling(&pp_obstack, &pp_token, false);
+			obstack_1grow(&pp_obstack, '\0');
+			char *spelling = obstack_finish(&pp_obstack);
+			fputs(spelling, out);
+			obstack_free(&pp_obstack, spelling);
+			next_preprocessing_token();
+		}
+		return;
+	}
+
+	bool unknown_pragma = true;
+
+	next_preprocessing_token();
+	if (is_pragma_once()) {
+		parse_pragma_once();
+		return;
+	}
+	if (pp_token.kind != TP_IDENTIFIER || info.at_line_begin) {
+		warningf(WARN_UNKNOWN_PRAGMAS, &pp_token.base.source_position,
+		         "expected identifier after #pragma");
+		eat_pp_directive();
+		return;
+	}
+
+	source_position_t position = pp_token.base.source_position;
+	symbol_t         *symbol   = pp_token.identifier.symbol;
+	if (symbol->pp_ID == TP_STDC) {
+		/* a STDC pragma */
+		if (c_mode & _C99) {
+			next_preprocessing_token();
+
+			int kind = pp_token.kind == TP_IDENTIFIER
+			           ? pp_token.identifier.symbol->pp_ID : TP_ERROR;
+			if (kind == TP_FP_CONTRACT || kind == TP_FENV_ACCESS
+					|| kind == TP_CX_LIMITED_RANGE) {
+				next_preprocessing_token();
+				int value = pp_token.kind == TP_IDENTIFIER
+				            ? pp_token.identifier.symbol->pp_ID : TP_ERROR;
+				if (value == TP_ON || value == TP_OFF || value == TP_DEFAULT) {
+					unknown_pragma = false;
+				} else {
+					errorf(&pp_token.base.source_position,
+					       "bad STDC pragma argument");
+				}
+			}
+		}
+	} else if (symbol == symbol_GCC) {
+		next_preprocessing_token();
+		if (pp_token.kind == TP_IDENTIFIER
+				&& pp_token.identifier.symbol == symbol_system_header) {
+			input.position.is_system_header = true;
+			unknown_pragma = false;
+		}
+	}
+	eat_pp_directive();
+	if (unknown_pragma) {
+		warningf(WARN_UNKNOWN_PRAGMAS, &position,
+		         "encountered unknown #pragma");
+	}
+}
+
+static void parse_preprocessing_directive(void)
+{
+	source_position_t position = pp_token.base.source_position;
+
+	in_pp_directive = true;
+	eat_pp('#');
+
+	if (info.at_line_begin) {
+		/* the nop directive "#" */
+		in_pp_directive = false;
+		return;
+	}
+
+	int kind = pp_token.kind == TP_IDENTIFIER
+	           ? pp_token.identifier.symbol->pp_ID : pp_token.kind;
+
+	if (skip_mode) {
+		switch (kind) {
+		case TP_if:
+			parse_if_directive();
+			break;
+		case TP_ifdef:
+		case TP_ifndef:
+			parse_ifdef_ifndef_directive(kind == TP_ifndef);
+			break;
+		case TP_elif:
+			parse_elif_directive();
+			break;
+		case TP_else:
+			parse_else_directive();
+			break;
+		case TP_endif:
+			parse_endif_directive();
+			break;
+		default:
+			eat_pp_directive();
+			break;
+		}
+	} else {
+		/* only an #ifndef may start an include guard */
+		if (kind != TP_ifndef || input.guard_state != GUARD_START)
+			mark_unguarded();
+
+		switch (kind) {
+		case TP_define:
+			parse_define_directive();
+			break;
+		case TP_undef:
+			parse_undef_directive();
+			break;
+		case TP_if:
+			parse_if_directive();
+			break;
+		case TP_ifdef:
+		case TP_ifndef:
+			parse_ifdef_ifndef_directive(kind == TP_ifndef);
+			break;
+		case TP_elif:
+			parse_elif_directive();
+			break;
+		case TP_else:
+			parse_else_directive();
+			break;
+		case TP_endif:
+			parse_endif_directive();
+			break;
+		case TP_include:
+			parse_include_directive(false);
+			break;
+		case TP_include_next:
+			parse_include_directive(true);
+			break;
+		case TP_line:
+			parse_line_directive(&position, false);
+			break;
+		case TP_NUMBER:
+			parse_line_directive(&position, true);
+			break;
+		case TP_error:
+			parse_diagnostic_directive(true);
+			break;
+		case TP_warning:
+			parse_diagnostic_directive(false);
+			break;
+		case TP_pragma:
+			parse_pragma_directive();
+			break;
+		case TP_ident:
+			eat_pp_directive();
+			break;
+		default:
+			errorf(&pp_token.base.source_position,
+				   "invalid preprocessing directive #%t", &pp_token);
+			eat_pp_directive();
+			break;
+		}
+	}
+
+	in_pp_directive = false;
+	pch_allowed     = false;
+	assert(info.at_line_begin);
+}
+
+static searchpath_entry_t *new_searchpath_entry(const char *path,
+                                                bool is_system_path)
+{
+	searchpath_entry_t *entry = OALLOCZ(&config_obstack, searchpath_entry_t);
+	entry->path           = path;
+	entry->is_system_path = is_system_path;
+	return entry;
+}
+
+void add_include_path(const char *path)
+{
+	searchpath_entry_t *entry = new_searchpath_entry(path, false);
+	if (searchpath_last != NULL) {
+		searchpath_last->next = entry;
+	} else {
+		searchpath = entry;
+	}
+	searchpath_last = entry;
+}
+
+void add_system_include_path(const char *path)
+{
+	searchpath_entry_t *entry = new_searchpath_entry(path, true);
+	*system_searchpath_anchor = entry;
+	system_searchpath_anchor  = &entry->next;
+}
+
+void setup_include_path(void)
+{
+	/* parse environment variable */
+	const char *cpath = getenv("CPATH");
+	if (cpath != NULL && *cpath != '\0') {
+		const char *begin = cpath;
+		const char *c;
+		do {
+			c = begin;
+			while (*c != '\0' && *c != ':')
+				++c;
+
+			size_t len = c-begin;
+			if (len == 0) {
+				/* for gcc compatibility (Matze: I would expect that
+				 * nothing happens for an empty entry...) */
+				add_include_path(".");
+			} else {
+				char *string = obstack_alloc(&config_obstack, len+1);
+				memcpy(string, begin, len);
+				string[len] = '\0';
+
+				add_include_path(string);
+			}
+
+			begin = c+1;
+			/* skip : */
+			if (*begin == ':')
+				++begin;
+		} while(*c != '\0');
+	}
+
+	/* built-in paths */
+	add_system_include_path(LOCAL_INCLUDE_DIR);
+#ifdef COMPILER_INCLUDE_DIR
+	add_system_include_path(COMPILER_INCLUDE_DIR);
+#endif
+#ifdef MULTIARCH_INCLUDE_DIR
+	add_system_include_path(MULTIARCH_INCLUDE_DIR);
+#endif
+	add_system_include_path(SYSTEM_INCLUDE_DIR);
+}
+
+static void add_command_line_macro(command_line_macro_t ***anchor,
+                                   const char *directive)
+{
+	command_line_macro_t *macro = OALLOCZ(&config_obstack, command_line_macro_t);
+	macro->directive = directive;
+	**anchor         = macro;
+	*anchor          = &macro->next;
+}
+
+void add_predefined_macro(const char *name, const char *value)
+{
+	assert(obstack_object_size(&config_obstack) == 0);
+	obstack_printf(&config_obstack, "#define %s %s\n", name, value);
+	obstack_1grow(&config_obstack, '\0');
+	char *directive = obstack_finish(&config_obstack);
+	add_command_line_macro(&predefined_macros_anchor, directive);
+}
+
+void add_define_string(const char *definition)
+{
+	assert(obstack_object_size(&config_obstack) == 0);
+	obstack_grow(&config_obstack, "#define ", 8);
+	const char *equal = strchr(definition, '=');
+	if (equal != NULL) {
+		obstack_grow(&config_obstack, definition, equal - definition);
+		obstack_1grow(&config_obstack, ' ');
+		obstack_grow(&config_obstack, equal+1, strlen(equal+1));
+	} else {
+		obstack_grow(&config_obstack, definition, strlen(definition));
+		obstack_grow(&config_obstack, " 1", 2);
+	}
+	obstack_grow(&config_obstack, "\n", 2);
+	char *directive = obstack_finish(&config_obstack);
+	add_command_line_macro(&command_line_macros_anchor, directive);
+}
+
+void add_undefine(const char *name)
+{
+	assert(obstack_object_size(&config_obstack) == 0);
+	obstack_printf(&config_obstack, "#undef %s\n", name);
+	obstack_1grow(&config_obstack, '\0');
+	char *directive = obstack_finish(&config_obstack);
+	add_command_line_macro(&command_line_macros_anchor, directive);
+}
+
+/**
+ * Processes the directives of the macros given on the command line.
+ */
+static void process_command_line_macros(const char *input_name,
+                                        const command_line_macro_t *macros)
+{
+	assert(obstack_object_size(&pp_obstack) == 0);
+	for (const command_line_macro_t *macro = macros; macro != NULL;
+	     macro = macro->next) {
+		obstack_grow(&pp_obstack, macro->directive, strlen(macro->directive));
+	}
+	obstack_1grow(&pp_obstack, '\0');
+	char *text = obstack_finish(&pp_obstack);
+
+	input.file                      = NULL;
+	input.input                     = input_from_string(text, NULL);
+	input.bufend                    = NULL;
+	input.bufpos                    = NULL;
+	input.n_putback                 = 0;
+	input.line_delta                = 0;
+	input.record                    = NULL;
+	input.replay                    = NULL;
+	input.path                      = NULL;
+	input.position.input_name       = input_name;
+	input.position.lineno           = 0;
+	input.position.is_system_header = true;
+	input.c                         = '\n';
+
+	next_preprocessing_token();
+	while (pp_token.kind != TP_EOF) {
+		if (pp_token.kind == '#' && info.at_line_begin) {
+			parse_preprocessing_directive();
+			continue;
+		}
+		next_preprocessing_token();
+	}
+
+	input_free(input.input);
+	input.input = NULL;
+}
+
+void switch_pp_input(FILE *file, const char *filename, const char *encoding)
+{
+	input_encoding = encoding;
+	base_file_name = filename;
+	counter        = 0;
+	set_input_error_callback(pp_input_error);
+
+	symbol_va_args           = symbol_table_insert("__VA_ARGS__");
+	symbol__Pragma           = symbol_table_insert("_Pragma");
+	symbol___FILE__          = symbol_table_insert("__FILE__");
+	symbol___LINE__          = symbol_table_insert("__LINE__");
+	symbol___DATE__          = symbol_table_insert("__DATE__");
+	symbol___TIME__          = symbol_table_insert("__TIME__");
+	symbol___COUNTER__       = symbol_table_insert("__COUNTER__");
+	symbol___INCLUDE_LEVEL__ = symbol_table_insert("__INCLUDE_LEVEL__");
+	symbol___BASE_FILE__     = symbol_table_insert("__BASE_FILE__");
+	symbol_GCC               = symbol_table_insert("GCC");
+	symbol_system_header     = symbol_table_insert("system_header");
+	symbol_once              = symbol_table_insert("once");
+	++translation_unit;
+	ARR_SHRINKLEN(once_files, 0);
+
+	time_t     now = time(NULL);
+	struct tm *tm  = localtime(&now);
+	strftime(date_string, sizeof(date_string), "%b %e %Y", tm);
+	strftime(time_string, sizeof(time_string), "%H:%M:%S", tm);
+
+	/* the user directories are searched before the system directories */
+	if (searchpath_last != NULL) {
+		searchpath_last->next = system_searchpath;
+	} else {
+		searchpath = system_searchpath;
+	}
+
+	process_command_line_macros("<built-in>", predefined_macros);
+	process_command_line_macros("<command-line>", command_line_macros);
+
+	switch_input(file, filename, NULL, false);
+	pch_allowed = true;
+}
+
+void close_pp_input(void)
+{
+	check_unclosed_conditionals();
+
+	/* the main input file belongs to the caller */
+	while (input_stack != NULL) {
+		close_input();
+		pop_restore_input();
+	}
+	input_free(input.input);
+	input.input = NULL;
+	input.file  = NULL;
+
+	/* forget the macros of this translation unit */
+	for (pp_definition_t *definition = definitions; definition != NULL;
+	     definition = definition->next) {
+		definition->symbol->pp_definition = NULL;
+	}
+	definitions = NULL;
+
+	while (expansion_stack != NULL) {
+		pop_expansion();
+	}
+	if (pch_tokens != NULL) {
+		DEL_ARR_F(pch_tokens);
+		pch_tokens = NULL;
+	}
+	has_lookahead = false;
+	skip_mode     = false;
+	pch_allowed   = false;
+	out           = NULL;
+
+	obstack_free(&pp_obstack, NULL);
+	obstack_init(&pp_obstack);
+}
+
+static void convert_number(token_t *token)
+{
+	const char *string     = token->number.number.begin;
+	const char *c          = string;
+	bool        is_float   = false;
+	bool        has_digits = false;
+
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X')) {
+		c += 2;
+		for (; isxdigit((unsigned char) *c); ++c) {
+			has_digits = true;
+			obstack_1grow(&symbol_obstack, *c);
+		}
+		if (*c == '.') {
+			is_float = true;
+			obstack_1grow(&symbol_obstack, *c++);
+			for (; isxdigit((unsigned char) *c); ++c) {
+				has_digits = true;
+				obstack_1grow(&symbol_obstack, *c);
+			}
+		}
+		if (*c == 'p' || *c == 'P') {
+			is_float = true;
+			obstack_1grow(&symbol_obstack, *c++);
+			if (*c == '-' || *c == '+')
+				obstack_1grow(&symbol_obstack, *c++);
+			for (; isdigit((unsigned char) *c); ++c) {
+				obstack_1grow(&symbol_obstack, *c);
+			}
+		} else if (is_float) {
+			errorf(&token->base.source_position,
+			       "hexadecimal floatingpoint constant requires an exponent");
+		}
+		token->kind = is_float ? T_FLOATINGPOINT_HEXADECIMAL
+		                       : T_INTEGER_HEXADECIMAL;
+	} else {
+		for (; isdigit((unsigned char) *c); ++c) {
+			has_digits = true;
+			obstack_1grow(&symbol_obstack, *c);
+		}
+		if (*c == '.') {
+			is_float = true;
+			obstack_1grow(&symbol_obstack, *c++);
+			for (; isdigit((unsigned char) *c); ++c) {
+				has_digits = true;
+				obstack_1grow(&symbol_obstack, *c);
+			}
+		}
+		if (*c == 'e' || *c == 'E') {
+			is_float = true;
+			obstack_1grow(&symbol_obstack, 'e');
+			++c;
+			if (*c == '-' || *c == '+')
+				obstack_1grow(&symbol_obstack, *c++);
+			for (; isdigit((unsigned char) *c); ++c) {
+				obstack_1grow(&symbol_obstack, *c);
+			}
+		}
+
+		if (is_float) {
+			token->kind = T_FLOATINGPOINT;
+		} else if (string[0] == '0') {
+			token->kind = T_INTEGER_OCTAL;
+
+			/* check for invalid octal digits */
+			for (const char *d = string; d != c; ++d) {
+				if (*d >= '8')
+					errorf(&token->base.source_position,
+					       "invalid digit '%c' in octal number", *d);
+			}
+		} else {
+			token->kind = T_INTEGER;
+		}
+	}
+
+	obstack_1grow(&symbol_obstack, '\0');
+	size_t  size   = obstack_object_size(&symbol_obstack) - 1;
+	char   *number = obstack_finish(&symbol_obstack);
+	token->number.number = (string_t) {number, size};
+
+	if (!has_digits) {
+		errorf(&token->base.source_position, "invalid number literal '%s'",
+		       string);
+		token->number.number = (string_t) {"0", 1};
+	}
+
+	if (*c == '\0') {
+		token->number.suffix.begin = NULL;
+		token->number.suffix.size  = 0;
+	} else {
+		size_t len = strlen(c) + 1;
+		token->number.suffix.begin = obstack_copy(&symbol_obstack, c, len);
+		token->number.suffix.size  = len;
+	}
+}
+
+/**
+ * Resolves the escape sequences of a string literal or character constant.
+ */
+static string_t convert_string(const token_t *token, bool is_wide,
+                               bool is_char)
+{
+	const source_position_t *position = &token->base.source_position;
+
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	for (const char *c = token->string.string.begin; *c != '\0';) {
+		if (*c != '\\') {
+			obstack_1grow(&symbol_obstack, *c);
+			++c;
+			continue;
+		}
+
+		++c;
+		utf32 const tc = parse_escape_sequence(&c, position);
+		if (is_wide) {
+			obstack_grow_symbol(&symbol_obstack, tc);
+		} else {
+			if (tc >= 0x100) {
+				warningf(WARN_OTHER, position, "escape sequence out of range");
+			}
+			obstack_1grow(&symbol_obstack, tc);
+		}
+	}
+	obstack_1grow(&symbol_obstack, '\0');
+
+	size_t  size   = obstack_object_size(&symbol_obstack);
+	char   *string = obstack_finish(&symbol_obstack);
+	/* character constants don't count the terminating 0 */
+	if (is_char)
+		--size;
+	return make_pp_string(string, size);
+}
+
+void preprocessor_next_token(token_t *token)
+{
+	next_expanded_token();
+	pch_allowed = false;
+
+	*token = pp_token;
+	token->base.had_whitespace = info.had_whitespace;
+	switch (pp_token.kind) {
+	case TP_IDENTIFIER:
+		token->kind = pp_token.identifier.symbol->ID;
+		break;
+	case TP_NUMBER:
+		convert_number(token);
+		break;
+	case TP_STRING_LITERAL:
+		token->kind          = T_STRING_LITERAL;
+		token->string.string = convert_string(&pp_token, false, false);
+		break;
+	case TP_WIDE_STRING_LITERAL:
+		token->kind          = T_WIDE_STRING_LITERAL;
+		token->string.string = convert_string(&pp_token, true, false);
+		break;
+	case TP_CHARACTER_CONSTANT:
+		token->kind          = T_CHARACTER_CONSTANT;
+		token->string.string = convert_string(&pp_token, false, true);
+		break;
+	case TP_WIDE_CHARACTER_CONSTANT:
+		token->kind          = T_WIDE_CHARACTER_CONSTANT;
+		token->string.string = convert_string(&pp_token, true, true);
+		break;
+	case TP_EOF:
+		token->kind = T_EOF;
+		break;
+	case TP_ERROR:
+		token->kind = T_ERROR;
+		break;
+	default:
+		/* punctuators have the same values for the parser */
+		if (pp_token.kind < 256 && get_token_kind_symbol(pp_token.kind) == NULL) {
+			errorf(&pp_token.base.source_position,
+			       "unknown character '%c' found", pp_token.kind);
+			token->kind = T_ERROR;
+		}
+		break;
+	}
+}
+
+void skip_preprocessed_input(void)
+{
+	do {
+		next_expanded_token();
+		pch_allowed = false;
+	} while (pp_token.kind != TP_EOF);
+}
+
+void record_pp_dependencies(bool system_headers)
+{
+	if (dependencies != NULL)
+		DEL_ARR_F(dependencies);
+	dependencies        = NEW_ARR_F(const char*, 0);
+	dependencies_system = system_headers;
+}
+
+static void print_make_quoted(FILE *output, const char *name)
+{
+	for (const char *c = name; *c != '\0'; ++c) {
+		switch (*c) {
+		case ' ':
+		case '\t':
+		case '\f':
+		case '\v':
+		case '#':
+			fputc('\\', output);
+			break;
+		case '$':
+			fputc('$', output);
+			break;
+		}
+		fputc(*c, output);
+	}
+}
+
+void write_pp_dependencies(FILE *output, const char *targets,
+                           bool phony_targets)
+{
+	assert(dependencies != NULL);
+
+	fprintf(output, "%s:", targets);
+	size_t column = strlen(targets) + 1;
+	for (size_t i = 0, n = ARR_LEN(dependencies); i < n; ++i) {
+		const char *name = dependencies[i];
+		size_t      len  = strlen(name);
+		if (column + len + 1 > 78 && column > 1) {
+			fputs(" \\\n", output);
+			column = 0;
+		}
+		fputc(' ', output);
+		print_make_quoted(output, name);
+		column += len + 1;
+	}
+	fputc('\n', output);
+
+	/* the main file is not a header */
+	if (phony_targets) {
+		for (size_t i = 1, n = ARR_LEN(dependencies); i < n; ++i) {
+			fputc('\n', output);
+			print_make_quoted(output, dependencies[i]);
+			fputs(":\n", output);
+		}
+	}
+
+	DEL_ARR_F(dependencies);
+	dependencies = NULL;
+}
+
+void print_preprocessed_input(FILE *output)
+{
+	out = output;
+
+	decoded_position_t position = input.position;
+	position.lineno = 1;
+	print_line_directive(&position, NULL);
+
+	while (true) {
+		next_expanded_token();
+		if (pp_token.kind == TP_EOF)
+			break;
+		emit_pp_token();
+	}
+	fputc('\n', out);
+}
+
+/*
+ * Precompiled headers contain the fully preprocessed tokens of a header and
+ * the macros defined at its end.  An #include of the header at the very
+ * beginning of a translation unit replays them instead of reading the
+ * header.  The file is only used if it was created with the same
+ * configuration and none of the files read for it changed.
+ */
+
+#define PCH_MAGIC   "cparser pch"
+#define PCH_VERSION 3
+
+typedef struct pch_reader_t {
+	const char *pos;
+	const char *end;
+	bool        error;
+} pch_reader_t;
+
+/**
+ * Appends everything influencing the preprocessing of a header to @p obst.
+ */
+static void grow_pch_config(struct obstack *obst)
+{
+	obstack_printf(obst, "%u %s\n", (unsigned) c_mode,
+	               input_encoding != NULL ? input_encoding : "");
+	for (const searchpath_entry_t *entry = searchpath; entry != NULL;
+	     entry = entry->next) {
+		obstack_printf(obst, "%s %d\n", entry->path, entry->is_system_path);
+	}
+	for (const command_line_macro_t *macro = predefined_macros; macro != NULL;
+	     macro = macro->next) {
+		obstack_grow(obst, macro->directive, strlen(macro->directive));
+	}
+	for (const command_line_macro_t *macro = command_line_macros;
+	     macro != NULL; macro = macro->next) {
+		obstack_grow(obst, macro->directive, strlen(macro->directive));
+	}
+}
+
+static void pch_write_u32(FILE *output, uint32_t value)
+{
+	fwrite(&value, sizeof(value), 1, output);
+}
+
+static void pch_write_u64(FILE *output, uint64_t value)
+{
+	fwrite(&value, sizeof(value), 1, output);
+}
+
+static void pch_write_string(FILE *output, const char *string, size_t len)
+{
+	pch_write_u32(output, (uint32_t) len);
+	fwrite(string, 1, len + 1, output);
+}
+
+static uint64_t get_mtime_nsec(const struct stat *st)
+{
+#if defined(_WIN32)
+	(void) st;
+	return 0;
+#elif defined(__APPLE__)
+	return (uint64_t) st->st_mtimespec.tv_nsec;
+#else
+	return (uint64_t) st->st_mtim.tv_nsec;
+#endif
+}
+
+/**
+ * Writes the size, modification time and inode of the file described by
+ * @p st.  A rewrite within the same second only shows in the nanoseconds of
+ * the modification time, a replaced file in its inode.
+ */
+static void pch_write_file_stamp(FILE *output, const struct stat *st)
+{
+	pch_write_u64(output, (uint64_t) st->st_size);
+	pch_write_u64(output, (uint64_t) st->st_mtime);
+	pch_write_u64(output, get_mtime_nsec(st));
+	pch_write_u64(output, (uint64_t) st->st_ino);
+}
+
+/**
+ * Returns the index of @p name in the name table @p names, adding it if
+ * necessary.
+ */
+static uint32_t pch_name_index(const char ***names, const char *name)
+{
+	static size_t last;
+	size_t        n_names = ARR_LEN(*names);
+	if (last < n_names && (*names)[last] == name)
+		return (uint32_t) last;
+
+	for (size_t i = 0; i < n_names; ++i) {
+		if ((*names)[i] == name) {
+			last = i;
+			return (uint32_t) i;
+		}
+	}
+	ARR_APP1(const char*, *names, name);
+	last = n_names;
+	return (uint32_t) n_names;
+}
+
+static void pch_write_position(FILE *output, const char ***names,
+                               const source_position_t *position)
+{
+	decoded_position_t const pos = decode_position(*position);
+	pch_write_u32(output, pch_name_index(names, pos.input_name));
+	pch_write_u32(output, pos.lineno);
+	pch_write_u32(output, pos.colno | (uint32_t) pos.is_system_header << 31);
+}
+
+static void pch_write_token(FILE *output, const char ***names,
+                            const token_t *token)
+{
+	pch_write_u32(output, (uint32_t) token->kind
+	                      | (uint32_t) token->base.had_whitespace << 31);
+	pch_write_position(output, names, &token->base.source_position);
+
+	switch (token->kind) {
+	case TP_IDENTIFIER: {
+		const char *string = token->identifier.symbol->string;
+		pch_write_string(output, string, strlen(string));
+		break;
+	}
+	case TP_NUMBER:
+	case TP_CHARACTER_CONSTANT:
+	case TP_WIDE_CHARACTER_CONSTANT:
+	case TP_STRING_LITERAL:
+	case TP_WIDE_STRING_LITERAL: {
+		/* strings may contain a 0, their size includes the final one */
+		const string_t *string = &token->string.string;
+		pch_write_string(output, string->begin, string->size - 1);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static void pch_collect_names(const char ***names, const token_t *tokens,
+                              size_t n_tokens)
+{
+	for (size_t i = 0; i < n_tokens; ++i) {
+		pch_name_index(names,
+		               decode_position(tokens[i].base.source_position).input_name);
+	}
+}
+
+bool write_precompiled_header(FILE *output)
+{
+	pch_allowed           = false;
+	pch_context_dependent = false;
+	pch_dependencies      = NEW_ARR_F(const char*, 0);
+	ARR_APP1(const char*, pch_dependencies, base_file_name);
+
+	token_t *tokens = NEW_ARR_F(token_t, 0);
+	while (true) {
+		next_expanded_token();
+		if (pp_token.kind == TP_EOF)
+			break;
+		pp_token.base.had_whitespace = info.had_whitespace;
+		ARR_APP1(token_t, tokens, pp_token);
+	}
+
+	/* the file is still written, but never used */
+	if (pch_context_dependent) {
+		warningf(WARN_OTHER, &pch_context_position,
+		         "header depends on the including unit, the precompiled header will not be used");
+	}
+
+	/* the macros defined at the end of the header */
+	size_t n_definitions = 0;
+	for (const pp_definition_t *definition = definitions; definition != NULL;
+	     definition = definition->next) {
+		if (definition->symbol->pp_definition == definition)
+			++n_definitions;
+	}
+
+	/* the name table has to be known before anything referencing it */
+	const char **names = NEW_ARR_F(const char*, 0);
+	pch_collect_names(&names, tokens, ARR_LEN(tokens));
+	for (const pp_definition_t *definition = definitions; definition != NULL;
+	     definition = definition->next) {
+		if (definition->symbol->pp_definition != definition)
+			continue;
+		pch_name_index(&names,
+		               decode_position(definition->source_position).input_name);
+		pch_collect_names(&names, definition->token_list,
+		                  definition->list_len);
+	}
+
+	fwrite(PCH_MAGIC, 1, sizeof(PCH_MAGIC), output);
+	pch_write_u32(output, PCH_VERSION);
+	pch_write_u32(output, pch_context_dependent);
+
+	assert(obstack_object_size(&pp_obstack) == 0);
+	grow_pch_config(&pp_obstack);
+	size_t  config_len = obstack_object_size(&pp_obstack);
+	obstack_1grow(&pp_obstack, '\0');
+	char   *config     = obstack_finish(&pp_obstack);
+	pch_write_string(output, config, config_len);
+	obstack_free(&pp_obstack, config);
+
+	size_t n_dependencies = ARR_LEN(pch_dependencies);
+	pch_write_u32(output, (uint32_t) n_dependencies);
+	for (size_t i = 0; i < n_dependencies; ++i) {
+		const char  *name = pch_dependencies[i];
+		struct stat  st;
+		if (stat(name, &st) != 0)
+			memset(&st, 0, sizeof(st));
+		pch_write_string(output, name, strlen(name));
+		pch_write_file_stamp(output, &st);
+	}
+
+	size_t n_names = ARR_LEN(names);
+	pch_write_u32(output, (uint32_t) n_names);
+	for (size_t i = 0; i < n_names; ++i) {
+		pch_write_string(output, names[i], strlen(names[i]));
+	}
+
+	pch_write_u32(output, counter);
+
+	size_t n_tokens = ARR_LEN(tokens);
+	pch_write_u32(output, (uint32_t) n_tokens);
+	for (size_t i = 0; i < n_tokens; ++i) {
+		pch_write_token(output, &names, &tokens[i]);
+	}
+
+	pch_write_u32(output, (uint32_t) n_definitions);
+	for (const pp_definition_t *definition = definitions; definition != NULL;
+	     definition = definition->next) {
+		if (definition->symbol->pp_definition != definition)
+			continue;
+		const char *string = definition->symbol->string;
+		pch_write_string(output, string, strlen(string));
+		pch_write_position(output, &names, &definition->source_position);
+		pch_write_u32(output, definition->is_variadic
+		                      | definition->has_parameters << 1
+		                      | definition->has_paste << 2);
+		pch_write_u32(output, (uint32_t) definition->n_parameters);
+		for (size_t i = 0; i < definition->n_parameters; ++i) {
+			const char *parameter = definition->parameters[i]->string;
+			pch_write_string(output, parameter, strlen(parameter));
+		}
+		pch_write_u32(output, (uint32_t) definition->list_len);
+		for (size_t i = 0; i < definition->list_len; ++i) {
+			pch_write_token(output, &names, &definition->token_list[i]);
+		}
+	}
+
+	DEL_ARR_F(names);
+	DEL_ARR_F(tokens);
+	DEL_ARR_F(pch_dependencies);
+	pch_dependencies = NULL;
+
+	return !ferror(output);
+}
+
+static uint32_t pch_read_u32(pch_reader_t *reader)
+{
+	uint32_t value;
+	if ((size_t) (reader->end - reader->pos) < sizeof(value)) {
+		reader->error = true;
+		return 0;
+	}
+	memcpy(&value, reader->pos, sizeof(value));
+	reader->pos += sizeof(value);
+	return value;
+}
+
+static uint64_t pch_read_u64(pch_reader_t *reader)
+{
+	uint64_t value;
+	if ((size_t) (reader->end - reader->pos) < sizeof(value)) {
+		reader->error = true;
+		return 0;
+	}
+	memcpy(&value, reader->pos, sizeof(value));
+	reader->pos += sizeof(value);
+	return value;
+}
+
+/**
+ * Reads a stamp written by pch_write_file_stamp() and checks that it still
+ * describes the file @p st.
+ */
+static bool pch_check_file_stamp(pch_reader_t *reader, const struct stat *st)
+{
+	uint64_t size  = pch_read_u64(reader);
+	uint64_t mtime = pch_read_u64(reader);
+	uint64_t nsec  = pch_read_u64(reader);
+	uint64_t inode = pch_read_u64(reader);
+	return !reader->error
+	    && size  == (uint64_t) st->st_size
+	    && mtime == (uint64_t) st->st_mtime
+	    && nsec  == get_mtime_nsec(st)
+	    && inode == (uint64_t) st->st_ino;
+}
+
+/**
+ * Returns a pointer to a 0-terminated string inside the file.
+ */
+static const char *pch_read_string(pch_reader_t *reader, size_t *len)
+{
+	uint32_t length = pch_read_u32(reader);
+	if (reader->error || (size_t) (reader->end - reader->pos) <= length
+			|| reader->pos[length] != '\0') {
+		reader->error = true;
+		return "";
+	}
+	const char *string = reader->pos;
+	reader->pos += length + 1;
+	if (len != NULL)
+		*len = length;
+	return string;
+}
+
+static symbol_t *pch_read_symbol(pch_reader_t *reader)
+{
+	size_t      len;
+	const char *string = pch_read_string(reader, &len);
+
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	obstack_grow(&symbol_obstack, string, len + 1);
+	char     *copy   = obstack_finish(&symbol_obstack);
+	symbol_t *symbol = symbol_table_insert(copy);
+	if (symbol->string != copy)
+		obstack_free(&symbol_obstack, copy);
+	return symbol;
+}
+
+static const char *pch_read_identified_string(pch_reader_t *reader)
+{
+	size_t      len;
+	const char *string = pch_read_string(reader, &len);
+
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	obstack_grow(&symbol_obstack, string, len + 1);
+	return identify_string(obstack_finish(&symbol_obstack));
+}
+
+static string_t pch_read_pp_string(pch_reader_t *reader)
+{
+	size_t      len;
+	const char *string = pch_read_string(reader, &len);
+
+	assert(obstack_object_size(&symbol_obstack) == 0);
+	obstack_grow(&symbol_obstack, string, len + 1);
+	return make_pp_string(obstack_finish(&symbol_obstack), len + 1);
+}
+
+static void pch_read_position(pch_reader_t *reader, const char **names,
+                              source_position_t *position)
+{
+	uint32_t name  = pch_read_u32(reader);
+	uint32_t line  = pch_read_u32(reader);
+	uint32_t colno = pch_read_u32(reader);
+	if (name >= ARR_LEN(names)) {
+		reader->error = true;
+		return;
+	}
+	decoded_position_t pos;
+	pos.input_name       = names[name];
+	pos.lineno           = line;
+	pos.colno            = colno & ~((uint32_t) 1 << 31);
+	pos.is_system_header = colno >> 31;
+	*position = encode_position(&pos);
+}
+
+static void pch_read_token(pch_reader_t *reader, const char **names,
+                           token_t *token)
+{
+	uint32_t kind = pch_read_u32(reader);
+
+	memset(token, 0, sizeof(*token));
+	token->kind                = (int) (kind & ~((uint32_t) 1 << 31));
+	token->base.had_whitespace = kind >> 31;
+	pch_read_position(reader, names, &token->base.source_position);
+	if (token->kind >= TP_LAST_TOKEN) {
+		reader->error = true;
+		return;
+	}
+
+	switch (token->kind) {
+	case TP_IDENTIFIER:
+		token->identifier.symbol = pch_read_symbol(reader);
+		break;
+	case TP_NUMBER:
+	case TP_CHARACTER_CONSTANT:
+	case TP_WIDE_CHARACTER_CONSTANT:
+	case TP_STRING_LITERAL:
+	case TP_WIDE_STRING_LITERAL:
+		token->string.string = pch_read_pp_string(reader);
+		break;
+	default:
+		break;
+	}
+}
+
+/** Checks whether @p filename lies below a system include directory. */
+static bool is_in_system_searchpath(const char *filename)
+{
+	for (const searchpath_entry_t *entry = system_searchpath; entry != NULL;
+	     entry = entry->next) {
+		size_t len = strlen(entry->path);
+		if (strncmp(filename, entry->path, len) == 0 && filename[len] == '/')
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Checks that the precompiled header was created with the current
+ * configuration from files which did not change since.
+ */
+static bool pch_check_dependencies(pch_reader_t *reader)
+{
+	if ((size_t) (reader->end - reader->pos) < sizeof(PCH_MAGIC)
+			|| memcmp(reader->pos, PCH_MAGIC, sizeof(PCH_MAGIC)) != 0)
+		return false;
+	reader->pos += sizeof(PCH_MAGIC);
+	if (pch_read_u32(reader) != PCH_VERSION
+			|| pch_read_u32(reader) != 0 || reader->error)
+		return false;
+
+	size_t      config_len;
+	const char *config = pch_read_string(reader, &config_len);
+	if (reader->error)
+		return false;
+	assert(obstack_object_size(&pp_obstack) == 0);
+	grow_pch_config(&pp_obstack);
+	size_t  current_len = obstack_object_size(&pp_obstack);
+	char   *current     = obstack_finish(&pp_obstack);
+	bool    same_config = current_len == config_len
+	                   && memcmp(current, config, config_len) == 0;
+	obstack_free(&pp_obstack, current);
+	if (!same_config)
+		return false;
+
+	uint32_t n_dependencies = pch_read_u32(reader);
+	for (uint32_t i = 0; i < n_dependencies && !reader->error; ++i) {
+		const char *name = pch_read_string(reader, NULL);
+		struct stat st;
+		if (reader->error || stat(name, &st) != 0
+				|| !pch_check_file_stamp(reader, &st))
+			return false;
+
+		/* the files of the header are dependencies even if it is replayed;
+		 * if loading fails later on, the header reads the same files */
+		if (dependencies != NULL) {
+			char *copy = obstack_copy0(&symbol_obstack, name, strlen(name));
+			add_dependency(identify_string(copy),
+			               is_in_system_searchpath(name));
+		}
+	}
+	return !reader->error;
+}
+
+/**
+ * Reads the tokens and macros of the precompiled header for @p filename if
+ * there is a usable one.
+ */
+static bool load_precompiled_header(const char *filename)
+{
+	assert(obstack_object_size(&pp_obstack) == 0);
+	obstack_printf(&pp_obstack, "%s.gch", filename);
+	obstack_1grow(&pp_obstack, '\0');
+	char *pch_name = obstack_finish(&pp_obstack);
+	FILE *file     = fopen(pch_name, "rb");
+	obstack_free(&pp_obstack, pch_name);
+	if (file == NULL)
+		return false;
+
+	char *buffer = NULL;
+	long  size   = -1;
+	if (fseek(file, 0, SEEK_END) == 0)
+		size = ftell(file);
+	if (size > 0 && fseek(file, 0, SEEK_SET) == 0) {
+		buffer = XMALLOCN(char, size);
+		if (fread(buffer, 1, size, file) != (size_t) size)
+			size = -1;
+	}
+	fclose(file);
+
+	pch_reader_t reader = { buffer, buffer + size, false };
+	if (size <= 0 || !pch_check_dependencies(&reader)) {
+		xfree(buffer);
+		return false;
+	}
+
+	uint32_t     n_names = pch_read_u32(&reader);
+	const char **names   = NEW_ARR_F(const char*, 0);
+	for (uint32_t i = 0; i < n_names && !reader.error; ++i) {
+		ARR_APP1(const char*, names, pch_read_identified_string(&reader));
+	}
+
+	unsigned pch_counter = pch_read_u32(&reader);
+
+	uint32_t  n_tokens = pch_read_u32(&reader);
+	token_t  *tokens   = NEW_ARR_F(token_t, 0);
+	for (uint32_t i = 0; i < n_tokens && !reader.error; ++i) {
+		token_t token;
+		pch_read_token(&reader, names, &token);
+		ARR_APP1(token_t, tokens, token);
+	}
+
+	/* the macros are only installed once the whole file is read */
+	char            *mark          = obstack_alloc(&pp_obstack, 1);
+	pp_definition_t *pch_macros    = NULL;
+	uint32_t         n_definitions = pch_read_u32(&reader);
+	for (uint32_t i = 0; i < n_definitions && !reader.error; ++i) {
+		pp_definition_t *definition = OALLOCZ(&pp_obstack, pp_definition_t);
+		definition->symbol = pch_read_symbol(&reader);
+		pch_read_position(&reader, names, &definition->source_position);
+		uint32_t flags = pch_read_u32(&reader);
+		definition->is_variadic    = (flags & 1) != 0;
+		definition->has_parameters = (flags & 2) != 0;
+		definition->has_paste      = (flags & 4) != 0;
+
+		uint32_t n_parameters = pch_read_u32(&reader);
+		if (n_parameters > (size_t) (reader.end - reader.pos))
+			reader.error = true;
+		if (reader.error)
+			break;
+		definition->n_parameters = n_parameters;
+		definition->parameters
+			= obstack_alloc(&pp_obstack, n_parameters * sizeof(symbol_t*));
+		for (uint32_t p = 0; p < n_parameters; ++p) {
+			definition->parameters[p] = pch_read_symbol(&reader);
+		}
+
+		uint32_t list_len = pch_read_u32(&reader);
+		if (list_len > (size_t) (reader.end - reader.pos))
+			reader.error = true;
+		if (reader.error)
+			break;
+		definition->list_len   = list_len;
+		token_t *token_list    = obstack_alloc(&pp_obstack,
+		                                       list_len * sizeof(token_t));
+		definition->token_list = token_list;
+		for (uint32_t t = 0; t < list_len; ++t) {
+			pch_read_token(&reader, names, &token_list[t]);
+		}
+
+		definition->next = pch_macros;
+		pch_macros       = definition;
+	}
+
+	DEL_ARR_F(names);
+	xfree(buffer);
+	if (reader.error) {
+		obstack_free(&pp_obstack, mark);
+		DEL_ARR_F(tokens);
+		return false;
+	}
+
+	/* the header ends with exactly these macros defined */
+	for (pp_definition_t *definition = definitions; definition != NULL;
+	     definition = definition->next) {
+		definition->symbol->pp_definition = NULL;
+	}
+	definitions = NULL;
+	for (pp_definition_t *definition = pch_macros; definition != NULL; ) {
+		pp_definition_t *next = definition->next;
+		definition->next                  = definitions;
+		definitions                       = definition;
+		definition->symbol->pp_definition = definition;
+		definition                        = next;
+	}
+
+	counter    = pch_counter;
+	pch_tokens = tokens;
+	return true;
+}
+
+/*
+ * The token cache keeps the preprocessing tokens of every header in a file
+ * of its own, before any macro expansion or directive processing.  An
+ * #include of an unchanged header replays them instead of reading the file
+ * again.  As the next translation unit might take different branches of the
+ * conditionals, the tokens of skipped lines are kept as well.
+ */
 
-		/* evaluate wether we are in true or false case */
-		condition = is_ifndef ? pp_definition == NULL : pp_definition != NULL;
-	}
+#define TOKEN_CACHE_MAGIC   "cparser tokens"
+#define TOKEN_CACHE_VERSION 2
 
-	pp_conditional_t *conditional = push_conditional();
-	conditional->source_position  = pp_token.base.source_position;
-	conditional->condition        = condition;
+void set_token_cache_dir(const char *dir)
+{
+	token_cache_dir = dir;
+	mkdir(dir, 0777);
+}
 
-	if (!condition) {
-		skip_mode = true;
+/**
+ * Returns the name of the cache file for @p filename on the pp_obstack.
+ * Everything influencing how the header is lexed is part of the name.
+ */
+static char *get_token_cache_name(const char *filename)
+{
+	assert(obstack_object_size(&pp_obstack) == 0);
+	obstack_printf(&pp_obstack, "%u %d %s\n%s", (unsigned) c_mode,
+	               (int) allow_dollar_in_symbol,
+	               input_encoding != NULL ? input_encoding : "", filename);
+	size_t  len    = obstack_object_size(&pp_obstack);
+	char   *config = obstack_finish(&pp_obstack);
+
+	sha1_t sha1;
+	sha1_init(&sha1);
+	sha1_update(&sha1, config, len);
+	unsigned char digest[SHA1_DIGEST_SIZE];
+	sha1_final(&sha1, digest);
+	obstack_free(&pp_obstack, config);
+
+	obstack_printf(&pp_obstack, "%s/", token_cache_dir);
+	for (unsigned i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+		obstack_printf(&pp_obstack, "%02x", digest[i]);
 	}
+	obstack_printf(&pp_obstack, ".tok");
+	obstack_1grow(&pp_obstack, '\0');
+	return obstack_finish(&pp_obstack);
 }
 
-static void parse_else_directive(void)
+static void token_cache_write_uint(FILE *output, uint32_t value)
 {
-	eat_pp(TP_else);
+	/* 7 bits at a time, most tokens need one byte per field this way */
+	while (value >= 0x80) {
+		fputc((int) (value & 0x7F) | 0x80, output);
+		value >>= 7;
+	}
+	fputc((int) value, output);
+}
 
-	if (!info.at_line_begin) {
-		if (!skip_mode) {
-			warningf(WARN_OTHER, &pp_token.base.source_position, "extra tokens at end of #else");
+static uint32_t token_cache_read_uint(pch_reader_t *reader)
+{
+	uint32_t value = 0;
+	for (unsigned shift = 0; shift < 32; shift += 7) {
+		if (reader->pos == reader->end) {
+			reader->error = true;
+			return 0;
 		}
-		eat_pp_directive();
+		unsigned char const b = (unsigned char) *reader->pos++;
+		value |= (uint32_t) (b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return value;
 	}
+	reader->error = true;
+	return 0;
+}
 
-	pp_conditional_t *conditional = conditional_stack;
-	if (conditional == NULL) {
-		errorf(&pp_token.base.source_position, "#else without prior #if");
-		return;
+/** Maps the strings of the tokens to their index in the string table. */
+typedef struct token_cache_names_t {
+	const char **strings;  /**< the table (ARR_F) */
+	size_t      *lens;     /**< length of the strings (ARR_F) */
+	const char **keys;     /**< open addressing hash of the strings */
+	uint32_t    *indices;
+	size_t       size;     /**< size of the hash, a power of two */
+} token_cache_names_t;
+
+static uint32_t token_cache_name_index(token_cache_names_t *names,
+                                       const char *string, size_t len)
+{
+	size_t const mask = names->size - 1;
+	size_t       i    = ((size_t) string >> 3) & mask;
+	for (;; i = (i + 1) & mask) {
+		if (names->keys[i] == string)
+			return names->indices[i];
+		if (names->keys[i] == NULL)
+			break;
 	}
 
-	if (conditional->in_else) {
-		errorf(&pp_token.base.source_position,
-		       "#else after #else (condition started %P)",
-		       conditional->source_position);
-		skip_mode = true;
-		return;
-	}
+	uint32_t const index = (uint32_t) ARR_LEN(names->strings);
+	ARR_APP1(const char*, names->strings, string);
+	ARR_APP1(size_t, names->lens, len);
+	names->keys[i]    = string;
+	names->indices[i] = index;
+	return index;
+}
 
-	conditional->in_else = true;
-	if (!conditional->skip) {
-		skip_mode = conditional->condition;
+/** Checks whether a cached token refers to a symbol or string. */
+static bool cached_token_has_string(const cached_token_t *cached)
+{
+	if (cached->flags & CACHED_HEADERNAME)
+		return true;
+
+	switch (cached->token.kind) {
+	case TP_IDENTIFIER:
+	case TP_NUMBER:
+	case TP_CHARACTER_CONSTANT:
+	case TP_WIDE_CHARACTER_CONSTANT:
+	case TP_STRING_LITERAL:
+	case TP_WIDE_STRING_LITERAL:
+		return true;
+	default:
+		return false;
 	}
-	conditional->source_position = pp_token.base.source_position;
 }
 
-static void parse_endif_directive(void)
+static bool is_cached_identifier(const cached_token_t *cached)
 {
-	eat_pp(TP_endif);
+	return cached->token.kind == TP_IDENTIFIER
+	    && !(cached->flags & CACHED_HEADERNAME);
+}
 
-	if (!info.at_line_begin) {
-		if (!skip_mode) {
-			warningf(WARN_OTHER, &pp_token.base.source_position, "extra tokens at end of #endif");
+static void write_token_cache(const char *filename, const cached_token_t *tokens)
+{
+	/* a file modified within the current second might change again without
+	 * a visible difference on file systems with coarse timestamps */
+	struct stat st;
+	if (stat(filename, &st) != 0 || st.st_mtime >= time(NULL))
+		return;
+
+	size_t const        n_tokens = ARR_LEN(tokens);
+	token_cache_names_t names;
+	names.size = 16;
+	while (names.size < 2 * n_tokens)
+		names.size *= 2;
+	names.strings = NEW_ARR_F(const char*, 0);
+	names.lens    = NEW_ARR_F(size_t, 0);
+	names.keys    = XMALLOCNZ(const char*, names.size);
+	names.indices = XMALLOCN(uint32_t, names.size);
+
+	uint32_t *token_names = XMALLOCN(uint32_t, n_tokens);
+	for (size_t i = 0; i < n_tokens; ++i) {
+		const cached_token_t *cached = &tokens[i];
+		if (!cached_token_has_string(cached)) {
+			token_names[i] = 0;
+		} else if (is_cached_identifier(cached)) {
+			const char *string = cached->token.identifier.symbol->string;
+			token_names[i] = token_cache_name_index(&names, string,
+			                                        strlen(string));
+		} else {
+			/* strings may contain a 0, their size includes the final one */
+			const string_t *string = &cached->token.string.string;
+			token_names[i] = token_cache_name_index(&names, string->begin,
+			                                        string->size - 1);
 		}
-		eat_pp_directive();
 	}
 
-	pp_conditional_t *conditional = conditional_stack;
-	if (conditional == NULL) {
-		errorf(&pp_token.base.source_position, "#endif without prior #if");
-		return;
-	}
+	char *cache_name = get_token_cache_name(filename);
+	obstack_printf(&pp_obstack, "%s.%d", cache_name, (int) getpid());
+	obstack_1grow(&pp_obstack, '\0');
+	char *temp_name  = obstack_finish(&pp_obstack);
+	FILE *output     = fopen(temp_name, "wb");
+	if (output != NULL) {
+		fwrite(TOKEN_CACHE_MAGIC, 1, sizeof(TOKEN_CACHE_MAGIC), output);
+		pch_write_u32(output, TOKEN_CACHE_VERSION);
+		pch_write_string(output, filename, strlen(filename));
+		pch_write_file_stamp(output, &st);
+
+		size_t const n_names = ARR_LEN(names.strings);
+		token_cache_write_uint(output, (uint32_t) n_names);
+		for (size_t i = 0; i < n_names; ++i) {
+			size_t const len = names.lens[i];
+			token_cache_write_uint(output, (uint32_t) len);
+			fwrite(names.strings[i], 1, len, output);
+		}
 
-	if (!conditional->skip) {
-		skip_mode = false;
+		token_cache_write_uint(output, (uint32_t) n_tokens);
+		unsigned lineno = 0;
+		for (size_t i = 0; i < n_tokens; ++i) {
+			const cached_token_t *cached = &tokens[i];
+			token_cache_write_uint(output, (uint32_t) cached->token.kind);
+			token_cache_write_uint(output, cached->flags);
+			token_cache_write_uint(output, cached->whitespace);
+			/* lines only grow, so they are stored as difference */
+			token_cache_write_uint(output, cached->lineno - lineno);
+			token_cache_write_uint(output, cached->colno);
+			token_cache_write_uint(output, cached->end_lineno - cached->lineno);
+			token_cache_write_uint(output, cached->end_colno);
+			lineno = cached->lineno;
+			if (cached_token_has_string(cached))
+				token_cache_write_uint(output, token_names[i]);
+		}
+
+		bool const ok = !ferror(output);
+		if (fclose(output) != 0 || !ok || rename(temp_name, cache_name) != 0)
+			remove(temp_name);
 	}
-	pop_conditional();
+	obstack_free(&pp_obstack, cache_name);
+
+	xfree(token_names);
+	xfree(names.indices);
+	xfree(names.keys);
+	DEL_ARR_F(names.lens);
+	DEL_ARR_F(names.strings);
 }
 
-static void parse_preprocessing_directive(void)
+/**
+ * Reads the cached tokens of @p filename.
+ *
+ * @return the tokens (ARR_F) or NULL if there is no usable cache file
+ */
+static cached_token_t *load_token_cache(const char *filename)
 {
-	in_pp_directive = true;
-	eat_pp('#');
+	char *cache_name = get_token_cache_name(filename);
+	FILE *file       = fopen(cache_name, "rb");
+	obstack_free(&pp_obstack, cache_name);
+	if (file == NULL)
+		return NULL;
 
-	if (skip_mode) {
-		switch (pp_token.kind) {
-		case TP_ifdef:
-		case TP_ifndef:
-			parse_ifdef_ifndef_directive();
-			break;
-		case TP_else:
-			parse_else_directive();
-			break;
-		case TP_endif:
-			parse_endif_directive();
-			break;
-		default:
-			eat_pp_directive();
+	char *buffer = NULL;
+	long  size   = -1;
+	if (fseek(file, 0, SEEK_END) == 0)
+		size = ftell(file);
+	if (size > 0 && fseek(file, 0, SEEK_SET) == 0) {
+		buffer = XMALLOCN(char, size);
+		if (fread(buffer, 1, size, file) != (size_t) size)
+			size = -1;
+	}
+	fclose(file);
+	if (size <= 0) {
+		xfree(buffer);
+		return NULL;
+	}
+
+	pch_reader_t reader = { buffer, buffer + size, false };
+	struct stat  st;
+	if ((size_t) size < sizeof(TOKEN_CACHE_MAGIC)
+			|| memcmp(buffer, TOKEN_CACHE_MAGIC, sizeof(TOKEN_CACHE_MAGIC)) != 0
+			|| stat(filename, &st) != 0) {
+		xfree(buffer);
+		return NULL;
+	}
+	reader.pos += sizeof(TOKEN_CACHE_MAGIC);
+	uint32_t    version = pch_read_u32(&reader);
+	const char *name    = pch_read_string(&reader, NULL);
+	if (reader.error || version != TOKEN_CACHE_VERSION
+			|| !streq(name, filename)
+			|| !pch_check_file_stamp(&reader, &st)) {
+		xfree(buffer);
+		return NULL;
+	}
+
+	/* the strings are only converted to symbols or identified strings when
+	 * a token uses them */
+	uint32_t n_names = token_cache_read_uint(&reader);
+	if (n_names > (size_t) (reader.end - reader.pos)) {
+		xfree(buffer);
+		return NULL;
+	}
+	const char **name_begins = XMALLOCN(const char*, n_names);
+	uint32_t    *name_lens   = XMALLOCN(uint32_t, n_names);
+	void       **converted   = XMALLOCNZ(void*, n_names);
+	for (uint32_t i = 0; i < n_names && !reader.error; ++i) {
+		uint32_t len = token_cache_read_uint(&reader);
+		if (len > (size_t) (reader.end - reader.pos)) {
+			reader.error = true;
 			break;
 		}
-	} else {
-		switch (pp_token.kind) {
-		case TP_define:
-			parse_define_directive();
-			break;
-		case TP_undef:
-			parse_undef_directive();
-			break;
-		case TP_ifdef:
-		case TP_ifndef:
-			parse_ifdef_ifndef_directive();
-			break;
-		case TP_else:
-			parse_else_directive();
-			break;
-		case TP_endif:
-			parse_endif_directive();
+		name_begins[i] = reader.pos;
+		name_lens[i]   = len;
+		reader.pos    += len;
+	}
+
+	uint32_t        n_tokens = token_cache_read_uint(&reader);
+	cached_token_t *tokens   = NEW_ARR_F(cached_token_t, 0);
+	unsigned        lineno   = 0;
+	for (uint32_t i = 0; i < n_tokens && !reader.error; ++i) {
+		cached_token_t cached;
+		memset(&cached, 0, sizeof(cached));
+		cached.token.kind  = (int) token_cache_read_uint(&reader);
+		cached.flags       = token_cache_read_uint(&reader);
+		cached.whitespace  = token_cache_read_uint(&reader);
+		lineno            += token_cache_read_uint(&reader);
+		cached.lineno      = lineno;
+		cached.colno       = token_cache_read_uint(&reader);
+		cached.end_lineno  = lineno + token_cache_read_uint(&reader);
+		cached.end_colno   = token_cache_read_uint(&reader);
+		if (cached.token.kind >= TP_LAST_TOKEN) {
+			reader.error = true;
 			break;
-		case TP_include:
-			parse_include_directive();
+		}
+
+		if (!cached_token_has_string(&cached)) {
+			ARR_APP1(cached_token_t, tokens, cached);
+			continue;
+		}
+		bool const is_identifier = is_cached_identifier(&cached);
+
+		uint32_t index = token_cache_read_uint(&reader);
+		if (reader.error || index >= n_names) {
+			reader.error = true;
 			break;
-		default:
-			if (info.at_line_begin) {
-				/* the nop directive "#" */
-				break;
+		}
+		if (converted[index] == NULL) {
+			assert(obstack_object_size(&symbol_obstack) == 0);
+			obstack_grow0(&symbol_obstack, name_begins[index],
+			              name_lens[index]);
+			char *copy = obstack_finish(&symbol_obstack);
+			if (is_identifier) {
+				symbol_t *symbol = symbol_table_insert(copy);
+				if (symbol->string != copy)
+					obstack_free(&symbol_obstack, copy);
+				converted[index] = symbol;
+			} else {
+				string_t string = make_pp_string(copy, name_lens[index] + 1);
+				converted[index] = (void*) string.begin;
 			}
-			errorf(&pp_token.base.source_position,
-				   "invalid preprocessing directive #%t", &pp_token);
-			eat_pp_directive();
-			break;
 		}
+		if (is_identifier) {
+			cached.token.identifier.symbol = converted[index];
+		} else {
+			cached.token.string.string.begin = converted[index];
+			cached.token.string.string.size  = name_lens[index] + 1;
+		}
+		ARR_APP1(cached_token_t, tokens, cached);
 	}
 
-	in_pp_directive = false;
-	assert(info.at_line_begin);
+	xfree(converted);
+	xfree(name_lens);
+	xfree(name_begins);
+	xfree(buffer);
+
+	/* a complete file ends with the end of file token */
+	size_t const n_read = ARR_LEN(tokens);
+	if (reader.error || n_read == 0 || tokens[n_read - 1].token.kind != TP_EOF) {
+		DEL_ARR_F(tokens);
+		return NULL;
+	}
+	return tokens;
 }
 
-static void prepend_include_path(const char *path)
+/**
+ * Replays the cached tokens of the header which was just entered, or
+ * records its tokens if there are none.
+ */
+static void start_token_cache(const char *filename)
 {
-	searchpath_entry_t *entry = OALLOCZ(&config_obstack, searchpath_entry_t);
-	entry->path = path;
-	entry->next = searchpath;
-	searchpath  = entry;
+	cached_token_t *tokens = load_token_cache(filename);
+	if (tokens != NULL) {
+		input_free(input.input);
+		input.input      = NULL;
+		input.replay     = tokens;
+		input.replay_pos = 0;
+	} else {
+		input.record = NEW_ARR_F(cached_token_t, 0);
+	}
 }
 
-static void setup_include_path(void)
+/**
+ * Writes the recorded tokens of the current input if it was read
+ * completely.
+ */
+static void finish_token_cache(void)
 {
-	/* built-in paths */
-	prepend_include_path("/usr/include");
+	if (input.replay != NULL) {
+		DEL_ARR_F(input.replay);
+		input.replay = NULL;
+	}
+	if (input.record != NULL) {
+		size_t const n_tokens = ARR_LEN(input.record);
+		if (n_tokens > 0 && input.record[n_tokens - 1].token.kind == TP_EOF)
+			write_token_cache(input.position.input_name, input.record);
+		DEL_ARR_F(input.record);
+		input.record = NULL;
+	}
+}
 
-	/* parse environment variable */
-	const char *cpath = getenv("CPATH");
-	if (cpath != NULL && *cpath != '\0') {
-		const char *begin = cpath;
-		const char *c;
-		do {
-			c = begin;
-			while (*c != '\0' && *c != ':')
-				++c;
+/** Stops recording, the tokens of the current input cannot be replayed. */
+static void abort_token_recording(void)
+{
+	DEL_ARR_F(input.record);
+	input.record = NULL;
+}
 
-			size_t len = c-begin;
-			if (len == 0) {
-				/* for gcc compatibility (Matze: I would expect that
-				 * nothing happens for an empty entry...) */
-				prepend_include_path(".");
-			} else {
-				char *string = obstack_alloc(&config_obstack, len+1);
-				memcpy(string, begin, len);
-				string[len] = '\0';
+static void lex_recorded_token(void)
+{
+	unsigned const whitespace    = info.whitespace;
+	unsigned const n_diagnostics = diagnostic_count;
+	lexed_newline         = false;
+	lexed_comment_newline = false;
+
+	lex_preprocessing_token();
+
+	/* replaying would not repeat the diagnostics, and tokens which are fine
+	 * in a skipped line might not be in the next translation unit */
+	bool const is_empty_char = (pp_token.kind == TP_CHARACTER_CONSTANT
+	                         || pp_token.kind == TP_WIDE_CHARACTER_CONSTANT)
+	                        && pp_token.string.string.size == 1;
+	if (diagnostic_count != n_diagnostics || pp_token.kind == TP_ERROR
+			|| is_empty_char) {
+		abort_token_recording();
+		return;
+	}
 
-				prepend_include_path(string);
-			}
+	cached_token_t cached;
+	cached.token = pp_token;
+	cached.flags = (lexed_newline ? CACHED_NEWLINE : 0)
+	             | (lexed_comment_newline ? CACHED_COMMENT_NEWLINE : 0)
+	             | (info.had_whitespace ? CACHED_WHITESPACE : 0);
+	cached.whitespace = lexed_newline || lexed_comment_newline
+	                    ? info.whitespace : info.whitespace - whitespace;
+	decoded_position_t const position
+		= decode_position(pp_token.base.source_position);
+	cached.lineno     = position.lineno - input.line_delta;
+	cached.colno      = position.colno;
+	cached.end_lineno = input.position.lineno - input.line_delta;
+	cached.end_colno  = input.position.colno;
+	ARR_APP1(cached_token_t, input.record, cached);
+}
 
-			begin = c+1;
-			/* skip : */
-			if (*begin == ':')
-				++begin;
-		} while(*c != '\0');
+static void record_headername(const char *headername, bool system_include)
+{
+	if (headername == NULL) {
+		abort_token_recording();
+		return;
 	}
+
+	cached_token_t cached;
+	memset(&cached, 0, sizeof(cached));
+	cached.token.kind                = TP_STRING_LITERAL;
+	cached.token.string.string.begin = headername;
+	cached.token.string.string.size  = strlen(headername) + 1;
+	cached.flags                     = CACHED_HEADERNAME
+		| (system_include ? CACHED_SYSTEM_HEADER : 0);
+	cached.end_lineno = input.position.lineno - input.line_delta;
+	cached.end_colno  = input.position.colno;
+	ARR_APP1(cached_token_t, input.record, cached);
 }
 
-int pptest_main(int argc, char **argv);
-int pptest_main(int argc, char **argv)
+static void replay_token(void)
 {
-	init_symbol_table();
-	init_tokens();
+	const cached_token_t *cached = &input.replay[input.replay_pos];
+	/* the end of file token is returned over and over like the lexer does */
+	if (input.replay_pos + 1 < ARR_LEN(input.replay))
+		++input.replay_pos;
+
+	/* the lexer leaves the whitespace flag of pp_token alone */
+	bool const had_whitespace = pp_token.base.had_whitespace;
+	pp_token = cached->token;
+	pp_token.base.had_whitespace = had_whitespace;
+
+	decoded_position_t position;
+	position.input_name       = input.position.input_name;
+	position.lineno           = cached->lineno + input.line_delta;
+	position.colno            = cached->colno;
+	position.is_system_header = input.position.is_system_header;
+	pp_token.base.source_position = encode_position(&position);
+	input.position.lineno = cached->end_lineno + input.line_delta;
+	input.position.colno  = cached->end_colno;
+
+	unsigned const flags           = cached->flags;
+	bool     const newline         = flags & CACHED_NEWLINE;
+	bool     const comment_newline = flags & CACHED_COMMENT_NEWLINE;
+	info.at_line_begin  = newline || (comment_newline && !in_pp_directive);
+	info.had_whitespace = (flags & CACHED_WHITESPACE) != 0;
+	if (newline || comment_newline) {
+		info.whitespace = cached->whitespace;
+	} else {
+		info.whitespace += cached->whitespace;
+	}
+}
+
+static bool replay_headername(const char **headername, bool *system_include)
+{
+	const cached_token_t *cached = &input.replay[input.replay_pos];
+	if (!(cached->flags & CACHED_HEADERNAME)) {
+		*system_include = false;
+		return false;
+	}
+	++input.replay_pos;
+
+	*headername           = cached->token.string.string.begin;
+	*system_include       = (cached->flags & CACHED_SYSTEM_HEADER) != 0;
+	input.position.lineno = cached->end_lineno + input.line_delta;
+	input.position.colno  = cached->end_colno;
+	return true;
+}
+
+/**
+ * Checks whether the macro name of a #define is directly followed by a '('.
+ */
+static bool replay_function_like(void)
+{
+	const cached_token_t *cached = &input.replay[input.replay_pos];
+	return cached->token.kind == '(' && !(cached->flags
+		& (CACHED_NEWLINE | CACHED_COMMENT_NEWLINE | CACHED_WHITESPACE));
+}
 
+void init_preprocessor(void)
+{
 	obstack_init(&config_obstack);
 	obstack_init(&pp_obstack);
 	obstack_init(&input_obstack);
+	obstack_init(&expansion_obstack);
 	strset_init(&stringset);
+	once_files = NEW_ARR_F(include_file_t*, 0);
+}
 
-	setup_include_path();
+void exit_preprocessor(void)
+{
+	obstack_free(&expansion_obstack, NULL);
+	obstack_free(&input_obstack, NULL);
+	obstack_free(&pp_obstack, NULL);
+	for (searchpath_entry_t *entry = searchpath; entry != NULL;
+	     entry = entry->next) {
+		if (entry->has_names)
+			strset_destroy(&entry->names);
+	}
+	obstack_free(&config_obstack, NULL);
+
+	DEL_ARR_F(once_files);
+	once_files = NULL;
+	xfree(include_files);
+	include_files      = NULL;
+	include_files_size = 0;
+	n_include_files    = 0;
+
+	strset_destroy(&stringset);
+}
+
+int pptest_main(int argc, char **argv);
+int pptest_main(int argc, char **argv)
+{
+	init_symbol_table();
+	init_tokens();
+	init_preprocessor();
 
 	/* simplistic commandline parser */
-	const char *filename = NULL;
+	const char *filename     = NULL;
+	bool        dependencies = false;
+	bool        phony        = false;
 	for (int i = 1; i < argc; ++i) {
 		const char *opt = argv[i];
 		if (streq(opt, "-I")) {
-			prepend_include_path(argv[++i]);
+			add_include_path(argv[++i]);
 			continue;
+		} else if (streq(opt, "-M")) {
+			dependencies = true;
+		} else if (streq(opt, "-MP")) {
+			dependencies = true;
+			phony        = true;
+		} else if (streq(opt, "-finclude-dir-listing")) {
+			set_include_dir_listing(true);
+		} else if (strstart(opt, "-ftoken-cache=")) {
+			set_token_cache_dir(strstart(opt, "-ftoken-cache="));
 		} else if (streq(opt, "-E")) {
 			/* ignore */
 		} else if (opt[0] == '-') {
@@ -1856,82 +5722,30 @@ int pptest_main(int argc, char **argv)
 		return 1;
 	}
 
-	out = stdout;
+	setup_include_path();
 
 	/* just here for gcc compatibility */
-	fprintf(out, "# 1 \"%s\"\n", filename);
-	fprintf(out, "# 1 \"<built-in>\"\n");
-	fprintf(out, "# 1 \"<command-line>\"\n");
+	fprintf(stdout, "# 1 \"%s\"\n", filename);
+	fprintf(stdout, "# 1 \"<built-in>\"\n");
+	fprintf(stdout, "# 1 \"<command-line>\"\n");
 
 	FILE *file = fopen(filename, "r");
 	if (file == NULL) {
 		fprintf(stderr, "Couldn't open input '%s'\n", filename);
 		return 1;
 	}
-	switch_input(file, filename);
-
-	while (true) {
-		if (pp_token.kind == '#' && info.at_line_begin) {
-			parse_preprocessing_directive();
-			continue;
-		} else if (pp_token.kind == TP_EOF) {
-			goto end_of_main_loop;
-		} else if (pp_token.kind == TP_IDENTIFIER && !in_pp_directive) {
-			symbol_t *symbol = pp_token.identifier.symbol;
-			pp_definition_t *pp_definition = symbol->pp_definition;
-			if (pp_definition != NULL && !pp_definition->is_expanding) {
-				expansion_pos = pp_token.base.source_position;
-				if (pp_definition->has_parameters) {
-					source_position_t position = pp_token.base.source_position;
-					add_token_info_t old_info = info;
-					next_preprocessing_token();
-					add_token_info_t new_info = info;
-
-					/* no opening brace -> no expansion */
-					if (pp_token.kind == '(') {
-						eat_pp('(');
-
-						/* parse arguments (TODO) */
-						while (pp_token.kind != TP_EOF && pp_token.kind != ')')
-							next_preprocessing_token();
-					} else {
-						token_t next_token = pp_token;
-						/* restore identifier token */
-						pp_token.kind                 = TP_IDENTIFIER;
-						pp_token.identifier.symbol    = symbol;
-						pp_token.base.source_position = position;
-						info = old_info;
-						emit_pp_token();
-
-						info = new_info;
-						pp_token = next_token;
-						continue;
-					}
-					info = old_info;
-				}
-				pp_definition->expand_pos   = 0;
-				pp_definition->is_expanding = true;
-				current_expansion           = pp_definition;
-				expand_next();
-				continue;
-			}
-		}
-
-		emit_pp_token();
-		next_preprocessing_token();
-	}
-end_of_main_loop:
-
-	fputc('\n', out);
-	check_unclosed_conditionals();
-	close_input();
-
-	obstack_free(&input_obstack, NULL);
-	obstack_free(&pp_obstack, NULL);
-	obstack_free(&config_obstack, NULL);
-
-	strset_destroy(&stringset);
-
+	if (dependencies)
+		record_pp_dependencies(true);
+	switch_pp_input(file, filename, NULL);
+	print_preprocessed_input(stdout);
+	close_pp_input();
+	fclose(file);
+
+	/* the rule follows the preprocessed output */
+	if (dependencies)
+		write_pp_dependencies(stdout, "out.o", phony);
+
+	exit_preprocessor();
 	exit_tokens();
 	exit_symbol_table();
 
@@ -0,0 +1,130 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PREPROCESSOR_H
+#define PREPROCESSOR_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "token_t.h"
+
+void init_preprocessor(void);
+void exit_preprocessor(void);
+
+/**
+ * Adds a directory to the list searched for #include files (-I).
+ */
+void add_include_path(const char *path);
+
+/**
+ * Adds a directory to the list searched for system headers (-isystem).
+ * System directories are searched after the ones added with
+ * add_include_path().
+ */
+void add_system_include_path(const char *path);
+
+/**
+ * Adds the directories from the CPATH environment variable and the builtin
+ * system include directories.
+ */
+void setup_include_path(void);
+
+/**
+ * Defines a macro before anything from the command line is processed.
+ */
+void add_predefined_macro(const char *name, const char *value);
+
+/**
+ * Defines a macro given as NAME or NAME=VALUE (-D).
+ */
+void add_define_string(const char *definition);
+
+/**
+ * Removes a macro definition (-U).
+ */
+void add_undefine(const char *name);
+
+/**
+ * Starts preprocessing a new translation unit read from @p file.
+ * The file is not closed by the preprocessor.
+ */
+void switch_pp_input(FILE *file, const char *filename, const char *encoding);
+
+/**
+ * Finishes the current translation unit and forgets all macros defined in it.
+ */
+void close_pp_input(void);
+
+/**
+ * Returns the next fully preprocessed token converted for the parser.
+ */
+void preprocessor_next_token(token_t *token);
+
+/**
+ * Writes the preprocessed translation unit to @p output (-E).
+ */
+void print_preprocessed_input(FILE *output);
+
+/**
+ * Preprocesses the whole input without writing it anywhere (-M).
+ */
+void skip_preprocessed_input(void);
+
+/**
+ * Records every file read from the next translation unit on, the main file
+ * first.  System headers are left out unless @p system_headers is set.
+ */
+void record_pp_dependencies(bool system_headers);
+
+/**
+ * Writes the recorded files as Makefile rule for @p targets to @p output
+ * and stops recording.  With @p phony_targets every header gets an empty
+ * rule of its own (-MP).
+ */
+void write_pp_dependencies(FILE *output, const char *targets,
+                           bool phony_targets);
+
+/**
+ * Writes the current input as precompiled header to @p output.  A later
+ * translation unit starting with an #include of the header reads the file
+ * NAME.gch next to it instead, as long as the configuration is the same and
+ * none of the files read for it changed.  A header expanding __BASE_FILE__
+ * or __INCLUDE_LEVEL__ is written, but never used.
+ *
+ * @return false if writing failed
+ */
+bool write_precompiled_header(FILE *output);
+
+/**
+ * Keeps the preprocessing tokens of every header read from now on in
+ * directory @p dir.  Later #includes of an unchanged header replay them
+ * instead of lexing the file again.
+ */
+void set_token_cache_dir(const char *dir);
+
+/**
+ * Lists every include search directory once and only tries to open headers
+ * which appear in the listing.  This saves the failed opens on slow file
+ * systems, but misses headers created while preprocessing and is wrong for
+ * case-insensitive file systems.
+ */
+void set_include_dir_listing(bool enable);
+
+#endif
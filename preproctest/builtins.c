@@ -0,0 +1,17 @@
+__FILE__ __LINE__
+__BASE_FILE__
+__INCLUDE_LEVEL__
+__COUNTER__ __COUNTER__ __COUNTER__
+#define LINE_OF_USE __LINE__
+LINE_OF_USE
+#define MULTI(x) x
+MULTI(__LINE__
+)
+#ifdef __FILE__
+file_is_defined
+#endif
+#if defined(__LINE__) && __LINE__ == 13
+line_in_condition
+#endif
+#include "builtins.h"
+after_include __LINE__ __INCLUDE_LEVEL__
@@ -0,0 +1 @@
+__FILE__ __LINE__ __BASE_FILE__ __INCLUDE_LEVEL__ __COUNTER__
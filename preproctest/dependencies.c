@@ -0,0 +1,6 @@
+// pptest: -MP
+/* dependency rules list every file read once, headers get phony rules */
+#include "header.h"
+#include "header.h"
+#include "simpleinc.h"
+#include <simpleinc.h>
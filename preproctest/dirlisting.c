@@ -0,0 +1,8 @@
+// pptest: -I searchpath/first -I searchpath/second -finclude-dir-listing
+/* the first directory has no two.h, the remembered miss must not hide
+ * the header in the second one */
+#include "one.h"
+#include "two.h"
+#include "two.h"
+#include <two.h>
+#include "searchpath/second/two.h"
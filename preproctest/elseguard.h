@@ -0,0 +1,6 @@
+#ifndef ELSEGUARD_H
+#define ELSEGUARD_H
+int elseguard_first;
+#else
+int elseguard_again = __COUNTER__;
+#endif
@@ -0,0 +1,9 @@
+/* form feeds and vertical tabs are whitespace, as in glibc headers */
+int a;
+intb;
+
+#define X1+ 2
+X;
+#  if X
+int c;
+#endif
@@ -0,0 +1,19 @@
+#define ADD(a, b) ((a) + (b))
+#define NOARGS() empty_list
+#define APPLY(m, x) m(x)
+#define NEG(x) -x
+#define PAREN (
+ADD(1, 2)
+ADD( 1 , ADD(2, 3) )
+ADD(
+	1,
+	2
+)
+NOARGS()
+NOARGS
+APPLY(NEG, 5)
+ADD((1, 2), [3])
+ADD(, )
+#define LATE ADD
+LATE(7, 8)
+ADD PAREN 1, 2)
@@ -0,0 +1,12 @@
+/* a header is only skipped as long as including it has no effect */
+#include "guard.h"
+#include "guard.h"
+#undef GUARD_H
+#include "guard.h"
+#include "notguard.h"
+#include "notguard.h"
+#include "elseguard.h"
+#include "elseguard.h"
+#include "once.h"
+#include "./once.h"
+#include "once.h"
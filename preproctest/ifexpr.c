@@ -0,0 +1,46 @@
+#define ONE 1
+#define TWO (ONE + ONE)
+#define EMPTY
+#if 1 + 2 * 3 == 7 && (1 + 2) * 3 == 9
+precedence
+#endif
+#if -1 < 0 && -1 > 0u
+unsigned_conversion
+#endif
+#if 0x10 == 16 && 010 == 8 && 'a' == 97 && '\n' == 10
+literals
+#endif
+#if 7 / 2 == 3 && 7 % 2 == 1 && (1 << 4) == 16 && (-16 >> 2) == -4
+division_shift
+#endif
+#if (5 & 3) == 1 && (5 | 3) == 7 && (5 ^ 3) == 6 && ~0 == -1
+bitwise
+#endif
+#if 1 ? 2 : 0 / 0
+conditional_short_circuit
+#endif
+#if 0 && (1 / 0)
+#else
+logical_short_circuit
+#endif
+#if defined ONE && defined(TWO) && !defined THREE
+defined_operator
+#endif
+#if TWO == 2 && undefined_name == 0
+macros_in_conditions
+#endif
+#if 0
+#elif TWO > 1
+elif_taken
+#else
+not_taken
+#endif
+#ifdef EMPTY
+ifdef_empty
+#endif
+#if (2 || 1 / 0) && 18446744073709551615u == -1
+max_unsigned
+#endif
+#if '\377' < 0 && '\xff' == -1 && 'ab' == 0x6162 && L'\377' == 255
+plain_char
+#endif
@@ -0,0 +1,12 @@
+/* #line and line markers */
+line_3 __LINE__
+#line 100
+line_100 __LINE__
+#line 200 "renamed.c"
+line_200 __LINE__ __FILE__
+#define NUMBER 300
+#define NAME "macro.c"
+#line NUMBER NAME
+line_300 __LINE__ __FILE__
+# 400 "marker.c"
+line_400 __LINE__ __FILE__
@@ -0,0 +1,5 @@
+#ifndef NOTGUARD_H
+#define NOTGUARD_H
+int notguard_first;
+#endif
+int notguard_every_time = __COUNTER__;
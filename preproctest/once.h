@@ -0,0 +1,2 @@
+#pragma once
+int once = __COUNTER__;
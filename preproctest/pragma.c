@@ -0,0 +1,7 @@
+#pragma weak foo
+#pragma GCC system_header
+#define DO_PRAGMA(x) _Pragma(#x)
+before _Pragma("message(\"hi\")") after
+DO_PRAGMA(pack(push, 1))
+#define PACKED(decl) DO_PRAGMA(pack(1)) decl DO_PRAGMA(pack())
+PACKED(struct s { char c; int i; };)
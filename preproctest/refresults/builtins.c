@@ -0,0 +1,23 @@
+# 1 "builtins.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "builtins.c"
+"builtins.c" 1
+"builtins.c"
+0
+0 1 2
+
+6
+
+8
+
+
+file_is_defined
+
+
+line_in_condition
+
+# 1 "builtins.h" 1
+"builtins.h" 1 "builtins.c" 1 3
+# 17 "builtins.c" 2
+after_include 17 0
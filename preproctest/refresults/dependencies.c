@@ -0,0 +1,27 @@
+# 1 "dependencies.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "dependencies.c"
+
+
+# 1 "header.h" 1
+
+
+
+int in_the_header;
+# 4 "dependencies.c" 2
+
+
+# 1 "simpleinc.h" 1
+foo
+# 6 "dependencies.c" 2
+# 1 "./simpleinc.h" 1
+foo
+# 6 "dependencies.c" 2
+out.o: dependencies.c header.h simpleinc.h ./simpleinc.h
+
+header.h:
+
+simpleinc.h:
+
+./simpleinc.h:
@@ -0,0 +1,12 @@
+# 1 "formfeed.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "formfeed.c"
+
+int a;
+int b;
+
+
+1 + 2 ;
+
+int c;
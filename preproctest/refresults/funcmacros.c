@@ -0,0 +1,23 @@
+# 1 "funcmacros.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "funcmacros.c"
+
+
+
+
+
+((1) + (2))
+((1) + (((2) + (3))))
+((1) + (2))
+
+
+
+empty_list
+NOARGS
+-5
+(((1, 2)) + ([3]))
+(() + ())
+
+((7) + (8))
+ADD ( 1, 2)
@@ -0,0 +1,51 @@
+# 1 "guard.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "guard.c"
+
+# 1 "guard.h" 1
+
+
+int guarded = 0;
+# 3 "guard.c" 2
+
+
+
+# 1 "guard.h" 1
+
+
+int guarded = 1;
+# 6 "guard.c" 2
+# 1 "notguard.h" 1
+
+
+int notguard_first;
+
+int notguard_every_time = 2;
+# 7 "guard.c" 2
+# 1 "notguard.h" 1
+
+
+
+
+int notguard_every_time = 3;
+# 8 "guard.c" 2
+# 1 "elseguard.h" 1
+
+
+int elseguard_first;
+# 9 "guard.c" 2
+# 1 "elseguard.h" 1
+
+
+
+
+int elseguard_again = 4;
+# 10 "guard.c" 2
+# 1 "once.h" 1
+
+int once = 5;
+# 11 "guard.c" 2
+
+
+
@@ -0,0 +1,49 @@
+# 1 "ifexpr.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "ifexpr.c"
+
+
+
+
+precedence
+
+
+unsigned_conversion
+
+
+literals
+
+
+division_shift
+
+
+bitwise
+
+
+conditional_short_circuit
+
+
+
+logical_short_circuit
+
+
+defined_operator
+
+
+macros_in_conditions
+
+
+
+elif_taken
+
+
+
+
+ifdef_empty
+
+
+max_unsigned
+
+
+plain_char
@@ -6,8 +6,6 @@
 
 
 
-# 1 "header.h" 1
-# 5 "header.h" 2
-
 int in_the_header;
 # 2 "incifdef.c" 2
+
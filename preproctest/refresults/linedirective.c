@@ -0,0 +1,14 @@
+# 1 "linedirective.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "linedirective.c"
+
+line_3 2
+# 100 "linedirective.c"
+line_100 100
+# 200 "renamed.c"
+line_200 200 "renamed.c"
+# 300 "macro.c"
+line_300 300 "macro.c"
+# 400 "marker.c"
+line_400 400 "marker.c"
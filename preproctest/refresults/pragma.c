@@ -0,0 +1,20 @@
+# 1 "pragma.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "pragma.c"
+#pragma weak foo
+#pragma GCC system_header
+
+before
+#pragma message("hi")
+# 4 "pragma.c"
+ after
+#pragma pack(push, 1)
+# 5 "pragma.c"
+
+#pragma pack(1)
+# 7 "pragma.c"
+ struct s { char c; int i; };
+#pragma pack()
+# 7 "pragma.c"
+
@@ -0,0 +1,25 @@
+# 1 "searchpath.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "searchpath.c"
+
+
+
+# 1 "searchpath/first/one.h" 1
+int first_one;
+# 1 "searchpath/second/one.h" 1
+int second_one;
+# 2 "searchpath/first/one.h" 2
+# 5 "searchpath.c" 2
+# 1 "searchpath/second/two.h" 1
+int second_two = 0;
+# 6 "searchpath.c" 2
+# 1 "searchpath/second/two.h" 1
+int second_two = 1;
+# 7 "searchpath.c" 2
+# 1 "searchpath/second/two.h" 1
+int second_two = 2;
+# 8 "searchpath.c" 2
+# 1 "searchpath/second/two.h" 1
+int second_two = 3;
+# 8 "searchpath.c" 2
@@ -0,0 +1,32 @@
+# 1 "stringify.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "stringify.c"
+
+
+
+
+
+"hello"
+"spaced out"
+"\"quoted \\\"string\\\"\\n\""
+"'\\''"
+"a b"
+
+""
+"VALUE"
+"42"
+foobar
+foo
+bar
+12
++=
+<<=
+42
+42
+L"wide"
+xVALUE
+x42
+
+
+"##"
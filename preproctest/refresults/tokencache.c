@@ -0,0 +1,45 @@
+# 1 "tokencache.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "tokencache.c"
+
+
+# 1 "tokencache.h" 1
+
+
+int first = 3;
+
+
+
+
+
+
+const char *value = "one";
+# 4 "tokencache.c" 2
+
+
+# 1 "tokencache.h" 1
+
+
+
+
+
+int second = 6;
+
+
+
+const char *value = "two" "tokencache.h";
+# 7 "tokencache.c" 2
+# 1 "tokencache.h" 1
+
+
+
+
+
+int second = 6;
+
+
+
+const char *value = "two" "tokencache.h";
+# 8 "tokencache.c" 2
+int main = 8;
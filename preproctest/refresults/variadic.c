@@ -0,0 +1,21 @@
+# 1 "variadic.c"
+# 1 "<built-in>"
+# 1 "<command-line>"
+# 1 "variadic.c"
+
+
+
+
+
+
+printf("%d %d", 1, 2)
+printf("%d", (1, 2))
+printf("none")
+printf("one %d", 1)
+{ }
+{ 1 }
+{ 1, 2, (3, 4) }
+1
+2
+3
+f(1, 2)
@@ -0,0 +1,2 @@
+int first_one;
+#include_next "one.h"
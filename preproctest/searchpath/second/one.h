@@ -0,0 +1 @@
+int second_one;
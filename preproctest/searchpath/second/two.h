@@ -0,0 +1 @@
+int second_two = __COUNTER__;
@@ -0,0 +1,28 @@
+#define STR(x) #x
+#define XSTR(x) STR(x)
+#define CAT(a, b) a ## b
+#define XCAT(a, b) CAT(a, b)
+#define VALUE 42
+STR(hello)
+STR(  spaced   out  )
+STR("quoted \"string\"\n")
+STR('\'')
+STR(a
+    b)
+STR()
+STR(VALUE)
+XSTR(VALUE)
+CAT(foo, bar)
+CAT(foo, )
+CAT(, bar)
+CAT(1, 2)
+CAT(+, =)
+CAT(<, <=)
+CAT(VAL, UE)
+XCAT(VAL, UE)
+CAT(L, "wide")
+CAT(x, VALUE)
+XCAT(x, VALUE)
+#define HASH_HASH # ## #
+#define MKSTR(x) STR(x)
+MKSTR(HASH_HASH)
@@ -2,7 +2,9 @@
 
 for i in *.c; do
 	echo -n "$i... "
-	pptest $i > /tmp/$i
+	# a first line "// pptest: OPTIONS" gives additional options
+	options=$(sed -n '1s|^// pptest: ||p' $i)
+	pptest -I . $options $i > /tmp/$i
 	if ! diff -u refresults/$i /tmp/$i > /dev/null; then
 		echo "FAILED"
 	else
@@ -0,0 +1,8 @@
+// pptest: -ftoken-cache=/tmp/pptest-tokens
+#define MODE 1
+#include "tokencache.h"
+#undef MODE
+#define MODE 2
+#include "tokencache.h"
+#include "tokencache.h"
+int main = __LINE__;
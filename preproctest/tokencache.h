@@ -0,0 +1,10 @@
+/* the cache keeps the tokens of every branch, a replay may take another */
+#if MODE == 1
+int first = __LINE__;
+#define VALUE "one"
+#else
+int second = __LINE__;
+#undef VALUE
+#define VALUE "two" __FILE__
+#endif
+const char *value = VALUE;
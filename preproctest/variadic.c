@@ -0,0 +1,17 @@
+#define LOG(fmt, ...) printf(fmt, __VA_ARGS__)
+#define GLOG(fmt, ...) printf(fmt, ## __VA_ARGS__)
+#define ALL(...) { __VA_ARGS__ }
+#define COUNT_(a, b, c, n, ...) n
+#define COUNT(...) COUNT_(__VA_ARGS__, 3, 2, 1, 0)
+#define NAMED(args...) f(args)
+LOG("%d %d", 1, 2)
+LOG("%d", (1, 2))
+GLOG("none")
+GLOG("one %d", 1)
+ALL()
+ALL(1)
+ALL(1, 2, (3, 4))
+COUNT(a)
+COUNT(a, b)
+COUNT(a, b, c)
+NAMED(1, 2)
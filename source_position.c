@@ -0,0 +1,228 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include <config.h>
+
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+#include "source_position.h"
+#include "adt/array.h"
+#include "adt/error.h"
+#include "adt/util.h"
+#include "adt/xmalloc.h"
+
+/** offset of builtin_source_position, the first encoded offset follows */
+#define BUILTIN_OFFSET 1
+
+const source_position_t builtin_source_position = { BUILTIN_OFFSET };
+
+/** A line (or the rest of it) whose positions got consecutive offsets. */
+typedef struct line_entry_t {
+	uint32_t    offset;            /**< offset of the column colno */
+	unsigned    lineno;
+	unsigned    colno            : 31;
+	unsigned    is_system_header : 1;
+	const char *input_name;
+} line_entry_t;
+
+struct position_range_t {
+	line_entry_t *lines;
+};
+
+/** all lines known to decode_position(), sorted by offset */
+static line_entry_t *lines;
+
+/** The state of the encoder of a thread. */
+typedef struct encoder_t {
+	line_entry_t **table;     /**< the lines new lines are appended to */
+	uint32_t       next;      /**< first offset not handed out yet */
+	uint32_t       end;       /**< end of the offsets usable by the thread */
+	bool           exhausted; /**< the range ran out of offsets */
+	line_entry_t   line;      /**< the line positions are added to */
+} encoder_t;
+
+/** colno of an encoder line which takes no more positions */
+#define NO_LINE_COLNO ((1u << 31) - 1)
+
+static THREAD_LOCAL encoder_t encoder = {
+	&lines, BUILTIN_OFFSET + 1, UINT32_MAX, false,
+	{ 0, 0, NO_LINE_COLNO, false, NULL }
+};
+static THREAD_LOCAL encoder_t         saved_encoder;
+static THREAD_LOCAL position_range_t *current_range;
+/** index of the last decoded line */
+static THREAD_LOCAL size_t            last_line;
+
+source_position_t encode_position(const decoded_position_t *pos)
+{
+	source_position_t result;
+	line_entry_t     *line = &encoder.line;
+	if (LIKELY(pos->lineno == line->lineno && pos->colno >= line->colno
+	           && pos->input_name == line->input_name
+	           && pos->is_system_header == line->is_system_header)) {
+		uint32_t const distance = pos->colno - line->colno;
+		if (LIKELY(distance < encoder.next - line->offset)) {
+			result.offset = line->offset + distance;
+			return result;
+		}
+		if (distance < encoder.end - line->offset) {
+			result.offset = line->offset + distance;
+			encoder.next  = result.offset + 1;
+			return result;
+		}
+	} else if (pos->input_name == NULL) {
+		result.offset = 0;
+		return result;
+	}
+
+	if (UNLIKELY(encoder.next == encoder.end)) {
+		if (current_range == NULL)
+			panic("too many source positions");
+		encoder.exhausted = true;
+		result.offset     = 0;
+		return result;
+	}
+
+	line->offset           = encoder.next;
+	line->lineno           = pos->lineno;
+	line->colno            = pos->colno;
+	line->is_system_header = pos->is_system_header;
+	line->input_name       = pos->input_name;
+	if (*encoder.table == NULL)
+		*encoder.table = NEW_ARR_F(line_entry_t, 0);
+	ARR_APP1(line_entry_t, *encoder.table, *line);
+
+	result.offset = encoder.next++;
+	return result;
+}
+
+decoded_position_t decode_position(source_position_t pos)
+{
+	decoded_position_t result;
+	if (pos.offset <= BUILTIN_OFFSET) {
+		if (pos.offset == BUILTIN_OFFSET) {
+			result.input_name       = "<built-in>";
+			result.is_system_header = true;
+		} else {
+			result.input_name       = NULL;
+			result.is_system_header = false;
+		}
+		result.lineno = 0;
+		result.colno  = 0;
+		return result;
+	}
+
+	assert(lines != NULL);
+	size_t const n_lines = ARR_LEN(lines);
+	size_t       i       = last_line;
+	if (i >= n_lines || lines[i].offset > pos.offset
+	    || (i + 1 < n_lines && lines[i + 1].offset <= pos.offset)) {
+		/* find the last line starting before pos */
+		size_t lo = 0;
+		size_t hi = n_lines;
+		while (hi - lo > 1) {
+			size_t const mid = lo + (hi - lo) / 2;
+			if (lines[mid].offset <= pos.offset) {
+				lo = mid;
+			} else {
+				hi = mid;
+			}
+		}
+		i         = lo;
+		last_line = i;
+	}
+
+	line_entry_t const *const line = &lines[i];
+	assert(line->offset <= pos.offset);
+	result.input_name       = line->input_name;
+	result.lineno           = line->lineno;
+	result.colno            = line->colno + (pos.offset - line->offset);
+	result.is_system_header = line->is_system_header;
+	return result;
+}
+
+uint32_t reserve_positions(uint32_t size)
+{
+	uint32_t const begin = encoder.next;
+	if (size > encoder.end - begin)
+		panic("too many source positions");
+	encoder.next         = begin + size;
+	encoder.line.colno   = NO_LINE_COLNO;
+	return begin;
+}
+
+void begin_position_range(uint32_t begin, uint32_t size)
+{
+	assert(current_range == NULL);
+	position_range_t *const range = XMALLOC(position_range_t);
+	range->lines  = NEW_ARR_F(line_entry_t, 0);
+	current_range = range;
+
+	saved_encoder      = encoder;
+	encoder.table      = &range->lines;
+	encoder.next       = begin;
+	encoder.end        = begin + size;
+	encoder.exhausted  = false;
+	encoder.line.colno = NO_LINE_COLNO;
+}
+
+position_range_t *end_position_range(void)
+{
+	position_range_t *const result = current_range;
+	assert(result != NULL);
+	bool const exhausted = encoder.exhausted;
+	current_range = NULL;
+	encoder       = saved_encoder;
+	if (exhausted) {
+		free_position_range(result);
+		return NULL;
+	}
+	return result;
+}
+
+void add_position_range(position_range_t *range)
+{
+	size_t const n_range = ARR_LEN(range->lines);
+	if (n_range > 0) {
+		if (lines == NULL)
+			lines = NEW_ARR_F(line_entry_t, 0);
+		size_t const n_lines = ARR_LEN(lines);
+		assert(n_lines == 0
+		       || lines[n_lines - 1].offset < range->lines[0].offset);
+		ARR_RESIZE(line_entry_t, lines, n_lines + n_range);
+		memcpy(&lines[n_lines], range->lines, n_range * sizeof(lines[0]));
+	}
+	free_position_range(range);
+}
+
+void free_position_range(position_range_t *range)
+{
+	DEL_ARR_F(range->lines);
+	xfree(range);
+}
+
+void exit_source_positions(void)
+{
+	if (lines != NULL) {
+		DEL_ARR_F(lines);
+		lines = NULL;
+	}
+}
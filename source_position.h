@@ -0,0 +1,104 @@
+/*
+ * This file is part of cparser.
+ * Copyright (C) 2007-2009 Matthias Braun <matze@braunis.de>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+/**
+ * @file
+ * @brief   Compact source positions.
+ *
+ * A source_position_t is a 32 bit offset.  The lexer and the preprocessor
+ * hand out increasing offsets for the positions they see and remember
+ * where a new line or file started, so every position on a line is just
+ * the offset of the line plus the distance of its column.
+ * decode_position() maps an offset back to file, line and column.
+ */
+#ifndef SOURCE_POSITION_H
+#define SOURCE_POSITION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct source_position_t  source_position_t;
+typedef struct decoded_position_t decoded_position_t;
+typedef struct position_range_t   position_range_t;
+
+struct source_position_t {
+	uint32_t offset; /**< 0 if there is no position */
+};
+
+struct decoded_position_t {
+	const char *input_name;
+	unsigned    lineno;
+	unsigned    colno            : 31;
+	unsigned    is_system_header : 1;
+};
+
+/* position used for "builtin" declarations/types */
+extern const source_position_t builtin_source_position;
+
+static inline bool has_source_position(source_position_t pos)
+{
+	return pos.offset != 0;
+}
+
+/**
+ * Returns the compact form of @p pos.  A position without input name
+ * becomes the "no position" position.
+ */
+source_position_t encode_position(const decoded_position_t *pos);
+
+/**
+ * Returns file, line and column of @p pos.  The input name is NULL if
+ * @p pos is no position.
+ */
+decoded_position_t decode_position(source_position_t pos);
+
+/**
+ * Reserves @p size offsets for a thread which encodes positions on its
+ * own, see begin_position_range().
+ *
+ * @return the first reserved offset
+ */
+uint32_t reserve_positions(uint32_t size);
+
+/**
+ * Lets the calling thread encode positions into the offsets
+ * [begin, begin + size) until end_position_range().  The positions may not
+ * be decoded before the range is added with add_position_range().
+ */
+void begin_position_range(uint32_t begin, uint32_t size);
+
+/**
+ * Returns the positions encoded since begin_position_range(), NULL if they
+ * did not fit into the range.
+ */
+position_range_t *end_position_range(void);
+
+/**
+ * Makes the positions of @p range known to decode_position() and frees
+ * the range.  Ranges have to be added in the order they were reserved,
+ * before any other position is encoded.
+ */
+void add_position_range(position_range_t *range);
+
+void free_position_range(position_range_t *range);
+
+void exit_source_positions(void);
+
+#endif
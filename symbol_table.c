@@ -19,18 +19,81 @@
  */
 #include <config.h>
 
+#include <stdint.h>
+#include <string.h>
+
 #include "adt/strutil.h"
 #include "symbol_table_t.h"
 #include "symbol_t.h"
 #include "token_t.h"
-#include "adt/hash_string.h"
 #include "adt/obst.h"
+#include "adt/util.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
 
 struct obstack symbol_obstack;
 
+/** The number of independently locked parts of the symbol table. */
+#define SYMBOL_TABLE_SHARDS 16
+
+/**
+ * A part of the symbol table.  A symbol is always found in the shard
+ * selected by the upper bits of its hash.
+ */
+typedef struct symbol_shard_t {
+	symbol_table_t  table;    /**< must be first, see InitData */
+	struct obstack  symbols;  /**< the symbol_t entries of this shard */
+#ifndef _WIN32
+	pthread_mutex_t lock;
+#endif
+} symbol_shard_t;
+
+/** A string looked up in the symbol table. */
+typedef struct symbol_key_t {
+	const char *string;
+	size_t      len;
+	unsigned    hash;
+	bool        copy;   /**< a new symbol needs a copy of the string */
+} symbol_key_t;
+
+/**
+ * Hashes @p len bytes at @p string a word at a time.
+ */
+static inline __attribute__((pure))
+unsigned hash_symbol(const char *string, size_t len)
+{
+	uint64_t const factor = UINT64_C(0x9E3779B97F4A7C15);
+	uint64_t       hash   = len * factor;
+	uint64_t       word;
+	for (; len >= sizeof(word); len -= sizeof(word), string += sizeof(word)) {
+		memcpy(&word, string, sizeof(word));
+		hash = ((hash << 29 | hash >> 35) ^ word) * factor;
+	}
+	word = 0;
+	memcpy(&word, string, len);
+	hash = ((hash << 29 | hash >> 35) ^ word) * factor;
+	return (unsigned) (hash ^ hash >> 32);
+}
+
+static inline bool symbol_equals(const char *string, const symbol_key_t *key)
+{
+	return memcmp(string, key->string, key->len) == 0
+	       && string[key->len] == '\0';
+}
+
 static inline
-void init_symbol_table_entry(symbol_t *entry, const char *string)
+void init_symbol_table_entry(symbol_shard_t *shard, symbol_t *entry,
+                             const symbol_key_t *key)
 {
+	const char *string = key->string;
+	if (key->copy) {
+		char *const copy = obstack_alloc(&shard->symbols, key->len + 1);
+		memcpy(copy, string, key->len);
+		copy[key->len] = '\0';
+		string = copy;
+	}
 	entry->string        = string;
 	entry->ID            = T_IDENTIFIER;
 	entry->pp_ID         = TP_IDENTIFIER;
@@ -44,12 +107,12 @@ void init_symbol_table_entry(symbol_t *entry, const char *string)
 #define ValueType                  symbol_t*
 #define NullValue                  NULL
 #define DeletedValue               ((symbol_t*)-1)
-#define KeyType                    const char *
-#define ConstKeyType               const char *
+#define KeyType                    const symbol_key_t *
+#define ConstKeyType               const symbol_key_t *
 #define GetKey(value)              (value)->string
-#define InitData(this,value,key)   ((void)((value) = (ValueType)obstack_alloc(&symbol_obstack, sizeof(symbol_t)), init_symbol_table_entry((value), key)))
-#define Hash(this, key)            hash_string(key)
-#define KeysEqual(this,key1,key2)  (streq(key1, key2))
+#define InitData(this,value,key)   ((void)((value) = (ValueType)obstack_alloc(&((symbol_shard_t*)(this))->symbols, sizeof(symbol_t)), init_symbol_table_entry((symbol_shard_t*)(this), (value), key)))
+#define Hash(this, key)            ((key)->hash)
+#define KeysEqual(this,key1,key2)  symbol_equals(key1, key2)
 #define SetRangeEmpty(ptr,size)    memset(ptr, 0, (size) * sizeof(symbol_table_hash_entry_t))
 #define SCALAR_RETURN
 
@@ -66,21 +129,73 @@ void init_symbol_table_entry(symbol_t *entry, const char *string)
 
 #include "adt/hashset.c"
 
-static symbol_table_t  symbol_table;
+static symbol_shard_t symbol_shards[SYMBOL_TABLE_SHARDS];
+static bool           symbol_table_concurrent;
+
+static symbol_t *insert_symbol(const symbol_key_t *key)
+{
+	/* the table of a shard picks the bucket with the lower bits */
+	unsigned const  shard_nr = (key->hash >> 24) % SYMBOL_TABLE_SHARDS;
+	symbol_shard_t *shard    = &symbol_shards[shard_nr];
+
+#ifndef _WIN32
+	if (UNLIKELY(symbol_table_concurrent)) {
+		pthread_mutex_lock(&shard->lock);
+		symbol_t *symbol = _symbol_table_insert(&shard->table, key);
+		pthread_mutex_unlock(&shard->lock);
+		return symbol;
+	}
+#endif
+	return _symbol_table_insert(&shard->table, key);
+}
 
 symbol_t *symbol_table_insert(const char *string)
 {
-	return _symbol_table_insert(&symbol_table, string);
+	symbol_key_t key;
+	key.string = string;
+	key.len    = strlen(string);
+	key.hash   = hash_symbol(string, key.len);
+	key.copy   = false;
+	return insert_symbol(&key);
+}
+
+symbol_t *symbol_table_insert_len(const char *string, size_t len)
+{
+	symbol_key_t key;
+	key.string = string;
+	key.len    = len;
+	key.hash   = hash_symbol(string, len);
+	key.copy   = true;
+	return insert_symbol(&key);
+}
+
+void symbol_table_set_concurrent(bool concurrent)
+{
+	symbol_table_concurrent = concurrent;
 }
 
 void init_symbol_table(void)
 {
 	obstack_init(&symbol_obstack);
-	_symbol_table_init(&symbol_table);
+	for (unsigned i = 0; i < SYMBOL_TABLE_SHARDS; ++i) {
+		symbol_shard_t *shard = &symbol_shards[i];
+		_symbol_table_init(&shard->table);
+		obstack_init(&shard->symbols);
+#ifndef _WIN32
+		pthread_mutex_init(&shard->lock, NULL);
+#endif
+	}
 }
 
 void exit_symbol_table(void)
 {
-	_symbol_table_destroy(&symbol_table);
+	for (unsigned i = 0; i < SYMBOL_TABLE_SHARDS; ++i) {
+		symbol_shard_t *shard = &symbol_shards[i];
+		_symbol_table_destroy(&shard->table);
+		obstack_free(&shard->symbols, NULL);
+#ifndef _WIN32
+		pthread_mutex_destroy(&shard->lock);
+#endif
+	}
 	obstack_free(&symbol_obstack, NULL);
 }
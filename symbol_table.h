@@ -20,11 +20,27 @@
 #ifndef SYMBOL_TABLE_H
 #define SYMBOL_TABLE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "symbol.h"
 #include "adt/obst.h"
 
 symbol_t *symbol_table_insert(const char *string);
 
+/**
+ * Like symbol_table_insert() for the @p len characters at @p string, which
+ * need no terminating 0.  A new symbol gets a copy of the string.
+ */
+symbol_t *symbol_table_insert_len(const char *string, size_t len);
+
+/**
+ * Makes symbol_table_insert() safe to call from several threads at once
+ * while @p concurrent is set.  The string of a new symbol must stay valid
+ * until exit_symbol_table().
+ */
+void symbol_table_set_concurrent(bool concurrent);
+
 void init_symbol_table(void);
 void exit_symbol_table(void);
 
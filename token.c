@@ -32,8 +32,6 @@
 static symbol_t *token_symbols[T_LAST_TOKEN];
 static symbol_t *pp_token_symbols[TP_LAST_TOKEN];
 
-const source_position_t builtin_source_position = { "<built-in>", 0, 0, true };
-
 static int last_id;
 
 static symbol_t *intern_register_token(token_kind_t id, const char *string)
@@ -63,14 +61,24 @@ static void register_token(unsigned mode, token_kind_t id, const char *string)
 	if (c_mode & mode) {
 		symbol_t *symbol = intern_register_token(id, string);
 		symbol->ID = id;
+	} else {
+		/* the tokens may have been registered for another language mode
+		 * before, e.g. by a compile server */
+		symbol_t *symbol = symbol_table_insert(string);
+		if (symbol->ID == id)
+			symbol->ID = T_IDENTIFIER;
 	}
 }
 
 static void register_pp_token(unsigned mode, preprocessor_token_kind_t id,
                               const char *string)
 {
-	if (! (c_mode & mode))
+	if (! (c_mode & mode)) {
+		symbol_t *symbol = symbol_table_insert(string);
+		if (symbol->pp_ID == id)
+			symbol->pp_ID = TP_IDENTIFIER;
 		return;
+	}
 
 	symbol_t *symbol = intern_register_pp_token(id, string);
 	symbol->pp_ID = id;
@@ -208,6 +216,11 @@ void print_pp_token_kind(FILE *f, int token_kind)
 	}
 }
 
+symbol_t *get_pp_token_kind_symbol(int kind)
+{
+	return pp_token_symbols[kind];
+}
+
 void print_pp_token(FILE *f, const token_t *token)
 {
 	switch((preprocessor_token_kind_t) token->kind) {
@@ -21,6 +21,7 @@
 #define TOKEN_T_H
 
 #include <stdio.h>
+#include "source_position.h"
 #include "string_rep.h"
 #include "symbol.h"
 #include "symbol_table.h"
@@ -50,17 +51,6 @@ typedef enum preprocessor_token_kind_t {
 	TP_LAST_TOKEN
 } preprocessor_token_kind_t;
 
-typedef struct source_position_t source_position_t;
-struct source_position_t {
-	const char *input_name;
-	unsigned    lineno;
-	unsigned    colno            : 31;
-	unsigned    is_system_header : 1;
-};
-
-/* position used for "builtin" declarations/types */
-extern const source_position_t builtin_source_position;
-
 typedef struct token_base_t     token_base_t;
 typedef struct identifier_t     identifier_t;
 typedef struct string_literal_t string_literal_t;
@@ -69,6 +59,10 @@ typedef union  token_t          token_t;
 
 struct token_base_t {
 	int               kind;
+	bool              had_whitespace; /**< whitespace preceded the token */
+	/** an identifier which is never macro-expanded, because it named a macro
+	 * whose expansion was in progress (C99 6.10.3.4:2) */
+	bool              no_expand;
 	source_position_t source_position;
 };
 
@@ -103,6 +97,8 @@ void print_token(FILE *out, const token_t *token);
 
 symbol_t *get_token_kind_symbol(int token_kind);
 
+symbol_t *get_pp_token_kind_symbol(int token_kind);
+
 void print_pp_token_kind(FILE *out, int kind);
 void print_pp_token(FILE *out, const token_t *token);
 
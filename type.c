@@ -97,7 +97,8 @@ atomic_type_properties_t atomic_type_properties[ATOMIC_TYPE_LAST+1] = {
 	[ATOMIC_TYPE_CHAR] = {
 		.size      = 1,
 		.alignment = 1,
-		.flags     = ATOMIC_TYPE_FLAG_INTEGER | ATOMIC_TYPE_FLAG_ARITHMETIC,
+		.flags     = ATOMIC_TYPE_FLAG_INTEGER | ATOMIC_TYPE_FLAG_ARITHMETIC
+		           | ATOMIC_TYPE_FLAG_SIGNED,
 		.rank      = 2,
 	},
 	[ATOMIC_TYPE_SCHAR] = {